@@ -0,0 +1,45 @@
+//
+//  PSCAnnotationExporter.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+typedef NS_ENUM(NSUInteger, PSCAnnotationStreamFormat) {
+    PSCAnnotationStreamFormatJSON, // One JSON object per line, using the PSPDFModelJSONFormat representation. Lossless.
+    PSCAnnotationStreamFormatXFDF  // XFDF. Supports the common markup, ink, shape, line, note, free text and stamp annotations.
+};
+
+/// Writes the annotations of a document to a stream, page by page.
+/// Only the annotations of the page that is currently written are held in memory; nothing is built up for the whole document.
+@interface PSCAnnotationExporter : NSObject
+
+/// Designated initializer.
+- (id)initWithDocument:(PSPDFDocument *)document;
+
+/// The document whose annotations are exported.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Annotation types to export. Defaults to PSPDFAnnotationTypeAll &~ PSPDFAnnotationTypeLink.
+@property (nonatomic, assign) PSPDFAnnotationType annotationTypes;
+
+/// Number of annotations that have been written by the last export.
+@property (nonatomic, assign, readonly) NSUInteger exportedAnnotationCount;
+
+/// Writes all annotations to outputStream. The stream is opened if needed, but not closed.
+/// This is synchronous and can take a while for large documents; call it from a background thread.
+- (BOOL)exportAnnotationsToStream:(NSOutputStream *)outputStream format:(PSCAnnotationStreamFormat)format error:(NSError **)error;
+
+/// Convenience variant that writes into a file.
+- (BOOL)exportAnnotationsToURL:(NSURL *)fileURL format:(PSCAnnotationStreamFormat)format error:(NSError **)error;
+
+@end
+
+/// XFDF element name (e.g. "ink") for an annotation typeString, or nil if the type isn't supported.
+extern NSString *PSCXFDFElementNameForTypeString(NSString *typeString);
+
+/// Reverse of PSCXFDFElementNameForTypeString.
+extern NSString *PSCTypeStringForXFDFElementName(NSString *elementName);
+
+/// Error domain used by PSCAnnotationExporter and PSCAnnotationImporter.
+extern NSString *const PSCAnnotationStreamErrorDomain;
@@ -0,0 +1,225 @@
+//
+//  PSCAnnotationExporter.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAnnotationExporter.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+NSString *const PSCAnnotationStreamErrorDomain = @"PSCAnnotationStreamErrorDomain";
+
+static NSDictionary *PSCXFDFElementNamesByTypeString(void) {
+    static NSDictionary *_elementNames;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _elementNames = @{PSPDFAnnotationTypeStringHighlight : @"highlight",
+                          PSPDFAnnotationTypeStringUnderline : @"underline",
+                          PSPDFAnnotationTypeStringStrikeout : @"strikeout",
+                          PSPDFAnnotationTypeStringNote      : @"text",
+                          PSPDFAnnotationTypeStringFreeText  : @"freetext",
+                          PSPDFAnnotationTypeStringInk       : @"ink",
+                          PSPDFAnnotationTypeStringSquare    : @"square",
+                          PSPDFAnnotationTypeStringCircle    : @"circle",
+                          PSPDFAnnotationTypeStringLine      : @"line",
+                          PSPDFAnnotationTypeStringStamp     : @"stamp"};
+    });
+    return _elementNames;
+}
+
+NSString *PSCXFDFElementNameForTypeString(NSString *typeString) {
+    return typeString ? PSCXFDFElementNamesByTypeString()[typeString] : nil;
+}
+
+NSString *PSCTypeStringForXFDFElementName(NSString *elementName) {
+    return [[PSCXFDFElementNamesByTypeString() allKeysForObject:elementName] lastObject];
+}
+
+static NSString *PSCXMLEscapedString(NSString *string) {
+    NSMutableString *escapedString = [string mutableCopy];
+    [escapedString replaceOccurrencesOfString:@"&" withString:@"&amp;" options:0 range:NSMakeRange(0, escapedString.length)];
+    [escapedString replaceOccurrencesOfString:@"<" withString:@"&lt;" options:0 range:NSMakeRange(0, escapedString.length)];
+    [escapedString replaceOccurrencesOfString:@">" withString:@"&gt;" options:0 range:NSMakeRange(0, escapedString.length)];
+    [escapedString replaceOccurrencesOfString:@"\"" withString:@"&quot;" options:0 range:NSMakeRange(0, escapedString.length)];
+    return escapedString;
+}
+
+static NSString *PSCXFDFStringFromColor(UIColor *color) {
+    CGFloat red, green, blue, alpha;
+    if (![color getRed:&red green:&green blue:&blue alpha:&alpha]) {
+        if (![color getWhite:&red alpha:&alpha]) return nil;
+        green = blue = red;
+    }
+    return [NSString stringWithFormat:@"#%02X%02X%02X", (int)roundf(red * 255), (int)roundf(green * 255), (int)roundf(blue * 255)];
+}
+
+static NSString *PSCXFDFStringFromDate(NSDate *date) {
+    static NSDateFormatter *_dateFormatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _dateFormatter = [NSDateFormatter new];
+        _dateFormatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        _dateFormatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+        _dateFormatter.dateFormat = @"'D:'yyyyMMddHHmmss'Z'";
+    });
+    @synchronized(_dateFormatter) {
+        return [_dateFormatter stringFromDate:date];
+    }
+}
+
+// Writes all bytes of data; NSOutputStream might accept less than requested per call.
+static BOOL PSCWriteData(NSOutputStream *outputStream, NSData *data, NSError **error) {
+    const uint8_t *bytes = [data bytes];
+    NSUInteger length = [data length], offset = 0;
+    while (offset < length) {
+        NSInteger written = [outputStream write:bytes + offset maxLength:length - offset];
+        if (written <= 0) {
+            if (error) *error = outputStream.streamError ?: [NSError errorWithDomain:PSCAnnotationStreamErrorDomain code:100 userInfo:@{NSLocalizedDescriptionKey : @"Failed to write to the output stream."}];
+            return NO;
+        }
+        offset += written;
+    }
+    return YES;
+}
+
+static BOOL PSCWriteString(NSOutputStream *outputStream, NSString *string, NSError **error) {
+    return PSCWriteData(outputStream, [string dataUsingEncoding:NSUTF8StringEncoding], error);
+}
+
+@implementation PSCAnnotationExporter
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super init])) {
+        _document = document;
+        _annotationTypes = PSPDFAnnotationTypeAll &~ PSPDFAnnotationTypeLink;
+    }
+    return self;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)exportAnnotationsToURL:(NSURL *)fileURL format:(PSCAnnotationStreamFormat)format error:(NSError **)error {
+    NSOutputStream *outputStream = [NSOutputStream outputStreamWithURL:fileURL append:NO];
+    [outputStream open];
+    BOOL success = [self exportAnnotationsToStream:outputStream format:format error:error];
+    [outputStream close];
+    return success;
+}
+
+- (BOOL)exportAnnotationsToStream:(NSOutputStream *)outputStream format:(PSCAnnotationStreamFormat)format error:(NSError **)error {
+    if (outputStream.streamStatus == NSStreamStatusNotOpen) [outputStream open];
+    _exportedAnnotationCount = 0;
+
+    if (format == PSCAnnotationStreamFormatXFDF) {
+        if (!PSCWriteString(outputStream, @"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<xfdf xmlns=\"http://ns.adobe.com/xfdf/\" xml:space=\"preserve\">\n<annots>\n", error)) return NO;
+    }
+
+    NSUInteger pageCount = self.document.pageCount;
+    for (NSUInteger page = 0; page < pageCount; page++) {
+        // Release the serialized page before moving to the next one.
+        @autoreleasepool {
+            NSArray *annotations = [self.document annotationsForPage:page type:self.annotationTypes];
+            for (PSPDFAnnotation *annotation in annotations) {
+                if (annotation.isDeleted) continue;
+
+                NSData *record = format == PSCAnnotationStreamFormatXFDF ? [self XFDFRecordForAnnotation:annotation page:page] : [self JSONRecordForAnnotation:annotation page:page];
+                if (!record) continue;
+                if (!PSCWriteData(outputStream, record, error)) return NO;
+                _exportedAnnotationCount++;
+            }
+        }
+    }
+
+    if (format == PSCAnnotationStreamFormatXFDF) {
+        if (!PSCWriteString(outputStream, @"</annots>\n</xfdf>\n", error)) return NO;
+    }
+    return YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - JSON
+
+- (NSData *)JSONRecordForAnnotation:(PSPDFAnnotation *)annotation page:(NSUInteger)page {
+    id externalRepresentation = [annotation externalRepresentationInFormat:PSPDFModelJSONFormat];
+    NSDictionary *record = @{@"page" : @(page), @"class" : NSStringFromClass(annotation.class), @"annotation" : externalRepresentation ?: @{}};
+    if (![NSJSONSerialization isValidJSONObject:record]) {
+        PSCLog(@"Skipping annotation that can't be represented as JSON: %@", annotation);
+        return nil;
+    }
+
+    NSError *error = nil;
+    NSMutableData *data = [[NSJSONSerialization dataWithJSONObject:record options:0 error:&error] mutableCopy];
+    if (!data) {
+        PSCLog(@"Failed to serialize %@: %@", annotation, error);
+        return nil;
+    }
+    [data appendBytes:"\n" length:1];
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - XFDF
+
+- (NSData *)XFDFRecordForAnnotation:(PSPDFAnnotation *)annotation page:(NSUInteger)page {
+    NSString *elementName = PSCXFDFElementNameForTypeString(annotation.typeString);
+    if (!elementName) return nil;
+
+    CGRect rect = annotation.boundingBox;
+    NSMutableString *xml = [NSMutableString stringWithFormat:@"<%@ page=\"%d\" rect=\"%.4f,%.4f,%.4f,%.4f\"", elementName, page, CGRectGetMinX(rect), CGRectGetMinY(rect), CGRectGetMaxX(rect), CGRectGetMaxY(rect)];
+    NSString *colorString = PSCXFDFStringFromColor(annotation.color);
+    if (colorString) [xml appendFormat:@" color=\"%@\"", colorString];
+    if (annotation.fillColor) {
+        NSString *fillColorString = PSCXFDFStringFromColor(annotation.fillColor);
+        if (fillColorString) [xml appendFormat:@" interior-color=\"%@\"", fillColorString];
+    }
+    [xml appendFormat:@" opacity=\"%.3f\" width=\"%.3f\"", annotation.alpha, annotation.lineWidth];
+    if (annotation.name.length)  [xml appendFormat:@" name=\"%@\"", PSCXMLEscapedString(annotation.name)];
+    if (annotation.user.length)  [xml appendFormat:@" title=\"%@\"", PSCXMLEscapedString(annotation.user)];
+    if (annotation.lastModified) [xml appendFormat:@" date=\"%@\"", PSCXFDFStringFromDate(annotation.lastModified)];
+
+    if ([annotation isKindOfClass:PSPDFHighlightAnnotation.class]) {
+        // QuadPoints order: upper left, upper right, lower left, lower right.
+        NSMutableArray *coords = [NSMutableArray array];
+        for (NSValue *rectValue in annotation.rects) {
+            CGRect r = [rectValue CGRectValue];
+            [coords addObject:[NSString stringWithFormat:@"%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f", CGRectGetMinX(r), CGRectGetMaxY(r), CGRectGetMaxX(r), CGRectGetMaxY(r), CGRectGetMinX(r), CGRectGetMinY(r), CGRectGetMaxX(r), CGRectGetMinY(r)]];
+        }
+        [xml appendFormat:@" coords=\"%@\"", [coords componentsJoinedByString:@","]];
+    }else if ([annotation isKindOfClass:PSPDFLineAnnotation.class]) {
+        PSPDFLineAnnotation *lineAnnotation = (PSPDFLineAnnotation *)annotation;
+        [xml appendFormat:@" start=\"%.4f,%.4f\" end=\"%.4f,%.4f\"", lineAnnotation.point1.x, lineAnnotation.point1.y, lineAnnotation.point2.x, lineAnnotation.point2.y];
+    }else if ([annotation isKindOfClass:PSPDFNoteAnnotation.class]) {
+        NSString *iconName = ((PSPDFNoteAnnotation *)annotation).iconName;
+        if (iconName.length) [xml appendFormat:@" icon=\"%@\"", PSCXMLEscapedString(iconName)];
+    }else if ([annotation isKindOfClass:PSPDFStampAnnotation.class]) {
+        NSString *subject = ((PSPDFStampAnnotation *)annotation).subject;
+        if (subject.length) [xml appendFormat:@" icon=\"%@\"", PSCXMLEscapedString(subject)];
+    }
+    [xml appendString:@">"];
+
+    if (annotation.contents.length) [xml appendFormat:@"<contents>%@</contents>", PSCXMLEscapedString(annotation.contents)];
+    if ([annotation isKindOfClass:PSPDFInkAnnotation.class]) {
+        [xml appendString:@"<inklist>"];
+        for (NSArray *line in ((PSPDFInkAnnotation *)annotation).lines) {
+            NSMutableArray *points = [NSMutableArray arrayWithCapacity:[line count]];
+            for (NSValue *pointValue in line) {
+                CGPoint point = [pointValue CGPointValue];
+                [points addObject:[NSString stringWithFormat:@"%.4f,%.4f", point.x, point.y]];
+            }
+            [xml appendFormat:@"<gesture>%@</gesture>", [points componentsJoinedByString:@";"]];
+        }
+        [xml appendString:@"</inklist>"];
+    }
+    [xml appendFormat:@"</%@>\n", elementName];
+    return [xml dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+@end
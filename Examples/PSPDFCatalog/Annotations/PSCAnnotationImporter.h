@@ -0,0 +1,39 @@
+//
+//  PSCAnnotationImporter.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAnnotationExporter.h"
+
+// Posted on the main thread once per page after all annotations of that page have been imported. object = document.
+extern NSString *const PSCAnnotationImporterDidImportPageNotification;
+extern NSString *const PSCAnnotationImporterPageKey;            // NSNumber, absolute page.
+extern NSString *const PSCAnnotationImporterAnnotationCountKey; // NSNumber, number of annotations added to the page.
+
+/// Reads annotations from a stream (JSON or XFDF, see PSCAnnotationExporter) and adds them to a document.
+/// Records are parsed incrementally and the annotations of a page are added in one go, so memory is bounded by the largest page.
+/// Annotations are set on the page's file annotation provider directly, so no PSPDFAnnotationAddedNotification is posted per annotation;
+/// the page image cache is invalidated and PSCAnnotationImporterDidImportPageNotification is posted once per page instead.
+/// Records for consecutive pages should be grouped together (as written by PSCAnnotationExporter), else a page is finished multiple times.
+@interface PSCAnnotationImporter : NSObject
+
+/// Designated initializer.
+- (id)initWithDocument:(PSPDFDocument *)document;
+
+/// The document the annotations are added to.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Number of annotations that have been added by the last import.
+@property (nonatomic, assign, readonly) NSUInteger importedAnnotationCount;
+
+/// Imports all annotations from inputStream. The stream is opened if needed, but not closed.
+/// This is synchronous; call it from a background thread.
+/// Invalid records are skipped. Returns NO if the stream couldn't be read or isn't well-formed.
+- (BOOL)importAnnotationsFromStream:(NSInputStream *)inputStream format:(PSCAnnotationStreamFormat)format error:(NSError **)error;
+
+/// Convenience variant that reads from a file.
+- (BOOL)importAnnotationsFromURL:(NSURL *)fileURL format:(PSCAnnotationStreamFormat)format error:(NSError **)error;
+
+@end
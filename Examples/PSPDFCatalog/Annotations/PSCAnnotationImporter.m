@@ -0,0 +1,344 @@
+//
+//  PSCAnnotationImporter.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAnnotationImporter.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+NSString *const PSCAnnotationImporterDidImportPageNotification = @"PSCAnnotationImporterDidImportPageNotification";
+NSString *const PSCAnnotationImporterPageKey = @"page";
+NSString *const PSCAnnotationImporterAnnotationCountKey = @"annotationCount";
+
+// Size of the chunks read from the input stream.
+#define kPSCAnnotationImporterReadLength (64 * 1024)
+
+static UIColor *PSCColorFromXFDFString(NSString *string) {
+    if (![string hasPrefix:@"#"] || string.length != 7) return nil;
+    unsigned int rgb = 0;
+    if (![[NSScanner scannerWithString:[string substringFromIndex:1]] scanHexInt:&rgb]) return nil;
+    return [UIColor colorWithRed:((rgb >> 16) & 0xFF) / 255.f green:((rgb >> 8) & 0xFF) / 255.f blue:(rgb & 0xFF) / 255.f alpha:1.f];
+}
+
+static NSDate *PSCDateFromXFDFString(NSString *string) {
+    static NSDateFormatter *_dateFormatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _dateFormatter = [NSDateFormatter new];
+        _dateFormatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        _dateFormatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+        _dateFormatter.dateFormat = @"'D:'yyyyMMddHHmmss";
+    });
+    if (string.length < 16) return nil;
+    @synchronized(_dateFormatter) {
+        return [_dateFormatter dateFromString:[string substringToIndex:16]];
+    }
+}
+
+// Parses "x,y,x,y,..." into a C array of floats. Returns the number of values; 0 for a missing attribute.
+static NSUInteger PSCParseXFDFNumbers(NSString *string, CGFloat *values, NSUInteger maxCount) {
+    if (![string isKindOfClass:NSString.class]) return 0;
+    NSScanner *scanner = [NSScanner scannerWithString:string];
+    scanner.charactersToBeSkipped = [NSCharacterSet characterSetWithCharactersInString:@", ;\n\r\t"];
+    NSUInteger count = 0;
+    float value;
+    while (count < maxCount && [scanner scanFloat:&value]) values[count++] = value;
+    return count;
+}
+
+@interface PSCAnnotationImporter () <NSXMLParserDelegate> {
+    NSUInteger _currentPage;
+    NSMutableArray *_pageAnnotations;
+
+    // XFDF parser state.
+    PSPDFAnnotation *_XFDFAnnotation;
+    NSUInteger _XFDFAnnotationPage;
+    NSMutableArray *_XFDFLines;
+    NSMutableString *_XFDFCharacters;
+}
+@end
+
+@implementation PSCAnnotationImporter
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super init])) {
+        _document = document;
+        _pageAnnotations = [NSMutableArray new];
+    }
+    return self;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)importAnnotationsFromURL:(NSURL *)fileURL format:(PSCAnnotationStreamFormat)format error:(NSError **)error {
+    NSInputStream *inputStream = [NSInputStream inputStreamWithURL:fileURL];
+    [inputStream open];
+    BOOL success = [self importAnnotationsFromStream:inputStream format:format error:error];
+    [inputStream close];
+    return success;
+}
+
+- (BOOL)importAnnotationsFromStream:(NSInputStream *)inputStream format:(PSCAnnotationStreamFormat)format error:(NSError **)error {
+    _importedAnnotationCount = 0;
+    _currentPage = NSNotFound;
+    [_pageAnnotations removeAllObjects];
+
+    BOOL success = format == PSCAnnotationStreamFormatXFDF ? [self importXFDFFromStream:inputStream error:error] : [self importJSONFromStream:inputStream error:error];
+
+    // Add what has been parsed so far, even if the input was cut off.
+    [self finishCurrentPage];
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Batching
+
+- (Class)classForClass:(Class)builtinClass {
+    return self.document.overrideClassNames[(id)builtinClass] ?: builtinClass;
+}
+
+- (void)addAnnotation:(PSPDFAnnotation *)annotation toPage:(NSUInteger)page {
+    if (!annotation || page >= self.document.pageCount) return;
+
+    if (page != _currentPage) {
+        [self finishCurrentPage];
+        _currentPage = page;
+    }
+    [_pageAnnotations addObject:annotation];
+}
+
+// The file annotation provider posts PSPDFAnnotationAddedNotification for every annotation passed to addAnnotations:forPage:,
+// and each one invalidates the page in the cache. The page's annotations are set in one go instead, followed by
+// one cache invalidation and one PSCAnnotationImporterDidImportPageNotification.
+- (void)finishCurrentPage {
+    if (_currentPage == NSNotFound || [_pageAnnotations count] == 0) return;
+
+    PSPDFDocument *document = self.document;
+    NSUInteger page = _currentPage;
+    NSArray *annotations = [_pageAnnotations copy];
+    [_pageAnnotations removeAllObjects];
+
+    @autoreleasepool {
+        NSUInteger compensatedPage = [document compensatedPageForPage:page];
+        PSPDFFileAnnotationProvider *fileAnnotationProvider = [document annotationParserForPage:page].fileAnnotationProvider;
+        if (fileAnnotationProvider) {
+            // New annotations aren't backed by the PDF, so they are dirty and get saved like added ones.
+            NSArray *existingAnnotations = [fileAnnotationProvider annotationsForPage:compensatedPage] ?: @[];
+            [fileAnnotationProvider updateAnnotationsPageAndDocumentReference:annotations page:compensatedPage];
+            [fileAnnotationProvider setAnnotations:[existingAnnotations arrayByAddingObjectsFromArray:annotations] forPage:compensatedPage];
+        }else {
+            [document addAnnotations:annotations forPage:page];
+        }
+    }
+    _importedAnnotationCount += [annotations count];
+
+    [PSPDFCache.sharedCache invalidateImageFromDocument:document andPage:page];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [[NSNotificationCenter defaultCenter] postNotificationName:PSCAnnotationImporterDidImportPageNotification object:document userInfo:@{PSCAnnotationImporterPageKey : @(page), PSCAnnotationImporterAnnotationCountKey : @([annotations count])}];
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - JSON
+
+// Reads the stream in chunks and processes each complete line as one record.
+- (BOOL)importJSONFromStream:(NSInputStream *)inputStream error:(NSError **)error {
+    if (inputStream.streamStatus == NSStreamStatusNotOpen) [inputStream open];
+
+    NSMutableData *pendingData = [NSMutableData data];
+    uint8_t *buffer = malloc(kPSCAnnotationImporterReadLength);
+    BOOL success = YES;
+    while (YES) {
+        NSInteger length = [inputStream read:buffer maxLength:kPSCAnnotationImporterReadLength];
+        if (length < 0) {
+            if (error) *error = inputStream.streamError;
+            success = NO;
+            break;
+        }
+        if (length == 0) break;
+
+        @autoreleasepool {
+            [pendingData appendBytes:buffer length:length];
+            const char *bytes = [pendingData bytes];
+            NSUInteger lineStart = 0;
+            for (NSUInteger idx = 0; idx < [pendingData length]; idx++) {
+                if (bytes[idx] == '\n') {
+                    [self importJSONRecordData:[NSData dataWithBytesNoCopy:(void *)(bytes + lineStart) length:idx - lineStart freeWhenDone:NO]];
+                    lineStart = idx + 1;
+                }
+            }
+            [pendingData replaceBytesInRange:NSMakeRange(0, lineStart) withBytes:NULL length:0];
+        }
+    }
+    free(buffer);
+
+    // The last record doesn't need a line break.
+    if (success && [pendingData length] > 0) [self importJSONRecordData:pendingData];
+    return success;
+}
+
+- (void)importJSONRecordData:(NSData *)recordData {
+    if ([recordData length] == 0) return;
+
+    NSError *error = nil;
+    NSDictionary *record = [NSJSONSerialization JSONObjectWithData:recordData options:0 error:&error];
+    if (![record isKindOfClass:NSDictionary.class]) {
+        PSCLog(@"Skipping invalid annotation record: %@", error);
+        return;
+    }
+
+    Class annotationClass = NSClassFromString(record[@"class"]);
+    if (![annotationClass isSubclassOfClass:PSPDFAnnotation.class]) {
+        PSCLog(@"Skipping annotation record with unknown class %@", record[@"class"]);
+        return;
+    }
+    annotationClass = [self classForClass:annotationClass];
+
+    PSPDFAnnotation *annotation = [annotationClass modelWithExternalRepresentation:record[@"annotation"] inFormat:PSPDFModelJSONFormat];
+    [self addAnnotation:annotation toPage:[record[@"page"] unsignedIntegerValue]];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - XFDF
+
+- (BOOL)importXFDFFromStream:(NSInputStream *)inputStream error:(NSError **)error {
+    NSXMLParser *parser = [[NSXMLParser alloc] initWithStream:inputStream];
+    parser.delegate = self;
+    BOOL success = [parser parse];
+    if (!success && error) *error = parser.parserError;
+
+    _XFDFAnnotation = nil;
+    _XFDFLines = nil;
+    _XFDFCharacters = nil;
+    return success;
+}
+
+- (PSPDFAnnotation *)newAnnotationWithTypeString:(NSString *)typeString {
+    if ([@[PSPDFAnnotationTypeStringHighlight, PSPDFAnnotationTypeStringUnderline, PSPDFAnnotationTypeStringStrikeout] containsObject:typeString]) {
+        PSPDFHighlightAnnotationType highlightType = [[PSPDFHighlightAnnotation.highlightTypeTransformer transformedValue:typeString] integerValue];
+        return [[[self classForClass:PSPDFHighlightAnnotation.class] alloc] initWithHighlightType:highlightType];
+    }else if ([@[PSPDFAnnotationTypeStringSquare, PSPDFAnnotationTypeStringCircle] containsObject:typeString]) {
+        PSPDFShapeAnnotationType shapeType = [[PSPDFShapeAnnotation.shapeTypeTransformer transformedValue:typeString] integerValue];
+        return [[[self classForClass:PSPDFShapeAnnotation.class] alloc] initWithShapeType:shapeType];
+    }
+
+    NSDictionary *classes = @{PSPDFAnnotationTypeStringInk      : PSPDFInkAnnotation.class,
+                              PSPDFAnnotationTypeStringNote     : PSPDFNoteAnnotation.class,
+                              PSPDFAnnotationTypeStringFreeText : PSPDFFreeTextAnnotation.class,
+                              PSPDFAnnotationTypeStringLine     : PSPDFLineAnnotation.class,
+                              PSPDFAnnotationTypeStringStamp    : PSPDFStampAnnotation.class};
+    Class annotationClass = classes[typeString];
+    return annotationClass ? [[[self classForClass:annotationClass] alloc] init] : nil;
+}
+
+- (void)parser:(NSXMLParser *)parser didStartElement:(NSString *)elementName namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName attributes:(NSDictionary *)attributes {
+    if (_XFDFAnnotation) {
+        if ([elementName isEqualToString:@"contents"] || [elementName isEqualToString:@"gesture"]) {
+            _XFDFCharacters = [NSMutableString string];
+        }
+        return;
+    }
+
+    NSString *typeString = PSCTypeStringForXFDFElementName(elementName);
+    if (!typeString || !attributes[@"page"]) return;
+
+    PSPDFAnnotation *annotation = [self newAnnotationWithTypeString:typeString];
+    if (!annotation) return;
+
+    // Without a valid rect (or the type's geometry below) the annotation can't be placed; skip the element.
+    CGFloat values[4];
+    if (PSCParseXFDFNumbers(attributes[@"rect"], values, 4) != 4) {
+        PSCLog(@"Skipping %@ without rect.", elementName);
+        return;
+    }
+    annotation.boundingBox = CGRectMake(values[0], values[1], values[2] - values[0], values[3] - values[1]);
+    UIColor *color = PSCColorFromXFDFString(attributes[@"color"]);
+    if (color) annotation.color = color;
+    UIColor *fillColor = PSCColorFromXFDFString(attributes[@"interior-color"]);
+    if (fillColor) annotation.fillColor = fillColor;
+    if (attributes[@"opacity"]) annotation.alpha = [attributes[@"opacity"] floatValue];
+    if (attributes[@"width"])   annotation.lineWidth = [attributes[@"width"] floatValue];
+    if (attributes[@"name"])    annotation.name = attributes[@"name"];
+    if (attributes[@"title"])   annotation.user = attributes[@"title"];
+    NSDate *date = PSCDateFromXFDFString(attributes[@"date"]);
+    if (date) annotation.lastModified = date;
+
+    if ([annotation isKindOfClass:PSPDFHighlightAnnotation.class]) {
+        NSString *coords = attributes[@"coords"];
+        if (!coords) {
+            PSCLog(@"Skipping %@ without coords.", elementName);
+            return;
+        }
+        NSUInteger maxCount = [[coords componentsSeparatedByString:@","] count];
+        CGFloat *quadPoints = malloc(MAX(maxCount, 1) * sizeof(CGFloat));
+        NSUInteger count = PSCParseXFDFNumbers(coords, quadPoints, maxCount);
+        NSMutableArray *rects = [NSMutableArray array];
+        for (NSUInteger idx = 0; idx + 8 <= count; idx += 8) {
+            CGFloat minX = fminf(fminf(quadPoints[idx], quadPoints[idx+2]), fminf(quadPoints[idx+4], quadPoints[idx+6]));
+            CGFloat maxX = fmaxf(fmaxf(quadPoints[idx], quadPoints[idx+2]), fmaxf(quadPoints[idx+4], quadPoints[idx+6]));
+            CGFloat minY = fminf(fminf(quadPoints[idx+1], quadPoints[idx+3]), fminf(quadPoints[idx+5], quadPoints[idx+7]));
+            CGFloat maxY = fmaxf(fmaxf(quadPoints[idx+1], quadPoints[idx+3]), fmaxf(quadPoints[idx+5], quadPoints[idx+7]));
+            [rects addObject:[NSValue valueWithCGRect:CGRectMake(minX, minY, maxX - minX, maxY - minY)]];
+        }
+        free(quadPoints);
+        annotation.rects = rects;
+    }else if ([annotation isKindOfClass:PSPDFLineAnnotation.class]) {
+        CGFloat start[2], end[2];
+        if (PSCParseXFDFNumbers(attributes[@"start"], start, 2) != 2 || PSCParseXFDFNumbers(attributes[@"end"], end, 2) != 2) {
+            PSCLog(@"Skipping %@ without start or end.", elementName);
+            return;
+        }
+        ((PSPDFLineAnnotation *)annotation).point1 = CGPointMake(start[0], start[1]);
+        ((PSPDFLineAnnotation *)annotation).point2 = CGPointMake(end[0], end[1]);
+    }else if ([annotation isKindOfClass:PSPDFNoteAnnotation.class]) {
+        if (attributes[@"icon"]) ((PSPDFNoteAnnotation *)annotation).iconName = attributes[@"icon"];
+    }else if ([annotation isKindOfClass:PSPDFStampAnnotation.class]) {
+        if (attributes[@"icon"]) ((PSPDFStampAnnotation *)annotation).subject = attributes[@"icon"];
+    }
+
+    _XFDFAnnotation = annotation;
+    _XFDFAnnotationPage = [attributes[@"page"] integerValue];
+    _XFDFLines = [NSMutableArray array];
+}
+
+- (void)parser:(NSXMLParser *)parser foundCharacters:(NSString *)string {
+    [_XFDFCharacters appendString:string];
+}
+
+- (void)parser:(NSXMLParser *)parser didEndElement:(NSString *)elementName namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName {
+    if (!_XFDFAnnotation) return;
+
+    if ([elementName isEqualToString:@"contents"]) {
+        _XFDFAnnotation.contents = _XFDFCharacters;
+        _XFDFCharacters = nil;
+    }else if ([elementName isEqualToString:@"gesture"]) {
+        NSMutableArray *line = [NSMutableArray array];
+        for (NSString *pointString in [_XFDFCharacters componentsSeparatedByString:@";"]) {
+            CGFloat point[2];
+            if (PSCParseXFDFNumbers(pointString, point, 2) == 2) [line addObject:BOXED(CGPointMake(point[0], point[1]))];
+        }
+        if ([line count] > 0) [_XFDFLines addObject:line];
+        _XFDFCharacters = nil;
+    }else if ([elementName isEqualToString:PSCXFDFElementNameForTypeString(_XFDFAnnotation.typeString)]) {
+        if ([_XFDFAnnotation isKindOfClass:PSPDFInkAnnotation.class]) {
+            // Setting lines recalculates the boundingBox; keep the one from the file.
+            CGRect boundingBox = _XFDFAnnotation.boundingBox;
+            ((PSPDFInkAnnotation *)_XFDFAnnotation).lines = _XFDFLines;
+            if (!CGRectIsEmpty(boundingBox)) [(PSPDFInkAnnotation *)_XFDFAnnotation setBoundingBox:boundingBox transformLines:NO];
+        }
+        [self addAnnotation:_XFDFAnnotation toPage:_XFDFAnnotationPage];
+        _XFDFAnnotation = nil;
+        _XFDFLines = nil;
+    }
+}
+
+@end
@@ -0,0 +1,26 @@
+//
+//  PSCDrawView.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// Draw view with an incremental renderer for the active stroke.
+/// PSPDFDrawView strokes the whole active path through a single CAShapeLayer on every touch, which gets slow for long strokes.
+/// This subclass follows the touches of freehand ink strokes and only redraws the area of the newest segment; the path itself isn't walked while drawing.
+/// The stroke is kept in chunks of a few segments, and a redraw restrokes the chunks intersecting the dirty area as a single path, so overlapping caps are composited once.
+/// Register with pdfController.overrideClassNames = @{(id)PSPDFDrawView.class : PSCDrawView.class};
+@interface PSCDrawView : PSPDFDrawView
+
+/// Enables the incremental renderer. Defaults to YES.
+@property (nonatomic, assign, getter=isIncrementalRenderingEnabled) BOOL incrementalRenderingEnabled;
+
+/// Number of segments per chunk. Defaults to 32.
+/// Lower values keep chunk bounds tighter, so less is restroked per frame; higher values mean fewer chunks to test.
+@property (nonatomic, assign) NSUInteger liveSegmentCount;
+
+/// Rebuilds the chunks from the path of the built-in shape layer and redraws them.
+/// Also happens when the path changes outside of a touch (undo/redo, clearing) and when stroke color or width change.
+- (void)invalidateBakedStroke;
+
+@end
@@ -0,0 +1,349 @@
+//
+//  PSCDrawView.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCDrawView.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+static char kPSCKVOToken; // we need a static address for the kvo token
+
+// Strokes the drawing in chunks of a few segments each. Every chunk keeps its bounds,
+// so a partial redraw only restrokes the chunks that intersect the dirty rect.
+// All chunks of a redraw are stroked as one path, so the caps where chunks meet are composited once.
+@interface PSCStrokeLayer : CALayer {
+    NSMutableArray *_chunkPaths;  // CGPathRef, sealed chunks
+    NSMutableData *_chunkBounds;  // CGRect per chunk, outset by the stroke
+    CGMutablePathRef _tailPath;   // Open chunk the next segments go to
+    CGRect _tailBounds;
+    NSUInteger _tailSegmentCount;
+    CGPoint _currentPoint;
+    BOOL _hasCurrentPoint;
+}
+@property (nonatomic, strong) __attribute__((NSObject)) CGColorRef strokeColor;
+@property (nonatomic, assign) CGFloat lineWidth;
+@property (nonatomic, assign) CGLineCap lineCap;
+@property (nonatomic, assign) CGLineJoin lineJoin;
+@property (nonatomic, assign) NSUInteger chunkSegmentCount;
+- (void)moveToPoint:(CGPoint)point;
+- (void)addLineToPoint:(CGPoint)point;
+- (void)addCurveWithPoints:(const CGPoint *)points count:(NSUInteger)count;
+- (void)addPath:(CGPathRef)path;
+- (void)closeChunk;
+- (void)removeAllStrokes;
+@end
+
+@interface PSCDrawView () {
+    CAShapeLayer *_observedShapeLayer;
+    PSCStrokeLayer *_strokeLayer;
+    BOOL _trackingTouch;
+}
+@end
+
+@implementation PSCDrawView
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithFrame:(CGRect)frame {
+    if ((self = [super initWithFrame:frame])) {
+        _incrementalRenderingEnabled = YES;
+        _liveSegmentCount = 32;
+
+        _strokeLayer = [PSCStrokeLayer layer];
+        _strokeLayer.chunkSegmentCount = _liveSegmentCount;
+        // Don't animate any of the frequent property changes.
+        _strokeLayer.actions = @{@"contents" : [NSNull null], @"bounds" : [NSNull null], @"position" : [NSNull null], @"hidden" : [NSNull null]};
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_observedShapeLayer removeObserver:self forKeyPath:NSStringFromSelector(@selector(path)) context:&kPSCKVOToken];
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context {
+    if (context == &kPSCKVOToken) {
+        // While a touch is tracked the stroke layer is fed from the touches; the path isn't walked per frame.
+        // Any other change (undo/redo, clearing, committing) replaces the path, so rebuild once.
+        if (!_trackingTouch) [self invalidateBakedStroke];
+    }else {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - UIView
+
+- (void)didMoveToWindow {
+    [super didMoveToWindow];
+    [self observeShapeLayer];
+}
+
+- (void)layoutSubviews {
+    [super layoutSubviews];
+    [self observeShapeLayer];
+    if (!CGRectEqualToRect(_strokeLayer.frame, _observedShapeLayer.frame)) {
+        [self invalidateBakedStroke];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - UIResponder
+
+- (void)touchesBegan:(NSSet *)touches withEvent:(UIEvent *)event {
+    [super touchesBegan:touches withEvent:event];
+    if (![self isStrokeLayerActive]) return;
+
+    // A changed style affects the whole drawing, like it does for the built-in layer.
+    if (![self strokeLayerMatchesShapeLayer]) [self invalidateBakedStroke];
+    _trackingTouch = YES;
+    [_strokeLayer moveToPoint:[self strokeLayerLocationOfTouch:[touches anyObject]]];
+}
+
+- (void)touchesMoved:(NSSet *)touches withEvent:(UIEvent *)event {
+    [super touchesMoved:touches withEvent:event];
+    if (_trackingTouch) [_strokeLayer addLineToPoint:[self strokeLayerLocationOfTouch:[touches anyObject]]];
+}
+
+- (void)touchesEnded:(NSSet *)touches withEvent:(UIEvent *)event {
+    [super touchesEnded:touches withEvent:event];
+    if (_trackingTouch) {
+        [_strokeLayer addLineToPoint:[self strokeLayerLocationOfTouch:[touches anyObject]]];
+        [_strokeLayer closeChunk];
+        _trackingTouch = NO;
+    }
+}
+
+- (void)touchesCancelled:(NSSet *)touches withEvent:(UIEvent *)event {
+    [super touchesCancelled:touches withEvent:event];
+    if (_trackingTouch) {
+        _trackingTouch = NO;
+        [self invalidateBakedStroke];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDrawView
+
+- (void)setStrokeColor:(UIColor *)strokeColor {
+    [super setStrokeColor:strokeColor];
+    [self invalidateBakedStroke];
+}
+
+- (void)setLineWidth:(CGFloat)lineWidth {
+    [super setLineWidth:lineWidth];
+    [self invalidateBakedStroke];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)setIncrementalRenderingEnabled:(BOOL)incrementalRenderingEnabled {
+    if (incrementalRenderingEnabled != _incrementalRenderingEnabled) {
+        _incrementalRenderingEnabled = incrementalRenderingEnabled;
+        [self invalidateBakedStroke];
+    }
+}
+
+- (void)setLiveSegmentCount:(NSUInteger)liveSegmentCount {
+    if (liveSegmentCount != _liveSegmentCount) {
+        _liveSegmentCount = liveSegmentCount;
+        _strokeLayer.chunkSegmentCount = liveSegmentCount;
+        [self invalidateBakedStroke];
+    }
+}
+
+- (void)invalidateBakedStroke {
+    CAShapeLayer *shapeLayer = _observedShapeLayer;
+    if (![self isStrokeLayerActive]) {
+        shapeLayer.hidden = NO;
+        [_strokeLayer removeFromSuperlayer];
+        [_strokeLayer removeAllStrokes];
+        return;
+    }
+
+    // Draw in place of the built-in layer.
+    if (_strokeLayer.superlayer != shapeLayer.superlayer) {
+        [shapeLayer.superlayer insertSublayer:_strokeLayer above:shapeLayer];
+    }
+    shapeLayer.hidden = YES;
+    _strokeLayer.frame = shapeLayer.frame;
+    _strokeLayer.contentsScale = shapeLayer.contentsScale;
+    _strokeLayer.strokeColor = shapeLayer.strokeColor;
+    _strokeLayer.lineWidth = shapeLayer.lineWidth;
+    _strokeLayer.lineCap = [shapeLayer.lineCap isEqualToString:kCALineCapRound] ? kCGLineCapRound : [shapeLayer.lineCap isEqualToString:kCALineCapSquare] ? kCGLineCapSquare : kCGLineCapButt;
+    _strokeLayer.lineJoin = [shapeLayer.lineJoin isEqualToString:kCALineJoinRound] ? kCGLineJoinRound : [shapeLayer.lineJoin isEqualToString:kCALineJoinBevel] ? kCGLineJoinBevel : kCGLineJoinMiter;
+
+    // The only full walk of the path; it's not repeated while drawing.
+    [_strokeLayer removeAllStrokes];
+    [_strokeLayer addPath:shapeLayer.path];
+    [_strokeLayer setNeedsDisplay];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)observeShapeLayer {
+    CAShapeLayer *shapeLayer = self.shapeLayer;
+    if (shapeLayer == _observedShapeLayer) return;
+
+    [_observedShapeLayer removeObserver:self forKeyPath:NSStringFromSelector(@selector(path)) context:&kPSCKVOToken];
+    _observedShapeLayer.hidden = NO;
+    _observedShapeLayer = shapeLayer;
+    [_observedShapeLayer addObserver:self forKeyPath:NSStringFromSelector(@selector(path)) options:0 context:&kPSCKVOToken];
+    [self invalidateBakedStroke];
+}
+
+// Shapes and lines replace their path on every touch; only freehand ink grows it.
+- (BOOL)isStrokeLayerActive {
+    return _observedShapeLayer && self.isIncrementalRenderingEnabled && self.annotationType == PSPDFAnnotationTypeInk;
+}
+
+- (BOOL)strokeLayerMatchesShapeLayer {
+    return _strokeLayer.superlayer && _strokeLayer.lineWidth == _observedShapeLayer.lineWidth && CGColorEqualToColor(_strokeLayer.strokeColor, _observedShapeLayer.strokeColor);
+}
+
+- (CGPoint)strokeLayerLocationOfTouch:(UITouch *)touch {
+    return [self.layer convertPoint:[touch locationInView:self] toLayer:_strokeLayer];
+}
+
+@end
+
+@implementation PSCStrokeLayer
+
+static void PSCStrokeLayerPathApplier(void *info, const CGPathElement *element) {
+    PSCStrokeLayer *layer = (__bridge PSCStrokeLayer *)info;
+    switch (element->type) {
+        case kCGPathElementMoveToPoint:
+            [layer moveToPoint:element->points[0]]; break;
+        case kCGPathElementAddLineToPoint:
+            [layer addLineToPoint:element->points[0]]; break;
+        case kCGPathElementAddQuadCurveToPoint:
+            [layer addCurveWithPoints:element->points count:2]; break;
+        case kCGPathElementAddCurveToPoint:
+            [layer addCurveWithPoints:element->points count:3]; break;
+        case kCGPathElementCloseSubpath:
+            break; // Ink strokes are open.
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _chunkPaths = [NSMutableArray array];
+        _chunkBounds = [NSMutableData data];
+        _lineWidth = 1.f;
+        _lineCap = kCGLineCapRound;
+        _lineJoin = kCGLineJoinRound;
+        _chunkSegmentCount = 32;
+        self.needsDisplayOnBoundsChange = YES;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_tailPath) CGPathRelease(_tailPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - CALayer
+
+- (void)drawInContext:(CGContextRef)context {
+    // The backing store keeps everything outside the dirty rect; inside, everything is restroked.
+    CGRect clipRect = CGContextGetClipBoundingBox(context);
+    CGContextClearRect(context, clipRect);
+
+    const CGRect *chunkBounds = [_chunkBounds bytes];
+    for (NSUInteger idx = 0; idx < _chunkPaths.count; idx++) {
+        if (CGRectIntersectsRect(chunkBounds[idx], clipRect)) CGContextAddPath(context, (__bridge CGPathRef)_chunkPaths[idx]);
+    }
+    if (_tailPath && CGRectIntersectsRect(_tailBounds, clipRect)) CGContextAddPath(context, _tailPath);
+    if (CGContextIsPathEmpty(context) || !self.strokeColor) return;
+
+    CGContextSetStrokeColorWithColor(context, self.strokeColor);
+    CGContextSetLineWidth(context, self.lineWidth);
+    CGContextSetLineCap(context, self.lineCap);
+    CGContextSetLineJoin(context, self.lineJoin);
+    CGContextStrokePath(context);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)moveToPoint:(CGPoint)point {
+    [self closeChunk];
+    _currentPoint = point;
+    _hasCurrentPoint = YES;
+}
+
+- (void)addLineToPoint:(CGPoint)point {
+    [self addCurveWithPoints:&point count:1];
+}
+
+// Appends a line (1 point), quad curve (2) or cubic curve (3) and invalidates only the area it covers.
+- (void)addCurveWithPoints:(const CGPoint *)points count:(NSUInteger)count {
+    if (!_hasCurrentPoint) {
+        _currentPoint = points[0];
+        _hasCurrentPoint = YES;
+    }
+    if (_tailSegmentCount >= MAX(self.chunkSegmentCount, 1U)) [self closeChunk];
+
+    // A new chunk continues at the end of the previous one.
+    if (!_tailPath) {
+        _tailPath = CGPathCreateMutable();
+        CGPathMoveToPoint(_tailPath, NULL, _currentPoint.x, _currentPoint.y);
+        _tailBounds = CGRectNull;
+    }
+    switch (count) {
+        case 1: CGPathAddLineToPoint(_tailPath, NULL, points[0].x, points[0].y); break;
+        case 2: CGPathAddQuadCurveToPoint(_tailPath, NULL, points[0].x, points[0].y, points[1].x, points[1].y); break;
+        default: CGPathAddCurveToPoint(_tailPath, NULL, points[0].x, points[0].y, points[1].x, points[1].y, points[2].x, points[2].y); break;
+    }
+
+    // The control points contain the curve; the outset covers width, caps and miter joins (default miter limit 10).
+    CGRect segmentRect = CGRectMake(_currentPoint.x, _currentPoint.y, 0.f, 0.f);
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        segmentRect = CGRectUnion(segmentRect, CGRectMake(points[idx].x, points[idx].y, 0.f, 0.f));
+    }
+    CGFloat outset = (self.lineJoin == kCGLineJoinMiter ? self.lineWidth * 5.f : self.lineWidth / 2.f) + 1.f;
+    segmentRect = CGRectInset(segmentRect, -outset, -outset);
+    _tailBounds = CGRectUnion(_tailBounds, segmentRect);
+    _tailSegmentCount++;
+    _currentPoint = points[count-1];
+    [self setNeedsDisplayInRect:segmentRect];
+}
+
+- (void)addPath:(CGPathRef)path {
+    if (path) CGPathApply(path, (__bridge void *)self, PSCStrokeLayerPathApplier);
+    [self closeChunk];
+    _hasCurrentPoint = NO;
+}
+
+- (void)closeChunk {
+    if (!_tailPath) return;
+    if (_tailSegmentCount > 0) {
+        [_chunkPaths addObject:(__bridge id)_tailPath];
+        [_chunkBounds appendBytes:&_tailBounds length:sizeof(CGRect)];
+    }
+    CGPathRelease(_tailPath);
+    _tailPath = NULL;
+    _tailSegmentCount = 0;
+}
+
+- (void)removeAllStrokes {
+    [self closeChunk];
+    [_chunkPaths removeAllObjects];
+    [_chunkBounds setLength:0];
+    _hasCurrentPoint = NO;
+    [self setNeedsDisplay];
+}
+
+@end
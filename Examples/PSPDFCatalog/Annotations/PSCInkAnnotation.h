@@ -0,0 +1,28 @@
+//
+//  PSCInkAnnotation.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+@class PSCPointBuffer;
+
+/// Ink annotation that stores its points in compact PSCPointBuffer objects instead of boxed CGPoints.
+/// `lines` is only boxed when it's accessed. The path is cached until lines or the boundingBox change,
+/// and hit testing runs directly over the point buffers.
+/// linesTransformer writes each line as a flat array of numbers, which is JSON-safe. (Legacy string representations are still read)
+/// Appearance streams are drawn through PSCAppearanceStreamCache.
+/// Register with [document overrideClass:PSPDFInkAnnotation.class withClass:PSCInkAnnotation.class].
+@interface PSCInkAnnotation : PSPDFInkAnnotation
+
+/// Compact representation of lines. Array of PSCPointBuffer.
+@property (nonatomic, copy, readonly) NSArray *pointBuffers;
+
+/// Total number of points over all lines.
+@property (nonatomic, assign, readonly) NSUInteger pointCount;
+
+/// Simplifies all lines with the Ramer-Douglas-Peucker algorithm. tolerance is in PDF coordinates.
+/// Returns YES if points have been removed.
+- (BOOL)simplifyLinesWithTolerance:(CGFloat)tolerance;
+
+@end
@@ -0,0 +1,168 @@
+//
+//  PSCInkAnnotation.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCInkAnnotation.h"
+#import "PSCPointBuffer.h"
+#import "PSCAppearanceStreamCache.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Extra distance (in PDF points) around the stroke that still counts as a hit.
+static const CGFloat kPSCInkHitTestSlop = 8.f;
+
+@interface PSCInkAnnotation () {
+    NSArray *_pointBuffers; // Backing store of lines. The boxed points aren't kept.
+    UIBezierPath *_cachedPath;
+}
+@end
+
+@implementation PSCInkAnnotation
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFInkAnnotation
+
+// Boxed on demand; PSPDFModel copying and serialization go through this accessor too.
+- (NSArray *)lines {
+    NSArray *pointBuffers = self.pointBuffers;
+    NSMutableArray *lines = [NSMutableArray arrayWithCapacity:[pointBuffers count]];
+    for (PSCPointBuffer *buffer in pointBuffers) {
+        [lines addObject:[buffer line]];
+    }
+    return lines;
+}
+
+// Accepts arrays of boxed CGPoints as well as PSCPointBuffer objects.
+- (void)setLines:(NSArray *)lines {
+    NSArray *pointBuffers = [PSCPointBuffer pointBuffersWithLines:lines];
+    @synchronized(self) {
+        _pointBuffers = pointBuffers;
+    }
+
+    // Like PSPDFInkAnnotation, the boundingBox follows the lines.
+    CGRect pointsRect = CGRectNull;
+    for (PSCPointBuffer *buffer in pointBuffers) {
+        if (buffer.count > 0) pointsRect = CGRectUnion(pointsRect, buffer.boundingBox);
+    }
+    if (!CGRectIsNull(pointsRect)) [super setBoundingBox:PSPDFGrowRectByLineWidth(pointsRect, self.lineWidth) transformLines:NO];
+    [self invalidateCachedGeometry];
+}
+
+- (void)setBoundingBox:(CGRect)boundingBox {
+    [super setBoundingBox:boundingBox];
+    [self invalidateCachedGeometry];
+}
+
+- (void)setBoundingBox:(CGRect)boundingBox transformLines:(BOOL)transformLines {
+    [super setBoundingBox:boundingBox transformLines:transformLines];
+    [self invalidateCachedGeometry];
+}
+
+// The path is rebuilt from lines on every access in PSPDFInkAnnotation. Cache it until the geometry changes.
+- (UIBezierPath *)path {
+    UIBezierPath *path;
+    @synchronized(self) {
+        if (!_cachedPath) _cachedPath = [super path];
+        path = _cachedPath;
+    }
+    return [path copy];
+}
+
+// Annotations with an appearance stream (e.g. signatures) are drawn from PSCAppearanceStreamCache.
+- (void)drawInContext:(CGContextRef)context {
+    if (![PSCAppearanceStreamCache.sharedCache drawAppearanceStreamOfAnnotation:self inContext:context]) {
+        [super drawInContext:context];
+    }
+}
+
+- (void)drawInContext:(CGContextRef)context withOptions:(NSDictionary *)options {
+    if ([options[kPSPDFAnnotationDrawFlattened] boolValue] || ![PSCAppearanceStreamCache.sharedCache drawAppearanceStreamOfAnnotation:self inContext:context]) {
+        [super drawInContext:context withOptions:options];
+    }
+}
+
+- (BOOL)hitTest:(CGPoint)point {
+    CGFloat maxDistance = self.lineWidth / 2.f + kPSCInkHitTestSlop;
+    if (!CGRectContainsPoint(CGRectInset(self.boundingBox, -kPSCInkHitTestSlop, -kPSCInkHitTestSlop), point)) return NO;
+
+    for (PSCPointBuffer *buffer in self.pointBuffers) {
+        if (!CGRectContainsPoint(CGRectInset(buffer.boundingBox, -maxDistance, -maxDistance), point)) continue;
+        if ([buffer distanceToPoint:point] <= maxDistance) return YES;
+    }
+    return NO;
+}
+
+// Lines are written as flat arrays of numbers (x0, y0, x1, y1, ...), which is valid JSON and property list data.
+// NSData lines and the legacy string representation are still read.
++ (NSValueTransformer *)linesTransformer {
+    NSValueTransformer *legacyTransformer = [super linesTransformer];
+    return [PSPDFValueTransformer reversibleTransformerWithForwardBlock:^id(NSArray *externalLines) {
+        if (![externalLines isKindOfClass:NSArray.class]) return nil;
+        NSMutableArray *pointBuffers = [NSMutableArray arrayWithCapacity:[externalLines count]];
+        for (id externalLine in externalLines) {
+            if ([externalLine isKindOfClass:NSData.class]) {
+                [pointBuffers addObject:[[PSCPointBuffer alloc] initWithDataRepresentation:externalLine]];
+            }else if ([externalLine isKindOfClass:NSArray.class] && ([externalLine count] == 0 || [externalLine[0] isKindOfClass:NSNumber.class])) {
+                [pointBuffers addObject:[[PSCPointBuffer alloc] initWithNumberRepresentation:externalLine]];
+            }else {
+                return [legacyTransformer transformedValue:externalLines];
+            }
+        }
+        return pointBuffers; // setLines: takes the buffers as they are.
+    } reverseBlock:^id(NSArray *lines) {
+        NSMutableArray *externalLines = [NSMutableArray arrayWithCapacity:[lines count]];
+        for (PSCPointBuffer *buffer in [PSCPointBuffer pointBuffersWithLines:lines]) {
+            [externalLines addObject:[buffer numberRepresentation]];
+        }
+        return externalLines;
+    }];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSArray *)pointBuffers {
+    @synchronized(self) {
+        return _pointBuffers ?: @[];
+    }
+}
+
+- (NSUInteger)pointCount {
+    NSUInteger pointCount = 0;
+    for (PSCPointBuffer *buffer in self.pointBuffers) {
+        pointCount += buffer.count;
+    }
+    return pointCount;
+}
+
+- (BOOL)simplifyLinesWithTolerance:(CGFloat)tolerance {
+    NSUInteger pointCount = self.pointCount;
+    NSMutableArray *simplifiedBuffers = [NSMutableArray arrayWithCapacity:[self.pointBuffers count]];
+    NSUInteger simplifiedPointCount = 0;
+    for (PSCPointBuffer *buffer in self.pointBuffers) {
+        PSCPointBuffer *simplifiedBuffer = [buffer simplifiedBufferWithTolerance:tolerance];
+        simplifiedPointCount += simplifiedBuffer.count;
+        [simplifiedBuffers addObject:simplifiedBuffer];
+    }
+    if (simplifiedPointCount == pointCount) return NO;
+
+    self.lines = simplifiedBuffers;
+    return YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)invalidateCachedGeometry {
+    @synchronized(self) {
+        _cachedPath = nil;
+    }
+    [PSCAppearanceStreamCache.sharedCache invalidateAnnotation:self];
+}
+
+@end
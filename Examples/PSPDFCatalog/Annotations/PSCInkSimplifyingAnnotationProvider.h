@@ -0,0 +1,21 @@
+//
+//  PSCInkSimplifyingAnnotationProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// Annotation provider that simplifies the strokes of new ink annotations before they are committed.
+/// It doesn't provide any annotations on its own; register it in front of the fileAnnotationProvider:
+/// documentProvider.annotationParser.annotationProviders = @[[PSCInkSimplifyingAnnotationProvider new], documentProvider.annotationParser.fileAnnotationProvider];
+@interface PSCInkSimplifyingAnnotationProvider : NSObject <PSPDFAnnotationProvider>
+
+/// Maximum deviation of the simplified stroke, in screen points. Defaults to 0.5.
+/// This is converted into PDF coordinates with the current zoom of the page the stroke was drawn on,
+/// so strokes drawn zoomed in keep more detail.
+@property (nonatomic, assign) CGFloat tolerance;
+
+/// Returns the tolerance in PDF coordinates for page, based on the displaying PSPDFPageView.
+- (CGFloat)PDFToleranceForPage:(NSUInteger)page;
+
+@end
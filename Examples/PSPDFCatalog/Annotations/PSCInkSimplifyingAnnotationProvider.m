@@ -0,0 +1,73 @@
+//
+//  PSCInkSimplifyingAnnotationProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCInkSimplifyingAnnotationProvider.h"
+#import "PSCInkAnnotation.h"
+#import "PSCPointBuffer.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@implementation PSCInkSimplifyingAnnotationProvider
+
+@synthesize providerDelegate = _providerDelegate;
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _tolerance = 0.5f;
+    }
+    return self;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFAnnotationProvider
+
+- (NSArray *)annotationsForPage:(NSUInteger)page {
+    return nil;
+}
+
+// Called before the annotations are handed to the fileAnnotationProvider. Simplify in place and let the next provider add them.
+- (BOOL)addAnnotations:(NSArray *)annotations forPage:(NSUInteger)page {
+    CGFloat tolerance = 0.f;
+    for (PSPDFAnnotation *annotation in annotations) {
+        if (![annotation isKindOfClass:PSPDFInkAnnotation.class]) continue;
+
+        if (tolerance == 0.f) tolerance = [self PDFToleranceForPage:page];
+        if ([annotation isKindOfClass:PSCInkAnnotation.class]) {
+            [(PSCInkAnnotation *)annotation simplifyLinesWithTolerance:tolerance];
+        }else {
+            PSPDFInkAnnotation *inkAnnotation = (PSPDFInkAnnotation *)annotation;
+            inkAnnotation.lines = PSCSimplifyLines(inkAnnotation.lines, tolerance);
+        }
+    }
+    return NO;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (CGFloat)PDFToleranceForPage:(NSUInteger)page {
+    CGFloat scale = 1.f;
+
+    // Page views are UIKit objects; off the main thread we fall back to an unzoomed scale.
+    if ([NSThread isMainThread]) {
+        PSPDFDocumentProvider *documentProvider = [self.providerDelegate parentDocumentProvider];
+        PSPDFDocument *document = documentProvider.document;
+        NSUInteger absolutePage = [document pageOffsetForDocumentProvider:documentProvider] + page;
+        PSPDFPageView *pageView = [document.displayingPdfController pageViewForPage:absolutePage];
+        if (pageView.PDFScale > 0.f) {
+            scale = pageView.PDFScale * fmaxf(pageView.scrollView.zoomScale, 1.f);
+        }
+    }
+    return self.tolerance / scale;
+}
+
+@end
@@ -0,0 +1,60 @@
+//
+//  PSCPointBuffer.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+// Simplifies an array of lines (arrays of boxed CGPoints) with the Ramer-Douglas-Peucker algorithm.
+// Points that deviate less than tolerance (in the coordinate space of the points) are dropped. First and last point of every line are kept.
+NSArray *PSCSimplifyLines(NSArray *lines, CGFloat tolerance);
+
+/// Immutable, contiguous storage for the points of a single line.
+/// Uses a fraction of the memory of an NSArray of boxed CGPoints and allows tight loops over the points.
+@interface PSCPointBuffer : NSObject <NSCopying, NSCoding>
+
+/// Create a buffer from an array of boxed CGPoints.
++ (instancetype)pointBufferWithLine:(NSArray *)line;
+
+/// Create buffers for every line in lines. Lines that already are a PSCPointBuffer are used as is.
++ (NSArray *)pointBuffersWithLines:(NSArray *)lines;
+
+/// Designated initializer. Copies count points.
+- (id)initWithPoints:(const CGPoint *)points count:(NSUInteger)count;
+
+/// Create a buffer from the compact data representation.
+- (id)initWithDataRepresentation:(NSData *)data;
+
+/// Create a buffer from the number representation.
+- (id)initWithNumberRepresentation:(NSArray *)numbers;
+
+/// Number of points.
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/// Direct access to the points. Valid as long as the buffer is alive.
+@property (nonatomic, assign, readonly) const CGPoint *points;
+
+/// Bounding box of all points (without line width).
+@property (nonatomic, assign, readonly) CGRect boundingBox;
+
+/// Converts the points back to an array of boxed CGPoints.
+- (NSArray *)line;
+
+/// Returns a simplified copy. See PSCSimplifyLines.
+- (PSCPointBuffer *)simplifiedBufferWithTolerance:(CGFloat)tolerance;
+
+/// Returns the smallest distance between point and the polyline.
+- (CGFloat)distanceToPoint:(CGPoint)point;
+
+/// Compact, platform independent representation (big endian float32 pairs).
+- (NSData *)dataRepresentation;
+
+/// JSON-safe representation: a flat array of NSNumbers, x0, y0, x1, y1, ...
+- (NSArray *)numberRepresentation;
+
+/// Returns a copy with transform applied to every point.
+- (PSCPointBuffer *)bufferByApplyingTransform:(CGAffineTransform)transform;
+
+@end
@@ -0,0 +1,272 @@
+//
+//  PSCPointBuffer.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCPointBuffer.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Squared distance from p to the segment a-b.
+static CGFloat PSCSquaredDistanceToSegment(CGPoint p, CGPoint a, CGPoint b) {
+    CGFloat dx = b.x - a.x, dy = b.y - a.y;
+    CGFloat lengthSquared = dx*dx + dy*dy;
+    CGFloat t = 0.f;
+    if (lengthSquared > 0.f) {
+        t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSquared;
+        t = fmaxf(0.f, fminf(1.f, t));
+    }
+    CGFloat px = a.x + t * dx - p.x, py = a.y + t * dy - p.y;
+    return px*px + py*py;
+}
+
+// Iterative Ramer-Douglas-Peucker. Marks the points to keep in keep, returns the number of kept points.
+// An explicit stack is used so that very long strokes can't overflow the call stack.
+static NSUInteger PSCMarkSimplifiedPoints(const CGPoint *points, NSUInteger count, CGFloat tolerance, BOOL *keep) {
+    if (count < 3) {
+        for (NSUInteger idx = 0; idx < count; idx++) keep[idx] = YES;
+        return count;
+    }
+
+    memset(keep, 0, count * sizeof(BOOL));
+    keep[0] = keep[count-1] = YES;
+    NSUInteger keptCount = 2;
+    CGFloat toleranceSquared = tolerance * tolerance;
+
+    NSUInteger *stack = malloc(count * 2 * sizeof(NSUInteger));
+    NSUInteger stackSize = 0;
+    stack[stackSize++] = 0; stack[stackSize++] = count-1;
+    while (stackSize > 0) {
+        NSUInteger last = stack[--stackSize], first = stack[--stackSize];
+        CGFloat maxDistance = 0.f;
+        NSUInteger maxIndex = first;
+        for (NSUInteger idx = first+1; idx < last; idx++) {
+            CGFloat distance = PSCSquaredDistanceToSegment(points[idx], points[first], points[last]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                maxIndex = idx;
+            }
+        }
+        if (maxDistance > toleranceSquared) {
+            keep[maxIndex] = YES;
+            keptCount++;
+            if (maxIndex - first > 1) { stack[stackSize++] = first; stack[stackSize++] = maxIndex; }
+            if (last - maxIndex > 1) { stack[stackSize++] = maxIndex; stack[stackSize++] = last; }
+        }
+    }
+    free(stack);
+    return keptCount;
+}
+
+NSArray *PSCSimplifyLines(NSArray *lines, CGFloat tolerance) {
+    if (tolerance <= 0.f) return lines;
+
+    NSMutableArray *simplifiedLines = [NSMutableArray arrayWithCapacity:[lines count]];
+    for (NSArray *line in lines) {
+        PSCPointBuffer *buffer = [[PSCPointBuffer pointBufferWithLine:line] simplifiedBufferWithTolerance:tolerance];
+        [simplifiedLines addObject:buffer.count == [line count] ? line : [buffer line]];
+    }
+    return simplifiedLines;
+}
+
+@interface PSCPointBuffer () {
+    NSData *_data;
+    CGRect _boundingBox;
+}
+@end
+
+@implementation PSCPointBuffer
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
++ (instancetype)pointBufferWithLine:(NSArray *)line {
+    NSUInteger count = [line count];
+    CGPoint *points = malloc(MAX(count, 1) * sizeof(CGPoint));
+    NSUInteger idx = 0;
+    for (NSValue *pointValue in line) {
+        points[idx++] = [pointValue CGPointValue];
+    }
+    PSCPointBuffer *buffer = [[self alloc] initWithPoints:points count:count];
+    free(points);
+    return buffer;
+}
+
++ (NSArray *)pointBuffersWithLines:(NSArray *)lines {
+    NSMutableArray *buffers = [NSMutableArray arrayWithCapacity:[lines count]];
+    for (id line in lines) {
+        [buffers addObject:[line isKindOfClass:PSCPointBuffer.class] ? line : [self pointBufferWithLine:line]];
+    }
+    return buffers;
+}
+
+- (id)initWithPoints:(const CGPoint *)points count:(NSUInteger)count {
+    if ((self = [super init])) {
+        _data = [NSData dataWithBytes:points length:count * sizeof(CGPoint)];
+        _boundingBox = CGRectNull;
+        if (count > 0) {
+            CGFloat minX = points[0].x, maxX = points[0].x, minY = points[0].y, maxY = points[0].y;
+            for (NSUInteger idx = 1; idx < count; idx++) {
+                minX = fminf(minX, points[idx].x); maxX = fmaxf(maxX, points[idx].x);
+                minY = fminf(minY, points[idx].y); maxY = fmaxf(maxY, points[idx].y);
+            }
+            _boundingBox = CGRectMake(minX, minY, maxX - minX, maxY - minY);
+        }
+    }
+    return self;
+}
+
+- (id)initWithDataRepresentation:(NSData *)data {
+    NSUInteger count = [data length] / (2 * sizeof(uint32_t));
+    const uint32_t *values = [data bytes];
+    CGPoint *points = malloc(MAX(count, 1) * sizeof(CGPoint));
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        CFSwappedFloat32 x = {values[idx*2]}, y = {values[idx*2+1]};
+        points[idx] = CGPointMake(CFConvertFloat32SwappedToHost(x), CFConvertFloat32SwappedToHost(y));
+    }
+    self = [self initWithPoints:points count:count];
+    free(points);
+    return self;
+}
+
+- (id)initWithNumberRepresentation:(NSArray *)numbers {
+    NSUInteger count = [numbers count] / 2;
+    CGPoint *points = malloc(MAX(count, 1) * sizeof(CGPoint));
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        points[idx] = CGPointMake([numbers[idx*2] floatValue], [numbers[idx*2+1] floatValue]);
+    }
+    self = [self initWithPoints:points count:count];
+    free(points);
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p count:%d boundingBox:%@>", NSStringFromClass(self.class), self, self.count, NSStringFromCGRect(self.boundingBox)];
+}
+
+- (BOOL)isEqual:(id)object {
+    return [object isKindOfClass:PSCPointBuffer.class] && [_data isEqualToData:((PSCPointBuffer *)object)->_data];
+}
+
+- (NSUInteger)hash {
+    return [_data hash];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSCopying
+
+- (id)copyWithZone:(NSZone *)zone {
+    return self; // immutable
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSCoding
+
+- (id)initWithCoder:(NSCoder *)decoder {
+    return [self initWithDataRepresentation:[decoder decodeObjectForKey:NSStringFromSelector(@selector(dataRepresentation))]];
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:[self dataRepresentation] forKey:NSStringFromSelector(@selector(dataRepresentation))];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSUInteger)count {
+    return [_data length] / sizeof(CGPoint);
+}
+
+- (const CGPoint *)points {
+    return [_data bytes];
+}
+
+- (CGRect)boundingBox {
+    return _boundingBox;
+}
+
+- (NSArray *)line {
+    NSUInteger count = self.count;
+    const CGPoint *points = self.points;
+    NSMutableArray *line = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        [line addObject:BOXED(points[idx])];
+    }
+    return line;
+}
+
+- (PSCPointBuffer *)simplifiedBufferWithTolerance:(CGFloat)tolerance {
+    NSUInteger count = self.count;
+    if (count < 3 || tolerance <= 0.f) return self;
+
+    const CGPoint *points = self.points;
+    BOOL *keep = malloc(count * sizeof(BOOL));
+    NSUInteger keptCount = PSCMarkSimplifiedPoints(points, count, tolerance, keep);
+    if (keptCount == count) { free(keep); return self; }
+
+    CGPoint *simplifiedPoints = malloc(keptCount * sizeof(CGPoint));
+    NSUInteger simplifiedIndex = 0;
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        if (keep[idx]) simplifiedPoints[simplifiedIndex++] = points[idx];
+    }
+    PSCPointBuffer *buffer = [[PSCPointBuffer alloc] initWithPoints:simplifiedPoints count:keptCount];
+    free(simplifiedPoints);
+    free(keep);
+    return buffer;
+}
+
+- (CGFloat)distanceToPoint:(CGPoint)point {
+    NSUInteger count = self.count;
+    const CGPoint *points = self.points;
+    if (count == 0) return CGFLOAT_MAX;
+    if (count == 1) return sqrtf(PSCSquaredDistanceToSegment(point, points[0], points[0]));
+
+    CGFloat minDistance = CGFLOAT_MAX;
+    for (NSUInteger idx = 1; idx < count; idx++) {
+        minDistance = fminf(minDistance, PSCSquaredDistanceToSegment(point, points[idx-1], points[idx]));
+    }
+    return sqrtf(minDistance);
+}
+
+- (NSData *)dataRepresentation {
+    NSUInteger count = self.count;
+    const CGPoint *points = self.points;
+    NSMutableData *data = [NSMutableData dataWithLength:count * 2 * sizeof(uint32_t)];
+    uint32_t *values = [data mutableBytes];
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        values[idx*2]   = CFConvertFloat32HostToSwapped(points[idx].x).v;
+        values[idx*2+1] = CFConvertFloat32HostToSwapped(points[idx].y).v;
+    }
+    return data;
+}
+
+- (NSArray *)numberRepresentation {
+    NSUInteger count = self.count;
+    const CGPoint *points = self.points;
+    NSMutableArray *numbers = [NSMutableArray arrayWithCapacity:count * 2];
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        [numbers addObject:@((float)points[idx].x)];
+        [numbers addObject:@((float)points[idx].y)];
+    }
+    return numbers;
+}
+
+- (PSCPointBuffer *)bufferByApplyingTransform:(CGAffineTransform)transform {
+    if (CGAffineTransformIsIdentity(transform)) return self;
+
+    NSUInteger count = self.count;
+    const CGPoint *points = self.points;
+    CGPoint *transformedPoints = malloc(MAX(count, 1) * sizeof(CGPoint));
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        transformedPoints[idx] = CGPointApplyAffineTransform(points[idx], transform);
+    }
+    PSCPointBuffer *buffer = [[PSCPointBuffer alloc] initWithPoints:transformedPoints count:count];
+    free(transformedPoints);
+    return buffer;
+}
+
+@end
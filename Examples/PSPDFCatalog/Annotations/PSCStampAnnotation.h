@@ -0,0 +1,11 @@
+//
+//  PSCStampAnnotation.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// Stamp annotation that draws its appearance stream through PSCAppearanceStreamCache.
+/// Register with [document overrideClass:PSPDFStampAnnotation.class withClass:PSCStampAnnotation.class].
+@interface PSCStampAnnotation : PSPDFStampAnnotation
+@end
@@ -0,0 +1,33 @@
+//
+//  PSCStampAnnotation.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCStampAnnotation.h"
+#import "PSCAppearanceStreamCache.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@implementation PSCStampAnnotation
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFAnnotation
+
+- (void)drawInContext:(CGContextRef)context {
+    if (![PSCAppearanceStreamCache.sharedCache drawAppearanceStreamOfAnnotation:self inContext:context]) {
+        [super drawInContext:context];
+    }
+}
+
+// Flattening writes into a PDF; keep the vector appearance stream there.
+- (void)drawInContext:(CGContextRef)context withOptions:(NSDictionary *)options {
+    if ([options[kPSPDFAnnotationDrawFlattened] boolValue] || ![PSCAppearanceStreamCache.sharedCache drawAppearanceStreamOfAnnotation:self inContext:context]) {
+        [super drawInContext:context withOptions:options];
+    }
+}
+
+@end
@@ -0,0 +1,38 @@
+//
+//  PSCAppearanceStreamCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// Shared cache of rasterized annotation appearance streams.
+/// PSPDFPageRenderer renders the appearance stream (a PDF within a PDF) of every stamp/ink annotation each time a page is drawn.
+/// This cache keeps a bitmap per annotation, appearance stream hash and scale, so repeated page renderings (thumbnails, zoom levels, re-renders after changes) only composite an image.
+/// Entries are invalidated through PSPDFAnnotationChangedNotification.
+/// Used by annotation subclasses in their drawInContext: implementation, see PSCStampAnnotation.
+@interface PSCAppearanceStreamCache : NSObject
+
+/// The shared cache.
++ (instancetype)sharedCache;
+
+/// Draws the cached appearance stream of annotation into context. (Rasterizes it on a cache miss)
+/// context needs to be set up in PDF coordinate space, as in drawInContext:.
+/// Returns NO if the annotation has no appearance stream or the image would be too large; draw the annotation normally then.
+- (BOOL)drawAppearanceStreamOfAnnotation:(PSPDFAnnotation *)annotation inContext:(CGContextRef)context;
+
+/// Removes all cached images of annotation.
+- (void)invalidateAnnotation:(PSPDFAnnotation *)annotation;
+
+/// Removes all cached images.
+- (void)clearCache;
+
+/// Hash of the appearance stream data, read from the PDF. Falls back to a hash of the appearance related properties if the stream can't be read.
+- (NSString *)appearanceStreamHashForAnnotation:(PSPDFAnnotation *)annotation;
+
+/// Memory limit for all cached images, in bytes. Defaults to 20MB.
+@property (nonatomic, assign) NSUInteger totalCostLimit;
+
+/// Maximum width/height of a cached image, in pixels. Larger appearance streams are rendered directly. Defaults to 2048.
+@property (nonatomic, assign) NSUInteger maximumImageDimension;
+
+@end
@@ -0,0 +1,217 @@
+//
+//  PSCAppearanceStreamCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAppearanceStreamCache.h"
+#import <CommonCrypto/CommonDigest.h>
+#import <objc/runtime.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+static char kPSCAppearanceStreamHashKey;
+
+static NSString *PSCSHA1StringFromData(CFDataRef data) {
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(CFDataGetBytePtr(data), (CC_LONG)CFDataGetLength(data), digest);
+    NSMutableString *string = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (NSUInteger idx = 0; idx < CC_SHA1_DIGEST_LENGTH; idx++) {
+        [string appendFormat:@"%02x", digest[idx]];
+    }
+    return string;
+}
+
+// Cached images are shared between scales within a power of two. Keeps the hit rate high while zooming, at most 2x oversampling.
+static CGFloat PSCAppearanceStreamBucketScale(CGFloat scale) {
+    return powf(2.f, ceilf(log2f(fmaxf(scale, 1.f/64.f))));
+}
+
+@interface PSCAppearanceStreamCache () {
+    NSCache *_imageCache;
+    NSMutableDictionary *_imageKeysByAnnotation; // annotation key -> NSMutableSet of image keys
+}
+@end
+
+@implementation PSCAppearanceStreamCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
++ (instancetype)sharedCache {
+    static PSCAppearanceStreamCache *_sharedCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedCache = [self new];
+    });
+    return _sharedCache;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _imageCache = [NSCache new];
+        _imageCache.name = @"com.pspdfkit.catalog.appearancestreamcache";
+        _imageKeysByAnnotation = [NSMutableDictionary new];
+        _maximumImageDimension = 2048;
+        self.totalCostLimit = 20 * 1024 * 1024;
+
+        [NSNotificationCenter.defaultCenter addObserver:self selector:@selector(annotationChangedNotification:) name:PSPDFAnnotationChangedNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [NSNotificationCenter.defaultCenter removeObserver:self];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSUInteger)totalCostLimit {
+    return _imageCache.totalCostLimit;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    _imageCache.totalCostLimit = totalCostLimit;
+}
+
+- (BOOL)drawAppearanceStreamOfAnnotation:(PSPDFAnnotation *)annotation inContext:(CGContextRef)context {
+    if (!annotation.hasAppearanceStream || !context) return NO;
+
+    CGRect boundingBox = annotation.boundingBox;
+    if (CGRectIsEmpty(boundingBox)) return NO;
+
+    CGAffineTransform deviceTransform = CGContextGetUserSpaceToDeviceSpaceTransform(context);
+    CGFloat scale = PSCAppearanceStreamBucketScale(sqrtf(fabsf(deviceTransform.a * deviceTransform.d - deviceTransform.b * deviceTransform.c)));
+    size_t width = ceilf(boundingBox.size.width * scale), height = ceilf(boundingBox.size.height * scale);
+    if (width > self.maximumImageDimension || height > self.maximumImageDimension) return NO;
+
+    NSString *annotationKey = [self keyForAnnotation:annotation];
+    NSString *imageKey = [NSString stringWithFormat:@"%@_%@_%@_%.0f", annotationKey, [self appearanceStreamHashForAnnotation:annotation], NSStringFromCGSize(boundingBox.size), scale * 100];
+
+    UIImage *image = [_imageCache objectForKey:imageKey];
+    if (!image) {
+        image = [self renderAppearanceStreamOfAnnotation:annotation width:width height:height scale:scale];
+        if (!image) return NO;
+
+        [_imageCache setObject:image forKey:imageKey cost:width * height * 4];
+        @synchronized(self) {
+            NSMutableSet *imageKeys = _imageKeysByAnnotation[annotationKey];
+            if (!imageKeys) _imageKeysByAnnotation[annotationKey] = imageKeys = [NSMutableSet set];
+            [imageKeys addObject:imageKey];
+        }
+    }
+
+    CGContextDrawImage(context, boundingBox, image.CGImage);
+    return YES;
+}
+
+- (void)invalidateAnnotation:(PSPDFAnnotation *)annotation {
+    if (!annotation) return;
+
+    NSString *annotationKey = [self keyForAnnotation:annotation];
+    NSSet *imageKeys;
+    @synchronized(self) {
+        imageKeys = _imageKeysByAnnotation[annotationKey];
+        [_imageKeysByAnnotation removeObjectForKey:annotationKey];
+    }
+    for (NSString *imageKey in imageKeys) {
+        [_imageCache removeObjectForKey:imageKey];
+    }
+    objc_setAssociatedObject(annotation, &kPSCAppearanceStreamHashKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (void)clearCache {
+    @synchronized(self) {
+        [_imageKeysByAnnotation removeAllObjects];
+    }
+    [_imageCache removeAllObjects];
+}
+
+- (NSString *)appearanceStreamHashForAnnotation:(PSPDFAnnotation *)annotation {
+    NSString *streamHash = objc_getAssociatedObject(annotation, &kPSCAppearanceStreamHashKey);
+    if (!streamHash) {
+        streamHash = [self readAppearanceStreamHashForAnnotation:annotation];
+        if (!streamHash) {
+            NSString *appearance = [NSString stringWithFormat:@"%@_%@_%f_%f", NSStringFromCGRect(annotation.boundingBox), annotation.color, annotation.alpha, [annotation.lastModified timeIntervalSinceReferenceDate]];
+            streamHash = PSCSHA1StringFromData((__bridge CFDataRef)[appearance dataUsingEncoding:NSUTF8StringEncoding]);
+        }
+        objc_setAssociatedObject(annotation, &kPSCAppearanceStreamHashKey, streamHash, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+    return streamHash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Annotations that are backed by the PDF are identified by their index, new ones by their address.
+- (NSString *)keyForAnnotation:(PSPDFAnnotation *)annotation {
+    NSString *identity = annotation.indexOnPage >= 0 ? [NSString stringWithFormat:@"i%d", annotation.indexOnPage] : [NSString stringWithFormat:@"p%p", annotation];
+    return [NSString stringWithFormat:@"%@_%d_%@", annotation.document.UID, annotation.absolutePage, identity];
+}
+
+- (UIImage *)renderAppearanceStreamOfAnnotation:(PSPDFAnnotation *)annotation width:(size_t)width height:(size_t)height scale:(CGFloat)scale {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) return nil;
+
+    // Map the annotation rect (PDF coordinates) onto the bitmap.
+    CGRect boundingBox = annotation.boundingBox;
+    CGContextScaleCTM(context, scale, scale);
+    CGContextTranslateCTM(context, -boundingBox.origin.x, -boundingBox.origin.y);
+
+    UIImage *image = nil;
+    if ([PSPDFPageRenderer renderAppearanceStream:annotation inContext:context]) {
+        CGImageRef imageRef = CGBitmapContextCreateImage(context);
+        image = [UIImage imageWithCGImage:imageRef];
+        CGImageRelease(imageRef);
+    }
+    CGContextRelease(context);
+    return image;
+}
+
+// Reads the normal appearance stream (/AP /N) of the annotation directly from the PDF.
+- (NSString *)readAppearanceStreamHashForAnnotation:(PSPDFAnnotation *)annotation {
+    PSPDFDocumentProvider *documentProvider = annotation.documentProvider;
+    if (!documentProvider || annotation.indexOnPage < 0) return nil;
+
+    CGPDFPageRef pageRef = [documentProvider requestPageRefForPageNumber:annotation.page+1];
+    if (!pageRef) return nil;
+
+    NSString *streamHash = nil;
+    CGPDFArrayRef annotsArray;
+    CGPDFDictionaryRef annotationDictionary, appearanceDictionary, stateDictionary;
+    CGPDFStreamRef appearanceStream = NULL;
+    const char *appearanceState;
+    if (CGPDFDictionaryGetArray(CGPDFPageGetDictionary(pageRef), "Annots", &annotsArray) &&
+        CGPDFArrayGetDictionary(annotsArray, annotation.indexOnPage, &annotationDictionary) &&
+        CGPDFDictionaryGetDictionary(annotationDictionary, "AP", &appearanceDictionary)) {
+        if (!CGPDFDictionaryGetStream(appearanceDictionary, "N", &appearanceStream) &&
+            CGPDFDictionaryGetDictionary(appearanceDictionary, "N", &stateDictionary) &&
+            CGPDFDictionaryGetName(annotationDictionary, "AS", &appearanceState)) {
+            CGPDFDictionaryGetStream(stateDictionary, appearanceState, &appearanceStream);
+        }
+    }
+    if (appearanceStream) {
+        CGPDFDataFormat format;
+        CFDataRef data = CGPDFStreamCopyData(appearanceStream, &format);
+        if (data) {
+            streamHash = PSCSHA1StringFromData(data);
+            CFRelease(data);
+        }
+    }
+    [documentProvider releasePageRef:pageRef];
+    return streamHash;
+}
+
+// Changed annotations are usually copies. Drop images of both the new and the original annotation.
+- (void)annotationChangedNotification:(NSNotification *)notification {
+    [self invalidateAnnotation:notification.object];
+    [self invalidateAnnotation:notification.userInfo[PSPDFAnnotationChangedNotificationOriginalAnnotationKey]];
+}
+
+@end
@@ -0,0 +1,63 @@
+//
+//  PSCCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+@class PSCCacheCodec, PSCDiskCacheWriteQueue;
+
+/// PSPDFCache subclass used within the catalog. Registered via kPSPDFCacheClassName in PSCAppDelegate.
+@interface PSCCache : PSPDFCache
+
+/// @name Dirty-Rect Invalidation
+
+/// Invalidates only `PDFRect` (PDF coordinate space) of all images cached for `page`.
+/// The dirty part is re-rendered through PSPDFRenderQueue and patched into the cached images (memory and disk) in place.
+/// Falls back to invalidateImageFromDocument:andPage: if the rect covers too much of the page.
+- (void)invalidateImageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page inPDFRect:(CGRect)PDFRect;
+
+/// If enabled, annotation changes only invalidate the union of the old and new annotation bounding box. Defaults to YES.
+@property (nonatomic, assign) BOOL dirtyRectInvalidationEnabled;
+
+/// If the dirty area is larger than this fraction of the page, the whole page is invalidated instead. Defaults to 0.5.
+@property (nonatomic, assign) CGFloat dirtyRectMaximumPageFraction;
+
+/// @name Adaptive Image Format
+
+/// If enabled, every disk cache entry is stored as JPEG, PNG or palette, depending on its content. Defaults to NO,
+/// so entries are written by the stock useJPGFormat path unless this is turned on.
+/// The codec needs lossless input, so enabling this sets useJPGFormat to NO; disabling restores the previous value.
+/// Entries are transcoded in the encryptDataBlock hook, before a custom encryptDataBlock runs; decryptFromPathBlock is wrapped likewise.
+@property (nonatomic, assign) BOOL adaptiveImageFormatEnabled;
+
+/// Codec that picks the format per entry.
+@property (nonatomic, strong, readonly) PSCCacheCodec *imageCodec;
+
+/// @name Write-Behind
+
+/// If enabled, cacheDocument:startAtPage:sizes:diskCacheStrategy: with PSPDFDiskCacheStrategyEverything uses a PSCPyramidCacher
+/// that stores through writeQueue: images are encoded and written in batches, and caching backs off while the disk falls behind.
+/// Other strategies are handled by PSPDFCache. Opt-in; defaults to NO.
+@property (nonatomic, assign) BOOL writeBehindEnabled;
+
+/// Write queue in front of the disk cache. Pending writes are dropped when the page or document is invalidated.
+@property (nonatomic, strong, readonly) PSCDiskCacheWriteQueue *writeQueue;
+
+/// @name Render Fingerprints
+
+/// If enabled, the actuality check (PSPDFCacheOptionActualityCheckAndRequest) is skipped for render states whose cached image was found current.
+/// The state (UID, page, size, annotations, render options) is hashed into a PSCRenderFingerprint and remembered once the stored
+/// entry's receipt matches; a stale image that triggers a re-render is not remembered. Annotation changes, invalidation and memory warnings reset this.
+/// @note Every lookup still fetches the page's annotations and hashes them, so this saves the receipt string formatting and compare,
+/// not the annotation access. The first lookup of a state builds one more receipt than PSPDFCache alone. Measure before enabling it. Defaults to NO.
+@property (nonatomic, assign) BOOL renderFingerprintCheckEnabled;
+
+/// @name Thumbnail Atlas
+
+/// If enabled, lookups for tinySize are answered from the document's PSCThumbnailAtlas once it has been loaded
+/// (e.g. by PSCAtlasThumbnailsViewController), without memory cache, disk or render queue access. Defaults to YES.
+/// Invalidating a page, removing a document's cache and clearCache invalidate the atlases as well.
+@property (nonatomic, assign) BOOL thumbnailAtlasLookupEnabled;
+
+@end
@@ -0,0 +1,561 @@
+//
+//  PSCCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCache.h"
+#import "PSCCacheCodec.h"
+#import "PSCDiskCacheWriteQueue.h"
+#import "PSCPyramidCacher.h"
+#import "PSCRenderFingerprint.h"
+#import "PSCThumbnailAtlas.h"
+#import <objc/runtime.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// A dirty rect is only used for the page invalidation that directly follows the annotation change.
+#define kPSCDirtyRectMaximumAge 1.0
+
+// Safety margin around the dirty rect, in pixels. Compensates antialiasing and rounding.
+#define kPSCDirtyRectPixelMargin 2.f
+
+// Render jobs might get cancelled (e.g. on a memory warning). Fall back to a full invalidation then.
+#define kPSCPatchRequestTimeout 5.0
+
+// Bounds the set of verified render fingerprints (16 bytes each).
+#define kPSCVerifiedFingerprintMaximumCount 2048
+
+// PSPDFCacheOptionActuality* bits.
+#define kPSCCacheOptionActualityMask ((PSPDFCacheOptions)(7 << 9))
+
+static char kPSCLastKnownBoundingBoxKey;
+
+// Remembers the area of a page that has been changed since the last invalidation.
+@interface PSCCacheDirtyRect : NSObject
+@property (nonatomic, assign) CGRect PDFRect;
+@property (nonatomic, assign) CFAbsoluteTime timestamp;
+@end
+
+// Renders the dirty part of one cached image size via PSPDFRenderQueue.
+@interface PSCCachePatchRequest : NSObject <PSPDFRenderDelegate>
+@property (nonatomic, strong) PSPDFDocument *document;
+@property (nonatomic, assign) NSUInteger page;
+@property (nonatomic, strong) PSPDFCacheInfo *cacheInfo;
+@property (nonatomic, strong) UIImage *image; // nil if the image is only cached on disk.
+@property (nonatomic, assign) CGRect imageRect;
+@property (nonatomic, copy) NSArray *annotations;
+@property (nonatomic, strong) PSPDFRenderJob *job;
+@property (nonatomic, copy) void (^completionBlock)(PSCCachePatchRequest *request, UIImage *renderedImage);
+- (void)finishWithRenderedImage:(UIImage *)renderedImage;
+@end
+
+@interface PSCCache () {
+    NSMutableDictionary *_pendingDirtyRects; // key -> PSCCacheDirtyRect
+    NSMutableSet *_patchRequests;
+    NSCountedSet *_patchingPages;
+    NSMutableArray *_delegates;              // non-retained NSValue's
+    NSMutableDictionary *_pyramidCachers;    // UID -> PSCPyramidCacher
+    NSMutableSet *_verifiedFingerprints;     // PSCRenderFingerprintData of render states that passed the actuality check
+    dispatch_queue_t _patchQueue;
+    BOOL _useJPGFormatBeforeAdaptiveImageFormat;
+    void (^_customEncryptDataBlock)(PSPDFDocument *document, NSMutableData *data);
+    NSData *(^_customDecryptFromPathBlock)(PSPDFDocument *document, NSString *path);
+}
+@end
+
+@implementation PSCCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _dirtyRectInvalidationEnabled = YES;
+        _dirtyRectMaximumPageFraction = 0.5f;
+        _pendingDirtyRects = [NSMutableDictionary new];
+        _patchRequests = [NSMutableSet new];
+        _patchingPages = [NSCountedSet new];
+        _delegates = [NSMutableArray new];
+        _patchQueue = pspdf_dispatch_queue_create("com.pspdfkit.catalog.cache.patch", DISPATCH_QUEUE_SERIAL);
+        _imageCodec = [PSCCacheCodec new];
+        _writeQueue = [[PSCDiskCacheWriteQueue alloc] initWithCache:self];
+        _pyramidCachers = [NSMutableDictionary new];
+        _verifiedFingerprints = [NSMutableSet new];
+        _thumbnailAtlasLookupEnabled = YES;
+
+        NSNotificationCenter *dnc = NSNotificationCenter.defaultCenter;
+        [dnc addObserver:self selector:@selector(annotationAddedNotification:) name:PSPDFAnnotationAddedNotification object:nil];
+        [dnc addObserver:self selector:@selector(annotationChangedNotification:) name:PSPDFAnnotationChangedNotification object:nil];
+        [dnc addObserver:self selector:@selector(resetVerifiedFingerprints) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [NSNotificationCenter.defaultCenter removeObserver:self];
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_patchQueue);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFCache
+
+- (UIImage *)imageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withSize:(CGSize)size options:(PSPDFCacheOptions)options {
+    // Scrobble bar thumbnails; the slices share the memory of the already decoded sheets.
+    if (self.thumbnailAtlasLookupEnabled && CGSizeEqualToSize(size, self.tinySize)) {
+        UIImage *atlasImage = [[PSCThumbnailAtlas loadedAtlasForDocument:document size:size] imageForPage:page];
+        if (atlasImage) return atlasImage;
+    }
+
+    // While a patch is in flight, the cached image is only outdated inside the dirty rect.
+    // Don't let the actuality check queue a full page render that would make the patch pointless.
+    if ([self isPatchingDocument:document page:page]) {
+        options = (options & ~kPSCCacheOptionActualityMask) | PSPDFCacheOptionActualityIgnore;
+    }else if (self.renderFingerprintCheckEnabled && (options & kPSCCacheOptionActualityMask) == PSPDFCacheOptionActualityCheckAndRequest && document.UID) {
+        // Skipped for states whose image was found current. The page's annotations are still fetched and hashed on every lookup,
+        // which is about as much work as building the receipt; only the receipt string formatting and compare is saved.
+        NSArray *annotations = [document annotationsForPage:page type:document.renderAnnotationTypes];
+        NSData *fingerprint = PSCRenderFingerprintData(PSCRenderFingerprintMake(document, page, size, CGRectZero, annotations, document.renderOptions));
+        BOOL verified;
+        @synchronized(_verifiedFingerprints) {
+            verified = [_verifiedFingerprints containsObject:fingerprint];
+        }
+        if (verified) {
+            options = (options & ~kPSCCacheOptionActualityMask) | PSPDFCacheOptionActualityIgnore;
+        }else {
+            // Super also returns stale images (and queues a re-render); only a current entry is remembered.
+            UIImage *image = [super imageFromDocument:document andPage:page withSize:size options:options];
+            BOOL current = image && [self hasCurrentEntryForDocument:document page:page size:size annotations:annotations];
+            @synchronized(_verifiedFingerprints) {
+                if (current) {
+                    if (_verifiedFingerprints.count >= kPSCVerifiedFingerprintMaximumCount) [_verifiedFingerprints removeAllObjects];
+                    [_verifiedFingerprints addObject:fingerprint];
+                }else {
+                    [_verifiedFingerprints removeObject:fingerprint];
+                }
+            }
+            return image;
+        }
+    }
+    return [super imageFromDocument:document andPage:page withSize:size options:options];
+}
+
+- (void)invalidateImageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page {
+    // A pending write would bring back the outdated image.
+    [self.writeQueue cancelWritesForDocument:document page:page];
+    [self resetVerifiedFingerprints];
+    CGRect dirtyRect = [self popDirtyRectForDocument:document page:page];
+    if (!CGRectIsNull(dirtyRect)) {
+        [self invalidateImageFromDocument:document andPage:page inPDFRect:dirtyRect];
+    }else {
+        [PSCThumbnailAtlas invalidateAtlasesForDocument:document page:page];
+        [super invalidateImageFromDocument:document andPage:page];
+    }
+}
+
+- (void)cacheDocument:(PSPDFDocument *)document startAtPage:(NSUInteger)page sizes:(NSArray *)sizes diskCacheStrategy:(PSPDFDiskCacheStrategy)diskCacheStrategy {
+    if (!self.writeBehindEnabled || diskCacheStrategy != PSPDFDiskCacheStrategyEverything || !document.UID || sizes.count == 0) {
+        [super cacheDocument:document startAtPage:page sizes:sizes diskCacheStrategy:diskCacheStrategy]; return;
+    }
+
+    NSString *UID = document.UID;
+    PSCPyramidCacher *cacher = [[PSCPyramidCacher alloc] initWithCache:self document:document sizes:sizes];
+    cacher.writeQueue = self.writeQueue;
+    cacher.maximumConcurrentPageCount = 1; // Like PSPDFCache, pre-caching renders one page at a time.
+    @synchronized(_pyramidCachers) {
+        [_pyramidCachers[UID] cancel];
+        _pyramidCachers[UID] = cacher;
+    }
+    [cacher startAtPage:page completionBlock:^(PSCPyramidCacher *finishedCacher) {
+        @synchronized(_pyramidCachers) {
+            if (_pyramidCachers[UID] == finishedCacher) [_pyramidCachers removeObjectForKey:UID];
+        }
+    }];
+}
+
+- (void)stopCachingDocument:(PSPDFDocument *)document {
+    [super stopCachingDocument:document];
+    if (!document.UID) return;
+
+    @synchronized(_pyramidCachers) {
+        [_pyramidCachers[document.UID] cancel];
+        [_pyramidCachers removeObjectForKey:document.UID];
+    }
+    [self.writeQueue cancelWritesForDocument:document page:NSNotFound];
+}
+
+- (BOOL)removeCacheForDocument:(PSPDFDocument *)document deleteDocument:(BOOL)deleteDocument error:(NSError **)error {
+    [self stopCachingDocument:document];
+    [self resetVerifiedFingerprints];
+    [PSCThumbnailAtlas removeAtlasesForDocument:document];
+    return [super removeCacheForDocument:document deleteDocument:deleteDocument error:error];
+}
+
+- (void)clearCache {
+    NSArray *pyramidCachers;
+    @synchronized(_pyramidCachers) {
+        pyramidCachers = _pyramidCachers.allValues;
+        [_pyramidCachers removeAllObjects];
+    }
+    [pyramidCachers makeObjectsPerformSelector:@selector(cancel)];
+    [self.writeQueue cancelAllWrites];
+    [self resetVerifiedFingerprints];
+    [PSCThumbnailAtlas removeAllAtlases];
+    [super clearCache];
+}
+
+- (void)addDelegate:(id<PSPDFCacheDelegate>)aDelegate {
+    [super addDelegate:aDelegate];
+    if (aDelegate) {
+        @synchronized(_delegates) {
+            [_delegates addObject:[NSValue valueWithNonretainedObject:aDelegate]];
+        }
+    }
+}
+
+- (BOOL)removeDelegate:(id<PSPDFCacheDelegate>)aDelegate {
+    @synchronized(_delegates) {
+        [_delegates removeObject:[NSValue valueWithNonretainedObject:aDelegate]];
+    }
+    return [super removeDelegate:aDelegate];
+}
+
+// Custom blocks are kept separately and wrapped by the codec, see updateDiskCacheBlocks.
+- (void)setEncryptDataBlock:(void (^)(PSPDFDocument *, NSMutableData *))encryptDataBlock {
+    @synchronized(self) {
+        _customEncryptDataBlock = [encryptDataBlock copy];
+    }
+    [self updateDiskCacheBlocks];
+}
+
+- (void)setDecryptFromPathBlock:(NSData *(^)(PSPDFDocument *, NSString *))decryptFromPathBlock {
+    @synchronized(self) {
+        _customDecryptFromPathBlock = [decryptFromPathBlock copy];
+    }
+    [self updateDiskCacheBlocks];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Adaptive Image Format
+
+- (void)setAdaptiveImageFormatEnabled:(BOOL)adaptiveImageFormatEnabled {
+    if (adaptiveImageFormatEnabled == _adaptiveImageFormatEnabled) return;
+
+    // The codec needs lossless input; the previous format is restored when it's turned off again.
+    if (adaptiveImageFormatEnabled) {
+        _useJPGFormatBeforeAdaptiveImageFormat = self.useJPGFormat;
+        self.useJPGFormat = NO;
+    }else {
+        self.useJPGFormat = _useJPGFormatBeforeAdaptiveImageFormat;
+    }
+    _adaptiveImageFormatEnabled = adaptiveImageFormatEnabled;
+    [self updateDiskCacheBlocks];
+}
+
+// PSPDFCache encodes entries as PNG, the codec re-encodes them before they're encrypted and written.
+// On load, the decrypted data is turned back into something UIImage can decode.
+- (void)updateDiskCacheBlocks {
+    void (^encryptDataBlock)(PSPDFDocument *, NSMutableData *);
+    NSData *(^decryptFromPathBlock)(PSPDFDocument *, NSString *);
+    @synchronized(self) {
+        encryptDataBlock = _customEncryptDataBlock;
+        decryptFromPathBlock = _customDecryptFromPathBlock;
+    }
+    if (!self.adaptiveImageFormatEnabled) {
+        [super setEncryptDataBlock:encryptDataBlock];
+        [super setDecryptFromPathBlock:decryptFromPathBlock];
+        return;
+    }
+
+    PSCCacheCodec *imageCodec = self.imageCodec;
+    [super setEncryptDataBlock:^(PSPDFDocument *document, NSMutableData *data) {
+        NSData *transcodedData = [imageCodec transcodeImageData:data];
+        if (transcodedData != data) [data setData:transcodedData];
+        if (encryptDataBlock) encryptDataBlock(document, data);
+    }];
+    [super setDecryptFromPathBlock:^NSData *(PSPDFDocument *document, NSString *path) {
+        NSData *data = decryptFromPathBlock ? decryptFromPathBlock(document, path) : [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+        return [imageCodec decodableDataFromData:data];
+    }];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Dirty-Rect Invalidation
+
+- (void)invalidateImageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page inPDFRect:(CGRect)PDFRect {
+    // Atlas sheets aren't patched; the page is looked up in PSPDFCache until the atlas is rebuilt.
+    [PSCThumbnailAtlas invalidateAtlasesForDocument:document page:page];
+
+    NSString *UID = document.UID;
+    PSPDFPageInfo *pageInfo = [document pageInfoForPage:page];
+    if (!UID || !pageInfo) {
+        [super invalidateImageFromDocument:document andPage:page]; return;
+    }
+
+    // Changes outside of the page are invisible.
+    CGRect pageRect = pageInfo.pageRect;
+    CGRect dirtyRect = CGRectIntersection(PSPDFNormalizeRect(PDFRect), pageRect);
+    if (CGRectIsEmpty(dirtyRect)) return;
+
+    // Large changes are faster rendered as a whole.
+    CGFloat dirtyFraction = (dirtyRect.size.width * dirtyRect.size.height) / (pageRect.size.width * pageRect.size.height);
+    if (dirtyFraction > self.dirtyRectMaximumPageFraction) {
+        [super invalidateImageFromDocument:document andPage:page]; return;
+    }
+
+    // Collect all cached sizes. Returning an empty array keeps the entries valid.
+    NSMutableDictionary *cacheInfos = [NSMutableDictionary dictionary];
+    [self.diskCache invalidateAllImagesWithUID:UID andPage:page infoArraySelector:^NSArray *(NSOrderedSet *infos) {
+        for (PSPDFCacheInfo *info in infos) cacheInfos[NSStringFromCGSize(info.size)] = info;
+        return @[];
+    }];
+    // Entries from the memory cache win, since they already have a decoded image.
+    [self.memoryCache invalidateAllImagesWithUID:UID andPage:page infoArraySelector:^NSArray *(NSOrderedSet *infos) {
+        for (PSPDFCacheInfo *info in infos) if (info.image) cacheInfos[NSStringFromCGSize(info.size)] = info;
+        return @[];
+    }];
+    if (cacheInfos.count == 0) return;
+
+    NSArray *annotations = [document annotationsForPage:page type:document.renderAnnotationTypes];
+    NSString *pageKey = PSCCachePageKey(document, page);
+    for (PSPDFCacheInfo *cacheInfo in cacheInfos.allValues) {
+        CGRect imageBounds = (CGRect){CGPointZero, cacheInfo.size};
+        CGRect imageRect = PSPDFConvertPDFRectToViewRect(dirtyRect, pageRect, pageInfo.pageRotation, imageBounds);
+        imageRect = CGRectIntersection(CGRectIntegral(CGRectInset(imageRect, -kPSCDirtyRectPixelMargin, -kPSCDirtyRectPixelMargin)), imageBounds);
+        if (CGRectIsEmpty(imageRect)) continue;
+
+        PSCCachePatchRequest *request = [PSCCachePatchRequest new];
+        request.document = document;
+        request.page = page;
+        request.cacheInfo = cacheInfo;
+        request.image = cacheInfo.image;
+        request.imageRect = imageRect;
+        request.annotations = annotations;
+        __weak PSCCache *weakSelf = self;
+        request.completionBlock = ^(PSCCachePatchRequest *finishedRequest, UIImage *renderedImage) {
+            [weakSelf finishPatchRequest:finishedRequest withRenderedImage:renderedImage];
+        };
+
+        @synchronized(_patchRequests) {
+            [_patchRequests addObject:request];
+            [_patchingPages addObject:pageKey];
+        }
+        // The render queue only weakly references the delegate, _patchRequests keeps the request alive.
+        request.job = [PSPDFRenderQueue.sharedRenderQueue requestRenderedImageForDocument:document andPage:page withSize:cacheInfo.size clippedToRect:imageRect withAnnotations:annotations options:document.renderOptions priority:PSPDFRenderQueuePriorityHigh queueAsNext:YES delegate:request];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kPSCPatchRequestTimeout * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [request finishWithRenderedImage:nil];
+        });
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Annotation Changes
+
+- (void)annotationAddedNotification:(NSNotification *)notification {
+    PSPDFAnnotation *annotation = notification.object;
+    if (![annotation isKindOfClass:PSPDFAnnotation.class]) return;
+
+    [self resetVerifiedFingerprints];
+    [PSCThumbnailAtlas invalidateAtlasesForDocument:annotation.document page:annotation.absolutePage];
+    CGRect boundingBox = PSCDirtyBoundingBoxForAnnotation(annotation);
+    PSCSetLastKnownBoundingBox(annotation, boundingBox);
+    [self addDirtyRect:boundingBox forDocument:annotation.document page:annotation.absolutePage];
+}
+
+- (void)annotationChangedNotification:(NSNotification *)notification {
+    PSPDFAnnotation *annotation = notification.object;
+    if (![annotation isKindOfClass:PSPDFAnnotation.class]) return;
+    PSPDFAnnotation *originalAnnotation = notification.userInfo[PSPDFAnnotationChangedNotificationOriginalAnnotationKey];
+    [self resetVerifiedFingerprints];
+    [PSCThumbnailAtlas invalidateAtlasesForDocument:annotation.document page:annotation.absolutePage];
+
+    // Find out where the annotation was before. Copied annotations still have their old geometry.
+    CGRect oldBoundingBox = PSCLastKnownBoundingBox(annotation);
+    if (CGRectIsNull(oldBoundingBox) && originalAnnotation && originalAnnotation != annotation) {
+        oldBoundingBox = PSCLastKnownBoundingBox(originalAnnotation);
+        if (CGRectIsNull(oldBoundingBox)) oldBoundingBox = PSCDirtyBoundingBoxForAnnotation(originalAnnotation);
+    }
+    CGRect newBoundingBox = PSCDirtyBoundingBoxForAnnotation(annotation);
+    PSCSetLastKnownBoundingBox(annotation, newBoundingBox);
+
+    PSPDFDocument *document = annotation.document;
+    NSUInteger page = annotation.absolutePage;
+    if (CGRectIsNull(oldBoundingBox)) {
+        // Annotation was loaded from the PDF and never tracked. Remember the page geometry so the next change is precise.
+        for (PSPDFAnnotation *pageAnnotation in [document annotationsForPage:page type:PSPDFAnnotationTypeAll]) {
+            if (CGRectIsNull(PSCLastKnownBoundingBox(pageAnnotation))) {
+                PSCSetLastKnownBoundingBox(pageAnnotation, PSCDirtyBoundingBoxForAnnotation(pageAnnotation));
+            }
+        }
+        return;
+    }
+    [self addDirtyRect:CGRectUnion(oldBoundingBox, newBoundingBox) forDocument:document page:page];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+static NSString *PSCCachePageKey(PSPDFDocument *document, NSUInteger page) {
+    return [NSString stringWithFormat:@"%@_%d", document.UID, page];
+}
+
+static CGRect PSCDirtyBoundingBoxForAnnotation(PSPDFAnnotation *annotation) {
+    return PSPDFGrowRectByLineWidth(annotation.boundingBox, annotation.lineWidth);
+}
+
+static CGRect PSCLastKnownBoundingBox(PSPDFAnnotation *annotation) {
+    NSValue *boundingBoxValue = objc_getAssociatedObject(annotation, &kPSCLastKnownBoundingBoxKey);
+    return boundingBoxValue ? [boundingBoxValue CGRectValue] : CGRectNull;
+}
+
+static void PSCSetLastKnownBoundingBox(PSPDFAnnotation *annotation, CGRect boundingBox) {
+    objc_setAssociatedObject(annotation, &kPSCLastKnownBoundingBoxKey, [NSValue valueWithCGRect:boundingBox], OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+static UIImage *PSCImageByPatchingImage(UIImage *image, UIImage *patchImage, CGRect patchRect, CGSize size) {
+    if (!image || !patchImage) return nil;
+
+    UIGraphicsBeginImageContextWithOptions(size, YES, image.scale);
+    [image drawInRect:(CGRect){CGPointZero, size}];
+    [patchImage drawInRect:patchRect];
+    UIImage *patchedImage = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    return patchedImage;
+}
+
+- (void)addDirtyRect:(CGRect)PDFRect forDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    if (!self.dirtyRectInvalidationEnabled || !document.UID || CGRectIsNull(PDFRect)) return;
+
+    NSString *pageKey = PSCCachePageKey(document, page);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    @synchronized(_pendingDirtyRects) {
+        PSCCacheDirtyRect *dirtyRect = _pendingDirtyRects[pageKey];
+        if (dirtyRect && now - dirtyRect.timestamp < kPSCDirtyRectMaximumAge) {
+            dirtyRect.PDFRect = CGRectUnion(dirtyRect.PDFRect, PDFRect);
+        }else {
+            dirtyRect = [PSCCacheDirtyRect new];
+            dirtyRect.PDFRect = PDFRect;
+            _pendingDirtyRects[pageKey] = dirtyRect;
+        }
+        dirtyRect.timestamp = now;
+    }
+}
+
+// Returns CGRectNull if there's no recent dirty rect; the page will then be invalidated as a whole.
+- (CGRect)popDirtyRectForDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    if (!self.dirtyRectInvalidationEnabled || !document.UID) return CGRectNull;
+
+    NSString *pageKey = PSCCachePageKey(document, page);
+    PSCCacheDirtyRect *dirtyRect;
+    @synchronized(_pendingDirtyRects) {
+        dirtyRect = _pendingDirtyRects[pageKey];
+        [_pendingDirtyRects removeObjectForKey:pageKey];
+    }
+    if (!dirtyRect || CFAbsoluteTimeGetCurrent() - dirtyRect.timestamp > kPSCDirtyRectMaximumAge) return CGRectNull;
+    return dirtyRect.PDFRect;
+}
+
+// Same comparison as PSPDFCache's actuality check: the receipt of the stored entry against one for the current state.
+- (BOOL)hasCurrentEntryForDocument:(PSPDFDocument *)document page:(NSUInteger)page size:(CGSize)size annotations:(NSArray *)annotations {
+    PSPDFCacheInfoSelector infoSelector = ^PSPDFCacheInfo *(NSOrderedSet *infos) {
+        for (PSPDFCacheInfo *info in infos) if (CGSizeEqualToSize(info.size, size)) return info;
+        return nil;
+    };
+    PSPDFCacheInfo *cacheInfo = [self.memoryCache cacheInfoForImageWithUID:document.UID andPage:page withSize:size infoSelector:infoSelector];
+    if (!cacheInfo.renderReceipt) cacheInfo = [self.diskCache cacheInfoForImageWithUID:document.UID andPage:page withSize:size infoSelector:infoSelector];
+    return PSCCacheInfoIsCurrent(cacheInfo, document, page, annotations);
+}
+
+// Not every annotation property is part of the fingerprint; any change forces a fresh actuality check.
+- (void)resetVerifiedFingerprints {
+    @synchronized(_verifiedFingerprints) {
+        [_verifiedFingerprints removeAllObjects];
+    }
+}
+
+- (BOOL)isPatchingDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    if (!document.UID) return NO;
+    @synchronized(_patchRequests) {
+        return _patchingPages.count > 0 && [_patchingPages countForObject:PSCCachePageKey(document, page)] > 0;
+    }
+}
+
+- (void)finishPatchRequest:(PSCCachePatchRequest *)request withRenderedImage:(UIImage *)renderedImage {
+    PSPDFDocument *document = request.document;
+    NSUInteger page = request.page;
+    CGSize size = request.cacheInfo.size;
+
+    dispatch_async(_patchQueue, ^{
+        UIImage *image = request.image;
+        if (!image && renderedImage) {
+            // Entry is only on disk; load it to patch it.
+            image = [self.diskCache imageWithUID:document.UID andPage:page withSize:size infoSelector:^PSPDFCacheInfo *(NSOrderedSet *infos) {
+                for (PSPDFCacheInfo *info in infos) if (CGSizeEqualToSize(info.size, size)) return info;
+                return nil;
+            } decryptionHelper:^UIImage *(NSString *path) {
+                NSData *data = self.decryptFromPathBlock ? self.decryptFromPathBlock(document, path) : [NSData dataWithContentsOfFile:path];
+                return data ? [UIImage imageWithData:data] : nil;
+            } cacheInfo:NULL];
+        }
+        UIImage *patchedImage = PSCImageByPatchingImage(image, renderedImage, request.imageRect, size);
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (patchedImage) {
+                // Receipt for the full page, so the actuality check matches the current annotation state.
+                PSPDFRenderReceipt *receipt = PSCRenderReceiptForCacheEntry(document, page, size, request.annotations);
+                [self saveImage:patchedImage fromDocument:document andPage:page withReceipt:receipt];
+                [self notifyDelegatesOfImage:patchedImage fromDocument:document andPage:page withSize:size];
+            }else {
+                PSCLog(@"Patching %@ failed, invalidating page %d.", request.cacheInfo, page);
+                [super invalidateImageFromDocument:document andPage:page];
+            }
+            @synchronized(_patchRequests) {
+                [_patchRequests removeObject:request];
+                [_patchingPages removeObject:PSCCachePageKey(document, page)];
+            }
+        });
+    });
+}
+
+- (void)notifyDelegatesOfImage:(UIImage *)image fromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withSize:(CGSize)size {
+    NSArray *delegates;
+    @synchronized(_delegates) {
+        delegates = [_delegates copy];
+    }
+    for (NSValue *delegateValue in delegates) {
+        id<PSPDFCacheDelegate> delegate = [delegateValue nonretainedObjectValue];
+        if ([delegate respondsToSelector:@selector(didCacheImage:fromDocument:andPage:withSize:)]) {
+            [delegate didCacheImage:image fromDocument:document andPage:page withSize:size];
+        }
+    }
+}
+
+@end
+
+@implementation PSCCacheDirtyRect @end
+
+@implementation PSCCachePatchRequest
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFRenderDelegate
+
+- (void)renderQueue:(PSPDFRenderQueue *)renderQueue jobDidFinish:(PSPDFRenderJob *)job {
+    if (job == self.job) [self finishWithRenderedImage:job.renderedImage];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+// Only the first call is forwarded to the completion block.
+- (void)finishWithRenderedImage:(UIImage *)renderedImage {
+    void (^completionBlock)(PSCCachePatchRequest *, UIImage *) = self.completionBlock;
+    self.completionBlock = nil;
+    if (completionBlock) completionBlock(self, renderedImage);
+}
+
+@end
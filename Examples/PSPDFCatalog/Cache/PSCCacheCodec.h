@@ -0,0 +1,59 @@
+//
+//  PSCCacheCodec.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+typedef NS_ENUM(NSUInteger, PSCCacheImageFormat) {
+    PSCCacheImageFormatUnknown = 0,
+    PSCCacheImageFormatJPEG    = 1, // Photos and scans.
+    PSCCacheImageFormatPNG     = 2, // Antialiased text and line art.
+    PSCCacheImageFormatPalette = 3  // Opaque pages with at most 256 colors. Indexed + run-length encoded; lossless and cheap to decode.
+};
+
+/**
+ Chooses the disk cache file format per image, based on its content.
+
+ PSPDFCache stores all entries either as JPEG or as PNG (useJPGFormat). Magazines mixing text and photo pages
+ get either blurry text or large photo files. The codec looks at each rendered page:
+ - Opaque images with at most 256 colors (plain text, diagrams, blank pages) are stored in a palette format.
+ - Of the remaining ones, images with mostly soft transitions are stored as JPEG, those with many hard edges stay PNG.
+
+ The format is recognized from the first bytes of the file, so every entry is loaded with the right decoder
+ and entries written in a different format stay readable.
+
+ Palette file format (little endian): 4 byte magic "PSCp", 1 byte version, 3 reserved bytes, 4 byte width,
+ 4 byte height, 2 byte color count, 2 reserved bytes, BGRA palette, then runs of 1 byte index plus the
+ run length - 1 as LEB128 varint. Runs continue across rows.
+ */
+@interface PSCCacheCodec : NSObject
+
+/// Returns the format of encoded image data, from its magic bytes.
++ (PSCCacheImageFormat)formatOfData:(NSData *)data;
+
+/// Analyzes image and returns the format it should be stored in.
+- (PSCCacheImageFormat)formatForImage:(CGImageRef)image;
+
+/// Re-encodes PNG data in the format chosen for its content. Other data, and data that stays PNG, is returned as is.
+- (NSData *)transcodeImageData:(NSData *)data;
+
+/// Returns data UIImage can decode. Palette data is expanded into an uncompressed BMP, everything else is returned as is. nil if palette data is corrupt.
+- (NSData *)decodableDataFromData:(NSData *)data;
+
+/// @name Settings
+
+/// Among all non-flat pixel transitions, the maximum fraction of hard edges that still counts as photographic. Defaults to 0.2.
+@property (nonatomic, assign) CGFloat maximumJPEGEdgeRatio;
+
+/// Compression quality for JPEG entries. Defaults to 0.9, like PSPDFCache's JPGFormatCompression.
+@property (nonatomic, assign) CGFloat JPEGCompression;
+
+/// @name Statistics
+
+/// Number of images stored per format by transcodeImageData:.
+@property (atomic, assign, readonly) NSUInteger JPEGCount;
+@property (atomic, assign, readonly) NSUInteger PNGCount;
+@property (atomic, assign, readonly) NSUInteger paletteCount;
+
+@end
@@ -0,0 +1,303 @@
+//
+//  PSCCacheCodec.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCacheCodec.h"
+#import <ImageIO/ImageIO.h>
+#import <libkern/OSByteOrder.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Increase when the palette file format changes.
+#define kPSCPaletteVersion 1
+#define kPSCPaletteHeaderLength 20
+#define kPSCPaletteMaximumColorCount 256
+
+// BITMAPFILEHEADER + BITMAPINFOHEADER.
+#define kPSCBMPHeaderLength 54
+
+// Open addressing hash for counting colors. Power of two, comfortably larger than the palette.
+#define kPSCColorTableSize 1024
+
+// Every nth pixel of every nth row is compared with its right neighbour.
+#define kPSCEdgeSampleStep 4
+
+// Luma differences. Below flat there's no transition, above hard it's an edge.
+#define kPSCFlatContrast 8
+#define kPSCHardContrast 64
+
+static const uint8_t PSCPaletteMagic[4] = {'P', 'S', 'C', 'p'};
+
+typedef struct {
+    uint32_t colors[kPSCColorTableSize];
+    uint8_t indices[kPSCColorTableSize];
+    BOOL used[kPSCColorTableSize];
+    uint32_t palette[kPSCPaletteMaximumColorCount];
+    NSUInteger count;
+} PSCColorTable;
+
+@interface PSCCacheCodec ()
+@property (atomic, assign) NSUInteger JPEGCount;
+@property (atomic, assign) NSUInteger PNGCount;
+@property (atomic, assign) NSUInteger paletteCount;
+@end
+
+// Returns the palette index of color (0xAARRGGBB), adding it if needed. -1 if the palette is full.
+static inline NSInteger PSCColorTableIndex(PSCColorTable *table, uint32_t color) {
+    NSUInteger slot = (color * 2654435761u) >> 22;
+    while (table->used[slot]) {
+        if (table->colors[slot] == color) return table->indices[slot];
+        slot = (slot + 1) & (kPSCColorTableSize - 1);
+    }
+    if (table->count == kPSCPaletteMaximumColorCount) return -1;
+
+    table->used[slot] = YES;
+    table->colors[slot] = color;
+    table->indices[slot] = (uint8_t)table->count;
+    table->palette[table->count] = color;
+    return table->count++;
+}
+
+static inline int PSCLuma(uint32_t color) {
+    return (int)((((color >> 16) & 0xFF) * 77 + ((color >> 8) & 0xFF) * 150 + (color & 0xFF) * 29) >> 8);
+}
+
+// Draws image into a BGRA bitmap, so pixels can be read as 0xAARRGGBB.
+static CGContextRef PSCCreateBGRAContextWithImage(CGImageRef image) {
+    if (!image) return NULL;
+    size_t width = CGImageGetWidth(image), height = CGImageGetHeight(image);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) return NULL;
+    CGContextSetBlendMode(context, kCGBlendModeCopy);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), image);
+    return context;
+}
+
+// One pass over the bitmap: collects the palette until it overflows, and samples edges for the JPEG/PNG decision.
+static PSCCacheImageFormat PSCAnalyzeBitmap(CGContextRef context, PSCColorTable *table, CGFloat maximumJPEGEdgeRatio) {
+    size_t width = CGBitmapContextGetWidth(context), height = CGBitmapContextGetHeight(context), rowBytes = CGBitmapContextGetBytesPerRow(context);
+    const uint8_t *pixels = CGBitmapContextGetData(context);
+    if (!pixels || width == 0 || height == 0) return PSCCacheImageFormatUnknown;
+
+    BOOL fitsPalette = YES;
+    NSUInteger softCount = 0, hardCount = 0;
+    for (size_t y = 0; y < height; y++) {
+        const uint32_t *row = (const uint32_t *)(pixels + y * rowBytes);
+        uint32_t lastColor = row[0] + 1;
+        for (size_t x = 0; x < width && fitsPalette; x++) {
+            uint32_t color = row[x];
+            if (color == lastColor) continue;
+            lastColor = color;
+            fitsPalette = (color >> 24) == 0xFF && PSCColorTableIndex(table, color) >= 0;
+        }
+        if (y % kPSCEdgeSampleStep == 0) {
+            for (size_t x = 0; x + 1 < width; x += kPSCEdgeSampleStep) {
+                int contrast = abs(PSCLuma(row[x]) - PSCLuma(row[x + 1]));
+                if (contrast >= kPSCHardContrast) hardCount++;
+                else if (contrast >= kPSCFlatContrast) softCount++;
+            }
+        }
+    }
+    if (fitsPalette) return PSCCacheImageFormatPalette;
+
+    // Photos change gradually, text jumps from background to ink. Smooth gradients have no transitions at all.
+    NSUInteger transitionCount = softCount + hardCount;
+    return hardCount <= transitionCount * maximumJPEGEdgeRatio ? PSCCacheImageFormatJPEG : PSCCacheImageFormatPNG;
+}
+
+static void PSCAppendRun(NSMutableData *data, uint8_t index, uint64_t length) {
+    uint8_t bytes[11];
+    size_t count = 0;
+    bytes[count++] = index;
+    uint64_t value = length - 1;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        bytes[count++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    [data appendBytes:bytes length:count];
+}
+
+// Encodes the bitmap with the palette collected by PSCAnalyzeBitmap.
+static NSData *PSCPaletteDataFromBitmap(CGContextRef context, PSCColorTable *table) {
+    size_t width = CGBitmapContextGetWidth(context), height = CGBitmapContextGetHeight(context), rowBytes = CGBitmapContextGetBytesPerRow(context);
+    const uint8_t *pixels = CGBitmapContextGetData(context);
+    if (width > INT32_MAX || height > INT32_MAX) return nil;
+
+    NSMutableData *data = [NSMutableData dataWithCapacity:kPSCPaletteHeaderLength + table->count * 4 + width * height / 16];
+    uint8_t header[kPSCPaletteHeaderLength] = {0};
+    memcpy(header, PSCPaletteMagic, sizeof(PSCPaletteMagic));
+    header[4] = kPSCPaletteVersion;
+    OSWriteLittleInt32(header, 8, (uint32_t)width);
+    OSWriteLittleInt32(header, 12, (uint32_t)height);
+    OSWriteLittleInt16(header, 16, (uint16_t)table->count);
+    [data appendBytes:header length:sizeof(header)];
+    for (NSUInteger idx = 0; idx < table->count; idx++) {
+        uint8_t entry[4];
+        OSWriteLittleInt32(entry, 0, table->palette[idx]);
+        [data appendBytes:entry length:sizeof(entry)];
+    }
+
+    // Runs continue across rows; the last one is flushed after the loop.
+    NSInteger runIndex = -1, lastIndex = -1;
+    uint64_t runLength = 0;
+    uint32_t lastColor = 0;
+    for (size_t y = 0; y < height; y++) {
+        const uint32_t *row = (const uint32_t *)(pixels + y * rowBytes);
+        for (size_t x = 0; x < width; x++) {
+            uint32_t color = row[x];
+            if (color != lastColor || lastIndex < 0) {
+                lastColor = color;
+                lastIndex = PSCColorTableIndex(table, color);
+                if (lastIndex < 0) return nil;
+            }
+            if (lastIndex == runIndex) {
+                runLength++;
+                continue;
+            }
+            if (runLength > 0) PSCAppendRun(data, (uint8_t)runIndex, runLength);
+            runIndex = lastIndex;
+            runLength = 1;
+        }
+    }
+    if (runLength > 0) PSCAppendRun(data, (uint8_t)runIndex, runLength);
+    return data;
+}
+
+static void PSCWriteBMPHeader(uint8_t *header, uint32_t width, uint32_t height, uint32_t imageLength) {
+    header[0] = 'B';
+    header[1] = 'M';
+    OSWriteLittleInt32(header, 2, kPSCBMPHeaderLength + imageLength);
+    OSWriteLittleInt32(header, 10, kPSCBMPHeaderLength); // Pixel data offset.
+    OSWriteLittleInt32(header, 14, 40);                  // BITMAPINFOHEADER size.
+    OSWriteLittleInt32(header, 18, width);
+    OSWriteLittleInt32(header, 22, (uint32_t)-(int32_t)height); // Negative height: rows are stored top-down.
+    OSWriteLittleInt16(header, 26, 1);                   // Planes.
+    OSWriteLittleInt16(header, 28, 32);                  // BGRX, uncompressed.
+    OSWriteLittleInt32(header, 34, imageLength);
+    OSWriteLittleInt32(header, 38, 2835);                // 72 dpi.
+    OSWriteLittleInt32(header, 42, 2835);
+}
+
+@implementation PSCCacheCodec
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _maximumJPEGEdgeRatio = 0.2f;
+        _JPEGCompression = 0.9f;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: JPEG:%d PNG:%d palette:%d>", self.class, self, self.JPEGCount, self.PNGCount, self.paletteCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
++ (PSCCacheImageFormat)formatOfData:(NSData *)data {
+    if (data.length < 4) return PSCCacheImageFormatUnknown;
+
+    const uint8_t *bytes = data.bytes;
+    if (memcmp(bytes, PSCPaletteMagic, sizeof(PSCPaletteMagic)) == 0) return PSCCacheImageFormatPalette;
+    if (bytes[0] == 0x89 && bytes[1] == 'P' && bytes[2] == 'N' && bytes[3] == 'G') return PSCCacheImageFormatPNG;
+    if (bytes[0] == 0xFF && bytes[1] == 0xD8) return PSCCacheImageFormatJPEG;
+    return PSCCacheImageFormatUnknown;
+}
+
+- (PSCCacheImageFormat)formatForImage:(CGImageRef)image {
+    CGContextRef context = PSCCreateBGRAContextWithImage(image);
+    if (!context) return PSCCacheImageFormatUnknown;
+
+    PSCColorTable table = {{0}};
+    PSCCacheImageFormat format = PSCAnalyzeBitmap(context, &table, self.maximumJPEGEdgeRatio);
+    CGContextRelease(context);
+    return format;
+}
+
+- (NSData *)transcodeImageData:(NSData *)data {
+    // Only lossless input can become a palette, and re-encoding a JPEG would only add artifacts.
+    if ([self.class formatOfData:data] != PSCCacheImageFormatPNG) return data;
+
+    CGImageSourceRef imageSource = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+    CGImageRef image = imageSource ? CGImageSourceCreateImageAtIndex(imageSource, 0, NULL) : NULL;
+    CGContextRef context = PSCCreateBGRAContextWithImage(image);
+    NSData *transcodedData = nil;
+    if (context) {
+        PSCColorTable table = {{0}};
+        PSCCacheImageFormat format = PSCAnalyzeBitmap(context, &table, self.maximumJPEGEdgeRatio);
+        if (format == PSCCacheImageFormatPalette) {
+            transcodedData = PSCPaletteDataFromBitmap(context, &table);
+        }else if (format == PSCCacheImageFormatJPEG) {
+            transcodedData = UIImageJPEGRepresentation([UIImage imageWithCGImage:image], self.JPEGCompression);
+        }
+        CGContextRelease(context);
+    }
+    if (image) CGImageRelease(image);
+    if (imageSource) CFRelease(imageSource);
+
+    // A different format is only worth it if it doesn't grow the cache.
+    if (transcodedData.length >= data.length) transcodedData = nil;
+    switch ([self.class formatOfData:transcodedData ?: data]) {
+        case PSCCacheImageFormatJPEG:    @synchronized(self) { self.JPEGCount++; } break;
+        case PSCCacheImageFormatPalette: @synchronized(self) { self.paletteCount++; } break;
+        default:                         @synchronized(self) { self.PNGCount++; } break;
+    }
+    return transcodedData ?: data;
+}
+
+- (NSData *)decodableDataFromData:(NSData *)data {
+    if ([self.class formatOfData:data] != PSCCacheImageFormatPalette) return data;
+
+    const uint8_t *bytes = data.bytes, *end = bytes + data.length;
+    if (data.length < kPSCPaletteHeaderLength || bytes[4] != kPSCPaletteVersion) return nil;
+    uint32_t width = OSReadLittleInt32(bytes, 8), height = OSReadLittleInt32(bytes, 12);
+    NSUInteger colorCount = OSReadLittleInt16(bytes, 16);
+    uint64_t pixelCount = (uint64_t)width * height;
+    if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX || pixelCount * 4 > UINT32_MAX - kPSCBMPHeaderLength) return nil;
+    if (colorCount == 0 || colorCount > kPSCPaletteMaximumColorCount || data.length < kPSCPaletteHeaderLength + colorCount * 4) return nil;
+
+    NSMutableData *BMPData = [NSMutableData dataWithLength:kPSCBMPHeaderLength + (NSUInteger)pixelCount * 4];
+    if (!BMPData) return nil;
+    uint8_t *BMPBytes = BMPData.mutableBytes;
+    PSCWriteBMPHeader(BMPBytes, width, height, (uint32_t)pixelCount * 4);
+
+    // Expanding runs straight into the BMP pixels is the whole decode; ImageIO then only has to copy.
+    const uint8_t *palette = bytes + kPSCPaletteHeaderLength;
+    const uint8_t *cursor = palette + colorCount * 4;
+    uint8_t *pixels = BMPBytes + kPSCBMPHeaderLength;
+    uint64_t pixelIndex = 0;
+    while (pixelIndex < pixelCount) {
+        if (cursor >= end) return nil;
+        uint8_t index = *cursor++;
+        uint64_t runLength = 0;
+        unsigned int shift = 0;
+        uint8_t byte;
+        do {
+            if (cursor >= end || shift > 56) return nil;
+            byte = *cursor++;
+            runLength |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        runLength++;
+        if (index >= colorCount || runLength > pixelCount - pixelIndex) return nil;
+
+        const uint8_t color[4] = {palette[index * 4], palette[index * 4 + 1], palette[index * 4 + 2], 0xFF};
+        memset_pattern4(pixels + pixelIndex * 4, color, (size_t)runLength * 4);
+        pixelIndex += runLength;
+    }
+    return BMPData;
+}
+
+@end
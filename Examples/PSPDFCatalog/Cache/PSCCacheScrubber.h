@@ -0,0 +1,86 @@
+//
+//  PSCCacheScrubber.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Background maintenance for the PSPDFCache disk cache.
+
+ PSPDFDiskCache evicts while writing and never looks at old entries again. After crashes or app kills
+ the cache directory can contain truncated files, entries of outdated renders and pages of deleted documents.
+ The scrubber cleans up in one low-priority pass:
+ 1. Documents whose files no longer exist are removed from the cache (removeCacheForDocument:deleteDocument:error:).
+ 2. Entries not accessed within maximumEntryAge are removed.
+ 3. Entries whose render receipt doesn't match the current document (annotations, render options) are removed; the receipt is
+    built with PSCRenderReceiptForCacheEntry, like PSCCache and PSCPyramidCacher build it.
+ 4. Entries whose JPEG, PNG or palette file is missing or truncated are removed.
+ 5. If the cache uses more than targetDiskSpaceFraction of allowedDiskSpace, the least recently accessed entries are evicted.
+
+ All entries are removed through PSPDFCache and PSPDFDiskCache, never by deleting files, so the cache metadata and
+ usedDiskSpace stay in sync. The scrubber only sees the entries of `documents`; the disk cache can't be enumerated by UID.
+ Pass documents whose files might be gone as well, otherwise step 1 has nothing to do.
+ Work runs on a background priority queue (which also throttles its disk I/O), one page or file at a time,
+ and waits while PSPDFRenderQueue has jobs.
+ */
+@interface PSCCacheScrubber : NSObject
+
+/// Designated initializer.
+- (id)initWithCache:(PSPDFCache *)cache;
+
+/// Scrubbed cache.
+@property (nonatomic, strong, readonly) PSPDFCache *cache;
+
+/// Documents whose entries are verified and considered for eviction.
+@property (nonatomic, copy) NSArray *documents;
+
+/// Entries not accessed for longer are removed. 0 disables this. Defaults to 30 days.
+@property (nonatomic, assign) NSTimeInterval maximumEntryAge;
+
+/// Eviction frees disk space until usedDiskSpace is below this fraction of allowedDiskSpace. Defaults to 0.8.
+@property (nonatomic, assign) CGFloat targetDiskSpaceFraction;
+
+/// Compare render receipts with the current state of the documents. Defaults to YES.
+@property (nonatomic, assign) BOOL verifiesRenderReceipts;
+
+/// Files modified more recently might still be written and aren't checked for truncation. Defaults to 60 seconds.
+@property (nonatomic, assign) NSTimeInterval minimumFileAge;
+
+/// Pause after each page or file. Defaults to 0.01 seconds.
+@property (nonatomic, assign) NSTimeInterval throttleInterval;
+
+/// Starts scrubbing in the background. completionBlock is called on the main thread, also after cancel.
+- (void)startWithCompletionBlock:(void (^)(PSCCacheScrubber *scrubber))completionBlock;
+
+/// Stops after the current page or file.
+- (void)cancel;
+
+/// YES after cancel has been called.
+@property (atomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/// @name Statistics
+
+/// Documents that were removed because their files are gone.
+@property (atomic, assign, readonly) NSUInteger orphanedDocumentCount;
+
+/// Entries removed because of maximumEntryAge.
+@property (atomic, assign, readonly) NSUInteger expiredEntryCount;
+
+/// Entries removed because their render receipt is outdated.
+@property (atomic, assign, readonly) NSUInteger staleEntryCount;
+
+/// Entries evicted to get below targetDiskSpaceFraction.
+@property (atomic, assign, readonly) NSUInteger evictedEntryCount;
+
+/// Entries removed because their file is missing or truncated.
+@property (atomic, assign, readonly) NSUInteger truncatedEntryCount;
+
+@end
+
+@interface PSPDFCache (PSCCacheScrubber)
+
+/// Starts a PSCCacheScrubber with default settings for documents.
+- (PSCCacheScrubber *)scrubDiskCacheWithDocuments:(NSArray *)documents completionBlock:(void (^)(PSCCacheScrubber *scrubber))completionBlock;
+
+@end
@@ -0,0 +1,283 @@
+//
+//  PSCCacheScrubber.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCacheScrubber.h"
+#import "PSCCacheCodec.h"
+#import "PSCRenderFingerprint.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Polling interval while PSPDFRenderQueue is busy.
+#define kPSCRenderQueueBusyInterval 0.5
+
+// Entry collected for LRU eviction.
+@interface PSCCacheScrubberEntry : NSObject
+@property (nonatomic, copy) NSString *UID;
+@property (nonatomic, assign) NSUInteger page;
+@property (nonatomic, assign) CGSize size;
+@property (nonatomic, strong) NSDate *lastAccessTime;
+@property (nonatomic, assign) NSUInteger diskSize;
+@end
+
+@interface PSCCacheScrubber ()
+@property (atomic, assign, getter=isCancelled) BOOL cancelled;
+@property (atomic, assign) NSUInteger orphanedDocumentCount;
+@property (atomic, assign) NSUInteger expiredEntryCount;
+@property (atomic, assign) NSUInteger staleEntryCount;
+@property (atomic, assign) NSUInteger evictedEntryCount;
+@property (atomic, assign) NSUInteger truncatedEntryCount;
+@end
+
+@implementation PSCCacheScrubber
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithCache:(PSPDFCache *)cache {
+    if ((self = [super init])) {
+        _cache = cache;
+        _maximumEntryAge = 30 * 24 * 60 * 60;
+        _targetDiskSpaceFraction = 0.8f;
+        _verifiesRenderReceipts = YES;
+        _minimumFileAge = 60;
+        _throttleInterval = 0.01;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: documents:%d orphaned:%d expired:%d stale:%d truncated:%d evicted:%d>", self.class, self, self.documents.count, self.orphanedDocumentCount, self.expiredEntryCount, self.staleEntryCount, self.truncatedEntryCount, self.evictedEntryCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)startWithCompletionBlock:(void (^)(PSCCacheScrubber *scrubber))completionBlock {
+    NSArray *documents = self.documents;
+
+    // Background priority queues get throttled disk I/O, so rendering always wins.
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSMutableArray *entries = [NSMutableArray array];
+        for (PSPDFDocument *document in documents) {
+            if (self.isCancelled) break;
+            [self scrubDocument:document entries:entries];
+        }
+        if (!self.isCancelled) [self evictEntries:entries];
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            PSCLog(@"Cache scrubbing %@: %@", self.isCancelled ? @"cancelled" : @"finished", self);
+            if (completionBlock) completionBlock(self);
+        });
+    });
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Yields to rendering: waits while the render queue has work, then pauses briefly.
+- (void)throttle {
+    while (!self.isCancelled && PSPDFRenderQueue.sharedRenderQueue.numberOfQueuedJobs > 0) {
+        [NSThread sleepForTimeInterval:kPSCRenderQueueBusyInterval];
+    }
+    if (self.throttleInterval > 0) [NSThread sleepForTimeInterval:self.throttleInterval];
+}
+
+// Documents from NSData or data providers have no files and always exist.
+- (BOOL)documentExists:(PSPDFDocument *)document {
+    for (NSURL *fileURL in document.filesWithBasePath) {
+        if ([fileURL isFileURL] && ![[NSFileManager defaultManager] fileExistsAtPath:fileURL.path]) return NO;
+    }
+    return YES;
+}
+
+- (void)scrubDocument:(PSPDFDocument *)document entries:(NSMutableArray *)entries {
+    NSString *UID = document.UID;
+    if (!UID) return;
+
+    // Goes through PSPDFCache, so the memory cache, the metadata and usedDiskSpace stay in sync.
+    PSPDFDiskCache *diskCache = self.cache.diskCache;
+    if (![self documentExists:document]) {
+        NSError *error = nil;
+        if ([self.cache removeCacheForDocument:document deleteDocument:NO error:&error]) {
+            @synchronized(self) { self.orphanedDocumentCount++; }
+        }else {
+            PSCLog(@"Failed to remove cache of %@: %@", document.title, [error localizedDescription]);
+        }
+        return;
+    }
+
+    NSDate *expiryDate = self.maximumEntryAge > 0 ? [NSDate dateWithTimeIntervalSinceNow:-self.maximumEntryAge] : nil;
+    NSUInteger pageCount = document.pageCount;
+    for (NSUInteger page = 0; page < pageCount && !self.isCancelled; page++) {
+        [self throttle];
+        @autoreleasepool {
+            // Collect the entries of all sizes. Returning an empty array keeps them valid.
+            __block NSArray *cacheInfos = nil;
+            [diskCache invalidateAllImagesWithUID:UID andPage:page infoArraySelector:^NSArray *(NSOrderedSet *infos) {
+                cacheInfos = infos.array;
+                return @[];
+            }];
+            if (cacheInfos.count == 0) continue;
+
+            // Receipts are computed outside of the selector, they need the annotations of the page.
+            NSMutableSet *invalidSizes = [NSMutableSet set];
+            NSUInteger expiredCount = 0, staleCount = 0, truncatedCount = 0;
+            NSArray *annotations = nil;
+            for (PSPDFCacheInfo *cacheInfo in cacheInfos) {
+                if (expiryDate && cacheInfo.lastAccessTime && [cacheInfo.lastAccessTime compare:expiryDate] == NSOrderedAscending) {
+                    [invalidSizes addObject:NSStringFromCGSize(cacheInfo.size)];
+                    expiredCount++;
+                    continue;
+                }
+                // Same receipt as the actuality check and PSCPyramidCacher. Entries without one are left to PSPDFCache.
+                if (self.verifiesRenderReceipts && cacheInfo.renderReceipt.renderFingerprintString) {
+                    if (!annotations) annotations = [document annotationsForPage:page type:document.renderAnnotationTypes] ?: @[];
+                    if (!PSCCacheInfoIsCurrent(cacheInfo, document, page, annotations)) {
+                        [invalidSizes addObject:NSStringFromCGSize(cacheInfo.size)];
+                        staleCount++;
+                        continue;
+                    }
+                }
+                if (![self isIntactEntryWithUID:UID page:page size:cacheInfo.size]) {
+                    [invalidSizes addObject:NSStringFromCGSize(cacheInfo.size)];
+                    truncatedCount++;
+                    continue;
+                }
+
+                PSCCacheScrubberEntry *entry = [PSCCacheScrubberEntry new];
+                entry.UID = UID;
+                entry.page = page;
+                entry.size = cacheInfo.size;
+                entry.lastAccessTime = cacheInfo.lastAccessTime;
+                entry.diskSize = cacheInfo.diskSize;
+                [entries addObject:entry];
+            }
+            if (invalidSizes.count == 0) continue;
+
+            [diskCache invalidateAllImagesWithUID:UID andPage:page infoArraySelector:^NSArray *(NSOrderedSet *infos) {
+                NSMutableArray *invalidInfos = [NSMutableArray array];
+                for (PSPDFCacheInfo *info in infos) {
+                    if ([invalidSizes containsObject:NSStringFromCGSize(info.size)]) [invalidInfos addObject:info];
+                }
+                return invalidInfos;
+            }];
+            @synchronized(self) {
+                self.expiredEntryCount += expiredCount;
+                self.staleEntryCount += staleCount;
+                self.truncatedEntryCount += truncatedCount;
+            }
+        }
+    }
+}
+
+- (void)evictEntries:(NSMutableArray *)entries {
+    PSPDFDiskCache *diskCache = self.cache.diskCache;
+    unsigned long long targetDiskSpace = (unsigned long long)(diskCache.allowedDiskSpace * self.targetDiskSpaceFraction);
+    unsigned long long usedDiskSpace = diskCache.usedDiskSpace;
+    if (diskCache.allowedDiskSpace == 0 || usedDiskSpace <= targetDiskSpace) return;
+
+    // Least recently accessed first. Entries without an access time have never been loaded.
+    [entries sortUsingComparator:^NSComparisonResult(PSCCacheScrubberEntry *entry1, PSCCacheScrubberEntry *entry2) {
+        return [entry1.lastAccessTime ?: NSDate.distantPast compare:entry2.lastAccessTime ?: NSDate.distantPast];
+    }];
+
+    unsigned long long excessDiskSpace = usedDiskSpace - targetDiskSpace, freedDiskSpace = 0;
+    for (PSCCacheScrubberEntry *entry in entries) {
+        if (self.isCancelled || freedDiskSpace >= excessDiskSpace || diskCache.usedDiskSpace <= targetDiskSpace) break;
+        [self throttle];
+
+        // Entries that have been accessed since they were collected are kept.
+        __block NSUInteger evictedDiskSize = 0;
+        [diskCache invalidateAllImagesWithUID:entry.UID andPage:entry.page infoArraySelector:^NSArray *(NSOrderedSet *infos) {
+            for (PSPDFCacheInfo *info in infos) {
+                BOOL unchanged = info.lastAccessTime == entry.lastAccessTime || [info.lastAccessTime isEqualToDate:entry.lastAccessTime];
+                if (CGSizeEqualToSize(info.size, entry.size) && unchanged) {
+                    evictedDiskSize = MAX(info.diskSize, 1U);
+                    return @[info];
+                }
+            }
+            return @[];
+        }];
+        if (evictedDiskSize > 0) {
+            freedDiskSpace += evictedDiskSize;
+            @synchronized(self) { self.evictedEntryCount++; }
+        }
+    }
+}
+
+// The disk cache only hands out the file path to the decryption helper. The helper checks the file and returns nil,
+// so nothing is decoded. Missing files count as truncated; files that might still be written as intact.
+- (BOOL)isIntactEntryWithUID:(NSString *)UID page:(NSUInteger)page size:(CGSize)size {
+    NSDate *settledDate = [NSDate dateWithTimeIntervalSinceNow:-self.minimumFileAge];
+    __block BOOL intact = YES;
+    [self.cache.diskCache imageWithUID:UID andPage:page withSize:size infoSelector:^PSPDFCacheInfo *(NSOrderedSet *infos) {
+        for (PSPDFCacheInfo *info in infos) {
+            if (CGSizeEqualToSize(info.size, size)) return info;
+        }
+        return nil;
+    } decryptionHelper:^UIImage *(NSString *path) {
+        NSURL *fileURL = [NSURL fileURLWithPath:path];
+        NSDate *modificationDate = nil;
+        if (![fileURL getResourceValue:&modificationDate forKey:NSURLContentModificationDateKey error:NULL]) {
+            intact = NO;
+        }else if ([modificationDate compare:settledDate] == NSOrderedAscending) {
+            intact = [self isIntactFileAtURL:fileURL];
+        }
+        return nil;
+    } cacheInfo:NULL];
+    return intact;
+}
+
+// Checks the end marker of JPEG and PNG files and decodes palette files. Other formats (e.g. encrypted files) are kept.
+- (BOOL)isIntactFileAtURL:(NSURL *)fileURL {
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingFromURL:fileURL error:NULL];
+    if (!fileHandle) return NO;
+
+    NSData *head = [fileHandle readDataOfLength:4];
+    unsigned long long length = [fileHandle seekToEndOfFile];
+    PSCCacheImageFormat format = [PSCCacheCodec formatOfData:head];
+    BOOL intact = YES;
+    if (format == PSCCacheImageFormatJPEG || format == PSCCacheImageFormatPNG) {
+        // JPEG ends with the EOI marker, PNG with the IEND chunk (length, type, CRC).
+        NSUInteger trailerLength = format == PSCCacheImageFormatJPEG ? 2 : 12;
+        intact = length >= head.length + trailerLength;
+        if (intact) {
+            [fileHandle seekToFileOffset:length - trailerLength];
+            NSData *trailer = [fileHandle readDataOfLength:trailerLength];
+            const uint8_t *bytes = trailer.bytes;
+            if (trailer.length != trailerLength) intact = NO;
+            else if (format == PSCCacheImageFormatJPEG) intact = bytes[0] == 0xFF && bytes[1] == 0xD9;
+            else intact = memcmp(bytes + 4, "IEND", 4) == 0;
+        }
+    }else if (format == PSCCacheImageFormatPalette) {
+        NSData *data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:NULL];
+        intact = [[PSCCacheCodec new] decodableDataFromData:data] != nil;
+    }
+    [fileHandle closeFile];
+    return intact;
+}
+
+@end
+
+@implementation PSCCacheScrubberEntry @end
+
+@implementation PSPDFCache (PSCCacheScrubber)
+
+- (PSCCacheScrubber *)scrubDiskCacheWithDocuments:(NSArray *)documents completionBlock:(void (^)(PSCCacheScrubber *scrubber))completionBlock {
+    PSCCacheScrubber *scrubber = [[PSCCacheScrubber alloc] initWithCache:self];
+    scrubber.documents = documents;
+    [scrubber startWithCompletionBlock:completionBlock];
+    return scrubber;
+}
+
+@end
@@ -0,0 +1,62 @@
+//
+//  PSCCacheWarmer.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Renders the covers of many documents into the disk cache in one pass.
+
+ Requesting covers one by one via imageFromDocument:andPage:withSize:options: opens every document once per size,
+ and the render queue interleaves the requests so documents are opened and closed over and over.
+ The warmer opens each document once, renders page 0 at the largest requested size, derives the smaller sizes from it
+ (see PSCPyramidCacher), and closes the document again right away.
+ Documents whose covers are already on disk are skipped without being opened.
+ Covers are written through a PSCDiskCacheWriteQueue, so documents don't need a disk cache strategy that stores renders;
+ documents with PSPDFDiskCacheStrategyNothing are skipped. completionBlock is called once all covers are on disk.
+ At most maximumOpenDocumentCount documents are open at the same time.
+ */
+@interface PSCCacheWarmer : NSObject
+
+/// Designated initializer. sizes is an array of NSValue (CGSize).
+- (id)initWithCache:(PSPDFCache *)cache documents:(NSArray *)documents sizes:(NSArray *)sizes;
+
+/// The cache that is warmed up.
+@property (nonatomic, strong, readonly) PSPDFCache *cache;
+
+/// Documents, in the order they are processed.
+@property (nonatomic, copy, readonly) NSArray *documents;
+
+/// Cover sizes. (NSValue/CGSize)
+@property (nonatomic, copy, readonly) NSArray *sizes;
+
+/// Number of documents that may be open concurrently for rendering.
+/// Defaults to the number of CPU cores, but at most half of PSPDFGlobalLock's allowedOpenDocumentRequests.
+@property (nonatomic, assign) NSUInteger maximumOpenDocumentCount;
+
+/// Starts processing in the background. completionBlock is called on the main thread, also after cancel.
+- (void)startWithCompletionBlock:(void (^)(PSCCacheWarmer *warmer))completionBlock;
+
+/// Stops processing. Documents that are currently rendering are finished.
+- (void)cancel;
+
+/// YES after cancel has been called.
+@property (atomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/// @name Statistics
+
+/// Number of documents that have been opened and rendered.
+@property (atomic, assign, readonly) NSUInteger renderedDocumentCount;
+
+/// Number of documents that were skipped: all covers already cached, invalid, locked or PSPDFDiskCacheStrategyNothing.
+@property (atomic, assign, readonly) NSUInteger skippedDocumentCount;
+
+@end
+
+@interface PSPDFCache (PSCCacheWarmer)
+
+/// Convenience method that creates and starts a PSCCacheWarmer.
+- (PSCCacheWarmer *)warmCoversOfDocuments:(NSArray *)documents sizes:(NSArray *)sizes completionBlock:(void (^)(PSCCacheWarmer *warmer))completionBlock;
+
+@end
@@ -0,0 +1,141 @@
+//
+//  PSCCacheWarmer.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCacheWarmer.h"
+#import "PSCPyramidCacher.h"
+#import "PSCDiskCacheWriteQueue.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@interface PSCCacheWarmer () {
+    PSCDiskCacheWriteQueue *_writeQueue;
+}
+@property (atomic, assign, getter=isCancelled) BOOL cancelled;
+@property (atomic, assign) NSUInteger renderedDocumentCount;
+@property (atomic, assign) NSUInteger skippedDocumentCount;
+@end
+
+@implementation PSCCacheWarmer
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithCache:(PSPDFCache *)cache documents:(NSArray *)documents sizes:(NSArray *)sizes {
+    if ((self = [super init])) {
+        _cache = cache;
+        _documents = [documents copy];
+        _sizes = [sizes copy];
+        _writeQueue = [[PSCDiskCacheWriteQueue alloc] initWithCache:cache];
+        NSUInteger allowedOpenDocuments = MAX(PSPDFGlobalLock.sharedGlobalLock.allowedOpenDocumentRequests / 2, 1U);
+        _maximumOpenDocumentCount = MIN(NSProcessInfo.processInfo.activeProcessorCount, allowedOpenDocuments);
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: documents:%d rendered:%d skipped:%d>", self.class, self, self.documents.count, self.renderedDocumentCount, self.skippedDocumentCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)startWithCompletionBlock:(void (^)(PSCCacheWarmer *warmer))completionBlock {
+    dispatch_semaphore_t openDocumentSemaphore = dispatch_semaphore_create(MAX(self.maximumOpenDocumentCount, 1U));
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t renderQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
+
+    // The feeder blocks on the semaphore, so the documents are picked up in order.
+    dispatch_async(renderQueue, ^{
+        for (PSPDFDocument *document in self.documents) {
+            if (self.isCancelled) break;
+
+            NSArray *missingSizes = [self missingSizesForDocument:document];
+            if (missingSizes.count == 0) {
+                @synchronized(self) { self.skippedDocumentCount++; }
+                continue;
+            }
+
+            dispatch_semaphore_wait(openDocumentSemaphore, DISPATCH_TIME_FOREVER);
+            dispatch_group_async(group, renderQueue, ^{
+                @autoreleasepool {
+                    [self renderCoversOfDocument:document sizes:missingSizes];
+                }
+                dispatch_semaphore_signal(openDocumentSemaphore);
+            });
+        }
+
+        dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+            [_writeQueue flushWithCompletionBlock:^{
+                PSCLog(@"Cache warm-up finished: %@", self);
+                if (completionBlock) completionBlock(self);
+            }];
+#if !OS_OBJECT_USE_OBJC
+            dispatch_release(group);
+            dispatch_release(openDocumentSemaphore);
+#endif
+        });
+    });
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Cache status is looked up by UID, this doesn't open the document.
+- (NSArray *)missingSizesForDocument:(PSPDFDocument *)document {
+    NSMutableArray *missingSizes = [NSMutableArray array];
+    for (NSValue *sizeValue in self.sizes) {
+        if ([self.cache cacheStatusForImageFromDocument:document andPage:0 withSize:sizeValue.CGSizeValue options:PSPDFCacheOptionSizeRequireAboutExact] != PSPDFCacheStatusOnDisk) {
+            [missingSizes addObject:sizeValue];
+        }
+    }
+    return missingSizes;
+}
+
+- (void)renderCoversOfDocument:(PSPDFDocument *)document sizes:(NSArray *)sizes {
+    if (!document.isValid || document.isLocked || document.pageCount == 0) {
+        @synchronized(self) { self.skippedDocumentCount++; }
+        return;
+    }
+
+    // Respect documents that opted out of the disk cache.
+    if (document.diskCacheStrategy == PSPDFDiskCacheStrategyNothing) {
+        @synchronized(self) { self.skippedDocumentCount++; }
+        return;
+    }
+
+    // The largest size is rendered once while the document reference is open, smaller ones are downsampled from it.
+    NSError *error = nil;
+    // Covers are stored through the write queue, straight into the disk cache. The document's strategy is only read, never changed.
+    PSCPyramidCacher *pyramidCacher = [[PSCPyramidCacher alloc] initWithCache:self.cache document:document sizes:sizes];
+    pyramidCacher.writeQueue = _writeQueue;
+    if (![pyramidCacher cachePage:0 error:&error]) PSCLog(@"Failed to render cover of %@: %@", document.title, [error localizedDescription]);
+
+    @synchronized(self) { self.renderedDocumentCount++; }
+
+    // Close the document again; fails silently if it's being displayed or used elsewhere.
+    for (PSPDFDocumentProvider *documentProvider in document.documentProviders) {
+        [documentProvider flushDocumentReference];
+    }
+}
+
+@end
+
+@implementation PSPDFCache (PSCCacheWarmer)
+
+- (PSCCacheWarmer *)warmCoversOfDocuments:(NSArray *)documents sizes:(NSArray *)sizes completionBlock:(void (^)(PSCCacheWarmer *warmer))completionBlock {
+    PSCCacheWarmer *warmer = [[PSCCacheWarmer alloc] initWithCache:self documents:documents sizes:sizes];
+    [warmer startWithCompletionBlock:completionBlock];
+    return warmer;
+}
+
+@end
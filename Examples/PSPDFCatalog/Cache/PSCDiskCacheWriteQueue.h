@@ -0,0 +1,83 @@
+//
+//  PSCDiskCacheWriteQueue.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Write-behind stage in front of PSPDFDiskCache.
+
+ saveImage:fromDocument:andPage:withReceipt: encodes and writes every image as it arrives, on whatever
+ thread the framework picks. While a whole document is pre-cached, these flash writes compete with the reads
+ of page turns. The write queue instead:
+ - Collects images and encodes them in batches on one dedicated worker with background priority,
+   which also throttles its disk I/O.
+ - Coalesces writes: a newer image for the same page and size replaces one that's still pending,
+   so the disk cache updates its metadata once.
+ - Applies backpressure: above highWaterMark bytes of pending images, PSPDFCache's render queue requests are paused
+   (pauseCachingForService:) and waitForCapacity blocks producers, until the queue drained to lowWaterMark.
+
+ Images are encoded like PSPDFCache would (useJPGFormat, JPGFormatCompression) and passed through the cache's encryptDataBlock.
+ On a PSCCache that's the block wrapped by updateDiskCacheBlocks, so with adaptiveImageFormatEnabled queued entries are
+ transcoded by the PSCCacheCodec like PSPDFCache's own writes, before any custom encryption runs.
+ Entries are stored into the disk cache only, not the memory cache.
+ */
+@interface PSCDiskCacheWriteQueue : NSObject
+
+/// Designated initializer.
+- (id)initWithCache:(PSPDFCache *)cache;
+
+/// Target cache. Weak, the cache usually owns its write queue.
+@property (nonatomic, weak, readonly) PSPDFCache *cache;
+
+/// Maximum number of images encoded per batch. Defaults to 8.
+@property (atomic, assign) NSUInteger batchSize;
+
+/// How long an incomplete batch waits for more images. Defaults to 0.25 seconds.
+@property (atomic, assign) NSTimeInterval batchInterval;
+
+/// Pending bytes (decoded images) above which producers are throttled. Defaults to 32MB.
+@property (atomic, assign) NSUInteger highWaterMark;
+
+/// Pending bytes below which throttling ends. Defaults to 16MB.
+@property (atomic, assign) NSUInteger lowWaterMark;
+
+/// Queues image for writing. Thread safe.
+- (void)enqueueImage:(UIImage *)image fromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withReceipt:(PSPDFRenderReceipt *)renderReceipt;
+
+/// Blocks the calling thread while the queue is above highWaterMark. Don't call this on the main thread.
+- (void)waitForCapacity;
+
+/// Drops pending writes of document. Use NSNotFound as a wildcard for all pages.
+- (void)cancelWritesForDocument:(PSPDFDocument *)document page:(NSUInteger)page;
+
+/// Drops all pending writes.
+- (void)cancelAllWrites;
+
+/// Writes everything that is pending now, then calls completionBlock on the main thread.
+- (void)flushWithCompletionBlock:(void (^)(void))completionBlock;
+
+/// @name State
+
+/// Number of images waiting to be written.
+@property (atomic, assign, readonly) NSUInteger pendingCount;
+
+/// Decoded size of the images waiting to be written.
+@property (atomic, assign, readonly) NSUInteger pendingBytes;
+
+/// YES while backpressure is applied.
+@property (atomic, assign, readonly, getter=isThrottling) BOOL throttling;
+
+/// @name Statistics
+
+/// Images handed to the disk cache.
+@property (atomic, assign, readonly) NSUInteger writtenImageCount;
+
+/// Images that were replaced by a newer one before being written.
+@property (atomic, assign, readonly) NSUInteger coalescedImageCount;
+
+/// Number of batches.
+@property (atomic, assign, readonly) NSUInteger batchCount;
+
+@end
@@ -0,0 +1,255 @@
+//
+//  PSCDiskCacheWriteQueue.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCDiskCacheWriteQueue.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// One queued image.
+@interface PSCDiskCacheWrite : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) UIImage *image;
+@property (nonatomic, strong) PSPDFDocument *document;
+@property (nonatomic, assign) NSUInteger page;
+@property (nonatomic, strong) PSPDFRenderReceipt *renderReceipt;
+@property (nonatomic, assign) NSUInteger bytes;
+@property (atomic, assign, getter=isCancelled) BOOL cancelled;
+@end
+
+@interface PSCDiskCacheWriteQueue () {
+    NSCondition *_condition;                 // Guards the writes below; broadcast when pendingBytes shrinks.
+    NSMutableArray *_pendingWrites;          // PSCDiskCacheWrite, oldest first.
+    NSMutableDictionary *_pendingWritesByKey;
+    NSArray *_inFlightWrites;                // Batch that is being encoded.
+    dispatch_queue_t _workerQueue;
+    BOOL _drainScheduled;
+    BOOL _immediateDrainScheduled;
+}
+@property (atomic, assign) NSUInteger pendingCount;
+@property (atomic, assign) NSUInteger pendingBytes;
+@property (atomic, assign, getter=isThrottling) BOOL throttling;
+@property (atomic, assign) NSUInteger writtenImageCount;
+@property (atomic, assign) NSUInteger coalescedImageCount;
+@property (atomic, assign) NSUInteger batchCount;
+@end
+
+@implementation PSCDiskCacheWriteQueue
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithCache:(PSPDFCache *)cache {
+    if ((self = [super init])) {
+        _cache = cache;
+        _batchSize = 8;
+        _batchInterval = 0.25;
+        _highWaterMark = 32 * 1024 * 1024;
+        _lowWaterMark = 16 * 1024 * 1024;
+        _condition = [NSCondition new];
+        _pendingWrites = [NSMutableArray array];
+        _pendingWritesByKey = [NSMutableDictionary dictionary];
+
+        // Background priority queues get throttled disk I/O, so page turns read first.
+        _workerQueue = pspdf_dispatch_queue_create("com.pspdfkit.catalog.cache.write", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(_workerQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_throttling) [_cache resumeCachingForService:self.class];
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_workerQueue);
+#endif
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: pending:%d (%d bytes) written:%d coalesced:%d batches:%d throttling:%d>", self.class, self, self.pendingCount, self.pendingBytes, self.writtenImageCount, self.coalescedImageCount, self.batchCount, self.isThrottling];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)enqueueImage:(UIImage *)image fromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withReceipt:(PSPDFRenderReceipt *)renderReceipt {
+    if (!image.CGImage || !document.UID) return;
+
+    PSCDiskCacheWrite *write = [PSCDiskCacheWrite new];
+    write.key = [NSString stringWithFormat:@"%@_%d_%@", document.UID, page, NSStringFromCGSize(image.size)];
+    write.image = image;
+    write.document = document;
+    write.page = page;
+    write.renderReceipt = renderReceipt;
+    write.bytes = CGImageGetBytesPerRow(image.CGImage) * CGImageGetHeight(image.CGImage);
+
+    [_condition lock];
+    PSCDiskCacheWrite *pendingWrite = _pendingWritesByKey[write.key];
+    if (pendingWrite) {
+        // The older image was never written; only the newer one will be.
+        [_pendingWrites removeObjectIdenticalTo:pendingWrite];
+        self.pendingBytes -= pendingWrite.bytes;
+        self.pendingCount--;
+        self.coalescedImageCount++;
+    }
+    [_pendingWrites addObject:write];
+    _pendingWritesByKey[write.key] = write;
+    self.pendingBytes += write.bytes;
+    self.pendingCount++;
+    [self updateThrottling];
+    [self scheduleDrain];
+    [_condition unlock];
+}
+
+- (void)waitForCapacity {
+    NSAssert(![NSThread isMainThread], @"Waiting on the main thread would block the UI.");
+    [_condition lock];
+    while (self.isThrottling) [_condition wait];
+    [_condition unlock];
+}
+
+- (void)cancelWritesForDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    NSString *UID = document.UID;
+    if (!UID) return;
+
+    [self cancelWritesPassingTest:^BOOL(PSCDiskCacheWrite *write) {
+        return [write.document.UID isEqualToString:UID] && (page == NSNotFound || write.page == page);
+    }];
+}
+
+- (void)cancelAllWrites {
+    [self cancelWritesPassingTest:^BOOL(PSCDiskCacheWrite *write) { return YES; }];
+}
+
+- (void)flushWithCompletionBlock:(void (^)(void))completionBlock {
+    dispatch_async(_workerQueue, ^{
+        NSUInteger remainingCount;
+        do {
+            [self drainBatch];
+            [_condition lock];
+            remainingCount = _pendingWrites.count;
+            [_condition unlock];
+        } while (remainingCount > 0);
+        if (completionBlock) dispatch_async(dispatch_get_main_queue(), completionBlock);
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)cancelWritesPassingTest:(BOOL (^)(PSCDiskCacheWrite *write))test {
+    [_condition lock];
+    for (PSCDiskCacheWrite *write in [_pendingWrites copy]) {
+        if (test(write)) {
+            [_pendingWrites removeObjectIdenticalTo:write];
+            [_pendingWritesByKey removeObjectForKey:write.key];
+            self.pendingBytes -= write.bytes;
+            self.pendingCount--;
+        }
+    }
+    // Writes of the current batch are accounted for when the batch finishes.
+    for (PSCDiskCacheWrite *write in _inFlightWrites) {
+        if (test(write)) write.cancelled = YES;
+    }
+    [self updateThrottling];
+    [_condition broadcast];
+    [_condition unlock];
+}
+
+// Called with the lock held. A complete batch is drained right away, an incomplete one after batchInterval.
+- (void)scheduleDrain {
+    if (_pendingWrites.count == 0) return;
+    BOOL batchComplete = _pendingWrites.count >= MAX(self.batchSize, 1U);
+    if (_immediateDrainScheduled || (_drainScheduled && !batchComplete)) return;
+
+    _drainScheduled = YES;
+    _immediateDrainScheduled = batchComplete;
+    dispatch_time_t drainTime = batchComplete ? DISPATCH_TIME_NOW : dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.batchInterval * NSEC_PER_SEC));
+    dispatch_after(drainTime, _workerQueue, ^{
+        [self drainBatch];
+    });
+}
+
+// Called with the lock held. Pause and resume are balanced and happen in order on the main thread.
+- (void)updateThrottling {
+    if (!self.isThrottling && self.pendingBytes > self.highWaterMark) {
+        self.throttling = YES;
+        PSCLog(@"Disk cache writer fell behind, pausing caching: %@", self);
+        dispatch_async(dispatch_get_main_queue(), ^{ [self.cache pauseCachingForService:self.class]; });
+    }else if (self.isThrottling && self.pendingBytes <= self.lowWaterMark) {
+        self.throttling = NO;
+        dispatch_async(dispatch_get_main_queue(), ^{ [self.cache resumeCachingForService:self.class]; });
+    }
+}
+
+// Runs on the worker queue.
+- (void)drainBatch {
+    [_condition lock];
+    _drainScheduled = NO;
+    _immediateDrainScheduled = NO;
+    NSRange batchRange = NSMakeRange(0, MIN(_pendingWrites.count, MAX(self.batchSize, 1U)));
+    NSArray *batch = [_pendingWrites subarrayWithRange:batchRange];
+    [_pendingWrites removeObjectsInRange:batchRange];
+    for (PSCDiskCacheWrite *write in batch) {
+        if (_pendingWritesByKey[write.key] == write) [_pendingWritesByKey removeObjectForKey:write.key];
+    }
+    _inFlightWrites = batch;
+    [_condition unlock];
+    if (batch.count == 0) return;
+
+    // Encode the whole batch first, then hand it to the disk cache in one go.
+    NSMutableArray *encodedData = [NSMutableArray arrayWithCapacity:batch.count];
+    for (PSCDiskCacheWrite *write in batch) {
+        @autoreleasepool {
+            NSData *data = write.isCancelled ? nil : [self encodedDataForWrite:write];
+            [encodedData addObject:data ?: [NSNull null]];
+        }
+    }
+    NSUInteger writtenCount = 0, batchBytes = 0;
+    PSPDFDiskCache *diskCache = self.cache.diskCache;
+    for (NSUInteger idx = 0; idx < batch.count; idx++) {
+        PSCDiskCacheWrite *write = batch[idx];
+        NSData *data = encodedData[idx];
+        batchBytes += write.bytes;
+        if (write.isCancelled || data == (id)[NSNull null]) continue;
+
+        [diskCache storeImage:write.image withUID:write.document.UID andPage:write.page encryptionHelper:^NSData *(UIImage *image) {
+            return data;
+        } withReceipt:write.renderReceipt];
+        writtenCount++;
+    }
+
+    [_condition lock];
+    _inFlightWrites = nil;
+    self.pendingCount -= batch.count;
+    self.pendingBytes -= batchBytes;
+    self.writtenImageCount += writtenCount;
+    self.batchCount++;
+    [self updateThrottling];
+    [_condition broadcast];
+    [self scheduleDrain];
+    [_condition unlock];
+}
+
+// Same encoding as PSPDFCache, including the encryption hook. nil on failure; a failed encryption leaves the data empty.
+// PSCCache's encryptDataBlock getter returns the codec-wrapped block, so the PNG data (useJPGFormat is off with the
+// adaptive format) is transcoded there first, then handed to the custom encryptDataBlock.
+- (NSData *)encodedDataForWrite:(PSCDiskCacheWrite *)write {
+    PSPDFCache *cache = self.cache;
+    NSData *data = cache.useJPGFormat ? UIImageJPEGRepresentation(write.image, cache.JPGFormatCompression) : UIImagePNGRepresentation(write.image);
+    void (^encryptDataBlock)(PSPDFDocument *, NSMutableData *) = cache.encryptDataBlock;
+    if (data && encryptDataBlock) {
+        NSMutableData *mutableData = [data mutableCopy];
+        encryptDataBlock(write.document, mutableData);
+        data = mutableData;
+    }
+    return data.length > 0 ? data : nil;
+}
+
+@end
+
+@implementation PSCDiskCacheWrite @end
@@ -0,0 +1,55 @@
+//
+//  PSCDocumentReferencePool.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ LRU pool for open CGPDFDocument references, with a memory estimate per reference.
+
+ PSPDFGlobalLock only limits the *number* of open providers and closes them without knowing which are in use.
+ The pool keeps an estimated cost for every open reference (xref table and parsed pages) and, when over budget, closes
+ the references that are cheapest to lose: idle the longest, large, and quick to reopen.
+ References of documents that are displayed in a PSPDFViewController and references that are currently in use are never closed.
+
+ Only providers of class PSCPooledDocumentProvider are tracked:
+ [document overrideClass:PSPDFDocumentProvider.class withClass:PSCPooledDocumentProvider.class];
+ Raise PSPDFGlobalLock's allowedOpenDocumentRequests above maximumOpenDocumentCount so the pool decides what is closed.
+ */
+@interface PSCDocumentReferencePool : NSObject
+
+/// Shared pool.
++ (instancetype)sharedPool;
+
+/// Estimated memory of all open references is kept below this. Defaults to 1/16 of the physical memory, at most 64MB.
+@property (atomic, assign) unsigned long long memoryBudget;
+
+/// Maximum number of open references. Defaults to PSPDFGlobalLock's allowedOpenDocumentRequests.
+@property (atomic, assign) NSUInteger maximumOpenDocumentCount;
+
+/// Closes references until the pool is within budget. Called automatically.
+- (void)trim;
+
+/// Adds overrideClass for PSCPooledDocumentProvider. Needs to be called before the document is first used.
+- (void)registerDocument:(PSPDFDocument *)document;
+
+/// @name Statistics
+
+/// Number of currently open references.
+@property (atomic, assign, readonly) NSUInteger openDocumentCount;
+
+/// Estimated memory of all open references.
+@property (atomic, assign, readonly) unsigned long long totalCost;
+
+/// Number of references that had to be opened again after they were closed.
+@property (atomic, assign, readonly) NSUInteger reopenCount;
+
+/// Time spent reopening references.
+@property (atomic, assign, readonly) NSTimeInterval totalReopenDuration;
+
+@end
+
+/// Document provider that reports usage of its document reference to PSCDocumentReferencePool.
+@interface PSCPooledDocumentProvider : PSPDFDocumentProvider
+@end
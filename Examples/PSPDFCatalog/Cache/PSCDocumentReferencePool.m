@@ -0,0 +1,273 @@
+//
+//  PSCDocumentReferencePool.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCDocumentReferencePool.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Rough cost estimate: CGPDF keeps the xref table (~20 bytes per object, objects average about 1KB)
+// and the parsed dictionaries and resources of every page that has been accessed.
+#define kPSCDocumentReferenceBaseCost (64 * 1024)
+#define kPSCDocumentReferenceXRefRatio 50
+#define kPSCDocumentReferencePageCost (16 * 1024)
+
+@interface PSCDocumentReferenceEntry : NSObject
+@property (nonatomic, weak) PSPDFDocumentProvider *documentProvider;
+@property (nonatomic, assign) BOOL open;
+@property (nonatomic, assign) BOOL wasClosed;
+@property (nonatomic, assign) NSUInteger activeRequestCount;
+@property (nonatomic, assign) unsigned long long fileSize;
+@property (nonatomic, strong) NSMutableIndexSet *accessedPages;
+@property (nonatomic, assign) CFAbsoluteTime lastAccessTime;
+@property (nonatomic, assign) NSTimeInterval openDuration;
+@end
+
+@implementation PSCDocumentReferenceEntry
+
+- (unsigned long long)cost {
+    return self.open ? kPSCDocumentReferenceBaseCost + self.fileSize / kPSCDocumentReferenceXRefRatio + [self.accessedPages count] * kPSCDocumentReferencePageCost : 0;
+}
+
+// Higher is closed first. Idle time and memory count for closing, the time it takes to reopen against it.
+- (double)evictionPriorityAtTime:(CFAbsoluteTime)now {
+    return (now - self.lastAccessTime) * [self cost] / MAX(self.openDuration, 0.001);
+}
+
+@end
+
+// Called by PSCPooledDocumentProvider.
+@interface PSCDocumentReferencePool (PSCDocumentProviderCallbacks)
+- (void)documentProvider:(PSPDFDocumentProvider *)documentProvider didRequestDocumentRefWithDuration:(NSTimeInterval)duration;
+- (void)documentProviderDidReleaseDocumentRef:(PSPDFDocumentProvider *)documentProvider;
+- (void)documentProvider:(PSPDFDocumentProvider *)documentProvider didAccessPage:(NSUInteger)page;
+- (void)documentProviderDidCloseDocumentRef:(PSPDFDocumentProvider *)documentProvider;
+- (void)removeDocumentProvider:(PSPDFDocumentProvider *)documentProvider;
+@end
+
+@interface PSCDocumentReferencePool () {
+    NSMutableDictionary *_entries; // NSValue (provider pointer) -> PSCDocumentReferenceEntry
+    BOOL _trimming;
+}
+@property (atomic, assign) NSUInteger reopenCount;
+@property (atomic, assign) NSTimeInterval totalReopenDuration;
+@end
+
+@implementation PSCDocumentReferencePool
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
++ (instancetype)sharedPool {
+    static PSCDocumentReferencePool *_sharedPool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedPool = [self new];
+    });
+    return _sharedPool;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _entries = [NSMutableDictionary new];
+        _memoryBudget = MIN(NSProcessInfo.processInfo.physicalMemory / 16, 64 * 1024 * 1024);
+        _maximumOpenDocumentCount = PSPDFGlobalLock.sharedGlobalLock.allowedOpenDocumentRequests;
+        [NSNotificationCenter.defaultCenter addObserver:self selector:@selector(didReceiveMemoryWarning) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [NSNotificationCenter.defaultCenter removeObserver:self];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)registerDocument:(PSPDFDocument *)document {
+    [document overrideClass:PSPDFDocumentProvider.class withClass:PSCPooledDocumentProvider.class];
+}
+
+- (void)trim {
+    [self trimToMemoryBudget:self.memoryBudget documentCount:self.maximumOpenDocumentCount];
+}
+
+- (NSUInteger)openDocumentCount {
+    @synchronized(self) {
+        return [[_entries.allValues filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"open == YES"]] count];
+    }
+}
+
+- (unsigned long long)totalCost {
+    @synchronized(self) {
+        unsigned long long totalCost = 0;
+        for (PSCDocumentReferenceEntry *entry in _entries.allValues) totalCost += [entry cost];
+        return totalCost;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Provider Callbacks
+
+- (PSCDocumentReferenceEntry *)entryForDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    NSValue *key = [NSValue valueWithPointer:(__bridge void *)documentProvider];
+    PSCDocumentReferenceEntry *entry = _entries[key];
+    if (!entry) {
+        entry = [PSCDocumentReferenceEntry new];
+        entry.documentProvider = documentProvider;
+        entry.fileSize = [documentProvider fileSize];
+        entry.accessedPages = [NSMutableIndexSet indexSet];
+        _entries[key] = entry;
+    }
+    return entry;
+}
+
+- (void)documentProvider:(PSPDFDocumentProvider *)documentProvider didRequestDocumentRefWithDuration:(NSTimeInterval)duration {
+    BOOL didOpen = NO;
+    @synchronized(self) {
+        PSCDocumentReferenceEntry *entry = [self entryForDocumentProvider:documentProvider];
+        entry.activeRequestCount++;
+        entry.lastAccessTime = CFAbsoluteTimeGetCurrent();
+        if (!entry.open) {
+            entry.open = YES;
+            entry.openDuration = duration;
+            didOpen = YES;
+            if (entry.wasClosed) {
+                self.reopenCount++;
+                self.totalReopenDuration += duration;
+            }
+        }
+    }
+    if (didOpen) [self trim];
+}
+
+- (void)documentProviderDidReleaseDocumentRef:(PSPDFDocumentProvider *)documentProvider {
+    BOOL idle = NO;
+    @synchronized(self) {
+        PSCDocumentReferenceEntry *entry = [self entryForDocumentProvider:documentProvider];
+        if (entry.activeRequestCount > 0) entry.activeRequestCount--;
+        idle = entry.activeRequestCount == 0;
+    }
+    // A close might have been skipped earlier because the reference was busy.
+    if (idle) [self trim];
+}
+
+- (void)documentProvider:(PSPDFDocumentProvider *)documentProvider didAccessPage:(NSUInteger)page {
+    @synchronized(self) {
+        PSCDocumentReferenceEntry *entry = [self entryForDocumentProvider:documentProvider];
+        [entry.accessedPages addIndex:page];
+        entry.lastAccessTime = CFAbsoluteTimeGetCurrent();
+    }
+}
+
+- (void)documentProviderDidCloseDocumentRef:(PSPDFDocumentProvider *)documentProvider {
+    @synchronized(self) {
+        PSCDocumentReferenceEntry *entry = [self entryForDocumentProvider:documentProvider];
+        if (entry.open) entry.wasClosed = YES;
+        entry.open = NO;
+        entry.activeRequestCount = 0;
+        [entry.accessedPages removeAllIndexes];
+    }
+}
+
+- (void)removeDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    @synchronized(self) {
+        [_entries removeObjectForKey:[NSValue valueWithPointer:(__bridge void *)documentProvider]];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)trimToMemoryBudget:(unsigned long long)memoryBudget documentCount:(NSUInteger)documentCount {
+    NSMutableArray *candidates = [NSMutableArray array];
+    unsigned long long totalCost = 0;
+    NSUInteger openCount = 0;
+
+    @synchronized(self) {
+        if (_trimming) return;
+
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        for (PSCDocumentReferenceEntry *entry in _entries.allValues) {
+            if (!entry.open) continue;
+            totalCost += [entry cost];
+            openCount++;
+
+            // Never close what's on screen or currently in use; flushDocumentReference would fail anyway.
+            PSPDFDocumentProvider *documentProvider = entry.documentProvider;
+            if (!documentProvider || entry.activeRequestCount > 0 || documentProvider.document.displayingPdfController) continue;
+            [candidates addObject:entry];
+        }
+        if (totalCost <= memoryBudget && openCount <= documentCount) return;
+
+        [candidates sortUsingComparator:^NSComparisonResult(PSCDocumentReferenceEntry *entry1, PSCDocumentReferenceEntry *entry2) {
+            return [@([entry2 evictionPriorityAtTime:now]) compare:@([entry1 evictionPriorityAtTime:now])];
+        }];
+        _trimming = YES;
+    }
+
+    // Outside the lock; flushing calls back into the pool.
+    for (PSCDocumentReferenceEntry *entry in candidates) {
+        if (totalCost <= memoryBudget && openCount <= documentCount) break;
+
+        unsigned long long cost = [entry cost];
+        PSPDFDocumentProvider *documentProvider = entry.documentProvider;
+        if ([documentProvider flushDocumentReference]) {
+            totalCost -= MIN(cost, totalCost);
+            openCount--;
+        }
+    }
+
+    @synchronized(self) {
+        _trimming = NO;
+    }
+}
+
+- (void)didReceiveMemoryWarning {
+    [self trimToMemoryBudget:self.memoryBudget / 2 documentCount:self.maximumOpenDocumentCount / 2];
+}
+
+@end
+
+@implementation PSCPooledDocumentProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (void)dealloc {
+    [PSCDocumentReferencePool.sharedPool removeDocumentProvider:self];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDocumentProvider
+
+- (CGPDFDocumentRef)requestDocumentRefWithOwner:(id)owner {
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    CGPDFDocumentRef documentRef = [super requestDocumentRefWithOwner:owner];
+    if (documentRef) [PSCDocumentReferencePool.sharedPool documentProvider:self didRequestDocumentRefWithDuration:CFAbsoluteTimeGetCurrent() - startTime];
+    return documentRef;
+}
+
+- (void)releaseDocumentRef:(CGPDFDocumentRef)documentRef withOwner:(id)owner {
+    [super releaseDocumentRef:documentRef withOwner:owner];
+    if (documentRef) [PSCDocumentReferencePool.sharedPool documentProviderDidReleaseDocumentRef:self];
+}
+
+- (CGPDFPageRef)requestPageRefForPageNumber:(NSUInteger)page error:(NSError **)error {
+    CGPDFPageRef pageRef = [super requestPageRefForPageNumber:page error:error];
+    if (pageRef) [PSCDocumentReferencePool.sharedPool documentProvider:self didAccessPage:page];
+    return pageRef;
+}
+
+- (BOOL)flushDocumentReference {
+    BOOL flushed = [super flushDocumentReference];
+    if (flushed) [PSCDocumentReferencePool.sharedPool documentProviderDidCloseDocumentRef:self];
+    return flushed;
+}
+
+@end
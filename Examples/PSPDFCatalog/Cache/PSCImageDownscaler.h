@@ -0,0 +1,51 @@
+//
+//  PSCImageDownscaler.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <Accelerate/Accelerate.h>
+
+typedef NS_ENUM(NSUInteger, PSCImageDownscalerQuality) {
+    PSCImageDownscalerQualityDefault = 0, // vImage's default resampling for the remainder.
+    PSCImageDownscalerQualityHigh    = 1  // Lanczos resampling for the remainder. Slower, sharper text.
+};
+
+/**
+ Downscales BGRA bitmaps on the CPU, without Core Graphics interpolation.
+
+ PSPDFCacheOptionSizeAllowLargerScaleSync/Async and pspdf_resizedImageWithContentMode:... scale with CGContextDrawImage
+ and kPSPDFInterpolationQuality, which gets slow when a full page image is reduced to a thumbnail.
+ The downscaler first halves the bitmap with a 2x2 box filter (NEON on the device, 16 bytes per step) for as long as it's
+ still at least twice the target size, then resamples the remaining less-than-2x step with vImage.
+ Bitmaps are 32 bit BGRA (kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little), the layout PSPDFKit renders into.
+ */
+@interface PSCImageDownscaler : NSObject
+
+/// Scales source into destination; both need to be allocated. Returns NO if destination is larger than source or vImage fails.
++ (BOOL)scaleBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination quality:(PSCImageDownscalerQuality)quality;
+
+/// One mipmap step: averages 2x2 pixel blocks of source into destination, which needs to be (width/2)x(height/2). An odd last row or column is dropped.
++ (void)halveBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination;
+
+/// Returns image scaled to size (in points, same scale as image). Returns image itself if it isn't larger than size, nil on failure.
++ (UIImage *)imageByScalingImage:(UIImage *)image toSize:(CGSize)size quality:(PSCImageDownscalerQuality)quality;
+
+@end
+
+@interface PSCImageDownscaler (Testing)
+
+/// halveBGRABuffer:toBuffer: without NEON and on the calling thread. Reference for PSCImageDownscalerTest.
++ (void)scalarHalveBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination;
+
+@end
+
+@interface PSPDFCache (PSCImageDownscaler)
+
+/// Replacement for PSPDFCacheOptionSizeAllowLargerScaleSync: loads the nearest larger image of page from memory or disk
+/// and aspect-fits it into size with PSCImageDownscaler. Never renders; nil if no larger image is cached.
+/// Loading is synchronous, call this from a background queue.
+- (UIImage *)downscaledImageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withSize:(CGSize)size;
+
+@end
@@ -0,0 +1,187 @@
+//
+//  PSCImageDownscaler.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCImageDownscaler.h"
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Below this many destination pixels, splitting a mipmap step across cores costs more than it saves.
+#define kPSCParallelHalvingPixelCount (256 * 256)
+
+static CGContextRef PSCCreateBGRAContext(size_t width, size_t height) {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    return context;
+}
+
+// Fits size into boundingSize, never upscales.
+static CGSize PSCAspectFitSize(CGSize size, CGSize boundingSize) {
+    CGFloat scale = MIN(MIN(boundingSize.width / size.width, boundingSize.height / size.height), 1.f);
+    return CGSizeMake(roundf(size.width * scale), roundf(size.height * scale));
+}
+
+// Averages rows [firstRow, firstRow + rowCount) of destination from the 2x2 blocks of source, rounding to nearest.
+// Without vectorized, only the portable loop runs; both produce identical output.
+static void PSCHalveRows(const vImage_Buffer *source, const vImage_Buffer *destination, size_t firstRow, size_t rowCount, BOOL vectorized) {
+    size_t width = destination->width;
+    for (size_t y = firstRow; y < firstRow + rowCount; y++) {
+        const uint8_t *top = (const uint8_t *)source->data + 2 * y * source->rowBytes;
+        const uint8_t *bottom = top + source->rowBytes;
+        uint8_t *output = (uint8_t *)destination->data + y * destination->rowBytes;
+        size_t x = 0;
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+        // 8 source pixels per row make 4 destination pixels. vld2 splits them into even and odd pixels,
+        // so adding the two halves sums horizontal neighbours channel by channel.
+        for (; vectorized && x + 4 <= width; x += 4) {
+            uint32x4x2_t topPixels = vld2q_u32((const uint32_t *)(top + x * 8));
+            uint32x4x2_t bottomPixels = vld2q_u32((const uint32_t *)(bottom + x * 8));
+            uint8x16_t top0 = vreinterpretq_u8_u32(topPixels.val[0]), top1 = vreinterpretq_u8_u32(topPixels.val[1]);
+            uint8x16_t bottom0 = vreinterpretq_u8_u32(bottomPixels.val[0]), bottom1 = vreinterpretq_u8_u32(bottomPixels.val[1]);
+            uint16x8_t low = vaddw_u8(vaddw_u8(vaddl_u8(vget_low_u8(top0), vget_low_u8(top1)), vget_low_u8(bottom0)), vget_low_u8(bottom1));
+            uint16x8_t high = vaddw_u8(vaddw_u8(vaddl_u8(vget_high_u8(top0), vget_high_u8(top1)), vget_high_u8(bottom0)), vget_high_u8(bottom1));
+            vst1q_u8(output + x * 4, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+        }
+#endif
+        for (; x < width; x++) {
+            for (size_t channel = 0; channel < 4; channel++) {
+                output[x * 4 + channel] = (uint8_t)((top[x * 8 + channel] + top[x * 8 + 4 + channel] + bottom[x * 8 + channel] + bottom[x * 8 + 4 + channel] + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Scales sourceRect (pixels, top-left origin) of image to pixelSize. Only for images in UIImageOrientationUp.
+static UIImage *PSCDownscaledImage(UIImage *image, CGRect sourceRect, CGSize pixelSize, CGFloat scale, PSCImageDownscalerQuality quality) {
+    CGImageRef sourceImage = image.CGImage;
+    size_t width = (size_t)pixelSize.width, height = (size_t)pixelSize.height;
+    if (!sourceImage || width == 0 || height == 0) return nil;
+
+    // The source is drawn into BGRA first, so the scaler knows the pixel layout. (A plain copy for rendered images)
+    size_t sourceWidth = CGImageGetWidth(sourceImage), sourceHeight = CGImageGetHeight(sourceImage);
+    CGContextRef sourceContext = PSCCreateBGRAContext(sourceWidth, sourceHeight);
+    CGContextRef destinationContext = PSCCreateBGRAContext(width, height);
+
+    UIImage *downscaledImage = nil;
+    if (sourceContext && destinationContext) {
+        CGContextSetBlendMode(sourceContext, kCGBlendModeCopy);
+        CGContextDrawImage(sourceContext, CGRectMake(0, 0, sourceWidth, sourceHeight), sourceImage);
+
+        // Cropping is just an offset into the source bitmap, whose first row is the top of the image.
+        sourceRect = CGRectIntersection(CGRectIntegral(sourceRect), CGRectMake(0, 0, sourceWidth, sourceHeight));
+        size_t sourceRowBytes = CGBitmapContextGetBytesPerRow(sourceContext);
+        uint8_t *sourceData = (uint8_t *)CGBitmapContextGetData(sourceContext) + (size_t)sourceRect.origin.y * sourceRowBytes + (size_t)sourceRect.origin.x * 4;
+        vImage_Buffer source = {sourceData, (vImagePixelCount)sourceRect.size.height, (vImagePixelCount)sourceRect.size.width, sourceRowBytes};
+        vImage_Buffer destination = {CGBitmapContextGetData(destinationContext), height, width, CGBitmapContextGetBytesPerRow(destinationContext)};
+        if ([PSCImageDownscaler scaleBGRABuffer:&source toBuffer:&destination quality:quality]) {
+            CGImageRef destinationImage = CGBitmapContextCreateImage(destinationContext);
+            downscaledImage = [UIImage imageWithCGImage:destinationImage scale:scale orientation:UIImageOrientationUp];
+            CGImageRelease(destinationImage);
+        }
+    }
+    CGContextRelease(sourceContext);
+    CGContextRelease(destinationContext);
+    return downscaledImage;
+}
+
+@implementation PSCImageDownscaler
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
++ (BOOL)scaleBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination quality:(PSCImageDownscalerQuality)quality {
+    if (destination->width == 0 || destination->height == 0 || destination->width > source->width || destination->height > source->height) return NO;
+
+    // Mipmap down while there's at least a 2x reduction left. The last step goes straight into destination if it fits exactly.
+    vImage_Buffer current = *source;
+    void *mipmapData = NULL;
+    while (current.width / 2 >= destination->width && current.height / 2 >= destination->height) {
+        vImage_Buffer halved = {NULL, current.height / 2, current.width / 2, (current.width / 2) * 4};
+        BOOL isDestination = halved.width == destination->width && halved.height == destination->height;
+        if (isDestination) {
+            halved = *destination;
+        }else {
+            halved.data = malloc(halved.rowBytes * halved.height);
+            if (!halved.data) {
+                free(mipmapData);
+                return NO;
+            }
+        }
+        [self halveBGRABuffer:&current toBuffer:&halved];
+        free(mipmapData);
+        if (isDestination) return YES;
+        mipmapData = halved.data;
+        current = halved;
+    }
+
+    vImage_Error error = kvImageNoError;
+    if (current.width == destination->width && current.height == destination->height) {
+        for (size_t y = 0; y < destination->height; y++) {
+            memcpy((uint8_t *)destination->data + y * destination->rowBytes, (const uint8_t *)current.data + y * current.rowBytes, destination->width * 4);
+        }
+    }else {
+        error = vImageScale_ARGB8888(&current, destination, NULL, quality == PSCImageDownscalerQualityHigh ? kvImageHighQualityResampling : kvImageNoFlags);
+    }
+    free(mipmapData);
+    return error == kvImageNoError;
+}
+
++ (void)halveBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination {
+    NSParameterAssert(destination->width <= source->width / 2 && destination->height <= source->height / 2);
+
+    // Rows are independent, so large bitmaps are split into one stripe per core.
+    vImage_Buffer sourceBuffer = *source, destinationBuffer = *destination;
+    size_t stripeCount = destination->width * destination->height >= kPSCParallelHalvingPixelCount ? MIN(NSProcessInfo.processInfo.activeProcessorCount, destination->height) : 1;
+    if (stripeCount <= 1) {
+        PSCHalveRows(&sourceBuffer, &destinationBuffer, 0, destinationBuffer.height, YES);
+        return;
+    }
+    size_t rowsPerStripe = (destinationBuffer.height + stripeCount - 1) / stripeCount;
+    dispatch_apply(stripeCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t stripe) {
+        size_t firstRow = stripe * rowsPerStripe;
+        if (firstRow < destinationBuffer.height) PSCHalveRows(&sourceBuffer, &destinationBuffer, firstRow, MIN(rowsPerStripe, destinationBuffer.height - firstRow), YES);
+    });
+}
+
++ (UIImage *)imageByScalingImage:(UIImage *)image toSize:(CGSize)size quality:(PSCImageDownscalerQuality)quality {
+    if (!image.CGImage) return nil;
+
+    CGSize sourcePixelSize = CGSizeMake(CGImageGetWidth(image.CGImage), CGImageGetHeight(image.CGImage));
+    CGSize pixelSize = CGSizeMake(MIN(roundf(size.width * image.scale), sourcePixelSize.width), MIN(roundf(size.height * image.scale), sourcePixelSize.height));
+    if (CGSizeEqualToSize(pixelSize, sourcePixelSize)) return image;
+    if (image.imageOrientation != UIImageOrientationUp) {
+        return [image pspdf_resizedImageWithContentMode:UIViewContentModeScaleToFill bounds:size honorScaleFactor:YES interpolationQuality:kCGInterpolationHigh];
+    }
+    return PSCDownscaledImage(image, (CGRect){.size = sourcePixelSize}, pixelSize, image.scale, quality);
+}
+
+@end
+
+@implementation PSCImageDownscaler (Testing)
+
++ (void)scalarHalveBGRABuffer:(const vImage_Buffer *)source toBuffer:(const vImage_Buffer *)destination {
+    NSParameterAssert(destination->width <= source->width / 2 && destination->height <= source->height / 2);
+    PSCHalveRows(source, destination, 0, destination->height, NO);
+}
+
+@end
+
+@implementation PSPDFCache (PSCImageDownscaler)
+
+- (UIImage *)downscaledImageFromDocument:(PSPDFDocument *)document andPage:(NSUInteger)page withSize:(CGSize)size {
+    // The full size image is only needed once, so it's kept out of the memory cache.
+    UIImage *image = [self imageFromDocument:document andPage:page withSize:size options:PSPDFCacheOptionMemoryStoreNever|PSPDFCacheOptionDiskLoadSync|PSPDFCacheOptionRenderSkip|PSPDFCacheOptionActualityIgnore|PSPDFCacheOptionSizeAllowLarger];
+    if (!image || image.size.width == 0 || image.size.height == 0) return nil;
+    return [PSCImageDownscaler imageByScalingImage:image toSize:PSCAspectFitSize(image.size, size) quality:PSCImageDownscalerQualityDefault];
+}
+
+@end
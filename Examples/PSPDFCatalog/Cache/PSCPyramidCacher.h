@@ -0,0 +1,71 @@
+//
+//  PSCPyramidCacher.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Pre-caches a document at several sizes by rendering each page once.
+
+ cacheDocument:startAtPage:sizes:diskCacheStrategy: renders every requested size from the PDF.
+ The pyramid cacher renders only the largest size (or loads it from disk if it's already cached) and derives the
+ smaller sizes (e.g. thumbnailSize and tinySize) with PSCImageDownscaler in the same job.
+ A cached largest size is only reused if its render receipt is current. All levels of a page are stored together, each with
+ the receipt of its own size (see PSCRenderReceiptForCacheEntry), and only if all of them could be created.
+
+ Documents with PSPDFDiskCacheStrategyNothing are not cached.
+ */
+@class PSCDiskCacheWriteQueue;
+
+@interface PSCPyramidCacher : NSObject
+
+/// Designated initializer. sizes is an array of NSValue (CGSize), in any order.
+- (id)initWithCache:(PSPDFCache *)cache document:(PSPDFDocument *)document sizes:(NSArray *)sizes;
+
+/// Target cache.
+@property (nonatomic, strong, readonly) PSPDFCache *cache;
+
+/// Cached document.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Sizes, largest first.
+@property (nonatomic, copy, readonly) NSArray *sizes;
+
+/// Number of pages that are processed concurrently. Defaults to the number of CPU cores.
+@property (nonatomic, assign) NSUInteger maximumConcurrentPageCount;
+
+/// If set, images are stored through the write queue, and startAtPage: waits for its capacity before each page. Defaults to nil.
+@property (nonatomic, strong) PSCDiskCacheWriteQueue *writeQueue;
+
+/// Caches all pages in the background, starting at page and working outward. completionBlock is called on the main thread.
+- (void)startAtPage:(NSUInteger)page completionBlock:(void (^)(PSCPyramidCacher *cacher))completionBlock;
+
+/// Caches the missing sizes of a single page on the current thread. Returns YES if nothing was missing.
+- (BOOL)cachePage:(NSUInteger)page error:(NSError **)error;
+
+/// Stops processing after the pages that are currently being cached.
+- (void)cancel;
+
+/// YES after cancel has been called.
+@property (atomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/// @name Statistics
+
+/// Number of pages that had to be rendered.
+@property (atomic, assign, readonly) NSUInteger renderedPageCount;
+
+/// Number of images that were created by downsampling instead of rendering.
+@property (atomic, assign, readonly) NSUInteger derivedImageCount;
+
+/// Number of pages where all sizes were already cached.
+@property (atomic, assign, readonly) NSUInteger skippedPageCount;
+
+@end
+
+@interface PSPDFCache (PSCPyramidCacher)
+
+/// Pyramid variant of cacheDocument:startAtPage:sizes:diskCacheStrategy: that caches all pages.
+- (PSCPyramidCacher *)cachePyramidOfDocument:(PSPDFDocument *)document startAtPage:(NSUInteger)page sizes:(NSArray *)sizes completionBlock:(void (^)(PSCPyramidCacher *cacher))completionBlock;
+
+@end
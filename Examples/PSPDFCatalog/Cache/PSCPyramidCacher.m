@@ -0,0 +1,185 @@
+//
+//  PSCPyramidCacher.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCPyramidCacher.h"
+#import "PSCImageDownscaler.h"
+#import "PSCDiskCacheWriteQueue.h"
+#import "PSCRenderFingerprint.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@interface PSCPyramidCacher ()
+@property (atomic, assign, getter=isCancelled) BOOL cancelled;
+@property (atomic, assign) NSUInteger renderedPageCount;
+@property (atomic, assign) NSUInteger derivedImageCount;
+@property (atomic, assign) NSUInteger skippedPageCount;
+@end
+
+// Fits size into boundingSize, never upscales.
+static CGSize PSCAspectFitSize(CGSize size, CGSize boundingSize) {
+    CGFloat scale = MIN(MIN(boundingSize.width / size.width, boundingSize.height / size.height), 1.f);
+    return CGSizeMake(roundf(size.width * scale), roundf(size.height * scale));
+}
+
+@implementation PSCPyramidCacher
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithCache:(PSPDFCache *)cache document:(PSPDFDocument *)document sizes:(NSArray *)sizes {
+    if ((self = [super init])) {
+        _cache = cache;
+        _document = document;
+        _sizes = [sizes sortedArrayUsingComparator:^NSComparisonResult(NSValue *sizeValue1, NSValue *sizeValue2) {
+            CGFloat area1 = sizeValue1.CGSizeValue.width * sizeValue1.CGSizeValue.height;
+            CGFloat area2 = sizeValue2.CGSizeValue.width * sizeValue2.CGSizeValue.height;
+            return area1 > area2 ? NSOrderedAscending : (area1 < area2 ? NSOrderedDescending : NSOrderedSame);
+        }];
+        _maximumConcurrentPageCount = NSProcessInfo.processInfo.activeProcessorCount;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: %@ sizes:%d rendered:%d derived:%d skipped:%d>", self.class, self, self.document.title, self.sizes.count, self.renderedPageCount, self.derivedImageCount, self.skippedPageCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)startAtPage:(NSUInteger)page completionBlock:(void (^)(PSCPyramidCacher *cacher))completionBlock {
+    dispatch_semaphore_t pageSemaphore = dispatch_semaphore_create(MAX(self.maximumConcurrentPageCount, 1U));
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t renderQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
+
+    // The feeder blocks on the semaphore, so pages are picked up in order.
+    dispatch_async(renderQueue, ^{
+        BOOL cacheable = self.document.isValid && !self.document.isLocked && self.sizes.count > 0 && self.document.diskCacheStrategy != PSPDFDiskCacheStrategyNothing;
+        for (NSNumber *pageNumber in cacheable ? [self pagesStartingAtPage:page] : nil) {
+            [self.writeQueue waitForCapacity];
+            if (self.isCancelled) break;
+
+            dispatch_semaphore_wait(pageSemaphore, DISPATCH_TIME_FOREVER);
+            dispatch_group_async(group, renderQueue, ^{
+                @autoreleasepool {
+                    NSError *error = nil;
+                    if (!self.isCancelled && ![self cachePage:pageNumber.unsignedIntegerValue error:&error]) {
+                        PSCLog(@"Failed to cache page %@: %@", pageNumber, [error localizedDescription]);
+                    }
+                }
+                dispatch_semaphore_signal(pageSemaphore);
+            });
+        }
+
+        dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+            PSCLog(@"Pyramid caching finished: %@", self);
+            if (completionBlock) completionBlock(self);
+#if !OS_OBJECT_USE_OBJC
+            dispatch_release(group);
+            dispatch_release(pageSemaphore);
+#endif
+        });
+    });
+}
+
+- (BOOL)cachePage:(NSUInteger)page error:(NSError **)error {
+    // Cache status is looked up by UID, this doesn't render.
+    NSMutableArray *missingSizes = [NSMutableArray array];
+    for (NSValue *sizeValue in self.sizes) {
+        if ([self.cache cacheStatusForImageFromDocument:self.document andPage:page withSize:sizeValue.CGSizeValue options:PSPDFCacheOptionSizeRequireAboutExact] != PSPDFCacheStatusOnDisk) {
+            [missingSizes addObject:sizeValue];
+        }
+    }
+    if (missingSizes.count == 0) {
+        @synchronized(self) { self.skippedPageCount++; }
+        return YES;
+    }
+
+    // The top level is loaded from disk if it's current, else rendered.
+    NSValue *largestSize = self.sizes[0];
+    BOOL largestMissing = [missingSizes containsObject:largestSize];
+    NSArray *annotations = [self.document annotationsForPage:page type:self.document.renderAnnotationTypes] ?: @[];
+    UIImage *largestImage = nil;
+    if (!largestMissing) {
+        largestImage = [self.cache imageFromDocument:self.document andPage:page withSize:largestSize.CGSizeValue options:PSPDFCacheOptionDiskLoadSync|PSPDFCacheOptionRenderSkip|PSPDFCacheOptionMemoryStoreNever|PSPDFCacheOptionActualityIgnore];
+        if (largestImage && ![self isCurrentImage:largestImage page:page annotations:annotations]) largestImage = nil;
+    }
+    if (!largestImage) {
+        NSMutableDictionary *renderOptions = [NSMutableDictionary dictionaryWithDictionary:self.document.renderOptions];
+        renderOptions[kPSPDFPreserveAspectRatio] = @YES;
+        largestImage = [self.document renderImageForPage:page withSize:largestSize.CGSizeValue clippedToRect:CGRectZero withAnnotations:annotations options:renderOptions receipt:NULL error:error];
+        if (!largestImage) return NO;
+        largestMissing = YES;
+        @synchronized(self) { self.renderedPageCount++; }
+    }
+
+    // Create all levels before storing any, so a page is either complete or untouched.
+    NSMutableArray *levelImages = [NSMutableArray arrayWithCapacity:missingSizes.count];
+    if (largestMissing) [levelImages addObject:largestImage];
+    for (NSValue *sizeValue in missingSizes) {
+        if ([sizeValue isEqual:largestSize]) continue;
+
+        UIImage *levelImage = [PSCImageDownscaler imageByScalingImage:largestImage toSize:PSCAspectFitSize(largestImage.size, sizeValue.CGSizeValue) quality:PSCImageDownscalerQualityHigh];
+        if (!levelImage) {
+            if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodePageRenderGraphicsContextNil userInfo:@{NSLocalizedDescriptionKey : @"Failed to downsample page image."}];
+            return NO;
+        }
+        [levelImages addObject:levelImage];
+    }
+    // Every level gets the receipt the actuality check builds for its size.
+    PSCDiskCacheWriteQueue *writeQueue = self.writeQueue;
+    for (UIImage *levelImage in levelImages) {
+        PSPDFRenderReceipt *renderReceipt = PSCRenderReceiptForCacheEntry(self.document, page, levelImage.size, annotations);
+        if (writeQueue) [writeQueue enqueueImage:levelImage fromDocument:self.document andPage:page withReceipt:renderReceipt];
+        else [self.cache saveImage:levelImage fromDocument:self.document andPage:page withReceipt:renderReceipt];
+    }
+    @synchronized(self) { self.derivedImageCount += levelImages.count - (largestMissing ? 1 : 0); }
+    return YES;
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// An outdated top level would be passed on to all derived levels.
+- (BOOL)isCurrentImage:(UIImage *)image page:(NSUInteger)page annotations:(NSArray *)annotations {
+    CGSize size = image.size;
+    PSPDFCacheInfo *cacheInfo = [self.cache.diskCache cacheInfoForImageWithUID:self.document.UID andPage:page withSize:size infoSelector:^PSPDFCacheInfo *(NSOrderedSet *infos) {
+        for (PSPDFCacheInfo *info in infos) if (CGSizeEqualToSize(info.size, size)) return info;
+        return nil;
+    }];
+    return PSCCacheInfoIsCurrent(cacheInfo, self.document, page, annotations);
+}
+
+// page, page+1, page-1, page+2, ...
+- (NSArray *)pagesStartingAtPage:(NSUInteger)page {
+    NSUInteger pageCount = self.document.pageCount;
+    NSMutableArray *pages = [NSMutableArray arrayWithCapacity:pageCount];
+    page = MIN(page, pageCount - 1);
+    for (NSUInteger distance = 0; pages.count < pageCount; distance++) {
+        if (page + distance < pageCount) [pages addObject:@(page + distance)];
+        if (distance > 0 && distance <= page) [pages addObject:@(page - distance)];
+    }
+    return pages;
+}
+
+@end
+
+@implementation PSPDFCache (PSCPyramidCacher)
+
+- (PSCPyramidCacher *)cachePyramidOfDocument:(PSPDFDocument *)document startAtPage:(NSUInteger)page sizes:(NSArray *)sizes completionBlock:(void (^)(PSCPyramidCacher *cacher))completionBlock {
+    PSCPyramidCacher *cacher = [[PSCPyramidCacher alloc] initWithCache:self document:document sizes:sizes];
+    [cacher startAtPage:page completionBlock:completionBlock];
+    return cacher;
+}
+
+@end
@@ -0,0 +1,45 @@
+//
+//  PSCRenderFingerprint.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// 128-bit fingerprint of everything that influences a page render.
+/// The binary counterpart of PSPDFRenderReceipt's renderFingerprintString: compared and hashed as two integers, built without any string formatting.
+/// Not cryptographic; the hash follows MurmurHash3 (x64, 128 bit).
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} PSCRenderFingerprint;
+
+extern const PSCRenderFingerprint PSCRenderFingerprintZero;
+
+static inline BOOL PSCRenderFingerprintEqualToFingerprint(PSCRenderFingerprint fingerprint1, PSCRenderFingerprint fingerprint2) {
+    return fingerprint1.high == fingerprint2.high && fingerprint1.low == fingerprint2.low;
+}
+
+static inline NSUInteger PSCRenderFingerprintHash(PSCRenderFingerprint fingerprint) {
+    return (NSUInteger)(fingerprint.high ^ fingerprint.low);
+}
+
+/// Computes the fingerprint incrementally from document UID, page, size, clipRect, the state of `annotations` and `options`.
+/// Annotations contribute what their receipt covers: class, type, geometry (rects, points, ink lines, line end points), style, contents,
+/// text and stamp properties and lastModified. `options` may contain strings, numbers, values, colors and collections of those.
+extern PSCRenderFingerprint PSCRenderFingerprintMake(PSPDFDocument *document, NSUInteger page, CGSize size, CGRect clipRect, NSArray *annotations, NSDictionary *options);
+
+/// Hex representation (32 characters), for logging.
+extern NSString *PSCRenderFingerprintToString(PSCRenderFingerprint fingerprint);
+
+/// Boxes a fingerprint for use in collections (16 bytes).
+extern NSData *PSCRenderFingerprintData(PSCRenderFingerprint fingerprint);
+
+/// @name Render Receipts
+
+/// Receipt of a whole page cache entry of size (the size stored in its PSPDFCacheInfo), built like PSPDFCache's actuality check
+/// builds it: no clip rect and the document's renderOptions. Entries that are stored with this receipt are current for
+/// the actuality check, PSCCache and PSCCacheScrubber alike. `annotations` should be the page's annotations of renderAnnotationTypes.
+extern PSPDFRenderReceipt *PSCRenderReceiptForCacheEntry(PSPDFDocument *document, NSUInteger page, CGSize size, NSArray *annotations);
+
+/// YES if the receipt of cacheInfo matches PSCRenderReceiptForCacheEntry for its size. NO if it has no receipt.
+extern BOOL PSCCacheInfoIsCurrent(PSPDFCacheInfo *cacheInfo, PSPDFDocument *document, NSUInteger page, NSArray *annotations);
@@ -0,0 +1,272 @@
+//
+//  PSCRenderFingerprint.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCRenderFingerprint.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+const PSCRenderFingerprint PSCRenderFingerprintZero = {0, 0};
+
+// Type tags, so e.g. @"1" and @1 differ.
+typedef NS_ENUM(NSUInteger, PSCFingerprintTag) {
+    PSCFingerprintTagNil = 0x6e696c,
+    PSCFingerprintTagString,
+    PSCFingerprintTagNumber,
+    PSCFingerprintTagValue,
+    PSCFingerprintTagColor,
+    PSCFingerprintTagArray,
+    PSCFingerprintTagDictionary,
+    PSCFingerprintTagObject
+};
+
+typedef struct {
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t length;
+} PSCFingerprintHasher;
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Hasher
+
+static inline uint64_t PSCRotateLeft(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t PSCFinalMix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Feeds one 64-bit word through both MurmurHash3 lanes.
+static inline void PSCHasherAddWord(PSCFingerprintHasher *hasher, uint64_t word) {
+    uint64_t k1 = PSCRotateLeft(word * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+    hasher->h1 ^= k1;
+    hasher->h1 = (PSCRotateLeft(hasher->h1, 27) + hasher->h2) * 5 + 0x52dce729;
+
+    uint64_t k2 = PSCRotateLeft(word * 0x4cf5ad432745937fULL, 33) * 0x87c37b91114253d5ULL;
+    hasher->h2 ^= k2;
+    hasher->h2 = (PSCRotateLeft(hasher->h2, 31) + hasher->h1) * 5 + 0x38495ab5;
+    hasher->length += sizeof(uint64_t);
+}
+
+static inline void PSCHasherAddDouble(PSCFingerprintHasher *hasher, double value) {
+    if (value == 0.0) value = 0.0; // -0.0 renders like 0.0
+    uint64_t word;
+    memcpy(&word, &value, sizeof(word));
+    PSCHasherAddWord(hasher, word);
+}
+
+static void PSCHasherAddBytes(PSCFingerprintHasher *hasher, const void *bytes, size_t length) {
+    const uint8_t *data = bytes;
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= length; offset += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + offset, sizeof(word));
+        PSCHasherAddWord(hasher, word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + offset, length - offset);
+    PSCHasherAddWord(hasher, tail);
+    PSCHasherAddWord(hasher, length);
+}
+
+// Hashes the UTF-16 characters in chunks, without allocating. Both paths produce the same words.
+static void PSCHasherAddString(PSCFingerprintHasher *hasher, NSString *string) {
+    CFStringRef cfString = (__bridge CFStringRef)string;
+    CFIndex length = CFStringGetLength(cfString);
+    const UniChar *characters = CFStringGetCharactersPtr(cfString);
+    UniChar buffer[64];
+    PSCHasherAddWord(hasher, length);
+    for (CFIndex location = 0; location < length; location += 64) {
+        CFIndex chunkLength = MIN(length - location, (CFIndex)64);
+        if (characters) {
+            PSCHasherAddBytes(hasher, characters + location, chunkLength * sizeof(UniChar));
+        }else {
+            CFStringGetCharacters(cfString, CFRangeMake(location, chunkLength), buffer);
+            PSCHasherAddBytes(hasher, buffer, chunkLength * sizeof(UniChar));
+        }
+    }
+}
+
+static PSCRenderFingerprint PSCHasherFinish(PSCFingerprintHasher *hasher) {
+    uint64_t h1 = hasher->h1 ^ hasher->length, h2 = hasher->h2 ^ hasher->length;
+    h1 += h2; h2 += h1;
+    h1 = PSCFinalMix(h1); h2 = PSCFinalMix(h2);
+    h1 += h2; h2 += h1;
+    return (PSCRenderFingerprint){h1, h2};
+}
+
+static void PSCHasherAddObject(PSCFingerprintHasher *hasher, id object);
+
+static void PSCHasherAddDictionary(PSCFingerprintHasher *hasher, NSDictionary *dictionary) {
+    // Enumeration order isn't defined; combine per-entry fingerprints order-independently.
+    __block uint64_t sum1 = 0, sum2 = 0;
+    [dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+        PSCFingerprintHasher entryHasher = {0, 0, 0};
+        PSCHasherAddObject(&entryHasher, key);
+        PSCHasherAddObject(&entryHasher, value);
+        PSCRenderFingerprint entryFingerprint = PSCHasherFinish(&entryHasher);
+        sum1 += entryFingerprint.high;
+        sum2 += entryFingerprint.low;
+    }];
+    PSCHasherAddWord(hasher, PSCFingerprintTagDictionary);
+    PSCHasherAddWord(hasher, dictionary.count);
+    PSCHasherAddWord(hasher, sum1);
+    PSCHasherAddWord(hasher, sum2);
+}
+
+static void PSCHasherAddObject(PSCFingerprintHasher *hasher, id object) {
+    if (!object || object == [NSNull null]) {
+        PSCHasherAddWord(hasher, PSCFingerprintTagNil);
+    }else if ([object isKindOfClass:NSString.class]) {
+        PSCHasherAddWord(hasher, PSCFingerprintTagString);
+        PSCHasherAddString(hasher, object);
+    }else if ([object isKindOfClass:NSNumber.class]) {
+        PSCHasherAddWord(hasher, PSCFingerprintTagNumber);
+        const char *type = [object objCType];
+        if (type[0] == 'f' || type[0] == 'd') PSCHasherAddDouble(hasher, [object doubleValue]);
+        else PSCHasherAddWord(hasher, (uint64_t)[object longLongValue]);
+    }else if ([object isKindOfClass:NSValue.class]) {
+        const char *type = [object objCType];
+        NSUInteger size = 0;
+        NSGetSizeAndAlignment(type, &size, NULL);
+        uint8_t buffer[64];
+        PSCHasherAddWord(hasher, PSCFingerprintTagValue);
+        PSCHasherAddBytes(hasher, type, strlen(type));
+        if (size <= sizeof(buffer)) {
+            memset(buffer, 0, sizeof(buffer));
+            [object getValue:buffer];
+            PSCHasherAddBytes(hasher, buffer, size);
+        }else {
+            PSCHasherAddWord(hasher, [object hash]);
+        }
+    }else if ([object isKindOfClass:UIColor.class]) {
+        CGFloat red, green, blue, alpha, white;
+        PSCHasherAddWord(hasher, PSCFingerprintTagColor);
+        if ([object getRed:&red green:&green blue:&blue alpha:&alpha]) {
+            PSCHasherAddDouble(hasher, red); PSCHasherAddDouble(hasher, green); PSCHasherAddDouble(hasher, blue); PSCHasherAddDouble(hasher, alpha);
+        }else if ([object getWhite:&white alpha:&alpha]) {
+            PSCHasherAddDouble(hasher, white); PSCHasherAddDouble(hasher, white); PSCHasherAddDouble(hasher, white); PSCHasherAddDouble(hasher, alpha);
+        }else {
+            PSCHasherAddWord(hasher, [object hash]); // pattern colors
+        }
+    }else if ([object isKindOfClass:NSArray.class]) {
+        PSCHasherAddWord(hasher, PSCFingerprintTagArray);
+        PSCHasherAddWord(hasher, [object count]);
+        for (id element in object) PSCHasherAddObject(hasher, element);
+    }else if ([object isKindOfClass:NSDictionary.class]) {
+        PSCHasherAddDictionary(hasher, object);
+    }else {
+        PSCHasherAddWord(hasher, PSCFingerprintTagObject);
+        PSCHasherAddWord(hasher, (uintptr_t)[object class]);
+        PSCHasherAddWord(hasher, [object hash]);
+    }
+}
+
+static inline void PSCHasherAddRect(PSCFingerprintHasher *hasher, CGRect rect) {
+    PSCHasherAddDouble(hasher, rect.origin.x);
+    PSCHasherAddDouble(hasher, rect.origin.y);
+    PSCHasherAddDouble(hasher, rect.size.width);
+    PSCHasherAddDouble(hasher, rect.size.height);
+}
+
+static inline void PSCHasherAddPoint(PSCFingerprintHasher *hasher, CGPoint point) {
+    PSCHasherAddDouble(hasher, point.x);
+    PSCHasherAddDouble(hasher, point.y);
+}
+
+// Everything of an annotation that shows up in the rendered page, including the properties of the subclasses.
+static void PSCHasherAddAnnotation(PSCFingerprintHasher *hasher, PSPDFAnnotation *annotation) {
+    PSCHasherAddWord(hasher, (uintptr_t)annotation.class);
+    PSCHasherAddWord(hasher, annotation.type);
+    PSCHasherAddWord(hasher, annotation.isDeleted);
+    PSCHasherAddWord(hasher, annotation.isOverlay);
+    PSCHasherAddWord(hasher, annotation.hasAppearanceStream);
+    PSCHasherAddRect(hasher, annotation.boundingBox);
+    PSCHasherAddWord(hasher, annotation.rotation);
+    PSCHasherAddDouble(hasher, annotation.alpha);
+    PSCHasherAddDouble(hasher, annotation.lineWidth);
+    PSCHasherAddWord(hasher, annotation.borderStyle);
+    PSCHasherAddObject(hasher, annotation.dashArray);
+    PSCHasherAddObject(hasher, annotation.color);
+    PSCHasherAddObject(hasher, annotation.fillColor);
+    PSCHasherAddObject(hasher, annotation.contents);
+    PSCHasherAddObject(hasher, annotation.name);
+    PSCHasherAddObject(hasher, annotation.rects);
+    PSCHasherAddObject(hasher, annotation.points);
+    PSCHasherAddDouble(hasher, annotation.lastModified.timeIntervalSinceReferenceDate);
+
+    if ([annotation isKindOfClass:PSPDFInkAnnotation.class]) {
+        PSCHasherAddObject(hasher, ((PSPDFInkAnnotation *)annotation).lines);
+    }else if ([annotation isKindOfClass:PSPDFLineAnnotation.class]) {
+        PSPDFLineAnnotation *lineAnnotation = (PSPDFLineAnnotation *)annotation;
+        PSCHasherAddPoint(hasher, lineAnnotation.point1);
+        PSCHasherAddPoint(hasher, lineAnnotation.point2);
+        PSCHasherAddWord(hasher, lineAnnotation.lineEnd1);
+        PSCHasherAddWord(hasher, lineAnnotation.lineEnd2);
+    }else if ([annotation isKindOfClass:PSPDFFreeTextAnnotation.class]) {
+        PSPDFFreeTextAnnotation *freeTextAnnotation = (PSPDFFreeTextAnnotation *)annotation;
+        PSCHasherAddObject(hasher, freeTextAnnotation.fontName);
+        PSCHasherAddDouble(hasher, freeTextAnnotation.fontSize);
+        PSCHasherAddWord(hasher, freeTextAnnotation.textAlignment);
+    }else if ([annotation isKindOfClass:PSPDFStampAnnotation.class]) {
+        PSPDFStampAnnotation *stampAnnotation = (PSPDFStampAnnotation *)annotation;
+        PSCHasherAddObject(hasher, stampAnnotation.subject);
+        PSCHasherAddObject(hasher, stampAnnotation.subtext);
+        PSCHasherAddObject(hasher, stampAnnotation.image);
+        PSCHasherAddObject(hasher, [NSValue valueWithCGAffineTransform:stampAnnotation.imageTransform]);
+    }else if ([annotation isKindOfClass:PSPDFNoteAnnotation.class]) {
+        PSCHasherAddObject(hasher, ((PSPDFNoteAnnotation *)annotation).iconName);
+    }else if ([annotation isKindOfClass:PSPDFHighlightAnnotation.class]) {
+        PSCHasherAddWord(hasher, ((PSPDFHighlightAnnotation *)annotation).highlightType);
+    }else if ([annotation isKindOfClass:PSPDFShapeAnnotation.class]) {
+        PSCHasherAddWord(hasher, ((PSPDFShapeAnnotation *)annotation).shapeType);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+PSCRenderFingerprint PSCRenderFingerprintMake(PSPDFDocument *document, NSUInteger page, CGSize size, CGRect clipRect, NSArray *annotations, NSDictionary *options) {
+    PSCFingerprintHasher hasher = {0, 0, 0};
+    PSCHasherAddObject(&hasher, document.UID);
+    PSCHasherAddWord(&hasher, page);
+    PSCHasherAddDouble(&hasher, size.width);
+    PSCHasherAddDouble(&hasher, size.height);
+    PSCHasherAddRect(&hasher, clipRect);
+
+    PSCHasherAddWord(&hasher, annotations.count);
+    for (PSPDFAnnotation *annotation in annotations) {
+        PSCHasherAddAnnotation(&hasher, annotation);
+    }
+    PSCHasherAddObject(&hasher, options);
+    return PSCHasherFinish(&hasher);
+}
+
+NSString *PSCRenderFingerprintToString(PSCRenderFingerprint fingerprint) {
+    return [NSString stringWithFormat:@"%016llx%016llx", fingerprint.high, fingerprint.low];
+}
+
+NSData *PSCRenderFingerprintData(PSCRenderFingerprint fingerprint) {
+    return [NSData dataWithBytes:&fingerprint length:sizeof(fingerprint)];
+}
+
+PSPDFRenderReceipt *PSCRenderReceiptForCacheEntry(PSPDFDocument *document, NSUInteger page, CGSize size, NSArray *annotations) {
+    return [[PSPDFRenderReceipt alloc] initWithDocument:document andPage:page ofSize:size clipRect:CGRectZero annotations:annotations ?: @[] options:document.renderOptions];
+}
+
+BOOL PSCCacheInfoIsCurrent(PSPDFCacheInfo *cacheInfo, PSPDFDocument *document, NSUInteger page, NSArray *annotations) {
+    NSString *cachedFingerprint = cacheInfo.renderReceipt.renderFingerprintString;
+    if (!cachedFingerprint) return NO;
+    return [PSCRenderReceiptForCacheEntry(document, page, cacheInfo.size, annotations).renderFingerprintString isEqualToString:cachedFingerprint];
+}
@@ -0,0 +1,70 @@
+//
+//  PSCThumbnailAtlas.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Sprite sheets of all page thumbnails of a document.
+
+ The scrobble bar and the thumbnail grid request one image per page from PSPDFCache, which means one lookup,
+ one file read and one decode per page; on documents with hundreds of pages the thumbnails pop in piece by piece.
+ The atlas packs the thumbnails of all pages into a few large JPEG sheets plus an index, built once and stored next
+ to the PSPDFCache files. Displaying them costs one decode per sheet; single pages are sliced out without copying.
+
+ Thumbnails are fetched from PSPDFCache (rendered if needed) while building.
+ PSCCache invalidates the atlases of a document together with its cached images: changed pages are no longer sliced
+ (lookups fall back to PSPDFCache) and the files are deleted, so the next load builds the atlas again.
+ */
+@interface PSCThumbnailAtlas : NSObject
+
+/// Returns the shared atlas for document and size (in points). Doesn't build it.
++ (instancetype)atlasForDocument:(PSPDFDocument *)document size:(CGSize)size;
+
+/// Returns the shared atlas for document and size only if it exists and is loaded. Thread safe.
++ (instancetype)loadedAtlasForDocument:(PSPDFDocument *)document size:(CGSize)size;
+
+/// Marks page (NSNotFound for all pages) as changed in all atlases of document and deletes their files. Thread safe.
++ (void)invalidateAtlasesForDocument:(PSPDFDocument *)document page:(NSUInteger)page;
+
+/// Unloads all atlases of document and deletes their files. Thread safe.
++ (void)removeAtlasesForDocument:(PSPDFDocument *)document;
+
+/// Unloads all atlases and deletes all atlas files. Thread safe.
++ (void)removeAllAtlases;
+
+/// Document.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Size of one thumbnail in points. Thumbnails are aspect-fit into this size.
+@property (nonatomic, assign, readonly) CGSize size;
+
+/// Maximum size of a sheet in pixels. Defaults to 2048, the texture limit of older devices.
+@property (nonatomic, assign) CGFloat maximumSheetSize;
+
+/// YES if the index and all sheets are available. The sheets are decoded before this is set.
+@property (atomic, assign, readonly, getter=isLoaded) BOOL loaded;
+
+/// Loads the atlas from disk, or builds it if it doesn't exist yet, and decodes the sheets in the background.
+/// completionBlock is called on the main thread.
+- (void)loadWithCompletionBlock:(void (^)(PSCThumbnailAtlas *atlas, NSError *error))completionBlock;
+
+/// Deletes the atlas from disk and memory.
+- (void)removeAtlas;
+
+/// @name Slicing
+
+/// Sheet image that contains page. (Already decoded once the atlas is loaded) NULL if page changed since the atlas was built.
+- (CGImageRef)sheetImageForPage:(NSUInteger)page;
+
+/// Rect of page within its sheet, in unit coordinates as used by CALayer's contentsRect. CGRectZero if not available.
+- (CGRect)contentsRectForPage:(NSUInteger)page;
+
+/// Thumbnail of page; shares the memory of the sheet. nil if the atlas isn't loaded or page changed since it was built.
+- (UIImage *)imageForPage:(NSUInteger)page;
+
+/// Number of sheets.
+@property (nonatomic, assign, readonly) NSUInteger sheetCount;
+
+@end
@@ -0,0 +1,496 @@
+//
+//  PSCThumbnailAtlas.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCThumbnailAtlas.h"
+#import "PSCImageDownscaler.h"
+#import <ImageIO/ImageIO.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Increase when the file format changes.
+#define kPSCThumbnailAtlasVersion 1
+
+static NSString *const PSCThumbnailAtlasVersionKey = @"version";
+static NSString *const PSCThumbnailAtlasUIDKey = @"UID";
+static NSString *const PSCThumbnailAtlasPageCountKey = @"pageCount";
+static NSString *const PSCThumbnailAtlasCellSizeKey = @"cellSize";
+static NSString *const PSCThumbnailAtlasPagesPerSheetKey = @"pagesPerSheet";
+static NSString *const PSCThumbnailAtlasSheetSizesKey = @"sheetSizes";
+static NSString *const PSCThumbnailAtlasPageRectsKey = @"pageRects";
+
+@interface PSCThumbnailAtlas () {
+    NSMutableArray *_sheetImages;  // CGImageRef or NSNull, decoded lazily
+    NSArray *_sheetSizes;          // NSValue (CGSize), pixels
+    NSArray *_pageRects;           // NSValue (CGRect), pixels, top-left origin
+    NSUInteger _pagesPerSheet;
+    NSMutableIndexSet *_stalePages;  // changed since the sheets were built
+    NSUInteger _generation;          // increased by removeAtlas; a load that started before doesn't mark the atlas loaded
+    NSMutableArray *_completionBlocks;
+}
+@property (atomic, assign, getter=isLoaded) BOOL loaded;
+@end
+
+// Decodes image into a bitmap, so drawing it later doesn't decode again.
+static CGImageRef PSCCreateDecodedImage(CGImageRef image) {
+    if (!image) return NULL;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, CGImageGetWidth(image), CGImageGetHeight(image), 8, 0, colorSpace, kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) return NULL;
+    CGContextDrawImage(context, CGRectMake(0, 0, CGImageGetWidth(image), CGImageGetHeight(image)), image);
+    CGImageRef decodedImage = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    return decodedImage;
+}
+
+@implementation PSCThumbnailAtlas
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (NSCache *)atlases {
+    static NSCache *_atlases;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _atlases = [NSCache new];
+        _atlases.countLimit = 10;
+    });
+    return _atlases;
+}
+
+// UID -> NSMutableSet of keys in atlases. NSCache can't be enumerated. Guarded by atlases.
++ (NSMutableDictionary *)atlasKeys {
+    static NSMutableDictionary *_atlasKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _atlasKeys = [NSMutableDictionary new];
+    });
+    return _atlasKeys;
+}
+
++ (instancetype)atlasForDocument:(PSPDFDocument *)document size:(CGSize)size {
+    if (!document.UID) return nil;
+
+    NSCache *atlases = [self atlases];
+    NSString *key = [NSString stringWithFormat:@"%@-%@", document.UID, NSStringFromCGSize(size)];
+    @synchronized(atlases) {
+        PSCThumbnailAtlas *atlas = [atlases objectForKey:key];
+        if (atlas.document != document) {
+            atlas = [[self alloc] initWithDocument:document size:size];
+            [atlases setObject:atlas forKey:key];
+            NSMutableDictionary *atlasKeys = [self atlasKeys];
+            if (!atlasKeys[document.UID]) atlasKeys[document.UID] = [NSMutableSet set];
+            [atlasKeys[document.UID] addObject:key];
+        }
+        return atlas;
+    }
+}
+
++ (instancetype)loadedAtlasForDocument:(PSPDFDocument *)document size:(CGSize)size {
+    if (!document.UID) return nil;
+
+    NSCache *atlases = [self atlases];
+    NSString *key = [NSString stringWithFormat:@"%@-%@", document.UID, NSStringFromCGSize(size)];
+    @synchronized(atlases) {
+        PSCThumbnailAtlas *atlas = [atlases objectForKey:key];
+        return atlas.document == document && atlas.isLoaded ? atlas : nil;
+    }
+}
+
++ (void)invalidateAtlasesForDocument:(PSPDFDocument *)document page:(NSUInteger)page {
+    if (!document.UID) return;
+
+    // In memory, only the changed page falls back to PSPDFCache. On disk the atlas is rebuilt on the next load.
+    for (PSCThumbnailAtlas *atlas in [self liveAtlasesWithUID:document.UID remove:NO]) {
+        [atlas invalidatePage:page];
+    }
+    [self removeAtlasFilesWithUID:document.UID];
+}
+
++ (void)removeAtlasesForDocument:(PSPDFDocument *)document {
+    if (!document.UID) return;
+
+    for (PSCThumbnailAtlas *atlas in [self liveAtlasesWithUID:document.UID remove:YES]) {
+        [atlas removeAtlas];
+    }
+    [self removeAtlasFilesWithUID:document.UID];
+}
+
++ (void)removeAllAtlases {
+    NSCache *atlases = [self atlases];
+    NSMutableArray *liveAtlases = [NSMutableArray array];
+    @synchronized(atlases) {
+        for (NSSet *keys in [self atlasKeys].allValues) {
+            for (NSString *key in keys) {
+                PSCThumbnailAtlas *atlas = [atlases objectForKey:key];
+                if (atlas) [liveAtlases addObject:atlas];
+            }
+        }
+        [atlases removeAllObjects];
+        [[self atlasKeys] removeAllObjects];
+    }
+    [liveAtlases makeObjectsPerformSelector:@selector(removeAtlas)];
+    [[NSFileManager defaultManager] removeItemAtPath:[self atlasDirectoryPath] error:NULL];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document size:(CGSize)size {
+    if ((self = [super init])) {
+        _document = document;
+        _size = size;
+        _maximumSheetSize = 2048;
+        _completionBlocks = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: %@ size:%@ sheets:%d loaded:%d>", self.class, self, self.document.title, NSStringFromCGSize(self.size), self.sheetCount, self.isLoaded];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)loadWithCompletionBlock:(void (^)(PSCThumbnailAtlas *atlas, NSError *error))completionBlock {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{ [self loadWithCompletionBlock:completionBlock]; });
+        return;
+    }
+    if (self.isLoaded) {
+        if (completionBlock) completionBlock(self, nil);
+        return;
+    }
+
+    // Calls are coalesced while loading.
+    [_completionBlocks addObject:completionBlock ? [completionBlock copy] : [NSNull null]];
+    if (_completionBlocks.count > 1) return;
+
+    CGFloat scale = UIScreen.mainScreen.scale;
+    NSUInteger generation;
+    @synchronized(self) {
+        generation = _generation;
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        NSError *error = nil;
+        BOOL success = [self loadIndexWithScale:scale] || [self buildWithScale:scale error:&error];
+        if (success) {
+            // Sheets loaded from disk are decoded here, so the main thread never decodes a JPEG.
+            [self decodeSheetsWithScale:scale];
+            @synchronized(self) {
+                // Pages changed while building might have been drawn outdated; don't keep those sheets on disk.
+                if (_stalePages.count > 0) [[NSFileManager defaultManager] removeItemAtPath:[self atlasPathWithScale:scale] error:NULL];
+                if (generation == _generation) self.loaded = YES;
+            }
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            NSArray *completionBlocks = [_completionBlocks copy];
+            [_completionBlocks removeAllObjects];
+            for (id block in completionBlocks) {
+                if (block != [NSNull null]) ((void (^)(PSCThumbnailAtlas *, NSError *))block)(self, success ? nil : error);
+            }
+        });
+    });
+}
+
+- (void)removeAtlas {
+    @synchronized(self) {
+        self.loaded = NO;
+        _generation++;
+        _sheetImages = nil;
+        _sheetSizes = nil;
+        _pageRects = nil;
+        _stalePages = nil;
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:[self atlasPathWithScale:UIScreen.mainScreen.scale] error:NULL];
+}
+
+- (NSUInteger)sheetCount {
+    @synchronized(self) {
+        return _sheetSizes.count;
+    }
+}
+
+- (CGImageRef)sheetImageForPage:(NSUInteger)page {
+    if (!self.isLoaded) return NULL;
+
+    @synchronized(self) {
+        if (page >= _pageRects.count || _pagesPerSheet == 0 || [_stalePages containsIndex:page]) return NULL;
+        NSUInteger sheet = page / _pagesPerSheet;
+        id sheetImage = _sheetImages[sheet];
+        if (sheetImage == [NSNull null]) {
+            // Only if decoding failed while loading.
+            CGImageRef decodedImage = [self createDecodedSheetAtIndex:sheet scale:UIScreen.mainScreen.scale];
+            if (!decodedImage) return NULL;
+            sheetImage = CFBridgingRelease(decodedImage);
+            _sheetImages[sheet] = sheetImage;
+        }
+        return (__bridge CGImageRef)sheetImage;
+    }
+}
+
+- (CGRect)contentsRectForPage:(NSUInteger)page {
+    @synchronized(self) {
+        if (!self.isLoaded || page >= _pageRects.count || [_stalePages containsIndex:page]) return CGRectZero;
+        CGRect pageRect = [_pageRects[page] CGRectValue];
+        CGSize sheetSize = [_sheetSizes[page / _pagesPerSheet] CGSizeValue];
+        if (CGRectIsEmpty(pageRect) || sheetSize.width == 0 || sheetSize.height == 0) return CGRectZero;
+        return CGRectMake(pageRect.origin.x / sheetSize.width, pageRect.origin.y / sheetSize.height, pageRect.size.width / sheetSize.width, pageRect.size.height / sheetSize.height);
+    }
+}
+
+- (UIImage *)imageForPage:(NSUInteger)page {
+    CGImageRef sheetImage = [self sheetImageForPage:page];
+    if (!sheetImage) return nil;
+
+    CGRect pageRect;
+    @synchronized(self) {
+        pageRect = [_pageRects[page] CGRectValue];
+    }
+    if (CGRectIsEmpty(pageRect)) return nil;
+    CGImageRef pageImage = CGImageCreateWithImageInRect(sheetImage, pageRect);
+    UIImage *image = [UIImage imageWithCGImage:pageImage scale:UIScreen.mainScreen.scale orientation:UIImageOrientationUp];
+    CGImageRelease(pageImage);
+    return image;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
++ (NSString *)atlasDirectoryPath {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [[cachesPath stringByAppendingPathComponent:PSPDFCache.sharedCache.cacheDirectory] stringByAppendingPathComponent:@"PSCThumbnailAtlas"];
+}
+
+// Atlases of UID that are still in memory. If remove is set, they are evicted, so the next lookup starts over.
++ (NSArray *)liveAtlasesWithUID:(NSString *)UID remove:(BOOL)remove {
+    NSCache *atlases = [self atlases];
+    NSMutableArray *liveAtlases = [NSMutableArray array];
+    @synchronized(atlases) {
+        NSMutableDictionary *atlasKeys = [self atlasKeys];
+        for (NSString *key in [atlasKeys[UID] copy]) {
+            PSCThumbnailAtlas *atlas = [atlases objectForKey:key];
+            if (atlas) [liveAtlases addObject:atlas];
+            else [atlasKeys[UID] removeObject:key];
+            if (remove) [atlases removeObjectForKey:key];
+        }
+        if (remove || [atlasKeys[UID] count] == 0) [atlasKeys removeObjectForKey:UID];
+    }
+    return liveAtlases;
+}
+
+// Deletes the atlases of UID for all sizes and scales. Names are <UID>-<width>x<height>@<scale>x, UIDs may contain dashes.
++ (void)removeAtlasFilesWithUID:(NSString *)UID {
+    NSString *directoryPath = [self atlasDirectoryPath];
+    NSString *prefix = [UID stringByAppendingString:@"-"];
+    NSFileManager *fileManager = [NSFileManager new];
+    for (NSString *atlasName in [fileManager contentsOfDirectoryAtPath:directoryPath error:NULL]) {
+        if (![atlasName hasPrefix:prefix]) continue;
+        NSString *suffix = [atlasName substringFromIndex:prefix.length];
+        NSScanner *scanner = [NSScanner scannerWithString:suffix];
+        if ([scanner scanInteger:NULL] && [scanner scanString:@"x" intoString:NULL] && [scanner scanInteger:NULL] && [scanner scanString:@"@" intoString:NULL] &&
+            [scanner scanInteger:NULL] && [scanner scanString:@"x" intoString:NULL] && scanner.isAtEnd) {
+            [fileManager removeItemAtPath:[directoryPath stringByAppendingPathComponent:atlasName] error:NULL];
+        }
+    }
+}
+
+- (void)invalidatePage:(NSUInteger)page {
+    @synchronized(self) {
+        if (!_stalePages) _stalePages = [NSMutableIndexSet indexSet];
+        if (page == NSNotFound) [_stalePages addIndexesInRange:NSMakeRange(0, self.document.pageCount)];
+        else [_stalePages addIndex:page];
+    }
+}
+
+- (NSString *)atlasPathWithScale:(CGFloat)scale {
+    NSString *atlasName = [NSString stringWithFormat:@"%@-%.0fx%.0f@%.0fx", self.document.UID, self.size.width, self.size.height, scale];
+    return [[self.class atlasDirectoryPath] stringByAppendingPathComponent:atlasName];
+}
+
+- (NSString *)sheetPathForIndex:(NSUInteger)sheet scale:(CGFloat)scale {
+    return [[self atlasPathWithScale:scale] stringByAppendingPathComponent:[NSString stringWithFormat:@"sheet-%d.jpg", sheet]];
+}
+
+- (CGSize)cellSizeWithScale:(CGFloat)scale {
+    return CGSizeMake(ceilf(self.size.width * scale), ceilf(self.size.height * scale));
+}
+
+- (BOOL)loadIndexWithScale:(CGFloat)scale {
+    NSDictionary *index = [NSDictionary dictionaryWithContentsOfFile:[[self atlasPathWithScale:scale] stringByAppendingPathComponent:@"index.plist"]];
+    if ([index[PSCThumbnailAtlasVersionKey] integerValue] != kPSCThumbnailAtlasVersion ||
+        ![index[PSCThumbnailAtlasUIDKey] isEqual:self.document.UID] ||
+        [index[PSCThumbnailAtlasPageCountKey] unsignedIntegerValue] != self.document.pageCount ||
+        !CGSizeEqualToSize(CGSizeFromString(index[PSCThumbnailAtlasCellSizeKey]), [self cellSizeWithScale:scale])) {
+        return NO;
+    }
+
+    NSMutableArray *sheetSizes = [NSMutableArray array];
+    for (NSString *sheetSize in index[PSCThumbnailAtlasSheetSizesKey]) {
+        if (![[NSFileManager defaultManager] fileExistsAtPath:[self sheetPathForIndex:sheetSizes.count scale:scale]]) return NO;
+        [sheetSizes addObject:[NSValue valueWithCGSize:CGSizeFromString(sheetSize)]];
+    }
+    NSMutableArray *pageRects = [NSMutableArray array];
+    for (NSString *pageRect in index[PSCThumbnailAtlasPageRectsKey]) {
+        [pageRects addObject:[NSValue valueWithCGRect:CGRectFromString(pageRect)]];
+    }
+    NSUInteger pagesPerSheet = [index[PSCThumbnailAtlasPagesPerSheetKey] unsignedIntegerValue];
+    if (pageRects.count != self.document.pageCount || pagesPerSheet == 0 || sheetSizes.count != (pageRects.count + pagesPerSheet - 1) / pagesPerSheet) return NO;
+
+    [self setSheetSizes:sheetSizes pageRects:pageRects pagesPerSheet:pagesPerSheet sheetImages:nil];
+    return YES;
+}
+
+- (BOOL)buildWithScale:(CGFloat)scale error:(NSError **)error {
+    NSUInteger pageCount = self.document.pageCount;
+    if (!self.document.isValid || pageCount == 0) {
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeUnableToOpenPDF userInfo:@{NSLocalizedDescriptionKey : @"Document is invalid."}];
+        return NO;
+    }
+
+    CGSize cellSize = [self cellSizeWithScale:scale];
+    CGFloat maximumSheetSize = MAX(self.maximumSheetSize, MAX(cellSize.width, cellSize.height));
+    NSUInteger columns = MAX((NSUInteger)(maximumSheetSize / cellSize.width), 1U);
+    NSUInteger rows = MAX((NSUInteger)(maximumSheetSize / cellSize.height), 1U);
+    NSUInteger pagesPerSheet = columns * rows;
+    NSUInteger sheetCount = (pageCount + pagesPerSheet - 1) / pagesPerSheet;
+
+    // Encrypted documents must not leave images on disk.
+    BOOL writeToDisk = self.document.diskCacheStrategy != PSPDFDiskCacheStrategyNothing;
+    NSString *atlasPath = [self atlasPathWithScale:scale];
+    if (writeToDisk) {
+        [[NSFileManager defaultManager] removeItemAtPath:atlasPath error:NULL];
+        [[NSFileManager defaultManager] createDirectoryAtPath:atlasPath withIntermediateDirectories:YES attributes:nil error:NULL];
+    }
+
+    PSPDFCache *cache = PSPDFCache.sharedCache;
+    PSPDFCacheOptions cacheOptions = PSPDFCacheOptionDiskLoadSync | PSPDFCacheOptionRenderSync | PSPDFCacheOptionMemoryStoreNever | PSPDFCacheOptionActualityIgnore | PSPDFCacheOptionSizeAllowLarger;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    NSMutableArray *sheetSizes = [NSMutableArray arrayWithCapacity:sheetCount];
+    NSMutableArray *indexSheetSizes = [NSMutableArray arrayWithCapacity:sheetCount];
+    NSMutableArray *sheetImages = [NSMutableArray arrayWithCapacity:sheetCount];
+    NSMutableArray *pageRects = [NSMutableArray arrayWithCapacity:pageCount];
+    NSMutableArray *indexPageRects = [NSMutableArray arrayWithCapacity:pageCount];
+    BOOL success = YES;
+
+    for (NSUInteger sheet = 0; sheet < sheetCount && success; sheet++) {
+        NSUInteger firstPage = sheet * pagesPerSheet;
+        NSUInteger sheetPageCount = MIN(pagesPerSheet, pageCount - firstPage);
+        CGSize sheetSize = CGSizeMake(MIN(sheetPageCount, columns) * cellSize.width, ((sheetPageCount + columns - 1) / columns) * cellSize.height);
+        CGContextRef context = CGBitmapContextCreate(NULL, (size_t)sheetSize.width, (size_t)sheetSize.height, 8, 0, colorSpace, kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+        if (!context) {
+            success = NO;
+            break;
+        }
+        CGContextSetFillColorWithColor(context, UIColor.whiteColor.CGColor);
+        CGContextFillRect(context, (CGRect){.size = sheetSize});
+
+        for (NSUInteger idx = 0; idx < sheetPageCount; idx++) {
+            @autoreleasepool {
+                NSUInteger page = firstPage + idx;
+                UIImage *image = [cache imageFromDocument:self.document andPage:page withSize:self.size options:cacheOptions];
+                CGRect pageRect = CGRectZero;
+                if (image.CGImage) {
+                    // Aspect fit, centered in the cell. pageRect has its origin at the top left, like the sheet image.
+                    CGSize imageSize = CGSizeMake(CGImageGetWidth(image.CGImage), CGImageGetHeight(image.CGImage));
+                    CGFloat fitScale = MIN(cellSize.width / imageSize.width, cellSize.height / imageSize.height);
+                    CGSize fitSize = CGSizeMake(floorf(imageSize.width * fitScale), floorf(imageSize.height * fitScale));
+                    CGPoint cellOrigin = CGPointMake((idx % columns) * cellSize.width, (idx / columns) * cellSize.height);
+                    pageRect = CGRectMake(cellOrigin.x + floorf((cellSize.width - fitSize.width) / 2), cellOrigin.y + floorf((cellSize.height - fitSize.height) / 2), fitSize.width, fitSize.height);
+                    CGRect drawRect = pageRect;
+                    drawRect.origin.y = sheetSize.height - CGRectGetMaxY(pageRect);
+
+                    // Scale with the downscaler (the cache may return a full page image), so drawing is a plain copy.
+                    UIImage *fitImage = [PSCImageDownscaler imageByScalingImage:image toSize:CGSizeMake(fitSize.width / image.scale, fitSize.height / image.scale) quality:PSCImageDownscalerQualityHigh];
+                    CGContextDrawImage(context, drawRect, (fitImage ?: image).CGImage);
+                }else {
+                    PSCLog(@"No thumbnail for page %d of %@", page, self.document.title);
+                }
+                [pageRects addObject:[NSValue valueWithCGRect:pageRect]];
+                [indexPageRects addObject:NSStringFromCGRect(pageRect)];
+            }
+        }
+
+        CGImageRef sheetImage = CGBitmapContextCreateImage(context);
+        CGContextRelease(context);
+        if (writeToDisk) {
+            NSData *JPEGData = UIImageJPEGRepresentation([UIImage imageWithCGImage:sheetImage], 0.8f);
+            success = [JPEGData writeToFile:[self sheetPathForIndex:sheet scale:scale] atomically:YES];
+        }
+        [sheetSizes addObject:[NSValue valueWithCGSize:sheetSize]];
+        [indexSheetSizes addObject:NSStringFromCGSize(sheetSize)];
+        if (sheetImage) [sheetImages addObject:CFBridgingRelease(sheetImage)];
+        else success = NO;
+    }
+    CGColorSpaceRelease(colorSpace);
+
+    // The index is written last; its presence marks a complete atlas.
+    if (success && writeToDisk) {
+        NSDictionary *index = @{PSCThumbnailAtlasVersionKey : @(kPSCThumbnailAtlasVersion),
+                                PSCThumbnailAtlasUIDKey : self.document.UID,
+                                PSCThumbnailAtlasPageCountKey : @(pageCount),
+                                PSCThumbnailAtlasCellSizeKey : NSStringFromCGSize(cellSize),
+                                PSCThumbnailAtlasPagesPerSheetKey : @(pagesPerSheet),
+                                PSCThumbnailAtlasSheetSizesKey : indexSheetSizes,
+                                PSCThumbnailAtlasPageRectsKey : indexPageRects};
+        success = [index writeToFile:[atlasPath stringByAppendingPathComponent:@"index.plist"] atomically:YES];
+    }
+    if (!success) {
+        if (writeToDisk) [[NSFileManager defaultManager] removeItemAtPath:atlasPath error:NULL];
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodePageRenderGraphicsContextNil userInfo:@{NSLocalizedDescriptionKey : @"Failed to build thumbnail atlas."}];
+        return NO;
+    }
+
+    // Freshly built sheets are already decoded; keep them.
+    [self setSheetSizes:sheetSizes pageRects:pageRects pagesPerSheet:pagesPerSheet sheetImages:sheetImages];
+    return YES;
+}
+
+- (CGImageRef)createDecodedSheetAtIndex:(NSUInteger)sheet scale:(CGFloat)scale {
+    NSURL *sheetURL = [NSURL fileURLWithPath:[self sheetPathForIndex:sheet scale:scale]];
+    CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)sheetURL, NULL);
+    CGImageRef image = imageSource ? CGImageSourceCreateImageAtIndex(imageSource, 0, NULL) : NULL;
+    CGImageRef decodedImage = PSCCreateDecodedImage(image);
+    if (!decodedImage) PSCLog(@"Failed to load atlas sheet %@", sheetURL.lastPathComponent);
+    if (image) CGImageRelease(image);
+    if (imageSource) CFRelease(imageSource);
+    return decodedImage;
+}
+
+// Decodes all sheets that aren't decoded yet. Runs outside the lock; only storing the results takes it.
+- (void)decodeSheetsWithScale:(CGFloat)scale {
+    NSUInteger sheetCount = self.sheetCount;
+    for (NSUInteger sheet = 0; sheet < sheetCount; sheet++) {
+        @synchronized(self) {
+            if (sheet >= _sheetImages.count || _sheetImages[sheet] != [NSNull null]) continue;
+        }
+        CGImageRef decodedImage = [self createDecodedSheetAtIndex:sheet scale:scale];
+        if (!decodedImage) continue;
+        @synchronized(self) {
+            if (sheet < _sheetImages.count && _sheetImages[sheet] == [NSNull null]) _sheetImages[sheet] = (__bridge id)decodedImage;
+        }
+        CGImageRelease(decodedImage);
+    }
+}
+
+- (void)setSheetSizes:(NSArray *)sheetSizes pageRects:(NSArray *)pageRects pagesPerSheet:(NSUInteger)pagesPerSheet sheetImages:(NSArray *)sheetImages {
+    @synchronized(self) {
+        _sheetSizes = sheetSizes;
+        _pageRects = pageRects;
+        _pagesPerSheet = pagesPerSheet;
+        _sheetImages = [NSMutableArray arrayWithCapacity:sheetSizes.count];
+        for (NSUInteger idx = 0; idx < sheetSizes.count; idx++) {
+            [_sheetImages addObject:idx < sheetImages.count ? sheetImages[idx] : [NSNull null]];
+        }
+    }
+}
+
+@end
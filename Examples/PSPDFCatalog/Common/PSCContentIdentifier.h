@@ -0,0 +1,60 @@
+//
+//  PSCContentIdentifier.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Content-addressed UIDs for PDF files.
+
+ PSPDFDocument's UID is derived from the file path, so identical files at two locations (or a re-download with identical bytes)
+ start with a cold render cache, text cache and saved view state. Using a hash of the content as UID lets them share all of that.
+
+ The sampled hash covers the file size, the first and last sampleSize bytes, the section the startxref entry points to,
+ and a few evenly spaced blocks from the middle. Any regular save rewrites the trailer and the xref, so the sample catches
+ practically every real change while reading only a few hundred KB of each file.
+ Files that are smaller than the sample are hashed completely. If a file has the same sampled hash as a file at another path
+ that already got that UID (e.g. an earlier download), both are hashed completely to rule out a collision.
+
+ The first UID assigned to a path is persisted and kept: saving annotations into the PDF changes its size and content,
+ but bookmarks, annotations, view state and cached pages stay under the same UID. Documents that already have data under
+ their current UID (installs from before content UIDs) keep that UID.
+
+ Hashes are persisted per path, file size and modification date, so unchanged files are never read twice.
+ */
+@interface PSCContentIdentifier : NSObject
+
+/// Shared instance.
++ (instancetype)sharedIdentifier;
+
+/// Sampled content hash. Returns nil and sets error if the file can't be read.
+- (NSString *)sampledHashForFileAtURL:(NSURL *)fileURL error:(NSError **)error;
+
+/// SHA1 of the complete file. Returns nil and sets error if the file can't be read.
+- (NSString *)fullHashForFileAtURL:(NSURL *)fileURL error:(NSError **)error;
+
+/// Cached variant of sampledHashForFileAtURL:error:, or fullHashForFileAtURL:error: with alwaysUseFullHash.
+- (NSString *)contentUIDForFileAtURL:(NSURL *)fileURL;
+
+/// UID for a single-file document: the UID assigned to its path before, else its content UID (see above). nil for other documents.
+/// Synchronous; call from a background thread, before the document is first used.
+- (NSString *)UIDForDocument:(PSPDFDocument *)document;
+
+/// Sets the UID of all single-file documents to UIDForDocument:. Synchronous; call from a background thread.
+/// Needs to be called before the documents are first rendered, else the old UID is already in use.
+- (void)assignContentUIDsToDocuments:(NSArray *)documents;
+
+/// Asynchronous variant. completionBlock is called on the main thread.
+- (void)assignContentUIDsToDocuments:(NSArray *)documents completionBlock:(dispatch_block_t)completionBlock;
+
+/// Always hash the complete file. Slower, but immune to changes that leave all sampled regions intact. Defaults to NO.
+@property (atomic, assign) BOOL alwaysUseFullHash;
+
+/// Size of the head and tail regions that are hashed. Defaults to 64KB.
+@property (atomic, assign) NSUInteger sampleSize;
+
+/// Removes all persisted hashes. Assigned UIDs are kept.
+- (void)clearCache;
+
+@end
@@ -0,0 +1,320 @@
+//
+//  PSCContentIdentifier.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCContentIdentifier.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+#define kPSCMiddleSampleCount 4
+#define kPSCMiddleSampleSize 4096
+#define kPSCFullHashChunkSize (1024 * 1024)
+
+static NSString *const PSCContentIdentifierSizeKey = @"size";
+static NSString *const PSCContentIdentifierModificationDateKey = @"modificationDate";
+static NSString *const PSCContentIdentifierSampledHashKey = @"sampledHash";
+static NSString *const PSCContentIdentifierFullHashKey = @"fullHash";
+
+@interface PSCContentIdentifier () {
+    NSMutableDictionary *_entries;      // path -> entry dictionary
+    BOOL _entriesChanged;
+    NSMutableDictionary *_assignedUIDs; // path -> UID, never changes once assigned
+    BOOL _assignedUIDsChanged;
+}
+@end
+
+@implementation PSCContentIdentifier
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (instancetype)sharedIdentifier {
+    static PSCContentIdentifier *_sharedIdentifier;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedIdentifier = [self new];
+    });
+    return _sharedIdentifier;
+}
+
+static NSString *PSCHexStringFromDigest(const unsigned char *digest) {
+    NSMutableString *string = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (NSUInteger idx = 0; idx < CC_SHA1_DIGEST_LENGTH; idx++) {
+        [string appendFormat:@"%02x", digest[idx]];
+    }
+    return string;
+}
+
+static NSError *PSCPOSIXError(void) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+}
+
+// Reads length bytes at offset into buffer and adds them to the hash. Returns the number of bytes read, or -1.
+static ssize_t PSCHashRange(int fileDescriptor, off_t offset, size_t length, NSMutableData *buffer, CC_SHA1_CTX *context) {
+    if (buffer.length < length) buffer.length = length;
+    ssize_t readLength = pread(fileDescriptor, buffer.mutableBytes, length, offset);
+    if (readLength > 0) CC_SHA1_Update(context, buffer.mutableBytes, (CC_LONG)readLength);
+    return readLength;
+}
+
+// Returns the offset after the last "startxref" keyword in bytes, or -1.
+static long long PSCStartXRefOffset(const char *bytes, size_t length) {
+    static const char keyword[] = "startxref";
+    const size_t keywordLength = sizeof(keyword) - 1;
+    if (length <= keywordLength) return -1;
+
+    for (size_t idx = length - keywordLength; idx > 0; idx--) {
+        if (memcmp(bytes + idx, keyword, keywordLength) == 0) {
+            size_t position = idx + keywordLength;
+            while (position < length && isspace((unsigned char)bytes[position])) position++;
+            long long offset = 0;
+            BOOL hasDigits = NO;
+            while (position < length && isdigit((unsigned char)bytes[position])) {
+                offset = offset * 10 + (bytes[position++] - '0');
+                hasDigits = YES;
+            }
+            return hasDigits ? offset : -1;
+        }
+    }
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _sampleSize = 64 * 1024;
+        _entries = [NSMutableDictionary dictionaryWithContentsOfFile:[self cachePath]] ?: [NSMutableDictionary dictionary];
+        _assignedUIDs = [NSMutableDictionary dictionaryWithContentsOfFile:[self assignedUIDsPath]] ?: [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSString *)sampledHashForFileAtURL:(NSURL *)fileURL error:(NSError **)error {
+    int fileDescriptor = open(fileURL.path.fileSystemRepresentation, O_RDONLY);
+    if (fileDescriptor < 0) {
+        if (error) *error = PSCPOSIXError();
+        return nil;
+    }
+
+    struct stat fileStat;
+    fstat(fileDescriptor, &fileStat);
+    off_t fileSize = fileStat.st_size;
+    size_t sampleSize = MAX(self.sampleSize, 4096U);
+
+    // Not worth sampling.
+    if (fileSize <= (off_t)(sampleSize * 4)) {
+        close(fileDescriptor);
+        return [self fullHashForFileAtURL:fileURL error:error];
+    }
+
+    CC_SHA1_CTX context;
+    CC_SHA1_Init(&context);
+    uint64_t littleEndianSize = OSSwapHostToLittleInt64((uint64_t)fileSize);
+    CC_SHA1_Update(&context, &littleEndianSize, sizeof(littleEndianSize));
+
+    NSMutableData *buffer = [NSMutableData dataWithLength:sampleSize];
+    BOOL success = PSCHashRange(fileDescriptor, 0, sampleSize, buffer, &context) == (ssize_t)sampleSize;
+
+    for (NSUInteger idx = 1; success && idx <= kPSCMiddleSampleCount; idx++) {
+        off_t offset = fileSize / (kPSCMiddleSampleCount + 1) * idx;
+        success = PSCHashRange(fileDescriptor, offset, kPSCMiddleSampleSize, buffer, &context) == kPSCMiddleSampleSize;
+    }
+
+    // The tail contains the trailer and startxref; the xref section it points to has an offset for every object.
+    off_t tailOffset = fileSize - sampleSize;
+    success = success && PSCHashRange(fileDescriptor, tailOffset, sampleSize, buffer, &context) == (ssize_t)sampleSize;
+    if (success) {
+        long long xrefOffset = PSCStartXRefOffset(buffer.bytes, sampleSize);
+        if (xrefOffset >= (long long)sampleSize && xrefOffset < tailOffset) {
+            size_t xrefLength = (size_t)MIN((off_t)sampleSize, tailOffset - xrefOffset);
+            success = PSCHashRange(fileDescriptor, (off_t)xrefOffset, xrefLength, buffer, &context) == (ssize_t)xrefLength;
+        }
+    }
+    if (!success && error) *error = PSCPOSIXError();
+    close(fileDescriptor);
+    if (!success) return nil;
+
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1_Final(digest, &context);
+    return PSCHexStringFromDigest(digest);
+}
+
+- (NSString *)fullHashForFileAtURL:(NSURL *)fileURL error:(NSError **)error {
+    NSData *data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:error];
+    if (!data) return nil;
+
+    CC_SHA1_CTX context;
+    CC_SHA1_Init(&context);
+    for (NSUInteger offset = 0; offset < data.length; offset += kPSCFullHashChunkSize) {
+        // Touching the mapped pages in chunks keeps the resident size small.
+        @autoreleasepool {
+            CC_SHA1_Update(&context, (const char *)data.bytes + offset, (CC_LONG)MIN(kPSCFullHashChunkSize, data.length - offset));
+        }
+    }
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1_Final(digest, &context);
+    return PSCHexStringFromDigest(digest);
+}
+
+- (NSString *)contentUIDForFileAtURL:(NSURL *)fileURL {
+    return [self cachedHashForFileAtURL:fileURL full:self.alwaysUseFullHash];
+}
+
+- (NSString *)UIDForDocument:(PSPDFDocument *)document {
+    NSURL *fileURL = document.fileURL;
+    if ([document.files count] > 1 || !fileURL.isFileURL) return nil;
+    NSString *path = fileURL.path;
+
+    // Saving annotations into the file changes its content; the UID (and everything stored under it) must not follow.
+    @synchronized(self) {
+        NSString *assignedUID = _assignedUIDs[path];
+        if (assignedUID) return assignedUID;
+    }
+
+    // Installs from before content UIDs keep the UID their bookmarks, annotations and view state are stored under.
+    NSString *legacyUID = document.UID;
+    NSString *UID = [self hasDataForDocument:document] ? legacyUID : [self contentUIDForFileAtURL:fileURL];
+    if (!UID) return nil;
+    if (UID != legacyUID) UID = [self UIDResolvingCollisionsWithContentUID:UID forFileAtURL:fileURL];
+
+    @synchronized(self) {
+        // Another thread may have been faster.
+        NSString *assignedUID = _assignedUIDs[path];
+        if (assignedUID) return assignedUID;
+        _assignedUIDs[path] = UID;
+        _assignedUIDsChanged = YES;
+    }
+    [self saveCache];
+    return UID;
+}
+
+- (void)assignContentUIDsToDocuments:(NSArray *)documents {
+    for (PSPDFDocument *document in documents) {
+        NSString *UID = [self UIDForDocument:document];
+        if (UID && ![UID isEqualToString:document.UID]) document.UID = UID;
+    }
+    [self saveCache];
+}
+
+- (void)assignContentUIDsToDocuments:(NSArray *)documents completionBlock:(dispatch_block_t)completionBlock {
+    NSArray *documentsCopy = [documents copy];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self assignContentUIDsToDocuments:documentsCopy];
+        if (completionBlock) dispatch_async(dispatch_get_main_queue(), completionBlock);
+    });
+}
+
+// Assigned UIDs are kept; they aren't a cache.
+- (void)clearCache {
+    @synchronized(self) {
+        [_entries removeAllObjects];
+        [[NSFileManager defaultManager] removeItemAtPath:[self cachePath] error:NULL];
+        _entriesChanged = NO;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSString *)cachePath {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [cachesPath stringByAppendingPathComponent:@"PSCContentIdentifiers.plist"];
+}
+
+// Application Support isn't purged like Caches; losing the assignments would orphan the data stored under the UIDs.
+- (NSString *)assignedUIDsPath {
+    NSString *applicationSupportPath = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES)[0];
+    return [applicationSupportPath stringByAppendingPathComponent:@"PSCContentUIDs.plist"];
+}
+
+- (void)saveCache {
+    @synchronized(self) {
+        if (_entriesChanged) {
+            if (![_entries writeToFile:[self cachePath] atomically:YES]) PSCLog(@"Failed to save content identifiers.");
+            _entriesChanged = NO;
+        }
+        if (_assignedUIDsChanged) {
+            NSString *assignedUIDsPath = [self assignedUIDsPath];
+            [[NSFileManager defaultManager] createDirectoryAtPath:[assignedUIDsPath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+            if (![_assignedUIDs writeToFile:assignedUIDsPath atomically:YES]) PSCLog(@"Failed to save assigned UIDs.");
+            _assignedUIDsChanged = NO;
+        }
+    }
+}
+
+// Saved view state (see PSCMagazine) or anything in the cache directory (bookmarks, annotations) under the current UID.
+- (BOOL)hasDataForDocument:(PSPDFDocument *)document {
+    if (!document.UID) return NO;
+    if ([[NSUserDefaults standardUserDefaults] objectForKey:document.UID]) return YES;
+    NSString *cacheDirectory = document.cacheDirectory;
+    return cacheDirectory && [[[NSFileManager defaultManager] contentsOfDirectoryAtPath:cacheDirectory error:NULL] count] > 0;
+}
+
+// Files at other paths that were assigned the same sampled hash are compared completely, including earlier downloads.
+// If the content differs, the full hash is used instead.
+- (NSString *)UIDResolvingCollisionsWithContentUID:(NSString *)contentUID forFileAtURL:(NSURL *)fileURL {
+    if (self.alwaysUseFullHash) return contentUID;
+
+    NSArray *otherPaths;
+    @synchronized(self) {
+        otherPaths = [_assignedUIDs allKeysForObject:contentUID];
+    }
+    for (NSString *otherPath in otherPaths) {
+        if ([otherPath isEqualToString:fileURL.path]) continue;
+        NSString *otherFullHash = [self cachedHashForFileAtURL:[NSURL fileURLWithPath:otherPath] full:YES];
+        NSString *fullHash = [self cachedHashForFileAtURL:fileURL full:YES];
+        if (otherFullHash && fullHash && ![otherFullHash isEqualToString:fullHash]) {
+            PSCLog(@"Sampled hash collision between %@ and %@, using the full hash.", otherPath, fileURL.path);
+            return fullHash;
+        }
+    }
+    return contentUID;
+}
+
+- (NSString *)cachedHashForFileAtURL:(NSURL *)fileURL full:(BOOL)full {
+    NSString *path = fileURL.path;
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+    if (!attributes) return nil;
+    NSNumber *fileSize = attributes[NSFileSize];
+    NSDate *modificationDate = attributes[NSFileModificationDate];
+    NSString *hashKey = full ? PSCContentIdentifierFullHashKey : PSCContentIdentifierSampledHashKey;
+
+    NSMutableDictionary *entry;
+    @synchronized(self) {
+        entry = [_entries[path] mutableCopy];
+    }
+    if (![entry[PSCContentIdentifierSizeKey] isEqual:fileSize] || ![entry[PSCContentIdentifierModificationDateKey] isEqual:modificationDate]) {
+        entry = [@{PSCContentIdentifierSizeKey : fileSize, PSCContentIdentifierModificationDateKey : modificationDate} mutableCopy];
+    }
+    NSString *hash = entry[hashKey];
+    if (hash) return hash;
+
+    NSError *error = nil;
+    hash = full ? [self fullHashForFileAtURL:fileURL error:&error] : [self sampledHashForFileAtURL:fileURL error:&error];
+    if (!hash) {
+        PSCLog(@"Failed to hash %@: %@", path, [error localizedDescription]);
+        return nil;
+    }
+    entry[hashKey] = hash;
+    @synchronized(self) {
+        _entries[path] = entry;
+        _entriesChanged = YES;
+    }
+    return hash;
+}
+
+@end
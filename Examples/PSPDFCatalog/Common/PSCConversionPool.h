@@ -0,0 +1,71 @@
+//
+//  PSCConversionPool.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+typedef void (^PSCConversionCompletionBlock)(NSURL *outputFileURL, BOOL cached, NSError *error);
+
+/**
+ Converts HTML files, HTML strings and web pages to PDF, several at a time.
+
+ PSPDFProcessor's generatePDFFromURL: renders a fixed number of pages (kPSPDFProcessorNumberOfPages) and waits
+ kPSPDFProcessorAdditionalDelay per page. The pool loads the input into a web view, waits until the document has
+ finished loading and paginates it with UIPrintPageRenderer, so there are no blank pages and no fixed delays.
+ Up to maximumConcurrentConversionCount inputs are loaded concurrently; the remaining ones are queued in order.
+
+ Converted files are cached by the SHA1 of the input content and the page geometry, so unchanged inputs are not
+ converted again. Only file URLs and HTML strings are cached. Resources referenced by the HTML (images, style sheets)
+ are not part of the hash; call clearCache when only those changed.
+
+ Supported options: kPSPDFProcessorPageRect, kPSPDFProcessorPageBorderMargin, kPSPDFProcessorDocumentTitle and the
+ kCGPDFContext* document info keys. kPSPDFProcessorNumberOfPages and kPSPDFProcessorAdditionalDelay are ignored.
+ Completion blocks are called on the main thread.
+ */
+@interface PSCConversionPool : NSObject
+
+/// Shared pool.
++ (instancetype)sharedPool;
+
+/// Number of inputs that are loaded at the same time. Defaults to 4.
+@property (nonatomic, assign) NSUInteger maximumConcurrentConversionCount;
+
+/// A conversion fails if the input hasn't finished loading after this time. Defaults to 30 seconds.
+@property (nonatomic, assign) NSTimeInterval loadTimeout;
+
+/// Enables the converted output cache. Defaults to YES.
+@property (nonatomic, assign, getter=isCacheEnabled) BOOL cacheEnabled;
+
+/// Converts a file or web URL to outputFileURL.
+- (void)convertURL:(NSURL *)inputURL outputFileURL:(NSURL *)outputFileURL options:(NSDictionary *)options completionBlock:(PSCConversionCompletionBlock)completionBlock;
+
+/// Converts an HTML string to outputFileURL. Relative links are resolved against baseURL.
+- (void)convertHTMLString:(NSString *)HTML baseURL:(NSURL *)baseURL outputFileURL:(NSURL *)outputFileURL options:(NSDictionary *)options completionBlock:(PSCConversionCompletionBlock)completionBlock;
+
+/// Cancels all queued and running conversions. Their completion blocks are called with NSUserCancelledError.
+- (void)cancelAllConversions;
+
+/// Removes all cached output.
+- (void)clearCache;
+
+/// @name Statistics
+
+/// Number of queued and running conversions.
+@property (nonatomic, assign, readonly) NSUInteger pendingConversionCount;
+
+/// Number of inputs that have been converted.
+@property (nonatomic, assign, readonly) NSUInteger convertedCount;
+
+/// Number of conversions that were served from the cache.
+@property (nonatomic, assign, readonly) NSUInteger cacheHitCount;
+
+@end
+
+@interface PSCConversionPool (Benchmark)
+
+/// Converts fileURLs with the pool (without cache) and then with PSPDFProcessor's generatePDFFromURL:, and reports
+/// the wall clock time of both runs. Output files are deleted. completionBlock is called on the main thread.
+- (void)benchmarkWithFileURLs:(NSArray *)fileURLs options:(NSDictionary *)options completionBlock:(void (^)(NSTimeInterval poolTime, NSTimeInterval processorTime))completionBlock;
+
+@end
@@ -0,0 +1,439 @@
+//
+//  PSCConversionPool.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCConversionPool.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@interface PSCConversionJob : NSObject
+@property (nonatomic, strong) NSURL *inputURL;
+@property (nonatomic, copy) NSString *HTML;
+@property (nonatomic, strong) NSURL *baseURL;
+@property (nonatomic, strong) NSURL *outputFileURL;
+@property (nonatomic, copy) NSDictionary *options;
+@property (nonatomic, copy) PSCConversionCompletionBlock completionBlock;
+@property (nonatomic, assign) BOOL cacheable;
+@property (nonatomic, copy) NSString *cacheKey;
+@property (nonatomic, strong) UIWebView *webView;
+@end
+
+@implementation PSCConversionJob
+@end
+
+// Scheme of the URL the load observer navigates to once the document has finished loading.
+static NSString *const PSCConversionLoadedScheme = @"psc-conversion-loaded";
+
+// UIPrintPageRenderer takes the paper and printable rect from the print controller; without one they are overridden.
+@interface PSCPrintPageRenderer : UIPrintPageRenderer
+- (id)initWithPaperRect:(CGRect)paperRect printableRect:(CGRect)printableRect;
+@end
+
+@implementation PSCPrintPageRenderer {
+    CGRect _paperRect;
+    CGRect _printableRect;
+}
+
+- (id)initWithPaperRect:(CGRect)paperRect printableRect:(CGRect)printableRect {
+    if ((self = [super init])) {
+        _paperRect = paperRect;
+        _printableRect = printableRect;
+    }
+    return self;
+}
+
+- (CGRect)paperRect {
+    return _paperRect;
+}
+
+- (CGRect)printableRect {
+    return _printableRect;
+}
+
+@end
+
+@interface PSCConversionPool () <UIWebViewDelegate> {
+    NSMutableArray *_hashingJobs;
+    NSMutableArray *_queuedJobs;
+    NSMutableArray *_runningJobs;
+}
+@property (nonatomic, assign) NSUInteger convertedCount;
+@property (nonatomic, assign) NSUInteger cacheHitCount;
+@end
+
+static CGRect PSCPageRectForOptions(NSDictionary *options) {
+    NSValue *pageRect = options[kPSPDFProcessorPageRect];
+    return pageRect ? [pageRect CGRectValue] : CGRectMake(0, 0, 595, 842);
+}
+
+static UIEdgeInsets PSCPageMarginForOptions(NSDictionary *options) {
+    NSValue *pageMargin = options[kPSPDFProcessorPageBorderMargin];
+    return pageMargin ? [pageMargin UIEdgeInsetsValue] : UIEdgeInsetsMake(5, 5, 5, 5);
+}
+
+static NSDictionary *PSCDocumentInfoForOptions(NSDictionary *options) {
+    NSMutableDictionary *documentInfo = [NSMutableDictionary dictionary];
+    for (id key in @[(id)kCGPDFContextAuthor, (id)kCGPDFContextCreator, (id)kCGPDFContextTitle, (id)kCGPDFContextSubject, (id)kCGPDFContextKeywords, (id)kCGPDFContextOwnerPassword, (id)kCGPDFContextUserPassword, (id)kCGPDFContextAllowsPrinting, (id)kCGPDFContextAllowsCopying, (id)kCGPDFContextEncryptionKeyLength]) {
+        if (options[key]) documentInfo[key] = options[key];
+    }
+    if (options[kPSPDFProcessorDocumentTitle]) documentInfo[(id)kCGPDFContextTitle] = options[kPSPDFProcessorDocumentTitle];
+    return documentInfo;
+}
+
+static NSError *PSCConversionError(NSString *description) {
+    return [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToConvertToPDF userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+@implementation PSCConversionPool
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Static
+
++ (instancetype)sharedPool {
+    static PSCConversionPool *_sharedPool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedPool = [self new];
+    });
+    return _sharedPool;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)init {
+    if ((self = [super init])) {
+        _maximumConcurrentConversionCount = 4;
+        _loadTimeout = 30;
+        _cacheEnabled = YES;
+        _hashingJobs = [NSMutableArray array];
+        _queuedJobs = [NSMutableArray array];
+        _runningJobs = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: pending:%d converted:%d cacheHits:%d>", self.class, self, self.pendingConversionCount, self.convertedCount, self.cacheHitCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (void)convertURL:(NSURL *)inputURL outputFileURL:(NSURL *)outputFileURL options:(NSDictionary *)options completionBlock:(PSCConversionCompletionBlock)completionBlock {
+    PSCConversionJob *job = [PSCConversionJob new];
+    job.inputURL = inputURL;
+    job.outputFileURL = outputFileURL;
+    job.options = options;
+    job.completionBlock = completionBlock;
+    [self enqueueJob:job];
+}
+
+- (void)convertHTMLString:(NSString *)HTML baseURL:(NSURL *)baseURL outputFileURL:(NSURL *)outputFileURL options:(NSDictionary *)options completionBlock:(PSCConversionCompletionBlock)completionBlock {
+    PSCConversionJob *job = [PSCConversionJob new];
+    job.HTML = HTML ?: @"";
+    job.baseURL = baseURL;
+    job.outputFileURL = outputFileURL;
+    job.options = options;
+    job.completionBlock = completionBlock;
+    [self enqueueJob:job];
+}
+
+- (void)cancelAllConversions {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{ [self cancelAllConversions]; });
+        return;
+    }
+
+    NSError *cancelError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil];
+    NSMutableArray *jobs = [NSMutableArray arrayWithArray:_hashingJobs];
+    [jobs addObjectsFromArray:_queuedJobs];
+    [_hashingJobs removeAllObjects];
+    [_queuedJobs removeAllObjects];
+    for (PSCConversionJob *job in jobs) {
+        if (job.completionBlock) job.completionBlock(nil, NO, cancelError);
+    }
+    for (PSCConversionJob *job in [_runningJobs copy]) {
+        [self finishJob:job error:cancelError];
+    }
+}
+
+- (void)clearCache {
+    dispatch_async([self cacheQueue], ^{
+        [[NSFileManager defaultManager] removeItemAtURL:[self cacheDirectoryURL] error:NULL];
+    });
+}
+
+- (NSUInteger)pendingConversionCount {
+    return _hashingJobs.count + _queuedJobs.count + _runningJobs.count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Scheduling
+
+- (void)enqueueJob:(PSCConversionJob *)job {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{ [self enqueueJob:job]; });
+        return;
+    }
+
+    // Web pages can change any time.
+    job.cacheable = self.isCacheEnabled && (job.HTML || job.inputURL.isFileURL);
+    [_hashingJobs addObject:job];
+
+    // Hashing and copying cached files happens in the background, in parallel with the running conversions.
+    dispatch_async([self cacheQueue], ^{
+        NSString *cacheKey = job.cacheable ? [self cacheKeyForJob:job] : nil;
+        BOOL cacheHit = cacheKey && [self copyItemAtURL:[[self cacheDirectoryURL] URLByAppendingPathComponent:[cacheKey stringByAppendingPathExtension:@"pdf"]] toURL:job.outputFileURL];
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            // Cancelled in the meantime.
+            if (![_hashingJobs containsObject:job]) return;
+            [_hashingJobs removeObject:job];
+
+            if (cacheHit) {
+                self.cacheHitCount++;
+                if (job.completionBlock) job.completionBlock(job.outputFileURL, YES, nil);
+            }else {
+                job.cacheKey = cacheKey;
+                [_queuedJobs addObject:job];
+                [self startQueuedJobs];
+            }
+        });
+    });
+}
+
+- (void)startQueuedJobs {
+    while (_runningJobs.count < MAX(self.maximumConcurrentConversionCount, 1U) && _queuedJobs.count > 0) {
+        PSCConversionJob *job = _queuedJobs[0];
+        [_queuedJobs removeObjectAtIndex:0];
+        [_runningJobs addObject:job];
+
+        CGRect pageRect = PSCPageRectForOptions(job.options);
+        job.webView = [[UIWebView alloc] initWithFrame:(CGRect){.size = pageRect.size}];
+        job.webView.delegate = self;
+        if (job.HTML) {
+            [job.webView loadHTMLString:job.HTML baseURL:job.baseURL];
+        }else {
+            [job.webView loadRequest:[NSURLRequest requestWithURL:job.inputURL]];
+        }
+        [self performSelector:@selector(loadTimedOut:) withObject:job afterDelay:self.loadTimeout];
+    }
+}
+
+- (void)finishJob:(PSCConversionJob *)job error:(NSError *)error {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(loadTimedOut:) object:job];
+    job.webView.delegate = nil;
+    [job.webView stopLoading];
+    job.webView = nil;
+    [_runningJobs removeObject:job];
+
+    if (error) {
+        [[NSFileManager defaultManager] removeItemAtURL:job.outputFileURL error:NULL];
+    }else {
+        self.convertedCount++;
+    }
+
+    // The completion block may move or delete the output, so it's only called once the cache has its copy.
+    if (!error && job.cacheKey) {
+        dispatch_async([self cacheQueue], ^{
+            [[NSFileManager defaultManager] createDirectoryAtURL:[self cacheDirectoryURL] withIntermediateDirectories:YES attributes:nil error:NULL];
+            [self copyItemAtURL:job.outputFileURL toURL:[[self cacheDirectoryURL] URLByAppendingPathComponent:[job.cacheKey stringByAppendingPathExtension:@"pdf"]]];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (job.completionBlock) job.completionBlock(job.outputFileURL, NO, nil);
+            });
+        });
+    }else {
+        if (job.completionBlock) job.completionBlock(error ? nil : job.outputFileURL, NO, error);
+    }
+
+    [self startQueuedJobs];
+}
+
+- (void)loadTimedOut:(PSCConversionJob *)job {
+    PSCLog(@"Conversion of %@ timed out.", job.inputURL ?: @"HTML string");
+    [self finishJob:job error:PSCConversionError(@"Loading timed out.")];
+}
+
+- (PSCConversionJob *)jobForWebView:(UIWebView *)webView {
+    for (PSCConversionJob *job in _runningJobs) {
+        if (job.webView == webView) return job;
+    }
+    return nil;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - UIWebViewDelegate
+
+- (BOOL)webView:(UIWebView *)webView shouldStartLoadWithRequest:(NSURLRequest *)request navigationType:(UIWebViewNavigationType)navigationType {
+    if ([request.URL.scheme isEqualToString:PSCConversionLoadedScheme]) {
+        PSCConversionJob *job = [self jobForWebView:webView];
+        if (job) [self renderJobIfLoaded:job];
+        return NO;
+    }
+    return YES;
+}
+
+- (void)webViewDidFinishLoad:(UIWebView *)webView {
+    PSCConversionJob *job = [self jobForWebView:webView];
+    if (job) [self renderJobIfLoaded:job];
+}
+
+- (void)webView:(UIWebView *)webView didFailLoadWithError:(NSError *)error {
+    // Sub-frame loads that have been replaced by a newer request.
+    if ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled) return;
+
+    PSCConversionJob *job = [self jobForWebView:webView];
+    if (job) [self finishJob:job error:error];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Rendering
+
+// webViewDidFinishLoad: is called once per frame; render once the main document and all frames are complete.
+- (void)renderJobIfLoaded:(PSCConversionJob *)job {
+    if (![_runningJobs containsObject:job]) return;
+
+    if (job.webView.isLoading) return;
+    if (![[job.webView stringByEvaluatingJavaScriptFromString:@"document.readyState"] isEqualToString:@"complete"]) {
+        // Scripts still running; the page reports its load event via webView:shouldStartLoadWithRequest:navigationType:.
+        NSString *script = [NSString stringWithFormat:@"if (!window.pscLoadObserver) { window.pscLoadObserver = true; window.addEventListener('load', function() { window.location.href = '%@:'; }); }", PSCConversionLoadedScheme];
+        [job.webView stringByEvaluatingJavaScriptFromString:script];
+        return;
+    }
+
+    NSError *error = nil;
+    BOOL success = [self renderWebView:job.webView toURL:job.outputFileURL options:job.options error:&error];
+    [self finishJob:job error:success ? nil : error];
+}
+
+- (BOOL)renderWebView:(UIWebView *)webView toURL:(NSURL *)fileURL options:(NSDictionary *)options error:(NSError **)error {
+    CGRect pageRect = PSCPageRectForOptions(options);
+    CGRect printableRect = UIEdgeInsetsInsetRect(pageRect, PSCPageMarginForOptions(options));
+
+    // The print formatter lays out the content for the printable rect and knows the real number of pages.
+    PSCPrintPageRenderer *renderer = [[PSCPrintPageRenderer alloc] initWithPaperRect:pageRect printableRect:printableRect];
+    [renderer addPrintFormatter:webView.viewPrintFormatter startingAtPageAtIndex:0];
+    NSInteger pageCount = MAX(renderer.numberOfPages, 1);
+
+    if (!UIGraphicsBeginPDFContextToFile(fileURL.path, pageRect, PSCDocumentInfoForOptions(options))) {
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToGeneratePDFInvalidArguments userInfo:@{NSLocalizedDescriptionKey : @"Failed to create output file."}];
+        return NO;
+    }
+    [renderer prepareForDrawingPages:NSMakeRange(0, pageCount)];
+    for (NSInteger page = 0; page < pageCount; page++) {
+        @autoreleasepool {
+            UIGraphicsBeginPDFPage();
+            [renderer drawPageAtIndex:page inRect:UIGraphicsGetPDFContextBounds()];
+        }
+    }
+    UIGraphicsEndPDFContext();
+    return YES;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Cache
+
+- (dispatch_queue_t)cacheQueue {
+    static dispatch_queue_t _cacheQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _cacheQueue = dispatch_queue_create("com.PSPDFCatalog.conversionCache", DISPATCH_QUEUE_SERIAL);
+    });
+    return _cacheQueue;
+}
+
+- (NSURL *)cacheDirectoryURL {
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    return [NSURL fileURLWithPath:[cachesPath stringByAppendingPathComponent:@"PSCConversionCache"] isDirectory:YES];
+}
+
+// SHA1 of the input content and everything that affects the output.
+- (NSString *)cacheKeyForJob:(PSCConversionJob *)job {
+    NSData *content = job.HTML ? [job.HTML dataUsingEncoding:NSUTF8StringEncoding] : [NSData dataWithContentsOfURL:job.inputURL options:NSDataReadingMappedIfSafe error:NULL];
+    if (!content) return nil;
+
+    NSString *settings = [NSString stringWithFormat:@"%@|%@|%@|%@|%@", job.HTML ? @"html" : job.inputURL.pathExtension.lowercaseString, job.baseURL.absoluteString ?: @"", NSStringFromCGRect(PSCPageRectForOptions(job.options)), NSStringFromUIEdgeInsets(PSCPageMarginForOptions(job.options)), PSCDocumentInfoForOptions(job.options)];
+    NSData *settingsData = [settings dataUsingEncoding:NSUTF8StringEncoding];
+
+    CC_SHA1_CTX context;
+    CC_SHA1_Init(&context);
+    CC_SHA1_Update(&context, content.bytes, (CC_LONG)content.length);
+    CC_SHA1_Update(&context, settingsData.bytes, (CC_LONG)settingsData.length);
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1_Final(digest, &context);
+
+    NSMutableString *cacheKey = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (NSUInteger idx = 0; idx < CC_SHA1_DIGEST_LENGTH; idx++) {
+        [cacheKey appendFormat:@"%02x", digest[idx]];
+    }
+    return cacheKey;
+}
+
+- (BOOL)copyItemAtURL:(NSURL *)sourceURL toURL:(NSURL *)destinationURL {
+    NSFileManager *fileManager = [NSFileManager new];
+    if (![fileManager fileExistsAtPath:sourceURL.path]) return NO;
+    [fileManager removeItemAtURL:destinationURL error:NULL];
+    NSError *error = nil;
+    if (![fileManager copyItemAtURL:sourceURL toURL:destinationURL error:&error]) {
+        PSCLog(@"Failed to copy %@: %@", sourceURL.lastPathComponent, [error localizedDescription]);
+        return NO;
+    }
+    return YES;
+}
+
+@end
+
+@implementation PSCConversionPool (Benchmark)
+
+- (void)benchmarkWithFileURLs:(NSArray *)fileURLs options:(NSDictionary *)options completionBlock:(void (^)(NSTimeInterval poolTime, NSTimeInterval processorTime))completionBlock {
+    if (fileURLs.count == 0) {
+        if (completionBlock) dispatch_async(dispatch_get_main_queue(), ^{ completionBlock(0, 0); });
+        return;
+    }
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        BOOL cacheEnabled = self.isCacheEnabled;
+        self.cacheEnabled = NO;
+        __block NSUInteger remainingCount = fileURLs.count;
+        CFAbsoluteTime poolStartTime = CFAbsoluteTimeGetCurrent();
+        for (NSURL *fileURL in fileURLs) {
+            NSURL *outputURL = PSPDFTempFileURLWithPathExtension(@"benchmark", @"pdf");
+            [self convertURL:fileURL outputFileURL:outputURL options:options completionBlock:^(NSURL *outputFileURL, BOOL cached, NSError *error) {
+                if (error) PSCLog(@"Pool failed to convert %@: %@", fileURL.lastPathComponent, [error localizedDescription]);
+                [[NSFileManager defaultManager] removeItemAtURL:outputURL error:NULL];
+                if (--remainingCount > 0) return;
+
+                NSTimeInterval poolTime = CFAbsoluteTimeGetCurrent() - poolStartTime;
+                self.cacheEnabled = cacheEnabled;
+                [self benchmarkProcessorWithFileURLs:fileURLs options:options completionBlock:^(NSTimeInterval processorTime) {
+                    PSCLog(@"Converted %d files: pool %.2fs, PSPDFProcessor %.2fs", fileURLs.count, poolTime, processorTime);
+                    if (completionBlock) completionBlock(poolTime, processorTime);
+                }];
+            }];
+        }
+    });
+}
+
+- (void)benchmarkProcessorWithFileURLs:(NSArray *)fileURLs options:(NSDictionary *)options completionBlock:(void (^)(NSTimeInterval processorTime))completionBlock {
+    __block NSUInteger remainingCount = fileURLs.count;
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    for (NSURL *fileURL in fileURLs) {
+        NSURL *outputURL = PSPDFTempFileURLWithPathExtension(@"benchmark", @"pdf");
+        [[PSPDFProcessor defaultProcessor] generatePDFFromURL:fileURL outputFileURL:outputURL options:options completionBlock:^(NSURL *outputFileURL, NSError *error) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (error) PSCLog(@"PSPDFProcessor failed to convert %@: %@", fileURL.lastPathComponent, [error localizedDescription]);
+                [[NSFileManager defaultManager] removeItemAtURL:outputURL error:NULL];
+                if (--remainingCount == 0) completionBlock(CFAbsoluteTimeGetCurrent() - startTime);
+            });
+        }];
+    }
+}
+
+@end
@@ -0,0 +1,67 @@
+//
+//  PSCPDFPageCopier.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Extracts pages into a new PDF by copying the page objects instead of redrawing them.
+
+ PSPDFProcessor draws every page into a CGPDFContext, which re-encodes all content and embeds fonts and images
+ once per page. The copier writes the content streams, fonts, images and other resources of the source pages
+ directly into the new file. Each shared resource (fonts, images, graphic states, shadings, patterns) is written once.
+ If a stream can't be read, the copy fails instead of writing an empty stream.
+ Only pages that have annotations of the types in kPSPDFProcessorAnnotationTypes are flattened with PSPDFProcessor;
+ the resulting pages are then copied the same way.
+
+ Copied pages don't keep their annotations (as with PSPDFProcessor, unless flattened), outlines or form fields.
+ Options that the copier can't write (kPSPDFProcessorAnnotationAsDictionary, kCGPDFContext* passwords)
+ make it fall back to PSPDFProcessor.
+ */
+@interface PSCPDFPageCopier : NSObject
+
+/// Designated initializer.
+- (id)initWithDocument:(PSPDFDocument *)document;
+
+/// Source document.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Compress streams with Flate. CGPDF only hands out decoded stream data (except JPEG/JPEG2000 images). Defaults to YES.
+@property (nonatomic, assign) BOOL compressStreams;
+
+/// Writes the pages in pageRange to fileURL. Same options as PSPDFProcessor.
+- (BOOL)generatePDFWithPages:(NSIndexSet *)pageRange outputFileURL:(NSURL *)fileURL options:(NSDictionary *)options error:(NSError **)error;
+
+/// Variant that returns the new PDF as data.
+- (NSData *)generatePDFDataWithPages:(NSIndexSet *)pageRange options:(NSDictionary *)options error:(NSError **)error;
+
+/// @name Merging
+
+/// Starts a new file that pages of any CGPDFDocument can be appended to. Used by PSCParallelPDFExporter
+/// to merge its intermediate files without redrawing them. The copier's document isn't used; compressStreams applies.
+- (BOOL)beginMergingToURL:(NSURL *)fileURL;
+
+/// Copies page into the file. Objects shared with pages appended before from the same CGPDFDocument are written once.
+- (BOOL)appendPage:(CGPDFPageRef)page;
+
+/// Call after the last page of a CGPDFDocument was appended, before that document is released.
+/// Objects of the next document are never shared with the ones of the previous one.
+- (void)finishSourceDocument;
+
+/// Writes the page tree and the document info, and closes the file. info maps keys like Title or Author to strings.
+/// Returns NO and removes the file if writing failed.
+- (BOOL)finishMergingWithInfo:(NSDictionary *)info;
+
+/// @name Statistics (of the last run)
+
+/// Number of pages that were copied without flattening.
+@property (nonatomic, assign, readonly) NSUInteger copiedPageCount;
+
+/// Number of pages that were flattened with PSPDFProcessor first.
+@property (nonatomic, assign, readonly) NSUInteger flattenedPageCount;
+
+/// Number of objects written, excluding pages. Shared resources are counted once.
+@property (nonatomic, assign, readonly) NSUInteger writtenObjectCount;
+
+@end
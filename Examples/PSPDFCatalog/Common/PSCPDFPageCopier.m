@@ -0,0 +1,620 @@
+//
+//  PSCPDFPageCopier.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCPDFPageCopier.h"
+#include <zlib.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Guards against reference cycles between direct objects (which can't exist in valid files, but do in the wild).
+#define kPSCPageCopierMaximumDepth 64
+#define kPSCPageCopierBufferSize (64 * 1024)
+
+// Fixed object numbers; everything else is numbered as it is encountered.
+#define kPSCCatalogObjectNumber 1
+#define kPSCPagesObjectNumber 2
+#define kPSCInfoObjectNumber 3
+
+typedef struct {
+    CGPDFObjectType type;
+    const void *reference; // CGPDFDictionaryRef or CGPDFStreamRef
+    NSUInteger objectNumber;
+} PSCPendingObject;
+
+@interface PSCPDFPageCopier () {
+    NSOutputStream *_outputStream;
+    NSMutableData *_buffer;
+    unsigned long long _offset;
+    NSMutableArray *_objectOffsets;        // Index is object number - 1.
+    CFMutableDictionaryRef _objectNumbers; // CGPDF object pointer -> object number. Pointers are unique per CGPDFDocument.
+    NSMutableData *_pendingObjects;        // PSCPendingObject
+    NSMutableArray *_mergedPageObjectNumbers;
+    NSURL *_mergeURL;
+    BOOL _writeFailed;                     // Output couldn't be written or a source object couldn't be read.
+}
+@property (nonatomic, assign) NSUInteger copiedPageCount;
+@property (nonatomic, assign) NSUInteger flattenedPageCount;
+@property (nonatomic, assign) NSUInteger writtenObjectCount;
+- (void)writeValue:(CGPDFObjectRef)object depth:(NSUInteger)depth;
+- (void)writeResources:(CGPDFDictionaryRef)resources depth:(NSUInteger)depth;
+- (void)writeDictionaryReference:(CGPDFDictionaryRef)dictionary;
+- (void)appendName:(const char *)name;
+- (void)appendString:(NSString *)string;
+@end
+
+typedef struct {
+    __unsafe_unretained PSCPDFPageCopier *copier;
+    __unsafe_unretained NSSet *excludedKeys;
+    NSUInteger depth;
+    BOOL sharesDictionaries;                     // Dictionary values are written as indirect objects.
+    __unsafe_unretained NSSet *sharedCategories; // Keys whose dictionary values are written with sharesDictionaries.
+} PSCDictionaryWriterContext;
+
+static void PSCWriteDictionaryEntry(const char *key, CGPDFObjectRef value, void *info) {
+    PSCDictionaryWriterContext *context = info;
+    if ([context->excludedKeys containsObject:@(key)]) return;
+
+    [context->copier appendName:key];
+    [context->copier appendString:@" "];
+    CGPDFDictionaryRef dictionary;
+    if (context->sharesDictionaries && CGPDFObjectGetValue(value, kCGPDFObjectTypeDictionary, &dictionary)) {
+        [context->copier writeDictionaryReference:dictionary];
+    }else if ([context->sharedCategories containsObject:@(key)] && CGPDFObjectGetValue(value, kCGPDFObjectTypeDictionary, &dictionary)) {
+        PSCDictionaryWriterContext categoryContext = {context->copier, nil, context->depth + 1, YES, nil};
+        [context->copier appendString:@"<<"];
+        CGPDFDictionaryApplyFunction(dictionary, PSCWriteDictionaryEntry, &categoryContext);
+        [context->copier appendString:@">>"];
+    }else if (!strcmp(key, "Resources") && CGPDFObjectGetValue(value, kCGPDFObjectTypeDictionary, &dictionary)) {
+        // Form XObjects, patterns and Type3 fonts have their own resources.
+        [context->copier writeResources:dictionary depth:context->depth + 1];
+    }else {
+        [context->copier writeValue:value depth:context->depth + 1];
+    }
+    [context->copier appendString:@"\n"];
+}
+
+// Returns the value for key from dictionary or its ancestors in the page tree. (Resources, MediaBox, CropBox and Rotate are inheritable)
+static CGPDFObjectRef PSCInheritedPageObject(CGPDFDictionaryRef dictionary, const char *key) {
+    for (NSUInteger depth = 0; dictionary && depth < kPSCPageCopierMaximumDepth; depth++) {
+        CGPDFObjectRef object;
+        if (CGPDFDictionaryGetObject(dictionary, key, &object)) return object;
+        if (!CGPDFDictionaryGetDictionary(dictionary, "Parent", &dictionary)) break;
+    }
+    return NULL;
+}
+
+static NSString *PSCRealString(CGPDFReal value) {
+    // PDF doesn't allow exponents.
+    NSString *string = [NSString stringWithFormat:@"%.5f", value];
+    while ([string hasSuffix:@"0"]) string = [string substringToIndex:string.length - 1];
+    if ([string hasSuffix:@"."]) string = [string substringToIndex:string.length - 1];
+    return [string isEqualToString:@"-0"] ? @"0" : string;
+}
+
+static NSString *PSCRectString(CGRect rect) {
+    return [NSString stringWithFormat:@"[%@ %@ %@ %@]", PSCRealString(CGRectGetMinX(rect)), PSCRealString(CGRectGetMinY(rect)), PSCRealString(CGRectGetMaxX(rect)), PSCRealString(CGRectGetMaxY(rect))];
+}
+
+static NSData *PSCDeflateData(NSData *data) {
+    uLongf compressedLength = compressBound((uLong)data.length);
+    NSMutableData *compressedData = [NSMutableData dataWithLength:compressedLength];
+    if (compress2(compressedData.mutableBytes, &compressedLength, data.bytes, (uLong)data.length, Z_DEFAULT_COMPRESSION) != Z_OK) return nil;
+    compressedData.length = compressedLength;
+    return compressedData;
+}
+
+@implementation PSCPDFPageCopier
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super init])) {
+        _document = document;
+        _compressStreams = YES;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: %@ copied:%d flattened:%d objects:%d>", self.class, self, self.document.title, self.copiedPageCount, self.flattenedPageCount, self.writtenObjectCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)generatePDFWithPages:(NSIndexSet *)pageRange outputFileURL:(NSURL *)fileURL options:(NSDictionary *)options error:(NSError **)error {
+    if ([self.class requiresProcessorForOptions:options]) {
+        return [PSPDFProcessor.defaultProcessor generatePDFFromDocument:self.document pageRange:pageRange outputFileURL:fileURL options:options progressBlock:NULL error:error];
+    }
+    if (!self.document.isValid || pageRange.count == 0 || pageRange.lastIndex >= self.document.pageCount) {
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToGeneratePDFInvalidArguments userInfo:@{NSLocalizedDescriptionKey : @"Invalid document or page range."}];
+        return NO;
+    }
+    self.copiedPageCount = 0;
+    self.flattenedPageCount = 0;
+    self.writtenObjectCount = 0;
+
+    // Only pages with annotations that should be flattened need to be drawn.
+    NSMutableIndexSet *flattenPages = [NSMutableIndexSet indexSet];
+    PSPDFAnnotationType annotationTypes = [options[kPSPDFProcessorAnnotationTypes] unsignedIntegerValue];
+    if (annotationTypes != PSPDFAnnotationTypeNone) {
+        [pageRange enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+            if ([[self.document annotationsForPage:page type:annotationTypes] count] > 0) [flattenPages addIndex:page];
+        }];
+    }
+    CGPDFDocumentRef flattenedDocument = NULL;
+    if (flattenPages.count > 0) {
+        NSData *flattenedData = [PSPDFProcessor.defaultProcessor generatePDFFromDocument:self.document pageRange:flattenPages options:options progressBlock:NULL error:error];
+        if (!flattenedData) return NO;
+        CGDataProviderRef dataProvider = CGDataProviderCreateWithCFData((__bridge CFDataRef)flattenedData);
+        flattenedDocument = CGPDFDocumentCreateWithProvider(dataProvider);
+        CGDataProviderRelease(dataProvider);
+    }
+
+    [self beginWritingToURL:fileURL];
+    NSString *title = options[kPSPDFProcessorDocumentTitle] ?: self.document.title;
+
+    // Source documents stay open until the end, so the object pointers stay unique.
+    NSMutableArray *documentProviders = [NSMutableArray array];
+    NSMutableArray *documentRefs = [NSMutableArray array];
+    NSMutableArray *pageObjectNumbers = [NSMutableArray arrayWithCapacity:pageRange.count];
+    __block NSUInteger flattenedPageNumber = 0;
+    __block BOOL success = YES;
+    [pageRange enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        CGPDFPageRef pageRef = NULL;
+        if ([flattenPages containsIndex:page]) {
+            pageRef = CGPDFDocumentGetPage(flattenedDocument, ++flattenedPageNumber);
+            self.flattenedPageCount++;
+        }else {
+            PSPDFDocumentProvider *documentProvider = [self.document documentProviderForPage:page];
+            NSUInteger providerIndex = [documentProviders indexOfObjectIdenticalTo:documentProvider];
+            if (documentProvider && providerIndex == NSNotFound) {
+                CGPDFDocumentRef documentRef = [documentProvider requestDocumentRefWithOwner:self];
+                if (documentRef) {
+                    [documentProviders addObject:documentProvider];
+                    [documentRefs addObject:[NSValue valueWithPointer:documentRef]];
+                    providerIndex = documentProviders.count - 1;
+                }
+            }
+            if (providerIndex != NSNotFound) {
+                pageRef = CGPDFDocumentGetPage([documentRefs[providerIndex] pointerValue], [self.document pageNumberForPage:page]);
+            }
+            self.copiedPageCount++;
+        }
+        if (!pageRef) {
+            success = NO;
+            *stop = YES;
+            return;
+        }
+        [pageObjectNumbers addObject:@([self writePage:pageRef])];
+    }];
+
+    if (success) [self finishWritingWithPageObjectNumbers:pageObjectNumbers info:title ? @{@"Title" : title} : nil];
+    success = success && !_writeFailed;
+    self.writtenObjectCount = _objectOffsets.count - pageObjectNumbers.count - 3;
+    [self endWriting];
+
+    for (NSUInteger idx = 0; idx < documentProviders.count; idx++) {
+        [documentProviders[idx] releaseDocumentRef:[documentRefs[idx] pointerValue] withOwner:self];
+    }
+    CGPDFDocumentRelease(flattenedDocument);
+
+    if (!success) {
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToConvertToPDF userInfo:@{NSLocalizedDescriptionKey : @"Failed to copy pages."}];
+    }
+    return success;
+}
+
+- (NSData *)generatePDFDataWithPages:(NSIndexSet *)pageRange options:(NSDictionary *)options error:(NSError **)error {
+    NSURL *tempURL = PSPDFTempFileURLWithPathExtension(@"copy", @"pdf");
+    if (![self generatePDFWithPages:pageRange outputFileURL:tempURL options:options error:error]) return nil;
+
+    // The mapping stays valid after the file has been removed.
+    NSData *data = [NSData dataWithContentsOfURL:tempURL options:NSDataReadingMappedAlways error:error];
+    [[NSFileManager defaultManager] removeItemAtURL:tempURL error:NULL];
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Merging
+
+- (BOOL)beginMergingToURL:(NSURL *)fileURL {
+    [self beginWritingToURL:fileURL];
+    _mergeURL = fileURL;
+    _mergedPageObjectNumbers = [NSMutableArray array];
+    self.copiedPageCount = 0;
+    self.flattenedPageCount = 0;
+    self.writtenObjectCount = 0;
+    return !_writeFailed;
+}
+
+- (BOOL)appendPage:(CGPDFPageRef)page {
+    if (!_mergeURL || !page || _writeFailed) return NO;
+    [_mergedPageObjectNumbers addObject:@([self writePage:page])];
+    self.copiedPageCount++;
+    return !_writeFailed;
+}
+
+- (void)finishSourceDocument {
+    if (_objectNumbers) CFDictionaryRemoveAllValues(_objectNumbers);
+}
+
+- (BOOL)finishMergingWithInfo:(NSDictionary *)info {
+    if (!_mergeURL) return NO;
+
+    [self finishWritingWithPageObjectNumbers:_mergedPageObjectNumbers info:info];
+    BOOL success = !_writeFailed;
+    self.writtenObjectCount = _objectOffsets.count - _mergedPageObjectNumbers.count - 3;
+    [self endWriting];
+    if (!success) [[NSFileManager defaultManager] removeItemAtURL:_mergeURL error:NULL];
+    _mergeURL = nil;
+    _mergedPageObjectNumbers = nil;
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
++ (BOOL)requiresProcessorForOptions:(NSDictionary *)options {
+    if ([options[kPSPDFProcessorAnnotationAsDictionary] boolValue]) return YES;
+    return options[(id)kCGPDFContextUserPassword] || options[(id)kCGPDFContextOwnerPassword];
+}
+
+- (void)beginWritingToURL:(NSURL *)fileURL {
+    _outputStream = [NSOutputStream outputStreamWithURL:fileURL append:NO];
+    [_outputStream open];
+    _buffer = [NSMutableData dataWithCapacity:kPSCPageCopierBufferSize];
+    _offset = 0;
+    _writeFailed = _outputStream.streamStatus != NSStreamStatusOpen;
+    _objectOffsets = [NSMutableArray arrayWithObjects:@0, @0, @0, nil]; // Catalog, Pages, Info
+    _objectNumbers = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+    _pendingObjects = [NSMutableData data];
+
+    // Binary comment so the file is treated as binary.
+    [self appendString:@"%PDF-1.5\n"];
+    const unsigned char binaryComment[] = {'%', 0xE2, 0xE3, 0xCF, 0xD3, '\n'};
+    [self appendBytes:binaryComment length:sizeof(binaryComment)];
+}
+
+- (void)endWriting {
+    [self flush];
+    [_outputStream close];
+    _outputStream = nil;
+    _buffer = nil;
+    _objectOffsets = nil;
+    _pendingObjects = nil;
+    if (_objectNumbers) CFRelease(_objectNumbers);
+    _objectNumbers = NULL;
+}
+
+// info maps document information keys (Title, Author...) to strings.
+- (void)finishWritingWithPageObjectNumbers:(NSArray *)pageObjectNumbers info:(NSDictionary *)info {
+    [self beginObject:kPSCPagesObjectNumber];
+    [self appendString:@"<< /Type /Pages /Kids ["];
+    for (NSNumber *pageObjectNumber in pageObjectNumbers) {
+        [self appendString:[NSString stringWithFormat:@"%d 0 R ", pageObjectNumber.unsignedIntegerValue]];
+    }
+    [self appendString:[NSString stringWithFormat:@"] /Count %d >>", pageObjectNumbers.count]];
+    [self endObject];
+
+    [self beginObject:kPSCCatalogObjectNumber];
+    [self appendString:[NSString stringWithFormat:@"<< /Type /Catalog /Pages %d 0 R >>", kPSCPagesObjectNumber]];
+    [self endObject];
+
+    [self beginObject:kPSCInfoObjectNumber];
+    [self appendString:@"<< /Producer "];
+    [self appendTextString:@"PSPDFCatalog"];
+    for (NSString *key in info) {
+        if (![info[key] isKindOfClass:NSString.class]) continue;
+        [self appendString:@" "];
+        [self appendName:key.UTF8String];
+        [self appendString:@" "];
+        [self appendTextString:info[key]];
+    }
+    [self appendString:@" >>"];
+    [self endObject];
+
+    // Cross-reference table; every entry is exactly 20 bytes.
+    unsigned long long xrefOffset = _offset;
+    [self appendString:[NSString stringWithFormat:@"xref\n0 %d\n0000000000 65535 f \n", _objectOffsets.count + 1]];
+    for (NSNumber *objectOffset in _objectOffsets) {
+        [self appendString:[NSString stringWithFormat:@"%010llu 00000 n \n", objectOffset.unsignedLongLongValue]];
+    }
+    [self appendString:[NSString stringWithFormat:@"trailer\n<< /Size %d /Root %d 0 R /Info %d 0 R >>\nstartxref\n%llu\n%%%%EOF\n", _objectOffsets.count + 1, kPSCCatalogObjectNumber, kPSCInfoObjectNumber, xrefOffset]];
+}
+
+// Writes the page with inherited attributes resolved, then all objects it references.
+- (NSUInteger)writePage:(CGPDFPageRef)page {
+    CGPDFDictionaryRef pageDictionary = CGPDFPageGetDictionary(page);
+    CGRect mediaBox = CGPDFPageGetBoxRect(page, kCGPDFMediaBox);
+    CGRect cropBox = CGPDFPageGetBoxRect(page, kCGPDFCropBox);
+
+    NSUInteger objectNumber = [self reserveObjectNumber];
+    [self beginObject:objectNumber];
+    [self appendString:[NSString stringWithFormat:@"<< /Type /Page /Parent %d 0 R /MediaBox %@", kPSCPagesObjectNumber, PSCRectString(mediaBox)]];
+    if (!CGRectEqualToRect(cropBox, mediaBox)) [self appendString:[NSString stringWithFormat:@" /CropBox %@", PSCRectString(cropBox)]];
+    if (CGPDFPageGetRotationAngle(page) != 0) [self appendString:[NSString stringWithFormat:@" /Rotate %d", CGPDFPageGetRotationAngle(page)]];
+
+    CGPDFObjectRef resourcesObject = PSCInheritedPageObject(pageDictionary, "Resources");
+    CGPDFDictionaryRef resources;
+    if (resourcesObject && CGPDFObjectGetValue(resourcesObject, kCGPDFObjectTypeDictionary, &resources)) {
+        [self appendString:@"\n/Resources "];
+        [self writeResources:resources depth:0];
+    }
+    const char *copiedKeys[] = {"Contents", "Group", "UserUnit"};
+    for (NSUInteger idx = 0; idx < sizeof(copiedKeys) / sizeof(copiedKeys[0]); idx++) {
+        const char *key = copiedKeys[idx];
+        CGPDFObjectRef object;
+        if (CGPDFDictionaryGetObject(pageDictionary, key, &object)) {
+            [self appendString:@"\n"];
+            [self appendName:key];
+            [self appendString:@" "];
+            [self writeValue:object depth:0];
+        }
+    }
+    [self appendString:@" >>"];
+    [self endObject];
+
+    [self writePendingObjects];
+    return objectNumber;
+}
+
+- (void)writePendingObjects {
+    while (_pendingObjects.length > 0 && !_writeFailed) {
+        PSCPendingObject pendingObject;
+        NSUInteger lastLocation = _pendingObjects.length - sizeof(PSCPendingObject);
+        [_pendingObjects getBytes:&pendingObject range:NSMakeRange(lastLocation, sizeof(PSCPendingObject))];
+        _pendingObjects.length = lastLocation;
+
+        [self beginObject:pendingObject.objectNumber];
+        if (pendingObject.type == kCGPDFObjectTypeStream) {
+            [self writeStream:(CGPDFStreamRef)pendingObject.reference];
+        }else {
+            [self writeDictionary:(CGPDFDictionaryRef)pendingObject.reference depth:0 excludedKeys:nil];
+        }
+        [self endObject];
+    }
+}
+
+- (NSUInteger)objectNumberForReference:(const void *)reference type:(CGPDFObjectType)type {
+    NSUInteger objectNumber = (NSUInteger)CFDictionaryGetValue(_objectNumbers, reference);
+    if (objectNumber == 0) {
+        objectNumber = [self reserveObjectNumber];
+        CFDictionarySetValue(_objectNumbers, reference, (const void *)objectNumber);
+        PSCPendingObject pendingObject = {type, reference, objectNumber};
+        [_pendingObjects appendBytes:&pendingObject length:sizeof(pendingObject)];
+    }
+    return objectNumber;
+}
+
+- (void)writeValue:(CGPDFObjectRef)object depth:(NSUInteger)depth {
+    if (depth > kPSCPageCopierMaximumDepth) {
+        [self appendString:@"null"];
+        return;
+    }
+
+    switch (CGPDFObjectGetType(object)) {
+        case kCGPDFObjectTypeBoolean: {
+            CGPDFBoolean value;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeBoolean, &value);
+            [self appendString:value ? @"true" : @"false"];
+        }break;
+        case kCGPDFObjectTypeInteger: {
+            CGPDFInteger value;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeInteger, &value);
+            [self appendString:[NSString stringWithFormat:@"%ld", value]];
+        }break;
+        case kCGPDFObjectTypeReal: {
+            CGPDFReal value;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeReal, &value);
+            [self appendString:PSCRealString(value)];
+        }break;
+        case kCGPDFObjectTypeName: {
+            const char *name;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeName, &name);
+            [self appendName:name];
+        }break;
+        case kCGPDFObjectTypeString: {
+            CGPDFStringRef string;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeString, &string);
+            [self appendHexBytes:CGPDFStringGetBytePtr(string) length:CGPDFStringGetLength(string)];
+        }break;
+        case kCGPDFObjectTypeArray: {
+            CGPDFArrayRef array;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeArray, &array);
+            [self appendString:@"["];
+            for (size_t idx = 0; idx < CGPDFArrayGetCount(array); idx++) {
+                CGPDFObjectRef element;
+                if (idx > 0) [self appendString:@" "];
+                if (CGPDFArrayGetObject(array, idx, &element)) [self writeValue:element depth:depth + 1];
+                else [self appendString:@"null"];
+            }
+            [self appendString:@"]"];
+        }break;
+        case kCGPDFObjectTypeDictionary: {
+            CGPDFDictionaryRef dictionary;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeDictionary, &dictionary);
+            const char *type = NULL;
+            if (CGPDFDictionaryGetName(dictionary, "Type", &type)) {
+                // Typed dictionaries (fonts, descriptors...) are the ones that are shared.
+                [self writeDictionaryReference:dictionary];
+            }else {
+                [self writeDictionary:dictionary depth:depth excludedKeys:nil];
+            }
+        }break;
+        case kCGPDFObjectTypeStream: {
+            CGPDFStreamRef stream;
+            CGPDFObjectGetValue(object, kCGPDFObjectTypeStream, &stream);
+            [self appendString:[NSString stringWithFormat:@"%d 0 R", [self objectNumberForReference:stream type:kCGPDFObjectTypeStream]]];
+        }break;
+        case kCGPDFObjectTypeNull:
+        default:
+            [self appendString:@"null"];
+            break;
+    }
+}
+
+- (void)writeDictionaryReference:(CGPDFDictionaryRef)dictionary {
+    const char *type = NULL;
+    CGPDFDictionaryGetName(dictionary, "Type", &type);
+    if (type && (!strcmp(type, "Page") || !strcmp(type, "Pages") || !strcmp(type, "Catalog") || !strcmp(type, "Annot"))) {
+        // Would drag in the source document structure.
+        [self appendString:@"null"];
+    }else {
+        [self appendString:[NSString stringWithFormat:@"%d 0 R", [self objectNumberForReference:dictionary type:kCGPDFObjectTypeDictionary]]];
+    }
+}
+
+// Graphic states, shadings, patterns and property lists are shared between pages, but often have no /Type.
+// The entries of these categories are always written as indirect objects, so each of them is written once.
+- (void)writeResources:(CGPDFDictionaryRef)resources depth:(NSUInteger)depth {
+    static NSSet *_sharedCategories;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedCategories = [NSSet setWithObjects:@"ExtGState", @"Shading", @"Pattern", @"Properties", nil];
+    });
+    if (depth > kPSCPageCopierMaximumDepth) {
+        [self appendString:@"null"];
+        return;
+    }
+
+    PSCDictionaryWriterContext context = {self, nil, depth, NO, _sharedCategories};
+    [self appendString:@"<<"];
+    CGPDFDictionaryApplyFunction(resources, PSCWriteDictionaryEntry, &context);
+    [self appendString:@">>"];
+}
+
+- (void)writeDictionary:(CGPDFDictionaryRef)dictionary depth:(NSUInteger)depth excludedKeys:(NSSet *)excludedKeys {
+    static NSSet *_parentKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _parentKeys = [NSSet setWithObjects:@"Parent", @"P", nil];
+    });
+
+    PSCDictionaryWriterContext context = {self, excludedKeys ?: _parentKeys, depth, NO, nil};
+    [self appendString:@"<<"];
+    CGPDFDictionaryApplyFunction(dictionary, PSCWriteDictionaryEntry, &context);
+    [self appendString:@">>"];
+}
+
+// CGPDF only hands out decoded data, except for JPEG and JPEG2000 images, so the filters are rewritten.
+- (void)writeStream:(CGPDFStreamRef)stream {
+    static NSSet *_encodingKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _encodingKeys = [NSSet setWithObjects:@"Length", @"Filter", @"DecodeParms", @"DL", @"Parent", @"P", nil];
+    });
+
+    CGPDFDataFormat format = CGPDFDataFormatRaw;
+    NSData *data = CFBridgingRelease(CGPDFStreamCopyData(stream, &format));
+    if (!data) {
+        // An empty stream would silently blank the page (or image); fail the copy instead.
+        PSCLog(@"Failed to read stream data of %p.", stream);
+        _writeFailed = YES;
+        return;
+    }
+    NSString *filter = nil;
+    if (format == CGPDFDataFormatJPEGEncoded) {
+        filter = @"DCTDecode";
+    }else if (format == CGPDFDataFormatJPEG2000) {
+        filter = @"JPXDecode";
+    }else if (self.compressStreams && data.length > 0) {
+        NSData *compressedData = PSCDeflateData(data);
+        if (compressedData) {
+            data = compressedData;
+            filter = @"FlateDecode";
+        }
+    }
+
+    PSCDictionaryWriterContext context = {self, _encodingKeys, 0, NO, nil};
+    [self appendString:@"<<"];
+    CGPDFDictionaryApplyFunction(CGPDFStreamGetDictionary(stream), PSCWriteDictionaryEntry, &context);
+    if (filter) [self appendString:[NSString stringWithFormat:@"/Filter /%@\n", filter]];
+    [self appendString:[NSString stringWithFormat:@"/Length %d>>\nstream\n", data.length]];
+    [self appendBytes:data.bytes length:data.length];
+    [self appendString:@"\nendstream"];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Output
+
+- (NSUInteger)reserveObjectNumber {
+    [_objectOffsets addObject:@0];
+    return _objectOffsets.count;
+}
+
+- (void)beginObject:(NSUInteger)objectNumber {
+    _objectOffsets[objectNumber - 1] = @(_offset);
+    [self appendString:[NSString stringWithFormat:@"%d 0 obj\n", objectNumber]];
+}
+
+- (void)endObject {
+    [self appendString:@"\nendobj\n"];
+}
+
+- (void)appendString:(NSString *)string {
+    const char *bytes = [string cStringUsingEncoding:NSISOLatin1StringEncoding];
+    if (bytes) [self appendBytes:bytes length:strlen(bytes)];
+}
+
+// Delimiters, whitespace and non-ASCII characters are written as #xx.
+- (void)appendName:(const char *)name {
+    NSMutableString *string = [NSMutableString stringWithString:@"/"];
+    for (const unsigned char *character = (const unsigned char *)name; *character; character++) {
+        if (*character < 0x21 || *character > 0x7E || strchr("()<>[]{}/%#", *character)) {
+            [string appendFormat:@"#%02X", *character];
+        }else {
+            [string appendFormat:@"%c", *character];
+        }
+    }
+    [self appendString:string];
+}
+
+- (void)appendHexBytes:(const unsigned char *)bytes length:(size_t)length {
+    NSMutableString *string = [NSMutableString stringWithCapacity:length * 2 + 2];
+    [string appendString:@"<"];
+    for (size_t idx = 0; idx < length; idx++) {
+        [string appendFormat:@"%02X", bytes[idx]];
+    }
+    [string appendString:@">"];
+    [self appendString:string];
+}
+
+// Text strings are written as UTF-16BE with byte order mark.
+- (void)appendTextString:(NSString *)string {
+    NSMutableData *data = [NSMutableData dataWithBytes:(const unsigned char[]){0xFE, 0xFF} length:2];
+    [data appendData:[string dataUsingEncoding:NSUTF16BigEndianStringEncoding]];
+    [self appendHexBytes:data.bytes length:data.length];
+}
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length {
+    [_buffer appendBytes:bytes length:length];
+    _offset += length;
+    if (_buffer.length >= kPSCPageCopierBufferSize) [self flush];
+}
+
+- (void)flush {
+    const uint8_t *bytes = _buffer.bytes;
+    NSUInteger remainingLength = _buffer.length;
+    while (remainingLength > 0 && !_writeFailed) {
+        NSInteger writtenLength = [_outputStream write:bytes maxLength:remainingLength];
+        if (writtenLength <= 0) {
+            PSCLog(@"Failed to write PDF: %@", _outputStream.streamError);
+            _writeFailed = YES;
+            break;
+        }
+        bytes += writtenLength;
+        remainingLength -= writtenLength;
+    }
+    _buffer.length = 0;
+}
+
+@end
@@ -0,0 +1,50 @@
+//
+//  PSCParallelPDFExporter.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Exports (and flattens) large documents with PSPDFProcessor, using all cores and bounded memory.
+
+ PSPDFProcessor processes the pages of one call sequentially. The exporter splits the page range into batches,
+ lets PSPDFProcessor flatten several batches in parallel into temporary files, and appends the pages of the finished
+ batches to the output in order. Only a window of batches is in flight at any time, so memory and temporary disk usage
+ don't grow with the document size.
+
+ Options are the same as for PSPDFProcessor. kCGPDFContext document properties and kPSPDFProcessorDocumentTitle
+ are applied to the output file only. Passwords, permissions and output intents need a CGPDFContext; with those,
+ and with kPSPDFProcessorAnnotationAsDictionary, the exporter falls back to a single PSPDFProcessor call.
+
+ The batches are merged with PSCPDFPageCopier: page objects are copied, not redrawn, so content is encoded once.
+ Annotations that aren't flattened are not carried over.
+ @note Resources are only shared within a batch. A font or image that is used on pages of several batches is embedded
+ once per batch, so the output can be larger than a single PSPDFProcessor pass; larger pagesPerBatch values reduce that.
+ */
+@interface PSCParallelPDFExporter : NSObject
+
+/// Designated initializer.
+- (id)initWithDocument:(PSPDFDocument *)document;
+
+/// The exported document.
+@property (nonatomic, strong, readonly) PSPDFDocument *document;
+
+/// Number of pages PSPDFProcessor handles per call. Defaults to 16.
+@property (nonatomic, assign) NSUInteger pagesPerBatch;
+
+/// Number of batches that are processed concurrently. Defaults to the number of CPU cores.
+@property (nonatomic, assign) NSUInteger maximumConcurrentBatchCount;
+
+/// Writes the pages in pageRange to fileURL. Synchronous; call from a background thread.
+/// progressBlock is called on the calling thread after each page was written to the output.
+- (BOOL)exportPages:(NSIndexSet *)pageRange toURL:(NSURL *)fileURL options:(NSDictionary *)options progressBlock:(PSPDFProgressBlock)progressBlock error:(NSError **)error;
+
+/// Variant that returns the output as data. The data is memory mapped from a temporary file, so it can be larger than
+/// what would fit into memory. (unlike PSPDFProcessor's NSData variant)
+- (NSData *)dataWithPages:(NSIndexSet *)pageRange options:(NSDictionary *)options progressBlock:(PSPDFProgressBlock)progressBlock error:(NSError **)error;
+
+/// Stops a running export. The export method returns NO with NSUserCancelledError.
+- (void)cancel;
+
+@end
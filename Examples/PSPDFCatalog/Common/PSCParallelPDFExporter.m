@@ -0,0 +1,223 @@
+//
+//  PSCParallelPDFExporter.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCParallelPDFExporter.h"
+#import "PSCPDFPageCopier.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@interface PSCParallelPDFExporter () {
+    NSCondition *_condition;
+}
+@property (atomic, assign, getter=isCancelled) BOOL cancelled;
+@end
+
+@implementation PSCParallelPDFExporter
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithDocument:(PSPDFDocument *)document {
+    if ((self = [super init])) {
+        _document = document;
+        _pagesPerBatch = 16;
+        _maximumConcurrentBatchCount = NSProcessInfo.processInfo.activeProcessorCount;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: %@ pagesPerBatch:%d concurrentBatches:%d>", self.class, self, self.document.title, self.pagesPerBatch, self.maximumConcurrentBatchCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)exportPages:(NSIndexSet *)pageRange toURL:(NSURL *)fileURL options:(NSDictionary *)options progressBlock:(PSPDFProgressBlock)progressBlock error:(NSError **)error {
+    NSUInteger pagesPerBatch = MAX(self.pagesPerBatch, 1U);
+
+    // Nothing to parallelize, annotations need to be written as objects, or the output needs encryption or permissions.
+    if (pageRange.count <= pagesPerBatch || [options[kPSPDFProcessorAnnotationAsDictionary] boolValue] || [self.class requiresProcessorForOptions:options]) {
+        return [PSPDFProcessor.defaultProcessor generatePDFFromDocument:self.document pageRange:pageRange outputFileURL:fileURL options:options progressBlock:progressBlock error:error];
+    }
+    if (!self.document.isValid) {
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToGeneratePDFDocumentInvalid userInfo:@{NSLocalizedDescriptionKey : @"Document is invalid."}];
+        return NO;
+    }
+    self.cancelled = NO;
+
+    // Document properties go into the output only; the batches are plain intermediate files.
+    NSMutableDictionary *batchOptions = [options mutableCopy] ?: [NSMutableDictionary dictionary];
+    NSMutableDictionary *documentInfo = [NSMutableDictionary dictionary];
+    NSDictionary *documentInfoKeys = [self.class documentInfoKeys];
+    for (id key in documentInfoKeys) {
+        if (batchOptions[key]) {
+            documentInfo[documentInfoKeys[key]] = batchOptions[key];
+            [batchOptions removeObjectForKey:key];
+        }
+    }
+    NSString *title = options[kPSPDFProcessorDocumentTitle] ?: self.document.title;
+    if (title) documentInfo[@"Title"] = title;
+
+    NSArray *batches = [self batchesForPageRange:pageRange pagesPerBatch:pagesPerBatch];
+    NSMutableArray *batchURLs = [NSMutableArray arrayWithCapacity:batches.count];
+    for (NSUInteger idx = 0; idx < batches.count; idx++) {
+        [batchURLs addObject:PSPDFTempFileURLWithPathExtension([NSString stringWithFormat:@"export-%d", idx], @"pdf")];
+    }
+
+    // One batch more than can run concurrently, so a finished batch can wait for the writer without stalling the workers.
+    NSUInteger concurrentBatchCount = MAX(self.maximumConcurrentBatchCount, 1U);
+    dispatch_semaphore_t windowSemaphore = dispatch_semaphore_create(concurrentBatchCount + 1);
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t workQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    NSCondition *condition = [NSCondition new];
+    @synchronized(self) { _condition = condition; }
+    NSMutableIndexSet *finishedBatches = [NSMutableIndexSet indexSet];
+    __block NSError *batchError = nil;
+
+    // Feeder; blocks on the window so batches are started in order.
+    dispatch_group_async(group, workQueue, ^{
+        for (NSUInteger idx = 0; idx < batches.count; idx++) {
+            dispatch_semaphore_wait(windowSemaphore, DISPATCH_TIME_FOREVER);
+            if (self.isCancelled) break;
+
+            dispatch_group_async(group, workQueue, ^{
+                @autoreleasepool {
+                    NSError *generateError = nil;
+                    BOOL success = [PSPDFProcessor.defaultProcessor generatePDFFromDocument:self.document pageRange:batches[idx] outputFileURL:batchURLs[idx] options:batchOptions progressBlock:NULL error:&generateError];
+                    [condition lock];
+                    if (success) [finishedBatches addIndex:idx];
+                    else if (!batchError) batchError = generateError ?: [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToConvertToPDF userInfo:nil];
+                    [condition broadcast];
+                    [condition unlock];
+                }
+            });
+        }
+    });
+
+    // Writer; copies the page objects of the batches in order as they complete. Nothing is redrawn or re-encoded.
+    NSError *writeError = nil;
+    PSCPDFPageCopier *pageCopier = [[PSCPDFPageCopier alloc] initWithDocument:self.document];
+    BOOL merging = [pageCopier beginMergingToURL:fileURL];
+    if (!merging) {
+        writeError = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToGeneratePDFInvalidArguments userInfo:@{NSLocalizedDescriptionKey : @"Failed to create output file."}];
+    }
+    __block NSUInteger processedPageCount = 0;
+    NSUInteger batchIndex = 0;
+    for (; merging && batchIndex < batches.count; batchIndex++) {
+        [condition lock];
+        while (![finishedBatches containsIndex:batchIndex] && !batchError && !self.isCancelled) [condition wait];
+        if (!writeError) writeError = batchError;
+        [condition unlock];
+        if (writeError || self.isCancelled) break;
+
+        @autoreleasepool {
+            CGPDFDocumentRef batchDocument = CGPDFDocumentCreateWithURL((__bridge CFURLRef)batchURLs[batchIndex]);
+            NSIndexSet *batch = batches[batchIndex];
+            if (!batchDocument || (NSUInteger)CGPDFDocumentGetNumberOfPages(batchDocument) != batch.count) {
+                writeError = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeUnableToOpenPDF userInfo:@{NSLocalizedDescriptionKey : @"Intermediate file is invalid."}];
+            }else {
+                __block size_t pageNumber = 1;
+                __block BOOL appended = YES;
+                [batch enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+                    appended = [pageCopier appendPage:CGPDFDocumentGetPage(batchDocument, pageNumber++)];
+                    if (!appended) *stop = YES;
+                    else if (progressBlock) progressBlock(page, ++processedPageCount, pageRange.count);
+                }];
+                if (!appended) writeError = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToConvertToPDF userInfo:@{NSLocalizedDescriptionKey : @"Failed to copy pages."}];
+            }
+            [pageCopier finishSourceDocument];
+            CGPDFDocumentRelease(batchDocument);
+        }
+        [[NSFileManager defaultManager] removeItemAtURL:batchURLs[batchIndex] error:NULL];
+        dispatch_semaphore_signal(windowSemaphore);
+        if (writeError) break;
+    }
+    if (merging && ![pageCopier finishMergingWithInfo:documentInfo] && !writeError) {
+        writeError = [NSError errorWithDomain:kPSPDFErrorDomain code:PSPDFErrorCodeFailedToConvertToPDF userInfo:@{NSLocalizedDescriptionKey : @"Failed to write output file."}];
+    }
+
+    // Wake the feeder so it can exit, then wait for running batches before cleaning up.
+    BOOL success = !writeError && !self.isCancelled && batchIndex == batches.count;
+    if (!success) {
+        self.cancelled = YES;
+        for (NSUInteger idx = batchIndex; idx < batches.count; idx++) dispatch_semaphore_signal(windowSemaphore);
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(group);
+    dispatch_release(windowSemaphore);
+#endif
+    @synchronized(self) { _condition = nil; }
+
+    if (!success) {
+        for (NSURL *batchURL in batchURLs) [[NSFileManager defaultManager] removeItemAtURL:batchURL error:NULL];
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+        if (error) *error = writeError ?: [NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil];
+    }
+    return success;
+}
+
+- (NSData *)dataWithPages:(NSIndexSet *)pageRange options:(NSDictionary *)options progressBlock:(PSPDFProgressBlock)progressBlock error:(NSError **)error {
+    NSURL *tempURL = PSPDFTempFileURLWithPathExtension(@"export", @"pdf");
+    if (![self exportPages:pageRange toURL:tempURL options:options progressBlock:progressBlock error:error]) return nil;
+
+    // The mapping stays valid after the file has been removed.
+    NSData *data = [NSData dataWithContentsOfURL:tempURL options:NSDataReadingMappedAlways error:error];
+    [[NSFileManager defaultManager] removeItemAtURL:tempURL error:NULL];
+    return data;
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+
+    // Wake up the writer.
+    NSCondition *condition;
+    @synchronized(self) { condition = _condition; }
+    [condition lock];
+    [condition broadcast];
+    [condition unlock];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// kCGPDFContext keys that the merged file can carry, mapped to document information keys.
++ (NSDictionary *)documentInfoKeys {
+    static NSDictionary *_documentInfoKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _documentInfoKeys = @{(id)kCGPDFContextAuthor : @"Author", (id)kCGPDFContextCreator : @"Creator", (id)kCGPDFContextTitle : @"Title", (id)kCGPDFContextSubject : @"Subject", (id)kCGPDFContextKeywords : @"Keywords"};
+    });
+    return _documentInfoKeys;
+}
+
+// Encryption, permissions and output intents can only be written by a CGPDFContext.
++ (BOOL)requiresProcessorForOptions:(NSDictionary *)options {
+    NSArray *contextOnlyKeys = @[(id)kCGPDFContextOwnerPassword, (id)kCGPDFContextUserPassword, (id)kCGPDFContextAllowsPrinting, (id)kCGPDFContextAllowsCopying, (id)kCGPDFContextEncryptionKeyLength, (id)kCGPDFContextOutputIntent, (id)kCGPDFContextOutputIntents];
+    for (id key in contextOnlyKeys) {
+        if (options[key]) return YES;
+    }
+    return NO;
+}
+
+- (NSArray *)batchesForPageRange:(NSIndexSet *)pageRange pagesPerBatch:(NSUInteger)pagesPerBatch {
+    NSMutableArray *batches = [NSMutableArray array];
+    __block NSMutableIndexSet *batch = nil;
+    [pageRange enumerateIndexesUsingBlock:^(NSUInteger page, BOOL *stop) {
+        if (batch.count == 0 || batch.count == pagesPerBatch) {
+            batch = [NSMutableIndexSet indexSet];
+            [batches addObject:batch];
+        }
+        [batch addIndex:page];
+    }];
+    return batches;
+}
+
+@end
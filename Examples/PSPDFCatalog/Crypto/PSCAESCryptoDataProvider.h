@@ -0,0 +1,44 @@
+//
+//  PSCAESCryptoDataProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/**
+ Seekable decryption of AES256-CBC encrypted files, compatible with the format of PSPDFAESCryptoDataProvider.
+ (16 byte IV, followed by the ciphertext with PKCS7 padding. Key is PBKDF2-SHA256 of passphrase and salt.)
+
+ CGPDF reads PDFs in random order (xref at the end, objects scattered through the file).
+ In CBC, every block can be decrypted with just the preceding ciphertext block, so any chunk of the file can be decrypted independently.
+ Decrypted chunks are kept in a small LRU cache, and sequential reads decrypt a few chunks ahead with a single call.
+ */
+@interface PSCAESCryptoDataProvider : NSObject
+
+/// Designated initializer with the passphrase and salt.
+/// URL must be a file-based URL. Returns nil if the file can't be opened or isn't a valid encrypted file.
+- (id)initWithURL:(NSURL *)URL passphrase:(NSString *)passphrase salt:(NSString *)salt;
+
+/// Initialize with an already derived 256 bit key.
+- (id)initWithURL:(NSURL *)URL key:(NSData *)key;
+
+/// Derives the key for passphrase and salt. (PBKDF2, SHA256, 50000 rounds)
+/// This is intentionally slow; keep the key around if the same file is opened multiple times.
++ (NSData *)keyForPassphrase:(NSString *)passphrase salt:(NSString *)salt;
+
+/// The decrypting data provider. Retains all necessary state; can outlive this object.
+@property (nonatomic, readonly) CGDataProviderRef dataProvider;
+
+/// Size of the decrypted content.
+@property (nonatomic, assign, readonly) off_t plaintextLength;
+
+/// Size of the chunks that are decrypted and cached. Matches the VM page size (usually 4096).
+@property (nonatomic, assign, readonly) NSUInteger chunkSize;
+
+/// Number of decrypted chunks that are cached. Defaults to 64 (256KB with 4KB chunks).
+@property (nonatomic, assign) NSUInteger cachedChunkCount;
+
+/// Number of chunks that are decrypted ahead once sequential reading is detected. Defaults to 8.
+@property (nonatomic, assign) NSUInteger readAheadChunkCount;
+
+@end
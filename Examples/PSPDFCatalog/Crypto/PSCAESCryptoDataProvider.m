@@ -0,0 +1,241 @@
+//
+//  PSCAESCryptoDataProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAESCryptoDataProvider.h"
+#import <CommonCrypto/CommonCryptor.h>
+#import <CommonCrypto/CommonKeyDerivation.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+#define kPSCAESKeyDerivationRounds 50000
+
+// Holds the file and the chunk cache. Owned by the CGDataProvider, so it stays alive as long as CGPDF needs it.
+@interface PSCAESChunkDecryptor : NSObject {
+    int _fileDescriptor;
+    NSData *_key;
+    off_t _ciphertextLength;
+    NSMutableDictionary *_chunks;         // NSNumber (index) -> NSData
+    NSMutableOrderedSet *_chunkUsage;     // least recently used first
+    NSUInteger _lastChunkIndex;
+}
+- (id)initWithURL:(NSURL *)URL key:(NSData *)key;
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count;
+@property (nonatomic, assign, readonly) off_t plaintextLength;
+@property (nonatomic, assign, readonly) NSUInteger chunkSize;
+@property (atomic, assign) NSUInteger cachedChunkCount;
+@property (atomic, assign) NSUInteger readAheadChunkCount;
+@end
+
+static size_t PSCAESGetBytesAtPosition(void *info, void *buffer, off_t position, size_t count) {
+    return [(__bridge PSCAESChunkDecryptor *)info getBytes:buffer atPosition:position count:count];
+}
+
+static void PSCAESReleaseInfo(void *info) {
+    CFBridgingRelease(info);
+}
+
+@interface PSCAESCryptoDataProvider () {
+    PSCAESChunkDecryptor *_decryptor;
+}
+@end
+
+@implementation PSCAESCryptoDataProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
++ (NSData *)keyForPassphrase:(NSString *)passphrase salt:(NSString *)salt {
+    NSData *passphraseData = [passphrase dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *saltData = [salt dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *key = [NSMutableData dataWithLength:kCCKeySizeAES256];
+    int result = CCKeyDerivationPBKDF(kCCPBKDF2, [passphraseData bytes], [passphraseData length], [saltData bytes], [saltData length], kCCPRFHmacAlgSHA256, kPSCAESKeyDerivationRounds, [key mutableBytes], [key length]);
+    return result == kCCSuccess ? key : nil;
+}
+
+- (id)initWithURL:(NSURL *)URL passphrase:(NSString *)passphrase salt:(NSString *)salt {
+    return [self initWithURL:URL key:[self.class keyForPassphrase:passphrase salt:salt]];
+}
+
+- (id)initWithURL:(NSURL *)URL key:(NSData *)key {
+    if ((self = [super init])) {
+        _decryptor = [[PSCAESChunkDecryptor alloc] initWithURL:URL key:key];
+        if (!_decryptor) return nil;
+
+        CGDataProviderDirectCallbacks callbacks = {0, NULL, NULL, PSCAESGetBytesAtPosition, PSCAESReleaseInfo};
+        _dataProvider = CGDataProviderCreateDirect((__bridge_retained void *)_decryptor, _decryptor.plaintextLength, &callbacks);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    CGDataProviderRelease(_dataProvider);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (off_t)plaintextLength {
+    return _decryptor.plaintextLength;
+}
+
+- (NSUInteger)chunkSize {
+    return _decryptor.chunkSize;
+}
+
+- (NSUInteger)cachedChunkCount {
+    return _decryptor.cachedChunkCount;
+}
+
+- (void)setCachedChunkCount:(NSUInteger)cachedChunkCount {
+    _decryptor.cachedChunkCount = cachedChunkCount;
+}
+
+- (NSUInteger)readAheadChunkCount {
+    return _decryptor.readAheadChunkCount;
+}
+
+- (void)setReadAheadChunkCount:(NSUInteger)readAheadChunkCount {
+    _decryptor.readAheadChunkCount = readAheadChunkCount;
+}
+
+@end
+
+@implementation PSCAESChunkDecryptor
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithURL:(NSURL *)URL key:(NSData *)key {
+    if ((self = [super init])) {
+        _fileDescriptor = -1;
+        if (!URL.isFileURL || [key length] != kCCKeySizeAES256) return nil;
+
+        _fileDescriptor = open([URL.path fileSystemRepresentation], O_RDONLY);
+        struct stat fileStat;
+        if (_fileDescriptor < 0 || fstat(_fileDescriptor, &fileStat) != 0) return nil;
+
+        // IV + at least one block, whole blocks only.
+        _ciphertextLength = fileStat.st_size - kCCBlockSizeAES128;
+        if (_ciphertextLength < kCCBlockSizeAES128 || _ciphertextLength % kCCBlockSizeAES128 != 0) return nil;
+
+        _key = [key copy];
+        _chunkSize = (NSUInteger)getpagesize();
+        _cachedChunkCount = 64;
+        _readAheadChunkCount = 8;
+        _chunks = [NSMutableDictionary new];
+        _chunkUsage = [NSMutableOrderedSet new];
+        _lastChunkIndex = NSNotFound;
+
+        // The padding length is in the last block. This also verifies the key.
+        uint8_t lastBlocks[2 * kCCBlockSizeAES128], lastBlock[kCCBlockSizeAES128];
+        if (pread(_fileDescriptor, lastBlocks, sizeof(lastBlocks), fileStat.st_size - sizeof(lastBlocks)) != sizeof(lastBlocks)) return nil;
+        if (![self decryptBytes:lastBlocks + kCCBlockSizeAES128 length:kCCBlockSizeAES128 IV:lastBlocks into:lastBlock]) return nil;
+        uint8_t paddingLength = lastBlock[kCCBlockSizeAES128-1];
+        if (paddingLength == 0 || paddingLength > kCCBlockSizeAES128) {
+            PSCLog(@"Invalid padding in %@. Wrong passphrase?", URL.lastPathComponent);
+            return nil;
+        }
+        _plaintextLength = _ciphertextLength - paddingLength;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_fileDescriptor >= 0) close(_fileDescriptor);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count {
+    if (position < 0 || position >= _plaintextLength) return 0;
+    count = (size_t)MIN((off_t)count, _plaintextLength - position);
+
+    size_t copiedLength = 0;
+    @synchronized(self) {
+        while (copiedLength < count) {
+            off_t offset = position + copiedLength;
+            NSUInteger chunkIndex = (NSUInteger)(offset / _chunkSize);
+            NSData *chunk = [self chunkAtIndex:chunkIndex];
+            size_t chunkOffset = (size_t)(offset - (off_t)chunkIndex * _chunkSize);
+            if (!chunk || chunkOffset >= [chunk length]) break;
+
+            size_t length = MIN(count - copiedLength, [chunk length] - chunkOffset);
+            memcpy((uint8_t *)buffer + copiedLength, (const uint8_t *)[chunk bytes] + chunkOffset, length);
+            copiedLength += length;
+        }
+    }
+    return copiedLength;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (BOOL)decryptBytes:(const void *)ciphertext length:(size_t)length IV:(const void *)IV into:(void *)plaintext {
+    size_t decryptedLength = 0;
+    CCCryptorStatus status = CCCrypt(kCCDecrypt, kCCAlgorithmAES128, 0, [_key bytes], [_key length], IV, ciphertext, length, plaintext, length, &decryptedLength);
+    return status == kCCSuccess && decryptedLength == length;
+}
+
+// Needs to be called within @synchronized(self).
+- (NSData *)chunkAtIndex:(NSUInteger)chunkIndex {
+    NSNumber *chunkKey = @(chunkIndex);
+    NSData *chunk = _chunks[chunkKey];
+    BOOL sequential = _lastChunkIndex != NSNotFound && chunkIndex == _lastChunkIndex + 1;
+    _lastChunkIndex = chunkIndex;
+
+    if (chunk) {
+        [_chunkUsage removeObject:chunkKey];
+        [_chunkUsage addObject:chunkKey];
+        return chunk;
+    }
+
+    // Decrypt the run of chunks with one read and one CCCrypt call.
+    NSUInteger chunkCount = (NSUInteger)((_ciphertextLength + _chunkSize - 1) / _chunkSize);
+    NSUInteger runLength = MIN(sequential ? 1 + self.readAheadChunkCount : 1, chunkCount - chunkIndex);
+    [self decryptChunksInRange:NSMakeRange(chunkIndex, runLength)];
+    return _chunks[chunkKey];
+}
+
+- (void)decryptChunksInRange:(NSRange)range {
+    // The IV of chunk n is the last ciphertext block before it; for chunk 0 that's the file IV.
+    off_t fileOffset = (off_t)range.location * _chunkSize;
+    size_t ciphertextLength = (size_t)MIN((off_t)range.length * _chunkSize, _ciphertextLength - fileOffset);
+    uint8_t *ciphertext = malloc(kCCBlockSizeAES128 + ciphertextLength);
+    uint8_t *plaintext = malloc(ciphertextLength);
+
+    BOOL success = pread(_fileDescriptor, ciphertext, kCCBlockSizeAES128 + ciphertextLength, fileOffset) == (ssize_t)(kCCBlockSizeAES128 + ciphertextLength);
+    success = success && [self decryptBytes:ciphertext + kCCBlockSizeAES128 length:ciphertextLength IV:ciphertext into:plaintext];
+    if (success) {
+        for (NSUInteger idx = 0; idx < range.length; idx++) {
+            off_t chunkStart = (off_t)(range.location + idx) * _chunkSize;
+            size_t chunkLength = (size_t)MIN((off_t)_chunkSize, _plaintextLength - chunkStart);
+            NSNumber *chunkKey = @(range.location + idx);
+            _chunks[chunkKey] = [NSData dataWithBytes:plaintext + idx * _chunkSize length:chunkLength];
+            [_chunkUsage removeObject:chunkKey];
+            [_chunkUsage addObject:chunkKey];
+        }
+    }else {
+        PSCLog(@"Failed to decrypt chunks %@", NSStringFromRange(range));
+    }
+    free(ciphertext);
+    free(plaintext);
+
+    // Evict least recently used chunks, but never the ones we just decrypted.
+    NSUInteger maximumCount = MAX(self.cachedChunkCount, range.length);
+    while ([_chunkUsage count] > maximumCount) {
+        NSNumber *chunkKey = [_chunkUsage firstObject];
+        [_chunks removeObjectForKey:chunkKey];
+        [_chunkUsage removeObjectAtIndex:0];
+    }
+}
+
+@end
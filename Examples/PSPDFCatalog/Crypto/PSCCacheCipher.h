@@ -0,0 +1,46 @@
+//
+//  PSCCacheCipher.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+typedef NS_ENUM(NSUInteger, PSCCacheCipherMode) {
+    PSCCacheCipherModeCTR = 1, // AES256-CTR. No padding, same size as the plaintext, encrypts in place.
+    PSCCacheCipherModeCBC = 2  // AES256-CBC with PKCS7 padding.
+};
+
+/**
+ Chunked AES encryption for the PSPDFCache encryptDataBlock/decryptFromPathBlock hooks.
+
+ Compared to running RNCryptor on the whole blob:
+ - The key is derived once, not for every image.
+ - Encryption runs in place inside the NSMutableData the cache hands us; no second copy of the image.
+ - Decryption reads the file memory mapped and decrypts chunk by chunk into a single preallocated buffer,
+   so peak memory is roughly the size of the decoded input instead of twice that.
+
+ File format: 4 byte magic "PSCc", 1 byte mode, 3 reserved bytes, 16 byte IV/nonce, ciphertext.
+ Files written by a different tool return nil and are simply re-rendered by the cache.
+ Note that this provides confidentiality only; there's no MAC.
+ */
+@interface PSCCacheCipher : NSObject
+
+/// Designated initializer. key must be 256 bit, e.g. from +[PSCAESCryptoDataProvider keyForPassphrase:salt:].
+- (id)initWithKey:(NSData *)key;
+
+/// Mode used for newly encrypted data. Decryption always uses the mode stored in the file. Defaults to PSCCacheCipherModeCTR.
+@property (nonatomic, assign) PSCCacheCipherMode mode;
+
+/// Bytes processed per CommonCrypto call. Needs to be a multiple of 16. Defaults to 64KB.
+@property (nonatomic, assign) NSUInteger chunkSize;
+
+/// Encrypts data in place. Returns NO and leaves data empty on failure; better to save nothing than unencrypted data.
+- (BOOL)encryptData:(NSMutableData *)data;
+
+/// Decrypts the file at path. Returns nil if the file doesn't exist or can't be decrypted.
+- (NSData *)decryptedDataWithContentsOfFile:(NSString *)path;
+
+/// Sets encryptDataBlock and decryptFromPathBlock of cache to use this cipher.
+- (void)installInCache:(PSPDFCache *)cache;
+
+@end
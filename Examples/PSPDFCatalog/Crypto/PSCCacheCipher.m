@@ -0,0 +1,138 @@
+//
+//  PSCCacheCipher.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCacheCipher.h"
+#import <CommonCrypto/CommonCryptor.h>
+#import <Security/SecRandom.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+static const char PSCCacheCipherMagic[4] = {'P', 'S', 'C', 'c'};
+
+typedef struct {
+    char magic[4];
+    uint8_t mode;
+    uint8_t reserved[3];
+    uint8_t IV[kCCBlockSizeAES128];
+} PSCCacheCipherHeader;
+
+@implementation PSCCacheCipher {
+    NSData *_key;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithKey:(NSData *)key {
+    if ((self = [super init])) {
+        if ([key length] != kCCKeySizeAES256) return nil;
+        _key = [key copy];
+        _mode = PSCCacheCipherModeCTR;
+        _chunkSize = 64 * 1024;
+    }
+    return self;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (BOOL)encryptData:(NSMutableData *)data {
+    PSCCacheCipherMode mode = self.mode;
+    size_t plaintextLength = [data length];
+    size_t paddingLength = mode == PSCCacheCipherModeCBC ? kCCBlockSizeAES128 : 0;
+
+    PSCCacheCipherHeader header = {{0}, mode, {0}, {0}};
+    memcpy(header.magic, PSCCacheCipherMagic, sizeof(header.magic));
+    if (SecRandomCopyBytes(kSecRandomDefault, sizeof(header.IV), header.IV) != 0) {
+        [data setLength:0];
+        return NO;
+    }
+
+    // Move the plaintext behind the header, then encrypt it where it is.
+    [data increaseLengthBy:sizeof(header) + paddingLength];
+    uint8_t *bytes = [data mutableBytes];
+    memmove(bytes + sizeof(header), bytes, plaintextLength);
+    memcpy(bytes, &header, sizeof(header));
+
+    uint8_t *payload = bytes + sizeof(header);
+    size_t ciphertextLength = 0;
+    if (![self cryptWithOperation:kCCEncrypt mode:mode IV:header.IV input:payload length:plaintextLength output:payload capacity:plaintextLength + paddingLength outputLength:&ciphertextLength]) {
+        PSCLog(@"Failed to encrypt %zu bytes.", plaintextLength);
+        [data setLength:0];
+        return NO;
+    }
+    [data setLength:sizeof(header) + ciphertextLength];
+    return YES;
+}
+
+- (NSData *)decryptedDataWithContentsOfFile:(NSString *)path {
+    // Mapped, so only the pages currently being decrypted need to be resident.
+    NSData *encryptedData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+    if ([encryptedData length] < sizeof(PSCCacheCipherHeader)) return nil;
+
+    PSCCacheCipherHeader header;
+    memcpy(&header, [encryptedData bytes], sizeof(header));
+    if (memcmp(header.magic, PSCCacheCipherMagic, sizeof(header.magic)) != 0) return nil;
+    if (header.mode != PSCCacheCipherModeCTR && header.mode != PSCCacheCipherModeCBC) return nil;
+
+    size_t ciphertextLength = [encryptedData length] - sizeof(header);
+    if (header.mode == PSCCacheCipherModeCBC && (ciphertextLength == 0 || ciphertextLength % kCCBlockSizeAES128 != 0)) return nil;
+
+    NSMutableData *decryptedData = [NSMutableData dataWithLength:ciphertextLength];
+    size_t plaintextLength = 0;
+    if (![self cryptWithOperation:kCCDecrypt mode:header.mode IV:header.IV input:(const uint8_t *)[encryptedData bytes] + sizeof(header) length:ciphertextLength output:[decryptedData mutableBytes] capacity:ciphertextLength outputLength:&plaintextLength]) {
+        PSCLog(@"Failed to decrypt %@", path);
+        return nil;
+    }
+    [decryptedData setLength:plaintextLength];
+    return decryptedData;
+}
+
+- (void)installInCache:(PSPDFCache *)cache {
+    [cache setEncryptDataBlock:^(PSPDFDocument *document, NSMutableData *data) {
+        [self encryptData:data];
+    }];
+    [cache setDecryptFromPathBlock:^NSData *(PSPDFDocument *document, NSString *path) {
+        return [self decryptedDataWithContentsOfFile:path];
+    }];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Input and output may be the same buffer; the output never runs ahead of the input.
+- (BOOL)cryptWithOperation:(CCOperation)operation mode:(PSCCacheCipherMode)mode IV:(const uint8_t *)IV input:(const uint8_t *)input length:(size_t)length output:(uint8_t *)output capacity:(size_t)capacity outputLength:(size_t *)outputLength {
+    CCCryptorRef cryptor = NULL;
+    CCCryptorStatus status;
+    if (mode == PSCCacheCipherModeCTR) {
+        status = CCCryptorCreateWithMode(operation, kCCModeCTR, kCCAlgorithmAES128, ccNoPadding, IV, [_key bytes], [_key length], NULL, 0, 0, kCCModeOptionCTR_BE, &cryptor);
+    }else {
+        status = CCCryptorCreateWithMode(operation, kCCModeCBC, kCCAlgorithmAES128, ccPKCS7Padding, IV, [_key bytes], [_key length], NULL, 0, 0, 0, &cryptor);
+    }
+    if (status != kCCSuccess) return NO;
+
+    size_t chunkSize = MAX(self.chunkSize / kCCBlockSizeAES128, 1) * kCCBlockSizeAES128;
+    size_t inputOffset = 0, outputOffset = 0, movedLength = 0;
+    while (status == kCCSuccess && inputOffset < length) {
+        size_t chunkLength = MIN(chunkSize, length - inputOffset);
+        status = CCCryptorUpdate(cryptor, input + inputOffset, chunkLength, output + outputOffset, capacity - outputOffset, &movedLength);
+        inputOffset += chunkLength;
+        outputOffset += movedLength;
+    }
+    if (status == kCCSuccess) {
+        status = CCCryptorFinal(cryptor, output + outputOffset, capacity - outputOffset, &movedLength);
+        outputOffset += movedLength;
+    }
+    CCCryptorRelease(cryptor);
+
+    if (outputLength) *outputLength = outputOffset;
+    return status == kCCSuccess;
+}
+
+@end
@@ -0,0 +1,21 @@
+//
+//  PSCCachingDecryptor.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "RNDecryptor.h"
+
+/// RNDecryptor that takes derived keys from PSCKeyDerivationCache.
+/// Drop-in replacement; +decryptData:withPassword:error: works unchanged.
+@interface PSCCachingDecryptor : RNDecryptor
+
+/// Decrypts multiple RNCryptor files concurrently, one file per core.
+/// RNCryptor salts every file individually, so each file still needs its own key, but derivation runs in parallel
+/// and keys of files that have been opened before are served from the cache.
+/// fileHandler is called on a background queue, possibly concurrently; data is nil on failure.
+/// completionBlock is called on the main queue after all files have been processed.
++ (void)decryptFilesAtURLs:(NSArray *)fileURLs withPassword:(NSString *)password fileHandler:(void (^)(NSURL *fileURL, NSData *data, NSError *error))fileHandler completionBlock:(void (^)(void))completionBlock;
+
+@end
@@ -0,0 +1,61 @@
+//
+//  PSCCachingDecryptor.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCCachingDecryptor.h"
+#import "PSCKeyDerivationCache.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@implementation PSCCachingDecryptor
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - RNCryptor
+
++ (NSData *)keyForPassword:(NSString *)password salt:(NSData *)salt settings:(RNCryptorKeyDerivationSettings)keySettings {
+    return [PSCKeyDerivationCache.sharedCache keyForPassword:password salt:salt settings:keySettings derivationBlock:^NSData *{
+        return [super keyForPassword:password salt:salt settings:keySettings];
+    }];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
++ (void)decryptFilesAtURLs:(NSArray *)fileURLs withPassword:(NSString *)password fileHandler:(void (^)(NSURL *fileURL, NSData *data, NSError *error))fileHandler completionBlock:(void (^)(void))completionBlock {
+    NSArray *URLs = [fileURLs copy];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        // Decryption blocks on the cryptor's own queue; limit the number of files in flight to the number of cores.
+        dispatch_semaphore_t slots = dispatch_semaphore_create(NSProcessInfo.processInfo.activeProcessorCount);
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+        for (NSURL *fileURL in URLs) {
+            dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+            dispatch_group_async(group, queue, ^{
+                @autoreleasepool {
+                    NSError *error = nil;
+                    NSData *decryptedData = nil;
+                    NSData *encryptedData = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:&error];
+                    if (encryptedData) {
+                        decryptedData = [self decryptData:encryptedData withPassword:password error:&error];
+                    }
+                    if (fileHandler) fileHandler(fileURL, decryptedData, decryptedData ? nil : error);
+                }
+                dispatch_semaphore_signal(slots);
+            });
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(group);
+        dispatch_release(slots);
+#endif
+        if (completionBlock) dispatch_async(dispatch_get_main_queue(), completionBlock);
+    });
+}
+
+@end
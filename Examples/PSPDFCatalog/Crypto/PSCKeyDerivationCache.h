@@ -0,0 +1,35 @@
+//
+//  PSCKeyDerivationCache.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "RNCryptor.h"
+
+/**
+ Caches PBKDF2-derived keys, so reopening an encrypted file doesn't burn another 2x10000 rounds.
+
+ Entries are looked up by a SHA256 of password, salt and settings; the password itself is never stored.
+ Keys are held in locked (non-pageable) memory, are zeroed on eviction and expire after `timeToLive`.
+ The cache is cleared on memory warnings and when the app enters the background.
+ */
+@interface PSCKeyDerivationCache : NSObject
+
+/// Shared cache.
++ (instancetype)sharedCache;
+
+/// Returns the cached key, or calls derivationBlock, caches and returns its result.
+/// derivationBlock is called outside of any lock, so different keys are derived concurrently.
+- (NSData *)keyForPassword:(NSString *)password salt:(NSData *)salt settings:(RNCryptorKeyDerivationSettings)settings derivationBlock:(NSData *(^)(void))derivationBlock;
+
+/// Zeroes and removes all keys.
+- (void)clearCache;
+
+/// Seconds a key stays cached after it was last used. Defaults to 300.
+@property (atomic, assign) NSTimeInterval timeToLive;
+
+/// Maximum number of cached keys; the least recently used one is evicted first. Defaults to 64.
+@property (atomic, assign) NSUInteger maximumKeyCount;
+
+@end
@@ -0,0 +1,154 @@
+//
+//  PSCKeyDerivationCache.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCKeyDerivationCache.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/mman.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Owns the key bytes. Locked so they can't be paged out, zeroed before they're freed.
+@interface PSCDerivedKey : NSObject {
+    void *_bytes;
+    size_t _length;
+}
+- (id)initWithKey:(NSData *)key;
+- (NSData *)key;
+@property (nonatomic, assign) CFAbsoluteTime lastAccessTime;
+@end
+
+@implementation PSCDerivedKey
+
+- (id)initWithKey:(NSData *)key {
+    if ((self = [super init])) {
+        _length = [key length];
+        _bytes = malloc(MAX(_length, 1));
+        mlock(_bytes, _length);
+        memcpy(_bytes, [key bytes], _length);
+        _lastAccessTime = CFAbsoluteTimeGetCurrent();
+    }
+    return self;
+}
+
+- (void)dealloc {
+    // volatile, so the compiler can't drop the write to memory that's freed right after.
+    volatile uint8_t *bytes = _bytes;
+    for (size_t idx = 0; idx < _length; idx++) bytes[idx] = 0;
+    munlock(_bytes, _length);
+    free(_bytes);
+}
+
+- (NSData *)key {
+    return [NSData dataWithBytes:_bytes length:_length];
+}
+
+@end
+
+@interface PSCKeyDerivationCache () {
+    NSMutableDictionary *_keys; // SHA256 (NSData) -> PSCDerivedKey
+}
+@end
+
+@implementation PSCKeyDerivationCache
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
++ (instancetype)sharedCache {
+    static PSCKeyDerivationCache *_sharedCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedCache = [self new];
+    });
+    return _sharedCache;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _keys = [NSMutableDictionary new];
+        _timeToLive = 300;
+        _maximumKeyCount = 64;
+
+        NSNotificationCenter *dnc = NSNotificationCenter.defaultCenter;
+        [dnc addObserver:self selector:@selector(clearCache) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+        [dnc addObserver:self selector:@selector(clearCache) name:UIApplicationDidEnterBackgroundNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [NSNotificationCenter.defaultCenter removeObserver:self];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSData *)keyForPassword:(NSString *)password salt:(NSData *)salt settings:(RNCryptorKeyDerivationSettings)settings derivationBlock:(NSData *(^)(void))derivationBlock {
+    NSData *cacheKey = [self cacheKeyForPassword:password salt:salt settings:settings];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    @synchronized(self) {
+        PSCDerivedKey *derivedKey = _keys[cacheKey];
+        if (derivedKey && now - derivedKey.lastAccessTime < self.timeToLive) {
+            derivedKey.lastAccessTime = now;
+            return [derivedKey key];
+        }
+        [_keys removeObjectForKey:cacheKey];
+    }
+
+    NSData *key = derivationBlock();
+    if (!key) return nil;
+
+    @synchronized(self) {
+        _keys[cacheKey] = [[PSCDerivedKey alloc] initWithKey:key];
+        [self evictKeysWithTime:now];
+    }
+    return key;
+}
+
+- (void)clearCache {
+    @synchronized(self) {
+        [_keys removeAllObjects];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (NSData *)cacheKeyForPassword:(NSString *)password salt:(NSData *)salt settings:(RNCryptorKeyDerivationSettings)settings {
+    NSData *passwordData = [password dataUsingEncoding:NSUTF8StringEncoding];
+    uint32_t parameters[] = {(uint32_t)settings.keySize, settings.PBKDFAlgorithm, settings.PRF, settings.rounds, (uint32_t)[passwordData length]};
+
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    CC_SHA256_Update(&context, parameters, sizeof(parameters));
+    CC_SHA256_Update(&context, [passwordData bytes], (CC_LONG)[passwordData length]);
+    CC_SHA256_Update(&context, [salt bytes], (CC_LONG)[salt length]);
+    NSMutableData *digest = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final([digest mutableBytes], &context);
+    return digest;
+}
+
+// Needs to be called within @synchronized(self).
+- (void)evictKeysWithTime:(CFAbsoluteTime)now {
+    NSTimeInterval timeToLive = self.timeToLive;
+    for (NSData *cacheKey in [_keys allKeys]) {
+        if (now - [_keys[cacheKey] lastAccessTime] >= timeToLive) [_keys removeObjectForKey:cacheKey];
+    }
+
+    NSUInteger maximumKeyCount = self.maximumKeyCount;
+    if ([_keys count] > maximumKeyCount) {
+        NSArray *sortedKeys = [_keys keysSortedByValueUsingComparator:^NSComparisonResult(PSCDerivedKey *key1, PSCDerivedKey *key2) {
+            return [@(key1.lastAccessTime) compare:@(key2.lastAccessTime)];
+        }];
+        [_keys removeObjectsForKeys:[sortedKeys subarrayWithRange:NSMakeRange(0, [_keys count] - maximumKeyCount)]];
+    }
+}
+
+@end
@@ -0,0 +1,21 @@
+//
+//  PSCAtlasThumbnailsViewController.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+/// Shows scrobble bar and thumbnail grid images from a PSCThumbnailAtlas.
+@interface PSCAtlasThumbnailsViewController : PSPDFViewController
+
+@end
+
+/// Scrobble bar that shows the thumbnails from the sheets of a PSCThumbnailAtlas.
+/// The atlas is built on first display; until then the regular cache images are shown.
+/// Once it's loaded, PSCCache serves the bar's image lookups from the atlas (see thumbnailAtlasLookupEnabled).
+@interface PSCAtlasScrobbleBar : PSPDFScrobbleBar
+@end
+
+/// Thumbnail cell that shows the atlas thumbnail as placeholder until the full-size thumbnail is loaded.
+@interface PSCAtlasThumbnailGridViewCell : PSPDFThumbnailGridViewCell
+@end
@@ -0,0 +1,109 @@
+//
+//  PSCAtlasThumbnailsViewController.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCAtlasThumbnailsViewController.h"
+#import "PSCThumbnailAtlas.h"
+#import "PSCImageDownscaler.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+static PSCThumbnailAtlas *PSCTinyAtlasForDocument(PSPDFDocument *document) {
+    return document ? [PSCThumbnailAtlas atlasForDocument:document size:PSPDFCache.sharedCache.tinySize] : nil;
+}
+
+@implementation PSCAtlasThumbnailsViewController
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFViewController
+
+- (void)commonInitWithDocument:(PSPDFDocument *)document {
+    [super commonInitWithDocument:document];
+
+    self.overrideClassNames = @{(id)[PSPDFScrobbleBar class] : [PSCAtlasScrobbleBar class], (id)[PSPDFThumbnailGridViewCell class] : [PSCAtlasThumbnailGridViewCell class]};
+
+    // Start building early, so the atlas is ready when the thumbnails are first shown.
+    [PSCTinyAtlasForDocument(document) loadWithCompletionBlock:NULL];
+}
+
+@end
+
+@interface PSCAtlasScrobbleBar () {
+    PSCThumbnailAtlas *_requestedAtlas;
+}
+@end
+
+@implementation PSCAtlasScrobbleBar
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - UIView
+
+- (void)layoutSubviews {
+    [super layoutSubviews];
+    [self loadAtlas];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Once the atlas is loaded, PSCCache answers the bar's tinySize lookups with slices of its sheets,
+// so the bar is just reloaded; nothing is looked up or drawn twice.
+- (void)loadAtlas {
+    PSCThumbnailAtlas *atlas = PSCTinyAtlasForDocument(self.pdfController.document);
+    if (!atlas || atlas.isLoaded || atlas == _requestedAtlas) return;
+
+    _requestedAtlas = atlas;
+    __weak PSCAtlasScrobbleBar *weakSelf = self;
+    [atlas loadWithCompletionBlock:^(PSCThumbnailAtlas *loadedAtlas, NSError *error) {
+        if (error) PSCLog(@"Failed to load thumbnail atlas: %@", [error localizedDescription]);
+        else [weakSelf updateToolbarForced];
+    }];
+}
+
+@end
+
+@implementation PSCAtlasThumbnailGridViewCell
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFThumbnailGridViewCell
+
+- (void)updateCell {
+    [super updateCell];
+
+    // Upscaled tiny thumbnail until the cache has loaded the real one.
+    if (!self.imageView.image) {
+        PSCThumbnailAtlas *atlas = PSCTinyAtlasForDocument(self.document);
+        UIImage *image = atlas.isLoaded ? [atlas imageForPage:self.page] : nil;
+        if (image) [self setImage:image animated:NO];
+        else [self loadDownscaledImage];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Without an atlas, a larger cached page image is scaled down off the main thread instead.
+- (void)loadDownscaledImage {
+    PSPDFDocument *document = self.document;
+    NSUInteger page = self.page;
+    if (!document) return;
+
+    CGSize size = PSPDFCache.sharedCache.thumbnailSize;
+    __weak PSCAtlasThumbnailGridViewCell *weakSelf = self;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        UIImage *image = [PSPDFCache.sharedCache downscaledImageFromDocument:document andPage:page withSize:size];
+        if (!image) return;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            PSCAtlasThumbnailGridViewCell *cell = weakSelf;
+            // Cells are reused; only apply if still showing the same page and the cache didn't deliver first.
+            if (cell.document == document && cell.page == page && !cell.imageView.image) [cell setImage:image animated:NO];
+        });
+    });
+}
+
+@end
@@ -7,6 +7,8 @@
 
 #import "PSCMagazine.h"
 
+@class PSCProgressivePDFSource;
+
 typedef NS_ENUM(NSUInteger, PSCStoreDownloadStatus) {
     PSCStoreDownloadStatusIdle,
     PSCStoreDownloadStatusLoading,
@@ -45,4 +47,11 @@ typedef NS_ENUM(NSUInteger, PSCStoreDownloadStatus) {
 /// Download cancelled?
 @property (nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
 
+/// Makes the partially downloaded file readable. Created once the server reported the file length.
+@property (nonatomic, strong, readonly) PSCProgressivePDFSource *progressiveSource;
+
+/// Magazine that reads from progressiveSource while the download is running. nil until progressiveSource exists.
+/// Missing data is fetched on demand; use progressiveSource.isPageAvailable: to check if a page can be shown right away.
+@property (nonatomic, strong, readonly) PSCMagazine *progressiveMagazine;
+
 @end
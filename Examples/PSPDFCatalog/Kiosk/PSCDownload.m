@@ -9,6 +9,8 @@
 #import "PSCStoreManager.h"
 #import "AFHTTPRequestOperation.h"
 #import "AFDownloadRequestOperation.h"
+#import "PSCProgressivePDFSource.h"
+#import "PSCContentIdentifier.h"
 
 @interface PSCDownload () {
     UIProgressView *progressView_;
@@ -18,6 +20,8 @@
 @property (nonatomic, assign) float downloadProgress;
 @property (nonatomic, strong) NSError *error;
 @property (nonatomic, strong) AFHTTPRequestOperation *request;
+@property (nonatomic, strong) PSCProgressivePDFSource *progressiveSource;
+@property (nonatomic, strong) PSCMagazine *progressiveMagazine;
 @end
 
 @implementation PSCDownload
@@ -55,6 +59,20 @@
     return _magazine;
 }
 
+- (PSCMagazine *)progressiveMagazine {
+    if (!_progressiveMagazine && self.progressiveSource) {
+        CGDataProviderRef dataProvider = [self.progressiveSource createDataProvider];
+        PSCMagazine *magazine = [PSCMagazine PDFDocumentWithDataProvider:dataProvider];
+        CGDataProviderRelease(dataProvider);
+        magazine.title = self.magazine.title;
+        magazine.UID = [NSString stringWithFormat:@"progressive-%@", self.URL.lastPathComponent];
+        // A read that timed out would leave a half-rendered page in the disk cache.
+        magazine.diskCacheStrategy = PSPDFDiskCacheStrategyNothing;
+        _progressiveMagazine = magazine;
+    }
+    return _progressiveMagazine;
+}
+
 - (void)setStatus:(PSCStoreDownloadStatus)aStatus {
     _status = aStatus;
 
@@ -100,6 +118,7 @@
         PSCLog(@"Download finished: %@", self.URL);
 
         if (self.isCancelled) {
+            [self.progressiveSource failDownload];
             self.status = PSCStoreDownloadStatusFailed;
             self.magazine.downloading = NO;
             return;
@@ -108,25 +127,41 @@
         NSString *fileName = [self.request.request.URL lastPathComponent];
         NSString *destinationPath = [[self downloadDirectory] stringByAppendingPathComponent:fileName];
         NSURL *destinationURL = [NSURL fileURLWithPath:destinationPath];
-        self.magazine.available = YES;
-        self.magazine.downloading = NO;
+        [self.progressiveSource finishDownload];
         self.magazine.fileURL = destinationURL;
-        self.status = PSCStoreDownloadStatusFinished;
-
-        // Start caching thumbnail and full-image sizes so that the document will render faster.
-        [PSPDFCache.sharedCache cacheDocument:self.magazine startAtPage:0 sizes:@[BOXED(PSPDFCache.sharedCache.thumbnailSize), BOXED(UIScreen.mainScreen.bounds.size)] diskCacheStrategy:PSPDFDiskCacheStrategyNearPages];
 
-        // don't back up the downloaded pdf - iCloud is for self-created files only.
-        [self addSkipBackupAttributeToItemAtURL:destinationURL];
+        // Hash in the background. A re-download keeps the UID of its path; identical copies elsewhere share their data.
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            NSString *UID = [PSCContentIdentifier.sharedIdentifier UIDForDocument:self.magazine];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (UID && ![UID isEqualToString:self.magazine.UID]) self.magazine.UID = UID;
+                self.magazine.available = YES;
+                self.magazine.downloading = NO;
+                self.status = PSCStoreDownloadStatusFinished;
+
+                // Start caching thumbnail and full-image sizes so that the document will render faster.
+                [PSPDFCache.sharedCache cacheDocument:self.magazine startAtPage:0 sizes:@[BOXED(PSPDFCache.sharedCache.thumbnailSize), BOXED(UIScreen.mainScreen.bounds.size)] diskCacheStrategy:PSPDFDiskCacheStrategyNearPages];
+
+                // don't back up the downloaded pdf - iCloud is for self-created files only.
+                [self addSkipBackupAttributeToItemAtURL:destinationURL];
+            });
+        });
     } failure:^(AFHTTPRequestOperation *operation, NSError *error) {
         PSCLog(@"Download failed: %@. Reason: %@.", self.URL, [error localizedDescription]);
         self.status = PSCStoreDownloadStatusFailed;
         self.error = pdfRequestWeak.error;
         self.magazine.downloading = NO;
+        [self.progressiveSource failDownload];
     }];
     [pdfRequest setProgressiveDownloadProgressBlock:^(AFDownloadRequestOperation *operation, NSInteger bytesRead, long long totalBytesRead, long long totalBytesExpected, long long totalBytesReadForFile, long long totalBytesExpectedToReadForFile) {
         self.downloadProgress = totalBytesReadForFile/(float)totalBytesExpectedToReadForFile;
 
+        // The temp file keeps its inode when it's moved to the target path, so the source can keep reading from it.
+        if (!self.progressiveSource && totalBytesExpectedToReadForFile > 0) {
+            NSURL *tempURL = [NSURL fileURLWithPath:[operation tempPath]];
+            self.progressiveSource = [[PSCProgressivePDFSource alloc] initWithRemoteURL:self.URL localFileURL:tempURL length:(unsigned long long)totalBytesExpectedToReadForFile];
+        }
+        self.progressiveSource.downloadedLength = (unsigned long long)totalBytesReadForFile;
     }];
     [pdfRequest start];
 
@@ -137,6 +172,7 @@
 - (void)cancelDownload {
     self.status = PSCStoreDownloadStatusCancelled;
     [_request cancel];
+    [_progressiveSource failDownload];
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -12,6 +12,9 @@
 #import "PSCKioskPDFViewController.h"
 #import "PSCSettingsController.h"
 #import "PSCShadowView.h"
+#import "PSCDownload.h"
+#import "PSCProgressivePDFSource.h"
+#import "PSCCacheWarmer.h"
 #import "SDURLCache.h"
 
 #if !__has_feature(objc_arc)
@@ -39,6 +42,7 @@
 @property (nonatomic, strong) PSCShadowView *shadowView;
 @property (nonatomic, strong) UISearchBar *searchBar;
 @property (nonatomic, strong) UIActivityIndicatorView *activityView;
+@property (nonatomic, strong) PSCCacheWarmer *coverWarmer;
 @end
 
 @implementation PSCGridController
@@ -79,6 +83,7 @@
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [_coverWarmer cancel];
     _searchBar.delegate = nil;
 }
 
@@ -465,15 +470,12 @@
     // If we're in plain mode, pre-set a folder.
     if (kPSPDFStoreManagerPlain) self.magazineFolder = PSCStoreManager.sharedStoreManager.magazineFolders.lastObject;
 
-    // Preload all magazines. (copy to prevent mutation errors)
+    // Preload all magazines. (copied by the warmer to prevent mutation errors)
+    // Each magazine is opened only once; covers that are already on disk are skipped without opening the PDF.
     // Don't do this on old devices, might gobble up the render stack if there are slow documents.
     if (!PSPDFIsCrappyDevice()) {
-        NSArray *magazines = [self.magazineFolder.magazines copy];
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
-            for (PSCMagazine *magazine in magazines) {
-                [PSPDFCache.sharedCache imageFromDocument:magazine andPage:0 withSize:kPSCLargeThumbnailSize options:PSPDFCacheOptionDiskLoadSkip|PSPDFCacheOptionRenderQueueBackground|PSPDFCacheOptionMemoryStoreNever|PSPDFCacheOptionActualityIgnore];
-            }
-        });
+        [self.coverWarmer cancel];
+        self.coverWarmer = [PSPDFCache.sharedCache warmCoversOfDocuments:self.magazineFolder.magazines sizes:@[BOXED(kPSCLargeThumbnailSize)] completionBlock:nil];
     }
 
     [self updateGrid];
@@ -632,7 +634,11 @@
     PSCLog(@"Magazine selected: %d %@", indexPath.item, magazine);
 
     if (folder.magazines.count == 1 || self.magazineFolder) {
-        if (magazine.isDownloading) {
+        PSCDownload *download = magazine.isDownloading ? [[PSCStoreManager sharedStoreManager] downloadObjectForMagazine:magazine] : nil;
+        if (download.progressiveMagazine && [download.progressiveSource isPageAvailable:0]) {
+            // Linearized files can be opened as soon as the first page arrived; the rest is loaded on demand.
+            [self openMagazine:download.progressiveMagazine animated:YES cellIndex:indexPath.item];
+        }else if (magazine.isDownloading) {
             [[[UIAlertView alloc] initWithTitle:PSPDFAppName()
                                         message:_(@"Item is currently downloading.")
                                        delegate:nil
@@ -0,0 +1,77 @@
+//
+//  PSCProgressivePDFSource.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+// Posted on the main thread when the first page becomes readable or the download completes. object = source.
+extern NSString *const PSCProgressivePDFSourceAvailabilityDidChangeNotification;
+
+/**
+ Makes a PDF readable while it is still being downloaded.
+
+ The downloader writes to localFileURL and reports the length of the contiguous prefix via downloadedLength.
+ Reads within the prefix are served from the file; reads beyond are fetched with HTTP range requests
+ and block until the data arrives (or readTimeout expires). The block containing the trailer is requested right away.
+ Servers that ignore range requests still work, readers then wait for the sequential download instead.
+ A failed range request fails the read that issued it; the block is requested again by the next read.
+
+ For linearized ("fast web view") PDFs, the linearization dictionary is parsed from the start of the file,
+ and the first page is reported as available as soon as its section (/E) has been downloaded.
+ The hint tables are not evaluated; other pages are fetched on demand when they are rendered.
+ */
+@interface PSCProgressivePDFSource : NSObject
+
+/// Designated initializer. length is the expected total file length (as reported by the server).
+- (id)initWithRemoteURL:(NSURL *)remoteURL localFileURL:(NSURL *)localFileURL length:(unsigned long long)length;
+
+/// Creates a new data provider that reads from this source. Follows the create rule; release with CGDataProviderRelease.
+/// The data provider retains the source.
+- (CGDataProviderRef)createDataProvider CF_RETURNS_RETAINED;
+
+/// URL the missing ranges are fetched from.
+@property (nonatomic, strong, readonly) NSURL *remoteURL;
+
+/// File that is being written by the download. Renaming the file after the download completes is fine.
+@property (nonatomic, strong, readonly) NSURL *localFileURL;
+
+/// Expected total length.
+@property (nonatomic, assign, readonly) unsigned long long length;
+
+/// Length of the contiguous prefix of localFileURL that has been written. Set by the downloader; only grows.
+@property (atomic, assign) unsigned long long downloadedLength;
+
+/// Call when the download completed. All reads are served from the file afterwards.
+- (void)finishDownload;
+
+/// Call when the download failed or was cancelled. Pending and future reads beyond the prefix fail.
+- (void)failDownload;
+
+/// YES after finishDownload has been called.
+@property (atomic, assign, readonly, getter=isComplete) BOOL complete;
+
+/// YES if the file starts with a valid linearization dictionary.
+@property (atomic, assign, readonly, getter=isLinearized) BOOL linearized;
+
+/// Page count from the linearization dictionary (/N), or 0 if the file isn't linearized.
+@property (atomic, assign, readonly) NSUInteger linearizedPageCount;
+
+/// Returns YES if page can be rendered without waiting for the network.
+/// Without linearization, this is only the case once the download is complete.
+- (BOOL)isPageAvailable:(NSUInteger)page;
+
+/// Maximum time a read waits for missing data before it fails. Defaults to 30 seconds.
+@property (atomic, assign) NSTimeInterval readTimeout;
+
+/// Size of the blocks fetched with range requests. Defaults to 256KB. Set before the first downloadedLength update.
+@property (atomic, assign) NSUInteger rangeRequestSize;
+
+/// Maximum number of fetched blocks kept in memory. The least recently used blocks are dropped and fetched again when needed.
+/// Defaults to 16 (4MB with the default rangeRequestSize).
+@property (atomic, assign) NSUInteger maximumFetchedBlockCount;
+
+/// Number of range requests that have been issued.
+@property (atomic, assign, readonly) NSUInteger rangeRequestCount;
+
+@end
@@ -0,0 +1,338 @@
+//
+//  PSCProgressivePDFSource.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCProgressivePDFSource.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+NSString *const PSCProgressivePDFSourceAvailabilityDidChangeNotification = @"PSCProgressivePDFSourceAvailabilityDidChangeNotification";
+
+// The linearization dictionary must be contained in the first 1024 bytes of the file. (PDF Reference, F.2)
+#define kPSCLinearizationHeaderLength 1024
+
+@interface PSCProgressivePDFSource () {
+    NSCondition *_condition;
+    NSOperationQueue *_rangeQueue;
+    int _fileDescriptor;
+    unsigned long long _downloadedLength;
+    unsigned long long _firstPageEnd;
+    NSUInteger _blockSize;
+    NSMutableDictionary *_fetchedBlocks;
+    NSMutableArray *_fetchedBlockOrder;   // NSNumber block indexes, least recently used first
+    NSMutableIndexSet *_pendingBlocks;
+    NSMutableIndexSet *_failedBlocks;
+    BOOL _linearizationChecked;
+    BOOL _fileOpenAttempted;
+    BOOL _rangeRequestsUnsupported;
+    BOOL _failed;
+}
+@property (atomic, assign, getter=isComplete) BOOL complete;
+@property (atomic, assign, getter=isLinearized) BOOL linearized;
+@property (atomic, assign) NSUInteger linearizedPageCount;
+@property (atomic, assign) NSUInteger rangeRequestCount;
+@end
+
+@implementation PSCProgressivePDFSource
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithRemoteURL:(NSURL *)remoteURL localFileURL:(NSURL *)localFileURL length:(unsigned long long)length {
+    if ((self = [super init])) {
+        _remoteURL = remoteURL;
+        _localFileURL = localFileURL;
+        _length = length;
+        _fileDescriptor = -1;
+        _readTimeout = 30.0;
+        _rangeRequestSize = 256 * 1024;
+        _condition = [NSCondition new];
+        _maximumFetchedBlockCount = 16;
+        _fetchedBlocks = [NSMutableDictionary new];
+        _fetchedBlockOrder = [NSMutableArray new];
+        _pendingBlocks = [NSMutableIndexSet new];
+        _failedBlocks = [NSMutableIndexSet new];
+        _rangeQueue = [NSOperationQueue new];
+        _rangeQueue.maxConcurrentOperationCount = 2;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_fileDescriptor >= 0) close(_fileDescriptor);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %p: %@ downloaded:%llu/%llu linearized:%d rangeRequests:%d>", self.class, self, self.remoteURL.lastPathComponent, self.downloadedLength, self.length, self.isLinearized, self.rangeRequestCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+static size_t PSCProgressiveGetBytes(void *info, void *buffer, off_t position, size_t count) {
+    PSCProgressivePDFSource *source = (__bridge PSCProgressivePDFSource *)info;
+    return [source getBytes:buffer atPosition:position count:count];
+}
+
+static void PSCProgressiveReleaseInfo(void *info) {
+    CFRelease(info);
+}
+
+- (CGDataProviderRef)createDataProvider {
+    CGDataProviderDirectCallbacks callbacks = {0, NULL, NULL, PSCProgressiveGetBytes, PSCProgressiveReleaseInfo};
+    return CGDataProviderCreateDirect((__bridge_retained void *)self, (off_t)self.length, &callbacks);
+}
+
+- (unsigned long long)downloadedLength {
+    [_condition lock];
+    unsigned long long downloadedLength = _downloadedLength;
+    [_condition unlock];
+    return downloadedLength;
+}
+
+- (void)setDownloadedLength:(unsigned long long)downloadedLength {
+    [_condition lock];
+    BOOL firstPageWasAvailable = [self isFirstPageAvailableLocked];
+    if (downloadedLength > _downloadedLength) {
+        _downloadedLength = MIN(downloadedLength, _length);
+
+        // Only once; if the file can't be opened, reads are served by range requests.
+        if (!_fileOpenAttempted) {
+            [self openFileLocked];
+
+            // CGPDF always starts with the trailer at the end of the file; fetch it before anybody asks.
+            if (_blockSize == 0) _blockSize = MAX(self.rangeRequestSize, 4096U);
+            NSUInteger lastBlockIndex = (NSUInteger)((_length - 1) / _blockSize);
+            if ((unsigned long long)lastBlockIndex * _blockSize >= _downloadedLength) [self fetchBlockAtIndexLocked:lastBlockIndex];
+        }
+        if (!_linearizationChecked && _downloadedLength >= MIN(kPSCLinearizationHeaderLength, _length)) {
+            [self parseLinearizationDictionaryLocked];
+        }
+
+        // Blocks that are now covered by the file aren't needed anymore.
+        if (_blockSize > 0) {
+            for (NSNumber *blockIndex in _fetchedBlocks.allKeys) {
+                if ((blockIndex.unsignedLongLongValue + 1) * _blockSize <= _downloadedLength) {
+                    [_fetchedBlocks removeObjectForKey:blockIndex];
+                    [_fetchedBlockOrder removeObject:blockIndex];
+                }
+            }
+        }
+        [_condition broadcast];
+    }
+    BOOL firstPageIsAvailable = [self isFirstPageAvailableLocked];
+    [_condition unlock];
+
+    if (!firstPageWasAvailable && firstPageIsAvailable) [self postAvailabilityNotification];
+}
+
+- (void)finishDownload {
+    [_condition lock];
+    // Small files may finish without any progress update before.
+    if (_fileDescriptor < 0) [self openFileLocked];
+    _downloadedLength = _length;
+    if (!_linearizationChecked) [self parseLinearizationDictionaryLocked];
+    [_fetchedBlocks removeAllObjects];
+    [_fetchedBlockOrder removeAllObjects];
+    self.complete = YES;
+    [_condition broadcast];
+    [_condition unlock];
+
+    [self postAvailabilityNotification];
+}
+
+- (void)failDownload {
+    [_condition lock];
+    _failed = YES;
+    [_rangeQueue cancelAllOperations];
+    [_condition broadcast];
+    [_condition unlock];
+}
+
+- (BOOL)isPageAvailable:(NSUInteger)page {
+    if (self.isComplete) {
+        NSUInteger pageCount = self.linearizedPageCount;
+        return pageCount == 0 || page < pageCount;
+    }
+    if (page > 0) return NO;
+
+    [_condition lock];
+    BOOL available = [self isFirstPageAvailableLocked];
+    [_condition unlock];
+    return available;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)openFileLocked {
+    _fileOpenAttempted = YES;
+    _fileDescriptor = open(self.localFileURL.path.fileSystemRepresentation, O_RDONLY);
+    if (_fileDescriptor < 0) PSCLog(@"Failed to open %@: %s", self.localFileURL.path, strerror(errno));
+}
+
+- (BOOL)isFirstPageAvailableLocked {
+    return self.isComplete || (self.isLinearized && _downloadedLength >= _firstPageEnd);
+}
+
+- (void)postAvailabilityNotification {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [[NSNotificationCenter defaultCenter] postNotificationName:PSCProgressivePDFSourceAvailabilityDidChangeNotification object:self];
+    });
+}
+
+// Returns the integer value for key (e.g. @"/E") in a PDF dictionary, or -1.
+static long long PSCDictionaryIntegerValue(NSString *dictionary, NSString *key) {
+    NSRange searchRange = NSMakeRange(0, dictionary.length);
+    NSRange keyRange;
+    while ((keyRange = [dictionary rangeOfString:key options:0 range:searchRange]).location != NSNotFound) {
+        NSUInteger valueLocation = NSMaxRange(keyRange);
+        searchRange = NSMakeRange(valueLocation, dictionary.length - valueLocation);
+
+        // Skip longer names that share the prefix. (/L vs /Linearized)
+        if (valueLocation >= dictionary.length || ![[NSCharacterSet whitespaceAndNewlineCharacterSet] characterIsMember:[dictionary characterAtIndex:valueLocation]]) continue;
+
+        NSScanner *scanner = [NSScanner scannerWithString:dictionary];
+        scanner.scanLocation = valueLocation;
+        long long value;
+        if ([scanner scanLongLong:&value]) return value;
+    }
+    return -1;
+}
+
+- (void)parseLinearizationDictionaryLocked {
+    _linearizationChecked = YES;
+    if (_fileDescriptor < 0) return;
+
+    char header[kPSCLinearizationHeaderLength];
+    ssize_t readLength = pread(_fileDescriptor, header, (size_t)MIN(sizeof(header), _downloadedLength), 0);
+    if (readLength <= 0) return;
+
+    NSString *string = [[NSString alloc] initWithBytes:header length:readLength encoding:NSISOLatin1StringEncoding];
+    NSRange linearizedRange = [string rangeOfString:@"/Linearized"];
+    if (linearizedRange.location == NSNotFound) return;
+    NSRange endRange = [string rangeOfString:@">>" options:0 range:NSMakeRange(linearizedRange.location, string.length - linearizedRange.location)];
+    if (endRange.location == NSNotFound) return;
+    NSString *dictionary = [string substringWithRange:NSMakeRange(linearizedRange.location, endRange.location - linearizedRange.location)];
+
+    long long fileLength = PSCDictionaryIntegerValue(dictionary, @"/L");
+    long long firstPageEnd = PSCDictionaryIntegerValue(dictionary, @"/E");
+    long long pageCount = PSCDictionaryIntegerValue(dictionary, @"/N");
+
+    // A length mismatch means the file has been updated incrementally; the linearization is no longer valid.
+    if (fileLength != (long long)_length || firstPageEnd <= 0 || pageCount <= 0) {
+        PSCLog(@"Ignoring linearization dictionary of %@ (L:%lld E:%lld N:%lld)", self.remoteURL.lastPathComponent, fileLength, firstPageEnd, pageCount);
+        return;
+    }
+    _firstPageEnd = (unsigned long long)firstPageEnd;
+    self.linearizedPageCount = (NSUInteger)pageCount;
+    self.linearized = YES;
+}
+
+- (void)fetchBlockAtIndexLocked:(NSUInteger)blockIndex {
+    [_pendingBlocks addIndex:blockIndex];
+    self.rangeRequestCount++;
+
+    unsigned long long start = (unsigned long long)blockIndex * _blockSize;
+    unsigned long long end = MIN(start + _blockSize, _length) - 1;
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.remoteURL cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:self.readTimeout];
+    [request setValue:[NSString stringWithFormat:@"bytes=%llu-%llu", start, end] forHTTPHeaderField:@"Range"];
+
+    [NSURLConnection sendAsynchronousRequest:request queue:_rangeQueue completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+        NSInteger statusCode = [response isKindOfClass:NSHTTPURLResponse.class] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+
+        [_condition lock];
+        [_pendingBlocks removeIndex:blockIndex];
+        if (statusCode == 206 && data.length == end - start + 1) {
+            // The connection works again; earlier failures are retried on the next read.
+            [_failedBlocks removeAllIndexes];
+            if (start + data.length > _downloadedLength) [self storeFetchedBlock:data atIndexLocked:blockIndex];
+        }else if (statusCode == 200) {
+            // Server ignored the Range header and sent the whole file. Wait for the download instead.
+            PSCLog(@"%@ doesn't support range requests.", self.remoteURL.host);
+            _rangeRequestsUnsupported = YES;
+        }else {
+            PSCLog(@"Range request %llu-%llu for %@ failed (%d): %@", start, end, self.remoteURL.lastPathComponent, statusCode, [error localizedDescription]);
+            [_failedBlocks addIndex:blockIndex];
+        }
+        [_condition broadcast];
+        [_condition unlock];
+    }];
+}
+
+// Evicts the least recently used blocks beyond maximumFetchedBlockCount; they are fetched again when needed.
+- (void)storeFetchedBlock:(NSData *)block atIndexLocked:(NSUInteger)blockIndex {
+    _fetchedBlocks[@(blockIndex)] = block;
+    [_fetchedBlockOrder removeObject:@(blockIndex)];
+    [_fetchedBlockOrder addObject:@(blockIndex)];
+    while (_fetchedBlockOrder.count > MAX(self.maximumFetchedBlockCount, 1U)) {
+        [_fetchedBlocks removeObjectForKey:_fetchedBlockOrder[0]];
+        [_fetchedBlockOrder removeObjectAtIndex:0];
+    }
+}
+
+- (size_t)getBytes:(void *)buffer atPosition:(off_t)position count:(size_t)count {
+    if (position < 0 || (unsigned long long)position >= _length) return 0;
+    count = (size_t)MIN(count, _length - position);
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:self.readTimeout];
+    NSMutableIndexSet *requestedBlocks = [NSMutableIndexSet indexSet];
+    size_t copied = 0;
+
+    [_condition lock];
+    if (_blockSize == 0) _blockSize = MAX(self.rangeRequestSize, 4096U);
+    while (copied < count) {
+        unsigned long long offset = position + copied;
+
+        // Already downloaded.
+        if (offset < _downloadedLength && _fileDescriptor >= 0) {
+            size_t readLength = (size_t)MIN(count - copied, _downloadedLength - offset);
+            int fileDescriptor = _fileDescriptor;
+            [_condition unlock];
+            ssize_t result = pread(fileDescriptor, (char *)buffer + copied, readLength, (off_t)offset);
+            [_condition lock];
+            if (result <= 0) break;
+            copied += result;
+            continue;
+        }
+
+        // Fetched by a range request.
+        NSUInteger blockIndex = (NSUInteger)(offset / _blockSize);
+        NSData *block = _fetchedBlocks[@(blockIndex)];
+        if (block) {
+            size_t blockOffset = (size_t)(offset - (unsigned long long)blockIndex * _blockSize);
+            size_t copyLength = MIN(count - copied, block.length - blockOffset);
+            memcpy((char *)buffer + copied, (const char *)block.bytes + blockOffset, copyLength);
+            copied += copyLength;
+            [_fetchedBlockOrder removeObject:@(blockIndex)];
+            [_fetchedBlockOrder addObject:@(blockIndex)];
+            continue;
+        }
+
+        if (_failed) break;
+        if ([_failedBlocks containsIndex:blockIndex]) {
+            // Give up if our own request failed; a block that failed for an earlier read is requested once more.
+            if ([requestedBlocks containsIndex:blockIndex]) break;
+            [_failedBlocks removeIndex:blockIndex];
+        }
+        if (!_rangeRequestsUnsupported && ![_pendingBlocks containsIndex:blockIndex]) {
+            [self fetchBlockAtIndexLocked:blockIndex];
+            [requestedBlocks addIndex:blockIndex];
+        }
+        if (![_condition waitUntilDate:deadline]) {
+            PSCLog(@"Timed out reading %zu bytes at %llu from %@", count - copied, offset, self.remoteURL.lastPathComponent);
+            break;
+        }
+    }
+    [_condition unlock];
+    return copied;
+}
+
+@end
@@ -9,6 +9,8 @@
 #import "PSCMagazine.h"
 #import "PSCMagazineFolder.h"
 #import "PSCDownload.h"
+#import "PSCContentIdentifier.h"
+#import "PSCCacheScrubber.h"
 #import "AFJSONRequestOperation.h"
 #include <objc/runtime.h>
 
@@ -16,6 +18,7 @@
     NSMutableArray *_magazineFolders;
     NSMutableArray *_downloadQueue;
     dispatch_queue_t _magazineFolderQueue;
+    PSCCacheScrubber *_cacheScrubber;
 }
 @property (nonatomic, strong) NSMutableArray *magazineFolders;
 @property (nonatomic, strong) NSMutableArray *downloadQueue;
@@ -74,6 +77,8 @@ static char kPSCKVOToken; // we need a static address for the kvo token
         dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
             [self loadMagazinesFromDisk];
         });
+
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationDidEnterBackgroundNotification:) name:UIApplicationDidEnterBackgroundNotification object:nil];
     }
     return self;
 }
@@ -467,6 +472,9 @@ static char kPSCKVOToken; // we need a static address for the kvo token
 - (void)loadMagazinesFromDisk {
     NSMutableArray *magazineFolders = [self searchForMagazineFolders];
 
+    // Identical files (e.g. a bundled sample that was also downloaded) share rendered pages and view state.
+    [PSCContentIdentifier.sharedIdentifier assignContentUIDsToDocuments:[magazineFolders valueForKeyPath:@"@unionOfArrays.magazines"]];
+
     dispatch_async(dispatch_get_main_queue(), ^{
         pspdf_dispatch_sync_reentrant(_magazineFolderQueue, ^{
             self.magazineFolders = magazineFolders;
@@ -488,6 +496,34 @@ static char kPSCKVOToken; // we need a static address for the kvo token
     return magazineFolders;
 }
 
+// Nothing is rendered in the background, a good time to clean up the cache.
+- (void)applicationDidEnterBackgroundNotification:(NSNotification *)notification {
+    if (_cacheScrubber || self.isDiskDataLoaded) return;
+
+    // Magazines that are no longer available are passed on too; the scrubber removes whatever they left in the cache.
+    // Only magazines that are still downloading are skipped, they don't have their file yet and would look deleted.
+    NSArray *magazines = [self.magazineFolders valueForKeyPath:@"@unionOfArrays.magazines"];
+    magazines = [magazines filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"downloading == NO"]];
+
+    PSCCacheScrubber *cacheScrubber = [[PSCCacheScrubber alloc] initWithCache:PSPDFCache.sharedCache];
+    cacheScrubber.documents = magazines;
+    UIApplication *application = [UIApplication sharedApplication];
+    __block UIBackgroundTaskIdentifier backgroundTask = UIBackgroundTaskInvalid;
+    void (^endBackgroundTask)(void) = ^{
+        if (backgroundTask != UIBackgroundTaskInvalid) [application endBackgroundTask:backgroundTask];
+        backgroundTask = UIBackgroundTaskInvalid;
+        if (_cacheScrubber == cacheScrubber) _cacheScrubber = nil;
+    };
+    backgroundTask = [application beginBackgroundTaskWithExpirationHandler:^{
+        [cacheScrubber cancel];
+        endBackgroundTask();
+    }];
+    _cacheScrubber = cacheScrubber;
+    [cacheScrubber startWithCompletionBlock:^(PSCCacheScrubber *scrubber) {
+        endBackgroundTask();
+    }];
+}
+
 - (void)finishDownload:(PSCDownload *)storeDownload {
     [storeDownload removeObserver:self forKeyPath:NSStringFromSelector(@selector(status))];
     [_downloadQueue removeObject:storeDownload];
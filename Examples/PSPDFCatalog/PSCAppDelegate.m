@@ -7,6 +7,7 @@
 
 #import "PSCAppDelegate.h"
 #import "PSCatalogViewController.h"
+#import "PSCCache.h"
 #import <DropboxSDK/DropboxSDK.h>
 #import <objc/message.h>
 #ifdef HOCKEY_ENABLED
@@ -27,6 +28,9 @@
     NSString *appVersion = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleShortVersionString"];
     NSLog(@"Starting Catalog Example %@ with %@", appVersion, PSPDFVersionString());
 
+    // Use a custom cache subclass. This needs to be set before PSPDFCache is accessed the first time.
+    kPSPDFCacheClassName = NSStringFromClass(PSCCache.class);
+
     // Example how to localize strings in PSPDFKit.
     // See PSPDFKit.bundle/en.lproj/PSPDFKit.strings for all available strings.
     // You can also replace the strings in the PSPDFKit.bundle, but then make sure you merge your changes anytime the bundle is updated.
@@ -42,15 +42,33 @@
 #import "PSCHeadlessSearchPDFViewController.h"
 #import "PSCSaveAsPDFViewController.h"
 #import "PSCCustomThumbnailsViewController.h"
+#import "PSCAtlasThumbnailsViewController.h"
+#import "PSCPyramidCacher.h"
 #import "PSCHideHUDForThumbnailsViewController.h"
 #import "PSCHideHUDDelayedDocumentViewController.h"
 #import "PSCCustomDefaultZoomScaleViewController.h"
 #import "PSCTextParserTest.h"
+#import "PSCInkRoundTripTest.h"
+#import "PSCProgressivePDFSourceTest.h"
+#import "PSCImageDownscalerTest.h"
 #import "PSCAppDelegate.h"
 #import "PSCDropboxSplitViewController.h"
 #import "PSCAnnotationTrailerCaptureDocument.h"
 #import "PSCImageOverlayPDFViewController.h"
 #import "PSCColoredHighlightAnnotation.h"
+#import "PSCInkAnnotation.h"
+#import "PSCInkSimplifyingAnnotationProvider.h"
+#import "PSCDrawView.h"
+#import "PSCStampAnnotation.h"
+#import "PSCAnnotationImporter.h"
+#import "PSCAESCryptoDataProvider.h"
+#import "PSCCacheCipher.h"
+#import "PSCCachingDecryptor.h"
+#import "PSCLazyMultiFileDocument.h"
+#import "PSCSharedDocumentProvider.h"
+#import "PSCParallelPDFExporter.h"
+#import "PSCPDFPageCopier.h"
+#import "PSCConversionPool.h"
 #import <objc/runtime.h>
 
 // Dropbox support
@@ -250,6 +268,24 @@ const char kPSCAlertViewKey;
         return controller;
     }]];
 
+    /// Same, but page count and page geometry come from a manifest and files are only opened when their pages are shown.
+    [documentTests addContent:[[PSContent alloc] initWithTitle:@"Multiple files (lazy, with manifest)" block:^{
+        NSArray *files = @[@"A.pdf", @"B.pdf", @"C.pdf", @"D.pdf"];
+        PSCLazyMultiFileDocument *document = [PSCLazyMultiFileDocument PDFDocumentWithBaseURL:samplesURL files:files];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        controller.rightBarButtonItems = @[controller.searchButtonItem, controller.viewModeButtonItem];
+        return controller;
+    }]];
+
+    /// Render, text parsing and annotation threads share one document reference without waiting for each other.
+    [documentTests addContent:[[PSContent alloc] initWithTitle:@"Shared document reference (reader-writer)" block:^{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+        [document overrideClass:PSPDFDocumentProvider.class withClass:PSCSharedDocumentProvider.class];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        controller.rightBarButtonItems = @[controller.searchButtonItem, controller.annotationButtonItem, controller.viewModeButtonItem];
+        return controller;
+    }]];
+
     [documentTests addContent:[[PSContent alloc] initWithTitle:@"Multiple NSData objects (memory mapped)" block:^{
         static PSPDFDocument *document = nil;
         if (!document) {
@@ -362,6 +398,44 @@ const char kPSCAlertViewKey;
         return controller;
     }]];
 
+    [documentTests addContent:[[PSContent alloc] initWithTitle:@"Extract pages without re-rendering with PSCPDFPageCopier" block:^{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kHackerMagazineExample]];
+
+        // Pages are copied object by object; only pages with annotations are drawn by PSPDFProcessor.
+        NSMutableIndexSet *pageIndexes = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, 5)];
+        [pageIndexes addIndex:document.pageCount - 1];
+        NSURL *tempURL = PSPDFTempFileURLWithPathExtension(@"copied", @"pdf");
+        PSCPDFPageCopier *pageCopier = [[PSCPDFPageCopier alloc] initWithDocument:document];
+        NSError *error = nil;
+        if (![pageCopier generatePDFWithPages:pageIndexes outputFileURL:tempURL options:@{kPSPDFProcessorAnnotationTypes : @(PSPDFAnnotationTypeAll & ~PSPDFAnnotationTypeLink)} error:&error]) {
+            PSCLog(@"Copying pages failed: %@", error);
+        }
+        PSCLog(@"%@", pageCopier);
+
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:[PSPDFDocument PDFDocumentWithURL:tempURL]];
+        controller.additionalBarButtonItems = @[controller.openInButtonItem, controller.emailButtonItem];
+        return controller;
+    }]];
+
+    [documentTests addContent:[[PSContent alloc] initWithTitle:@"Flatten annotations with PSCParallelPDFExporter" block:^{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kHackerMagazineExample]];
+
+        // Batches of pages are flattened concurrently and streamed into the output file in order.
+        NSURL *tempURL = PSPDFTempFileURLWithPathExtension(@"flattened", @"pdf");
+        PSCParallelPDFExporter *exporter = [[PSCParallelPDFExporter alloc] initWithDocument:document];
+        NSDictionary *options = @{kPSPDFProcessorAnnotationTypes : @(PSPDFAnnotationTypeAll & ~PSPDFAnnotationTypeLink)};
+        NSError *error = nil;
+        if (![exporter exportPages:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, document.pageCount)] toURL:tempURL options:options progressBlock:^(NSUInteger currentPage, NSUInteger numberOfProcessedPages, NSUInteger totalPages) {
+            PSCLog(@"Exported page %d (%d/%d)", currentPage, numberOfProcessedPages, totalPages);
+        } error:&error]) {
+            PSCLog(@"Export failed: %@", error);
+        }
+
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:[PSPDFDocument PDFDocumentWithURL:tempURL]];
+        controller.additionalBarButtonItems = @[controller.openInButtonItem, controller.emailButtonItem];
+        return controller;
+    }]];
+
     [documentTests addContent:[[PSContent alloc] initWithTitle:@"Limit pages to 5-10 via pageRange" block:^{
         // cache needs to be cleared since pages will change.
         [[PSPDFCache sharedCache] clearCache];
@@ -499,6 +573,27 @@ const char kPSCAlertViewKey;
         return [[PSCSaveAsPDFViewController alloc] initWithDocument:linkDocument];
     }]];
 
+    [annotationSection addContent:[[PSContent alloc] initWithTitle:@"Export and import annotations as XFDF" block:^{
+        // Stream all annotations of the test document into a XFDF file.
+        PSPDFDocument *sourceDocument = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:@"Annotation Test.pdf"]];
+        NSURL *XFDFURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"annotations.xfdf"]];
+        NSError *error = nil;
+        PSCAnnotationExporter *exporter = [[PSCAnnotationExporter alloc] initWithDocument:sourceDocument];
+        if (![exporter exportAnnotationsToURL:XFDFURL format:PSCAnnotationStreamFormatXFDF error:&error]) {
+            NSLog(@"Failed to export annotations: %@", error);
+        }
+
+        // And read them back into another document.
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithData:[NSData dataWithContentsOfURL:hackerMagURL options:NSDataReadingMappedIfSafe error:NULL]];
+        document.annotationSaveMode = PSPDFAnnotationSaveModeDisabled;
+        PSCAnnotationImporter *importer = [[PSCAnnotationImporter alloc] initWithDocument:document];
+        if (![importer importAnnotationsFromURL:XFDFURL format:PSCAnnotationStreamFormatXFDF error:&error]) {
+            NSLog(@"Failed to import annotations: %@", error);
+        }
+        document.title = [NSString stringWithFormat:@"%d annotations exported, %d imported", exporter.exportedAnnotationCount, importer.importedAnnotationCount];
+        return [[PSPDFViewController alloc] initWithDocument:document];
+    }]];
+
     [content addObject:annotationSection];
     ///////////////////////////////////////////////////////////////////////////////////////////
 
@@ -590,6 +685,30 @@ const char kPSCAlertViewKey;
         [websitePrompt show];
         return nil;
     }]];
+
+    [textExtractionSection addContent:[[PSContent alloc] initWithTitle:@"Benchmark HTML conversion with PSCConversionPool" block:^UIViewController *{
+        // Create a few local HTML files of different lengths.
+        NSMutableArray *fileURLs = [NSMutableArray array];
+        for (NSUInteger idx = 0; idx < 12; idx++) {
+            NSMutableString *HTML = [NSMutableString stringWithFormat:@"<html><body><h1>Report %d</h1>", idx];
+            for (NSUInteger paragraph = 0; paragraph < 20 * (idx + 1); paragraph++) {
+                [HTML appendFormat:@"<p>Paragraph %d. Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.</p>", paragraph];
+            }
+            [HTML appendString:@"</body></html>"];
+            NSURL *fileURL = PSPDFTempFileURLWithPathExtension([NSString stringWithFormat:@"report-%d", idx], @"html");
+            [HTML writeToURL:fileURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+            [fileURLs addObject:fileURL];
+        }
+
+        [PSPDFProgressHUD showWithStatus:@"Converting..." maskType:PSPDFProgressHUDMaskTypeGradient];
+        [[PSCConversionPool sharedPool] benchmarkWithFileURLs:fileURLs options:@{kPSPDFProcessorNumberOfPages : @(20)} completionBlock:^(NSTimeInterval poolTime, NSTimeInterval processorTime) {
+            for (NSURL *fileURL in fileURLs) [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+            [PSPDFProgressHUD dismiss];
+            NSString *message = [NSString stringWithFormat:@"%d files\nPSCConversionPool: %.2fs\nPSPDFProcessor: %.2fs", fileURLs.count, poolTime, processorTime];
+            [[[UIAlertView alloc] initWithTitle:@"Conversion Benchmark" message:message delegate:nil cancelButtonTitle:@"Ok" otherButtonTitles:nil] show];
+        }];
+        return nil;
+    }]];
     [content addObject:textExtractionSection];
 
     ///////////////////////////////////////////////////////////////////////////////////////////
@@ -739,6 +858,12 @@ const char kPSCAlertViewKey;
         return pdfController;
     }]];
 
+    [customizationSection addContent:[[PSContent alloc] initWithTitle:@"Scrobble bar and thumbnails from a sprite atlas" block:^{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+        PSPDFViewController *pdfController = [[PSCAtlasThumbnailsViewController alloc] initWithDocument:document];
+        return pdfController;
+    }]];
+
     [customizationSection addContent:[[PSContent alloc] initWithTitle:@"Hide HUD while showing thumbnails" block:^{
         PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
         PSPDFViewController *pdfController = [[PSCHideHUDForThumbnailsViewController alloc] initWithDocument:document];
@@ -819,6 +944,22 @@ const char kPSCAlertViewKey;
         }]];
     }
 
+    /// Same file, decrypted with PSCAESCryptoDataProvider. Only the chunks CGPDF actually reads are decrypted.
+    [passwordSection addContent:[[PSContent alloc] initWithTitle:@"Encrypted CGDocumentProvider (seekable)" block:^{
+
+        NSURL *encryptedPDF = [samplesURL URLByAppendingPathComponent:@"aes-encrypted.pdf.aes"];
+        NSString *passphrase = @"afghadöghdgdhfgöhapvuenröaoeruhföaeiruaerub";
+        NSString *salt = @"ducrXn9WaRdpaBfMjDTJVjUf3FApA6gtim0e61LeSGWV9sTxB0r26mPs59Lbcexn";
+
+        PSCAESCryptoDataProvider *cryptoWrapper = [[PSCAESCryptoDataProvider alloc] initWithURL:encryptedPDF passphrase:passphrase salt:salt];
+
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithDataProvider:cryptoWrapper.dataProvider];
+        document.UID = [encryptedPDF lastPathComponent]; // manually set an UID for encrypted documents.
+        document.diskCacheStrategy = PSPDFDiskCacheStrategyNothing; // don't leak decrypted content as cached images.
+
+        return [[PSPDFViewController alloc] initWithDocument:document];
+    }]];
+
     // Encrypting the images will be a 5-10% slowdown, nothing substantial at all.
     // TODO: Update RNCryptor as soon as file format v2 has been released: http://robnapier.net/blog/rncryptor-hmac-vulnerability-827
     [passwordSection addContent:[[PSContent alloc] initWithTitle:@"Enable PSPDFCache encryption" block:^UIViewController *{
@@ -849,9 +990,10 @@ const char kPSCAlertViewKey;
             NSData *encryptedData = [NSData dataWithContentsOfFile:path];
             if (!encryptedData) return nil; // no file, return early.
 
-            NSData *decryptedData = [RNDecryptor decryptData:encryptedData
-                                                withPassword:password
-                                                       error:&error];
+            // PSCCachingDecryptor keeps derived keys around, so reloading a cached page doesn't run PBKDF2 again.
+            NSData *decryptedData = [PSCCachingDecryptor decryptData:encryptedData
+                                                        withPassword:password
+                                                               error:&error];
             if (!decryptedData) {
                 PSPDFLogWarning(@"Failed to decrypt: %@", [error localizedDescription]);
             }
@@ -863,6 +1005,21 @@ const char kPSCAlertViewKey;
         return controller;
     }]];
 
+    // Same as above, but with a key that's derived only once and chunked AES-CTR that encrypts in place.
+    [passwordSection addContent:[[PSContent alloc] initWithTitle:@"Enable PSPDFCache encryption (streaming AES-CTR)" block:^UIViewController *{
+        PSPDFCache *cache = [PSPDFCache sharedCache];
+        [cache clearCache];
+        cache.cacheDirectory = @"PSPDFKit_encrypted_streaming";
+
+        NSData *key = [PSCAESCryptoDataProvider keyForPassphrase:@"unsafe-testpassword" salt:cache.cacheDirectory];
+        PSCCacheCipher *cipher = [[PSCCacheCipher alloc] initWithKey:key];
+        [cipher installInCache:cache];
+
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kHackerMagazineExample]];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        return controller;
+    }]];
+
     [content addObject:passwordSection];
     ///////////////////////////////////////////////////////////////////////////////////////////
 
@@ -972,6 +1129,44 @@ const char kPSCAlertViewKey;
         return controller;
     }]];
 
+    [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Compact and simplified ink annotations" block:^UIViewController *{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+        [document overrideClass:PSPDFInkAnnotation.class withClass:PSCInkAnnotation.class];
+        [document setDidCreateDocumentProviderBlock:^(PSPDFDocumentProvider *documentProvider) {
+            documentProvider.annotationParser.annotationProviders = @[[PSCInkSimplifyingAnnotationProvider new], documentProvider.annotationParser.fileAnnotationProvider];
+        }];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        return controller;
+    }]];
+
+    [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Incremental ink drawing" block:^UIViewController *{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        controller.overrideClassNames = @{(id)PSPDFDrawView.class : PSCDrawView.class};
+        return controller;
+    }]];
+
+    [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Cached annotation appearance streams" block:^UIViewController *{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+        [document overrideClass:PSPDFStampAnnotation.class withClass:PSCStampAnnotation.class];
+        [document overrideClass:PSPDFInkAnnotation.class withClass:PSCInkAnnotation.class];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        return controller;
+    }]];
+
+    [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Pre-cache all pages as an image pyramid" block:^UIViewController *{
+        PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
+
+        // Renders the screen size once per page; thumbnail and tiny sizes are downsampled from it.
+        PSPDFCache *cache = PSPDFCache.sharedCache;
+        NSArray *sizes = @[BOXED(UIScreen.mainScreen.bounds.size), BOXED(cache.thumbnailSize), BOXED(cache.tinySize)];
+        [cache cachePyramidOfDocument:document startAtPage:0 sizes:sizes completionBlock:^(PSCPyramidCacher *cacher) {
+            PSCLog(@"%@", cacher);
+        }];
+        PSPDFViewController *controller = [[PSPDFViewController alloc] initWithDocument:document];
+        return controller;
+    }]];
+
     [subclassingSection addContent:[[PSContent alloc] initWithTitle:@"Programmatically add an ink annotation" block:^UIViewController *{
         PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:hackerMagURL];
         document.annotationSaveMode = PSPDFAnnotationSaveModeDisabled; // don't confuse other examples
@@ -1377,6 +1572,22 @@ const char kPSCAlertViewKey;
         return nil;
     }]];
 
+    // Ink lines must survive JSON export and import (see PSCInkAnnotation's linesTransformer).
+    [testSection addContent:[[PSContent alloc] initWithTitle:@"Ink annotation JSON round trip" block:^UIViewController *{
+        [PSCInkRoundTripTest runWithDocumentAtPath:[samplesURL URLByAppendingPathComponent:@"A.pdf"].path];
+        return nil;
+    }]];
+
+    [testSection addContent:[[PSContent alloc] initWithTitle:@"Progressive PDF source with range requests" block:^UIViewController *{
+        [PSCProgressivePDFSourceTest runWithDocumentAtPath:[samplesURL URLByAppendingPathComponent:kHackerMagazineExample].path];
+        return nil;
+    }]];
+
+    [testSection addContent:[[PSContent alloc] initWithTitle:@"Image downscaler NEON vs. scalar" block:^UIViewController *{
+        [PSCImageDownscalerTest run];
+        return nil;
+    }]];
+
     // Page 26 of hackernews-12 has a very complex XObject setup with nested objects that reference objects that have a parent with the same name. If parsed from top to bottom with the wrong XObjects this will take 100^4 calls, thus clocks up the iPad for a very long time.
     [testSection addContent:[[PSContent alloc] initWithTitle:@"Test for cyclic XObject references." block:^UIViewController *{
         PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[samplesURL URLByAppendingPathComponent:kHackerMagazineExample]];
@@ -0,0 +1,30 @@
+//
+//  PSCLazyMultiFileDocument.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/**
+ Document for many files (e.g. a book split into chapters) that doesn't touch every file on load.
+
+ Page count, page rects and rotations of each file are stored in a manifest in the caches directory.
+ On the next load, files are only checked with stat (size and modification date); a file is only parsed if it changed.
+ Document providers are created on first access of one of their pages, and open document references
+ are trimmed via PSPDFGlobalLock after that, so only a few files are open at any time.
+ `documentProviders` returns a provider for every file and creates the missing ones, so operations on the whole
+ document (search, saving, ...) still cover all files; the files themselves are only opened when their pages are accessed.
+
+ @note pageRange is not supported.
+ */
+@interface PSCLazyMultiFileDocument : PSPDFDocument
+
+/// Location of the manifest. Derived from the file paths.
+@property (nonatomic, copy, readonly) NSURL *manifestURL;
+
+/// Number of document providers that have been created so far.
+@property (nonatomic, assign, readonly) NSUInteger loadedDocumentProviderCount;
+
+@end
@@ -0,0 +1,292 @@
+//
+//  PSCLazyMultiFileDocument.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCLazyMultiFileDocument.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/stat.h>
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Manifest keys
+static NSString *const PSCManifestFileSizeKey = @"fileSize";
+static NSString *const PSCManifestModificationDateKey = @"modificationDate";
+static NSString *const PSCManifestPDFBoxKey = @"PDFBox";
+static NSString *const PSCManifestPageRectsKey = @"pageRects";
+static NSString *const PSCManifestRotationsKey = @"rotations";
+
+@interface PSCLazyMultiFileDocument () {
+    NSArray *_fileEntries;                  // NSDictionary per file, see manifest keys
+    NSArray *_pageOffsets;                  // NSNumber per file, first page of the file
+    NSUInteger _pageCount;
+    NSMutableArray *_documentProviders;     // PSPDFDocumentProvider or NSNull
+    NSMutableDictionary *_pageInfos;        // NSNumber -> PSPDFPageInfo
+}
+@end
+
+@implementation PSCLazyMultiFileDocument
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - PSPDFDocument
+
+- (void)setFiles:(NSArray *)files {
+    [super setFiles:files];
+    [self resetLazyState];
+}
+
+- (void)appendFile:(NSString *)file {
+    [super appendFile:file];
+    [self resetLazyState];
+}
+
+- (NSUInteger)pageCount {
+    [self loadManifestIfNeeded];
+    return _pageCount;
+}
+
+- (NSInteger)fileIndexForPage:(NSUInteger)page {
+    [self loadManifestIfNeeded];
+    if (page >= _pageCount || [_pageOffsets count] == 0) return 0;
+
+    // Last file that starts at or before page. Files without pages share their offset with the next file; LastEqual skips them.
+    NSUInteger insertionIndex = [_pageOffsets indexOfObject:@(page) inSortedRange:NSMakeRange(0, [_pageOffsets count]) options:NSBinarySearchingInsertionIndex|NSBinarySearchingLastEqual usingComparator:^NSComparisonResult(NSNumber *offset1, NSNumber *offset2) {
+        return [offset1 compare:offset2];
+    }];
+    return insertionIndex - 1;
+}
+
+- (NSUInteger)compensatedPageForPage:(NSUInteger)page {
+    NSInteger fileIndex = [self fileIndexForPage:page];
+    if ([_pageOffsets count] == 0) return page;
+    return page - [_pageOffsets[fileIndex] unsignedIntegerValue];
+}
+
+- (NSUInteger)pageNumberForPage:(NSUInteger)page {
+    return [self compensatedPageForPage:page] + 1;
+}
+
+- (PSPDFDocumentProvider *)documentProviderForPage:(NSUInteger)page {
+    if ([self pageCount] == 0) return nil;
+    return [self documentProviderAtFileIndex:[self fileIndexForPage:page]];
+}
+
+// Whole-document operations (search, save, dirty annotations, ...) iterate this, so every file has to be included.
+// Missing providers are created here; they only open their file on first page access, and PSPDFGlobalLock trims open references.
+- (NSArray *)documentProviders {
+    [self loadManifestIfNeeded];
+    NSUInteger fileCount;
+    @synchronized(self) {
+        fileCount = [_documentProviders count];
+    }
+    NSMutableArray *documentProviders = [NSMutableArray arrayWithCapacity:fileCount];
+    for (NSUInteger fileIndex = 0; fileIndex < fileCount; fileIndex++) {
+        PSPDFDocumentProvider *documentProvider = [self documentProviderAtFileIndex:fileIndex];
+        if (documentProvider) [documentProviders addObject:documentProvider];
+    }
+    return documentProviders;
+}
+
+- (NSUInteger)pageOffsetForDocumentProvider:(PSPDFDocumentProvider *)documentProvider {
+    @synchronized(self) {
+        NSUInteger fileIndex = [_documentProviders indexOfObjectIdenticalTo:documentProvider];
+        return fileIndex != NSNotFound ? [_pageOffsets[fileIndex] unsignedIntegerValue] : 0;
+    }
+}
+
+- (PSPDFPageInfo *)pageInfoForPage:(NSUInteger)page {
+    if (page >= [self pageCount]) return nil;
+
+    NSInteger fileIndex;
+    NSUInteger compensatedPage;
+    CGRect pageRect;
+    NSInteger rotation;
+    @synchronized(self) {
+        PSPDFPageInfo *pageInfo = _pageInfos[@(page)];
+        if (pageInfo) return pageInfo;
+
+        fileIndex = [self fileIndexForPage:page];
+        compensatedPage = page - [_pageOffsets[fileIndex] unsignedIntegerValue];
+        NSDictionary *fileEntry = _fileEntries[fileIndex];
+        pageRect = CGRectFromString(fileEntry[PSCManifestPageRectsKey][compensatedPage]);
+        rotation = [fileEntry[PSCManifestRotationsKey][compensatedPage] integerValue];
+    }
+
+    // Resolving the provider may take the global lock, so it must not happen while holding ours.
+    PSPDFDocumentProvider *documentProvider = [self documentProviderAtFileIndex:fileIndex];
+    PSPDFPageInfo *pageInfo = [[PSPDFPageInfo alloc] initWithPage:compensatedPage rect:pageRect rotation:rotation documentProvider:documentProvider];
+    @synchronized(self) {
+        // Another thread may have been faster, or the state was reset in between.
+        PSPDFPageInfo *existingPageInfo = _pageInfos[@(page)];
+        if (existingPageInfo) return existingPageInfo;
+        if (_pageInfos && documentProvider && [_documentProviders indexOfObjectIdenticalTo:documentProvider] != NSNotFound) _pageInfos[@(page)] = pageInfo;
+    }
+    return pageInfo;
+}
+
+- (BOOL)hasPageInfoForPage:(NSUInteger)page {
+    return page < [self pageCount];
+}
+
+- (PSPDFPageInfo *)nearestPageInfoForPage:(NSUInteger)page {
+    return [self pageInfoForPage:MIN(page, [self pageCount] - 1)];
+}
+
+- (CGRect)rectBoxForPage:(NSUInteger)page {
+    return [self pageInfoForPage:page].pageRect;
+}
+
+- (int)rotationForPage:(NSUInteger)page {
+    return (int)[self pageInfoForPage:page].pageRotation;
+}
+
+- (void)clearCache {
+    [super clearCache];
+    [self resetLazyState];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Public
+
+- (NSURL *)manifestURL {
+    NSString *paths = [[[self filesWithBasePath] valueForKey:@"path"] componentsJoinedByString:@"\n"];
+    NSData *pathData = [paths dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([pathData bytes], (CC_LONG)[pathData length], digest);
+    NSMutableString *fileName = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (NSUInteger idx = 0; idx < CC_SHA1_DIGEST_LENGTH; idx++) {
+        [fileName appendFormat:@"%02x", digest[idx]];
+    }
+    [fileName appendString:@".plist"];
+
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES)[0];
+    NSString *manifestPath = [[cachesPath stringByAppendingPathComponent:@"PSCDocumentManifests"] stringByAppendingPathComponent:fileName];
+    return [NSURL fileURLWithPath:manifestPath];
+}
+
+- (NSUInteger)loadedDocumentProviderCount {
+    @synchronized(self) {
+        return [[_documentProviders indexesOfObjectsPassingTest:^BOOL(id documentProvider, NSUInteger idx, BOOL *stop) {
+            return documentProvider != NSNull.null;
+        }] count];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+- (void)resetLazyState {
+    @synchronized(self) {
+        _fileEntries = nil;
+        _pageOffsets = nil;
+        _pageCount = 0;
+        _documentProviders = nil;
+        _pageInfos = nil;
+    }
+}
+
+// Must be called without holding the lock; limitOpenDocumentProviders takes PSPDFGlobalLock and asks other providers to close.
+- (PSPDFDocumentProvider *)documentProviderAtFileIndex:(NSUInteger)fileIndex {
+    BOOL createdDocumentProvider = NO;
+    PSPDFDocumentProvider *documentProvider;
+    @synchronized(self) {
+        [self loadManifestIfNeeded];
+        if (fileIndex >= [_documentProviders count]) return nil;
+
+        documentProvider = _documentProviders[fileIndex];
+        if ((id)documentProvider == NSNull.null) {
+            documentProvider = [[PSPDFDocumentProvider alloc] initWithFileURL:[self URLForFileIndex:fileIndex] document:self];
+            documentProvider = [self didCreateDocumentProvider:documentProvider];
+            _documentProviders[fileIndex] = documentProvider ?: (id)NSNull.null;
+            createdDocumentProvider = YES;
+        }
+    }
+    if (createdDocumentProvider) [PSPDFGlobalLock.sharedGlobalLock limitOpenDocumentProviders];
+    return documentProvider;
+}
+
+- (void)loadManifestIfNeeded {
+    @synchronized(self) {
+        if (_fileEntries) return;
+
+        NSURL *manifestURL = self.manifestURL;
+        NSDictionary *manifest = [NSDictionary dictionaryWithContentsOfURL:manifestURL];
+        NSArray *fileURLs = [self filesWithBasePath];
+        NSMutableArray *fileEntries = [NSMutableArray arrayWithCapacity:[fileURLs count]];
+        NSMutableArray *pageOffsets = [NSMutableArray arrayWithCapacity:[fileURLs count]];
+        NSUInteger pageCount = 0;
+        BOOL manifestChanged = NO;
+
+        for (NSURL *fileURL in fileURLs) {
+            @autoreleasepool {
+                NSDictionary *fileEntry = manifest[fileURL.path];
+                if (![self isFileEntry:fileEntry validForFileURL:fileURL]) {
+                    fileEntry = [self fileEntryForFileURL:fileURL];
+                    manifestChanged = YES;
+                }
+                [fileEntries addObject:fileEntry];
+                [pageOffsets addObject:@(pageCount)];
+                pageCount += [fileEntry[PSCManifestPageRectsKey] count];
+            }
+        }
+
+        if (manifestChanged || [manifest count] != [fileURLs count]) {
+            NSMutableDictionary *newManifest = [NSMutableDictionary dictionaryWithCapacity:[fileURLs count]];
+            [fileURLs enumerateObjectsUsingBlock:^(NSURL *fileURL, NSUInteger idx, BOOL *stop) {
+                newManifest[fileURL.path] = fileEntries[idx];
+            }];
+            [NSFileManager.defaultManager createDirectoryAtURL:[manifestURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+            if (![newManifest writeToURL:manifestURL atomically:YES]) {
+                PSCLog(@"Failed to write manifest to %@", manifestURL.path);
+            }
+        }
+
+        _fileEntries = fileEntries;
+        _pageOffsets = pageOffsets;
+        _pageCount = pageCount;
+        _documentProviders = [NSMutableArray arrayWithCapacity:[fileURLs count]];
+        for (NSUInteger idx = 0; idx < [fileURLs count]; idx++) [_documentProviders addObject:NSNull.null];
+        _pageInfos = [NSMutableDictionary dictionary];
+    }
+}
+
+- (BOOL)isFileEntry:(NSDictionary *)fileEntry validForFileURL:(NSURL *)fileURL {
+    struct stat fileStat;
+    if (!fileEntry || stat([fileURL.path fileSystemRepresentation], &fileStat) != 0) return NO;
+    return [fileEntry[PSCManifestFileSizeKey] longLongValue] == fileStat.st_size &&
+           [fileEntry[PSCManifestModificationDateKey] longLongValue] == fileStat.st_mtime &&
+           [fileEntry[PSCManifestPDFBoxKey] intValue] == self.PDFBox;
+}
+
+// Slow path: opens the file once and reads the geometry of every page.
+- (NSDictionary *)fileEntryForFileURL:(NSURL *)fileURL {
+    struct stat fileStat = {0};
+    stat([fileURL.path fileSystemRepresentation], &fileStat);
+
+    NSMutableArray *pageRects = [NSMutableArray array];
+    NSMutableArray *rotations = [NSMutableArray array];
+    CGPDFDocumentRef documentRef = CGPDFDocumentCreateWithURL((__bridge CFURLRef)fileURL);
+    if (documentRef) {
+        size_t numberOfPages = CGPDFDocumentGetNumberOfPages(documentRef);
+        for (size_t pageNumber = 1; pageNumber <= numberOfPages; pageNumber++) {
+            CGPDFPageRef pageRef = CGPDFDocumentGetPage(documentRef, pageNumber);
+            [pageRects addObject:NSStringFromCGRect(CGPDFPageGetBoxRect(pageRef, self.PDFBox))];
+            [rotations addObject:@(CGPDFPageGetRotationAngle(pageRef))];
+        }
+        CGPDFDocumentRelease(documentRef);
+    }else {
+        PSCLog(@"Failed to open %@", fileURL.path);
+    }
+
+    return @{PSCManifestFileSizeKey : @(fileStat.st_size),
+             PSCManifestModificationDateKey : @(fileStat.st_mtime),
+             PSCManifestPDFBoxKey : @(self.PDFBox),
+             PSCManifestPageRectsKey : pageRects,
+             PSCManifestRotationsKey : rotations};
+}
+
+@end
@@ -0,0 +1,27 @@
+//
+//  PSCSharedDocumentProvider.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/**
+ Document provider that shares its CGPDFDocumentRef between threads with copy-on-write epochs.
+
+ Readers (rendering, text parsing, annotation parsing) get a retained snapshot of the current document reference
+ and never wait for each other. The snapshot is opened through super, so PSPDFGlobalLock tracks it and can flush it
+ once none of its references is out. Writes (saving annotations, replacing data, unlocking) are serialized with each other
+ but don't wait for readers: readers that hold or request a reference during a write keep reading the previous epoch,
+ and after the write the next request opens a new snapshot. Old snapshots are released with their last reference.
+ Requests only block while a write runs and there's no earlier snapshot to hand out, so nested requests don't deadlock.
+
+ Use with [document overrideClass:PSPDFDocumentProvider.class withClass:PSCSharedDocumentProvider.class];
+ */
+@interface PSCSharedDocumentProvider : PSPDFDocumentProvider
+
+/// Incremented on every write. A snapshot opened before the write can't become the current one afterwards.
+@property (atomic, assign, readonly) NSUInteger documentEpoch;
+
+@end
@@ -0,0 +1,230 @@
+//
+//  PSCSharedDocumentProvider.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCSharedDocumentProvider.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+@interface PSCSharedDocumentProvider () {
+    NSCondition *_condition;             // guards the state below; broadcast when a write finishes
+    CGPDFDocumentRef _snapshot;          // current epoch, retained by us
+    BOOL _snapshotOwned;                 // _snapshot is also requested from super, so PSPDFGlobalLock tracks it
+    NSUInteger _readerCount;             // references of the current snapshot that are out
+    NSThread *_writerThread;
+    NSMutableDictionary *_pageLeases;    // NSValue (CGPDFPageRef) -> NSMutableArray of NSValue (retained CGPDFDocumentRef)
+}
+@property (atomic, assign) NSUInteger documentEpoch;
+@end
+
+@implementation PSCSharedDocumentProvider
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - NSObject
+
+- (id)initWithFileURL:(NSURL *)fileURL document:(PSPDFDocument *)document {
+    if ((self = [super initWithFileURL:fileURL document:document])) {
+        [self commonSharedInit];
+    }
+    return self;
+}
+
+- (id)initWithData:(NSData *)data document:(PSPDFDocument *)document {
+    if ((self = [super initWithData:data document:document])) {
+        [self commonSharedInit];
+    }
+    return self;
+}
+
+- (id)initWithDataProvider:(CGDataProviderRef)dataProvider document:(PSPDFDocument *)document {
+    if ((self = [super initWithDataProvider:dataProvider document:document])) {
+        [self commonSharedInit];
+    }
+    return self;
+}
+
+- (void)commonSharedInit {
+    _condition = [NSCondition new];
+    _pageLeases = [NSMutableDictionary new];
+}
+
+- (void)dealloc {
+    if (_snapshotOwned) [super releaseDocumentRef:_snapshot withOwner:self];
+    CGPDFDocumentRelease(_snapshot);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Reading
+
+// Never waits for a write while there is a snapshot to hand out, so nested requests of a thread that already holds one can't deadlock.
+- (CGPDFDocumentRef)requestDocumentRefWithOwner:(id)owner {
+    // The write itself (e.g. super's annotation saving) reads through the superclass.
+    if (_writerThread == NSThread.currentThread) return [super requestDocumentRefWithOwner:owner];
+
+    CGPDFDocumentRef documentRef = NULL;
+    while (!documentRef) {
+        [_condition lock];
+        // Without any snapshot there's nothing older to read; only then a running write has to finish first.
+        while (!_snapshot && _writerThread) [_condition wait];
+        documentRef = CGPDFDocumentRetain(_snapshot);
+        if (documentRef) _readerCount++;
+        NSUInteger epoch = self.documentEpoch;
+        [_condition unlock];
+        if (documentRef) break;
+
+        // Opening goes through super and may trim other providers via PSPDFGlobalLock, which can flush us; so not under the condition.
+        CGPDFDocumentRef snapshot = [super requestDocumentRefWithOwner:self];
+        if (!snapshot) return NULL;
+        [_condition lock];
+        // A write that started or finished in between makes the new reference stale; then try again.
+        BOOL installSnapshot = !_snapshot && !_writerThread && epoch == self.documentEpoch;
+        if (installSnapshot) {
+            _snapshot = CGPDFDocumentRetain(snapshot);
+            _snapshotOwned = YES;
+            documentRef = CGPDFDocumentRetain(_snapshot);
+            _readerCount++;
+        }
+        [_condition unlock];
+        if (!installSnapshot) [super releaseDocumentRef:snapshot withOwner:self];
+    }
+    return documentRef;
+}
+
+// The reference is retained per request, so this works for any epoch. Older snapshots go away with their last reader.
+- (void)releaseDocumentRef:(CGPDFDocumentRef)documentRef withOwner:(id)owner {
+    if (_writerThread == NSThread.currentThread) {
+        [super releaseDocumentRef:documentRef withOwner:owner];
+        return;
+    }
+    if (!documentRef) return;
+
+    [_condition lock];
+    if (documentRef == _snapshot && _readerCount > 0) _readerCount--;
+    [_condition unlock];
+    CGPDFDocumentRelease(documentRef);
+}
+
+- (void)performBlock:(void (^)(PSPDFDocumentProvider *docProvider, CGPDFDocumentRef documentRef))documentRefBlock {
+    CGPDFDocumentRef documentRef = [self requestDocumentRefWithOwner:self];
+    documentRefBlock(self, documentRef);
+    [self releaseDocumentRef:documentRef withOwner:self];
+}
+
+- (CGPDFPageRef)requestPageRefForPageNumber:(NSUInteger)page {
+    return [self requestPageRefForPageNumber:page error:NULL];
+}
+
+- (CGPDFPageRef)requestPageRefForPageNumber:(NSUInteger)page error:(NSError **)error {
+    CGPDFDocumentRef documentRef = [self requestDocumentRefWithOwner:self];
+    CGPDFPageRef pageRef = documentRef ? CGPDFDocumentGetPage(documentRef, page) : NULL;
+    if (!pageRef) {
+        [self releaseDocumentRef:documentRef withOwner:self];
+        if (error) *error = [NSError errorWithDomain:kPSPDFErrorDomain code:documentRef ? PSPDFErrorCodeUnableToGetPageReference : PSPDFErrorCodeUnableToOpenPDF userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Unable to get page reference for page %d.", page]}];
+        return NULL;
+    }
+
+    // The page belongs to the snapshot; keep the snapshot alive until the page is released.
+    @synchronized(_pageLeases) {
+        NSValue *pageKey = [NSValue valueWithPointer:pageRef];
+        NSMutableArray *leases = _pageLeases[pageKey];
+        if (!leases) _pageLeases[pageKey] = leases = [NSMutableArray array];
+        [leases addObject:[NSValue valueWithPointer:documentRef]];
+    }
+    return pageRef;
+}
+
+- (void)releasePageRef:(CGPDFPageRef)pageRef {
+    if (!pageRef) return;
+
+    CGPDFDocumentRef documentRef = NULL;
+    @synchronized(_pageLeases) {
+        NSValue *pageKey = [NSValue valueWithPointer:pageRef];
+        NSMutableArray *leases = _pageLeases[pageKey];
+        documentRef = [[leases lastObject] pointerValue];
+        if (leases) [leases removeLastObject];
+        if ([leases count] == 0) [_pageLeases removeObjectForKey:pageKey];
+    }
+    [self releaseDocumentRef:documentRef withOwner:self];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Writing
+
+- (void)setData:(NSData *)data {
+    [self performWrite:^BOOL{
+        [super setData:data];
+        return YES;
+    }];
+}
+
+- (BOOL)saveChangedAnnotationsWithError:(NSError **)error {
+    return [self performWrite:^BOOL{
+        return [super saveChangedAnnotationsWithError:error];
+    }];
+}
+
+- (BOOL)unlockWithPassword:(NSString *)password {
+    return [self performWrite:^BOOL{
+        return [super unlockWithPassword:password];
+    }];
+}
+
+// Only succeeds while no reference of the current snapshot is out; otherwise PSPDFGlobalLock asks again later.
+- (BOOL)flushDocumentReference {
+    if (_writerThread == NSThread.currentThread) return [super flushDocumentReference];
+
+    [_condition lock];
+    BOOL inUse = _readerCount > 0 || _writerThread;
+    CGPDFDocumentRef snapshot = inUse ? NULL : _snapshot;
+    BOOL snapshotOwned = !inUse && _snapshotOwned;
+    if (!inUse) {
+        _snapshot = NULL;
+        _snapshotOwned = NO;
+    }
+    [_condition unlock];
+    if (inUse) return NO;
+
+    if (snapshotOwned) [super releaseDocumentRef:snapshot withOwner:self];
+    CGPDFDocumentRelease(snapshot);
+    return [super flushDocumentReference];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Private
+
+// Copy-on-write: writes are serialized with each other, but never wait for readers.
+// Readers keep using the current snapshot while the write runs; only super's reference to it is given back first, so super can
+// reopen the document for saving. Afterwards the snapshot is dropped and the next request opens the new epoch.
+// Older snapshots stay valid: annotations are saved as incremental updates appended to the file, and setData: keeps the old data
+// alive through the old reference's data provider.
+- (BOOL)performWrite:(BOOL (^)(void))writeBlock {
+    [_condition lock];
+    while (_writerThread) [_condition wait];
+    _writerThread = NSThread.currentThread;
+    CGPDFDocumentRef snapshot = _snapshot;
+    BOOL snapshotOwned = _snapshotOwned;
+    _snapshotOwned = NO;
+    [_condition unlock];
+    if (snapshotOwned) [super releaseDocumentRef:snapshot withOwner:self];
+
+    BOOL success = writeBlock();
+
+    [_condition lock];
+    if (_snapshot == snapshot) {
+        _snapshot = NULL;
+        _readerCount = 0;
+    }
+    _writerThread = nil;
+    self.documentEpoch++;
+    [_condition broadcast];
+    [_condition unlock];
+    CGPDFDocumentRelease(snapshot);
+    return success;
+}
+
+@end
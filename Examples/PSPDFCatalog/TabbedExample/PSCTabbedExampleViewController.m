@@ -8,6 +8,7 @@
 #import "PSCTabbedExampleViewController.h"
 #import "PSCAddDocumentsBarButtonItem.h"
 #import "PSCClearTabsButtonItem.h"
+#import "PSCDocumentReferencePool.h"
 
 @implementation PSCTabbedExampleViewController
 
@@ -38,6 +39,9 @@ const char *clearAllActionSheetToken;
             self.navigationItem.leftItemsSupplementBackButton = YES;
         }
 
+        // Let PSCDocumentReferencePool decide which documents stay open while switching tabs.
+        PSPDFGlobalLock.sharedGlobalLock.allowedOpenDocumentRequests = MAX(PSPDFGlobalLock.sharedGlobalLock.allowedOpenDocumentRequests, PSCDocumentReferencePool.sharedPool.maximumOpenDocumentCount + 1);
+
         // choose *some* documents randomly if state could not be restored.
         if (![self restoreState] || [self.documents count] == 0) {
             NSArray *documents = [PSCDocumentSelectorController documentsFromDirectory:@"/Bundle/Samples"];
@@ -45,6 +49,9 @@ const char *clearAllActionSheetToken;
                 return arc4random_uniform(2) > 0; // returns 0 or 1 randomly.
             }]];
         }
+        for (PSPDFDocument *document in self.documents) {
+            [PSCDocumentReferencePool.sharedPool registerDocument:document];
+        }
     }
     return self;
 }
@@ -54,6 +61,9 @@ const char *clearAllActionSheetToken;
 
 - (BOOL)tabbedPDFController:(PSPDFTabbedViewController *)tabbedPDFController shouldChangeDocuments:(NSArray *)newDocuments {
     //NSLog(@"shouldChangeDocuments: %@", newDocuments);
+    for (PSPDFDocument *document in newDocuments) {
+        [PSCDocumentReferencePool.sharedPool registerDocument:document];
+    }
 
     // return YES to allow the change
     return YES;
@@ -72,6 +82,9 @@ const char *clearAllActionSheetToken;
 
 - (void)tabbedPDFController:(PSPDFTabbedViewController *)tabbedPDFController didChangeVisibleDocument:(PSPDFDocument *)oldDocument {
     //NSLog(@"didChangeVisibleDocument: %@ (old)", oldDocument);
+
+    // The previous document is no longer displayed and may now be closed.
+    [PSCDocumentReferencePool.sharedPool trim];
 }
 
 @end
@@ -0,0 +1,18 @@
+//
+//  PSCImageDownscalerTest.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/// Compares the NEON halving and scaling paths of PSCImageDownscaler with the portable scalar loop.
+/// Uses random bitmaps with odd sizes, padded rows and unaligned start addresses; large ones also take the multi-core path.
+/// Without NEON (simulator), both paths are the scalar loop and the test only checks consistency.
+@interface PSCImageDownscalerTest : NSObject
+
+/// Returns YES if all outputs are byte-identical to the scalar reference. The result is logged.
++ (BOOL)run;
+
+@end
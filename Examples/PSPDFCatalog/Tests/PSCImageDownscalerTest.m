@@ -0,0 +1,117 @@
+//
+//  PSCImageDownscalerTest.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCImageDownscalerTest.h"
+#import "PSCImageDownscaler.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+// Random BGRA bitmap. rowPadding extra bytes per row; the pixels start offset bytes into the allocation (to get unaligned loads).
+static vImage_Buffer PSCCreateRandomBuffer(size_t width, size_t height, size_t rowPadding, size_t offset, void **allocation) {
+    size_t rowBytes = width * 4 + rowPadding;
+    *allocation = malloc(rowBytes * height + offset);
+    uint8_t *data = (uint8_t *)*allocation + offset;
+    for (size_t idx = 0; idx < rowBytes * height; idx++) data[idx] = (uint8_t)arc4random_uniform(256);
+    return (vImage_Buffer){data, height, width, rowBytes};
+}
+
+static vImage_Buffer PSCCreateBuffer(size_t width, size_t height) {
+    return (vImage_Buffer){calloc(width * height, 4), height, width, width * 4};
+}
+
+static BOOL PSCBuffersEqual(const vImage_Buffer *buffer1, const vImage_Buffer *buffer2) {
+    if (buffer1->width != buffer2->width || buffer1->height != buffer2->height) return NO;
+    for (size_t y = 0; y < buffer1->height; y++) {
+        if (memcmp((const uint8_t *)buffer1->data + y * buffer1->rowBytes, (const uint8_t *)buffer2->data + y * buffer2->rowBytes, buffer1->width * 4) != 0) return NO;
+    }
+    return YES;
+}
+
+// Same steps as scaleBGRABuffer:toBuffer:quality:, with the scalar halving.
+static BOOL PSCScalarScaleBuffer(const vImage_Buffer *source, const vImage_Buffer *destination, PSCImageDownscalerQuality quality) {
+    vImage_Buffer current = *source;
+    void *mipmapData = NULL;
+    while (current.width / 2 >= destination->width && current.height / 2 >= destination->height) {
+        vImage_Buffer halved = PSCCreateBuffer(current.width / 2, current.height / 2);
+        [PSCImageDownscaler scalarHalveBGRABuffer:&current toBuffer:&halved];
+        free(mipmapData);
+        mipmapData = halved.data;
+        current = halved;
+    }
+
+    vImage_Error error = kvImageNoError;
+    if (current.width == destination->width && current.height == destination->height) {
+        for (size_t y = 0; y < destination->height; y++) {
+            memcpy((uint8_t *)destination->data + y * destination->rowBytes, (const uint8_t *)current.data + y * current.rowBytes, destination->width * 4);
+        }
+    }else {
+        error = vImageScale_ARGB8888(&current, destination, NULL, quality == PSCImageDownscalerQualityHigh ? kvImageHighQualityResampling : kvImageNoFlags);
+    }
+    free(mipmapData);
+    return error == kvImageNoError;
+}
+
+@implementation PSCImageDownscalerTest
+
++ (BOOL)run {
+    // width, height, row padding, start offset. 1031x777 is above the multi-core threshold.
+    const size_t sources[][4] = {{8, 2, 0, 0}, {9, 3, 0, 1}, {37, 23, 12, 3}, {64, 64, 4, 2}, {1031, 777, 20, 1}};
+    // Target sizes as divisors of the source size: exact halving, two mipmap steps, and a remainder for vImage.
+    const CGFloat targetDivisors[] = {2, 4, 2.5f, 3.3f};
+    BOOL success = YES;
+    NSUInteger comparisonCount = 0;
+
+    for (NSUInteger sourceIndex = 0; sourceIndex < sizeof(sources) / sizeof(sources[0]); sourceIndex++) {
+        void *allocation;
+        vImage_Buffer source = PSCCreateRandomBuffer(sources[sourceIndex][0], sources[sourceIndex][1], sources[sourceIndex][2], sources[sourceIndex][3], &allocation);
+
+        // Halving, including the scalar tail of odd widths and the dropped odd row/column.
+        vImage_Buffer halved = PSCCreateBuffer(source.width / 2, source.height / 2);
+        vImage_Buffer scalarHalved = PSCCreateBuffer(source.width / 2, source.height / 2);
+        [PSCImageDownscaler halveBGRABuffer:&source toBuffer:&halved];
+        [PSCImageDownscaler scalarHalveBGRABuffer:&source toBuffer:&scalarHalved];
+        if (!PSCBuffersEqual(&halved, &scalarHalved)) {
+            NSLog(@"Image downscaler halving differs for %zux%zu", source.width, source.height);
+            success = NO;
+        }
+        comparisonCount++;
+        free(halved.data);
+        free(scalarHalved.data);
+
+        // Full scaling, both qualities.
+        for (NSUInteger divisorIndex = 0; divisorIndex < sizeof(targetDivisors) / sizeof(targetDivisors[0]); divisorIndex++) {
+            size_t width = (size_t)(source.width / targetDivisors[divisorIndex]), height = (size_t)(source.height / targetDivisors[divisorIndex]);
+            if (width == 0 || height == 0) continue;
+            for (PSCImageDownscalerQuality quality = PSCImageDownscalerQualityDefault; quality <= PSCImageDownscalerQualityHigh; quality++) {
+                vImage_Buffer scaled = PSCCreateBuffer(width, height);
+                vImage_Buffer scalarScaled = PSCCreateBuffer(width, height);
+                BOOL scaledSuccess = [PSCImageDownscaler scaleBGRABuffer:&source toBuffer:&scaled quality:quality];
+                BOOL scalarSuccess = PSCScalarScaleBuffer(&source, &scalarScaled, quality);
+                if (!scaledSuccess || !scalarSuccess || !PSCBuffersEqual(&scaled, &scalarScaled)) {
+                    NSLog(@"Image downscaler scaling differs for %zux%zu -> %zux%zu (quality %d)", source.width, source.height, width, height, quality);
+                    success = NO;
+                }
+                comparisonCount++;
+                free(scaled.data);
+                free(scalarScaled.data);
+            }
+        }
+        free(allocation);
+    }
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    NSString *path = @"NEON";
+#else
+    NSString *path = @"scalar only";
+#endif
+    NSLog(@"Image downscaler test %@: %d comparisons (%@)", success ? @"passed" : @"FAILED", comparisonCount, path);
+    return success;
+}
+
+@end
@@ -0,0 +1,17 @@
+//
+//  PSCInkRoundTripTest.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/// Exports a PSCInkAnnotation with PSCAnnotationExporter (JSON), imports it into a second document
+/// with PSCAnnotationImporter and compares the points. Use a document without ink annotations.
+@interface PSCInkRoundTripTest : NSObject
+
+/// Returns YES if the lines survived the round trip. The result is logged.
++ (BOOL)runWithDocumentAtPath:(NSString *)path;
+
+@end
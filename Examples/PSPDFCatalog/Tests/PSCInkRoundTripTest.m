@@ -0,0 +1,61 @@
+//
+//  PSCInkRoundTripTest.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCInkRoundTripTest.h"
+#import "PSCInkAnnotation.h"
+#import "PSCAnnotationExporter.h"
+#import "PSCAnnotationImporter.h"
+
+@implementation PSCInkRoundTripTest
+
++ (PSPDFDocument *)documentWithPath:(NSString *)path {
+    PSPDFDocument *document = [PSPDFDocument PDFDocumentWithURL:[NSURL fileURLWithPath:path]];
+    document.annotationSaveMode = PSPDFAnnotationSaveModeDisabled;
+    [document overrideClass:PSPDFInkAnnotation.class withClass:PSCInkAnnotation.class];
+    return document;
+}
+
++ (BOOL)runWithDocumentAtPath:(NSString *)path {
+    PSPDFDocument *sourceDocument = [self documentWithPath:path];
+    PSCInkAnnotation *annotation = [PSCInkAnnotation new];
+    annotation.color = [UIColor redColor];
+    annotation.lineWidth = 3.f;
+    annotation.lines = @[@[BOXED(CGPointMake(100.f, 100.f)), BOXED(CGPointMake(120.5f, 140.25f)), BOXED(CGPointMake(200.f, 90.f))],
+                         @[BOXED(CGPointMake(50.f, 300.f)), BOXED(CGPointMake(60.125f, 310.f))]];
+    NSArray *expectedPointBuffers = annotation.pointBuffers;
+    [sourceDocument addAnnotations:@[annotation] forPage:0];
+
+    NSError *error = nil;
+    PSCAnnotationExporter *exporter = [[PSCAnnotationExporter alloc] initWithDocument:sourceDocument];
+    exporter.annotationTypes = PSPDFAnnotationTypeInk;
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToMemory];
+    BOOL exported = [exporter exportAnnotationsToStream:outputStream format:PSCAnnotationStreamFormatJSON error:&error];
+    NSData *data = [outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    [outputStream close];
+    if (!exported || exporter.exportedAnnotationCount == 0) {
+        NSLog(@"Ink round trip failed: nothing exported (%@)", [error localizedDescription]);
+        return NO;
+    }
+
+    PSPDFDocument *targetDocument = [self documentWithPath:path];
+    PSCAnnotationImporter *importer = [[PSCAnnotationImporter alloc] initWithDocument:targetDocument];
+    NSInputStream *inputStream = [NSInputStream inputStreamWithData:data];
+    BOOL imported = [importer importAnnotationsFromStream:inputStream format:PSCAnnotationStreamFormatJSON error:&error];
+    [inputStream close];
+    if (!imported || importer.importedAnnotationCount != exporter.exportedAnnotationCount) {
+        NSLog(@"Ink round trip failed: exported %d, imported %d (%@)", exporter.exportedAnnotationCount, importer.importedAnnotationCount, [error localizedDescription]);
+        return NO;
+    }
+
+    // Annotations are written page by page in order, so ours is the last ink annotation on the first page.
+    PSCInkAnnotation *importedAnnotation = [[targetDocument annotationsForPage:0 type:PSPDFAnnotationTypeInk] lastObject];
+    BOOL success = [importedAnnotation isKindOfClass:PSCInkAnnotation.class] && [importedAnnotation.pointBuffers isEqualToArray:expectedPointBuffers];
+    NSLog(@"Ink round trip %@: %@ -> %@", success ? @"passed" : @"FAILED", expectedPointBuffers, importedAnnotation.pointBuffers);
+    return success;
+}
+
+@end
@@ -0,0 +1,18 @@
+//
+//  PSCProgressivePDFSourceTest.h
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/// Opens a partially "downloaded" copy of a PDF through PSCProgressivePDFSource and compares it to the original.
+/// Range requests are answered by a local stand-in for a file server (an NSURLProtocol that serves the file with Range support),
+/// so this runs without network access.
+@interface PSCProgressivePDFSourceTest : NSObject
+
+/// Returns YES if page count and page rects match and the missing data came from range requests. The result is logged.
++ (BOOL)runWithDocumentAtPath:(NSString *)path;
+
+@end
@@ -0,0 +1,105 @@
+//
+//  PSCProgressivePDFSourceTest.m
+//  PSPDFCatalog
+//
+//  Copyright (c) 2013 Peter Steinberger. All rights reserved.
+//
+
+#import "PSCProgressivePDFSourceTest.h"
+#import "PSCProgressivePDFSource.h"
+
+#if !__has_feature(objc_arc)
+#error "Compile this file with ARC"
+#endif
+
+static NSString *const PSCLocalFileServerScheme = @"psc-fileserver";
+
+// Local stand-in for a file server: psc-fileserver://localhost/<path> serves the file at path, honoring single byte ranges.
+@interface PSCLocalFileServerURLProtocol : NSURLProtocol @end
+
+@implementation PSCLocalFileServerURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.scheme isEqualToString:PSCLocalFileServerScheme];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+- (void)startLoading {
+    NSData *fileData = [NSData dataWithContentsOfFile:self.request.URL.path options:NSDataReadingMappedIfSafe error:NULL];
+    if (!fileData) {
+        [self.client URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorFileDoesNotExist userInfo:nil]];
+        return;
+    }
+
+    NSInteger statusCode = 200;
+    NSRange range = NSMakeRange(0, fileData.length);
+    NSMutableDictionary *headerFields = [NSMutableDictionary dictionaryWithObject:@"bytes" forKey:@"Accept-Ranges"];
+    unsigned long long start, end;
+    NSString *rangeHeader = [self.request valueForHTTPHeaderField:@"Range"];
+    if (rangeHeader && sscanf(rangeHeader.UTF8String, "bytes=%llu-%llu", &start, &end) == 2 && start <= end && end < fileData.length) {
+        statusCode = 206;
+        range = NSMakeRange((NSUInteger)start, (NSUInteger)(end - start + 1));
+        headerFields[@"Content-Range"] = [NSString stringWithFormat:@"bytes %llu-%llu/%d", start, end, fileData.length];
+    }
+    headerFields[@"Content-Length"] = [NSString stringWithFormat:@"%d", range.length];
+
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headerFields];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocol:self didLoadData:[fileData subdataWithRange:range]];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading {}
+
+@end
+
+@implementation PSCProgressivePDFSourceTest
+
++ (BOOL)runWithDocumentAtPath:(NSString *)path {
+    NSData *fileData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+    if (fileData.length == 0) {
+        NSLog(@"Progressive source test failed: can't read %@", path);
+        return NO;
+    }
+
+    // Simulate a download that stopped after the first quarter of the file.
+    NSURL *localFileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"PSCProgressivePDFSourceTest.pdf"]];
+    NSUInteger downloadedLength = fileData.length / 4;
+    [[fileData subdataWithRange:NSMakeRange(0, downloadedLength)] writeToURL:localFileURL atomically:YES];
+
+    [NSURLProtocol registerClass:PSCLocalFileServerURLProtocol.class];
+    NSURL *remoteURL = [[NSURL alloc] initWithScheme:PSCLocalFileServerScheme host:@"localhost" path:path];
+    PSCProgressivePDFSource *source = [[PSCProgressivePDFSource alloc] initWithRemoteURL:remoteURL localFileURL:localFileURL length:fileData.length];
+    source.rangeRequestSize = 16 * 1024;
+    source.maximumFetchedBlockCount = 4; // forces evictions and refetches for most files
+    source.readTimeout = 10.0;
+    source.downloadedLength = downloadedLength;
+
+    CGDataProviderRef dataProvider = [source createDataProvider];
+    CGPDFDocumentRef progressiveDocument = CGPDFDocumentCreateWithProvider(dataProvider);
+    CGDataProviderRelease(dataProvider);
+    CGPDFDocumentRef originalDocument = CGPDFDocumentCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:path]);
+
+    size_t pageCount = progressiveDocument ? CGPDFDocumentGetNumberOfPages(progressiveDocument) : 0;
+    BOOL success = progressiveDocument && originalDocument && pageCount == CGPDFDocumentGetNumberOfPages(originalDocument);
+    for (size_t pageNumber = 1; success && pageNumber <= pageCount; pageNumber++) {
+        CGPDFPageRef progressivePage = CGPDFDocumentGetPage(progressiveDocument, pageNumber);
+        CGPDFPageRef originalPage = CGPDFDocumentGetPage(originalDocument, pageNumber);
+        success = progressivePage && CGRectEqualToRect(CGPDFPageGetBoxRect(progressivePage, kCGPDFMediaBox), CGPDFPageGetBoxRect(originalPage, kCGPDFMediaBox));
+    }
+    success = success && source.rangeRequestCount > 0;
+
+    CGPDFDocumentRelease(progressiveDocument);
+    CGPDFDocumentRelease(originalDocument);
+    [source failDownload];
+    [NSURLProtocol unregisterClass:PSCLocalFileServerURLProtocol.class];
+    [NSFileManager.defaultManager removeItemAtURL:localFileURL error:NULL];
+
+    NSLog(@"Progressive source test %@: %zu pages, %@", success ? @"passed" : @"FAILED", pageCount, source);
+    return success;
+}
+
+@end